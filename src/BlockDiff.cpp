@@ -0,0 +1,349 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "BlockDiff.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "BlockParser.h"
+#include "FrontMatter.h"
+#include "RevisionStore.h"
+
+static const char* kConflictStart = "<<<<<<< editor\n";
+static const char* kConflictSeparator = "=======\n";
+static const char* kConflictEnd = ">>>>>>> file\n";
+
+void BlockDiff::GetBlocks(const char* text, int64 size, vector<diff_block>* blocks) {
+    int32 frontMatter = FrontMatter::Detect(text, min(size, (int64) INT32_MAX));
+    BlockParser parser;
+    parser.Parse(text, size, frontMatter);
+
+    vector<int64> starts;
+    parser.GetBlockStarts(&starts);
+    if (frontMatter > 0) {
+        starts.insert(starts.begin(), frontMatter);
+    }
+    GetBlocks(text, size, starts, blocks);
+}
+
+void BlockDiff::GetBlocks(const char* text, int64 size, const vector<int64>& starts, vector<diff_block>* blocks) {
+    blocks->clear();
+    blocks->reserve(starts.size() + 1);
+    int64 position = 0;
+
+    for (auto start : starts) {
+        if (start <= position || start > size) {
+            continue;
+        }
+        blocks->push_back({position, start - position, RevisionStore::HashBlock(text + position, start - position)});
+        position = start;
+    }
+    if (position < size) {
+        blocks->push_back({position, size - position, RevisionStore::HashBlock(text + position, size - position)});
+    }
+}
+
+template<typename Equal>
+bool BlockDiff::Myers(int64 oldCount, int64 newCount, Equal equal, vector<diff_change>* changes) {
+    // furthest x reached on each diagonal k = x - y for each edit distance d, -1 where not reachable
+    // within the grid. the rounds are kept to trace the path back.
+    vector<vector<int64>> trace;
+    auto previous = [&](int64 d, int64 k, bool* down) {
+        const vector<int64>& last = trace[d - 1];
+        int64 fromAbove = (k + 1 <= d - 1) ? last[k + 1 + d - 1] : -1;
+        int64 fromLeft  = (k - 1 >= 1 - d && last[k - 1 + d - 1] >= 0) ? last[k - 1 + d - 1] + 1 : -1;
+        *down = (fromAbove >= 0 && fromAbove >= fromLeft);
+        return (*down ? fromAbove : fromLeft);
+    };
+
+    int64 maxDistance = min(oldCount + newCount, (int64) kMaxEditDistance);
+    for (int64 d = 0; d <= maxDistance; d++) {
+        trace.emplace_back(2 * d + 1, -1);
+        vector<int64>& current = trace.back();
+
+        for (int64 k = -d; k <= d; k += 2) {
+            bool down;
+            int64 x = (d == 0 ? 0 : previous(d, k, &down));
+            int64 y = x - k;
+            if (x < 0 || x > oldCount || y < 0 || y > newCount) {
+                continue;
+            }
+            while (x < oldCount && y < newCount && equal(x, y)) {
+                x++;
+                y++;
+            }
+            current[k + d] = x;
+            if (x < oldCount || y < newCount) {
+                continue;
+            }
+
+            // walk back from the end, each round added one removed or inserted element
+            vector<diff_change> edits;
+            for (int64 round = d; round > 0; round--) {
+                int64 diagonal = x - y;
+                x = previous(round, diagonal, &down);
+                if (down) {
+                    y = x - diagonal - 1;
+                    edits.push_back({x, x, y, y + 1});
+                } else {
+                    x--;
+                    y = x - diagonal + 1;
+                    edits.push_back({x, x + 1, y, y});
+                }
+            }
+            for (auto edit = edits.rbegin(); edit != edits.rend(); edit++) {
+                if (!changes->empty() && changes->back().oldEnd == edit->oldStart
+                    && changes->back().newEnd == edit->newStart) {
+                    changes->back().oldEnd = edit->oldEnd;
+                    changes->back().newEnd = edit->newEnd;
+                } else {
+                    changes->push_back(*edit);
+                }
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static int64 BlockOffset(const vector<diff_block>& blocks, int64 index) {
+    if (index < (int64) blocks.size()) {
+        return blocks[index].offset;
+    }
+    return (blocks.empty() ? 0 : blocks.back().offset + blocks.back().length);
+}
+
+void BlockDiff::Diff(const char* oldText, const vector<diff_block>& oldBlocks,
+                     const char* newText, const vector<diff_block>& newBlocks,
+                     vector<diff_change>* changes) {
+    changes->clear();
+    auto same = [&](int64 oldIndex, int64 newIndex) {
+        return oldBlocks[oldIndex].hash == newBlocks[newIndex].hash
+            && oldBlocks[oldIndex].length == newBlocks[newIndex].length;
+    };
+
+    // most blocks are unchanged, so skip the common blocks at both ends first
+    int64 oldCount = oldBlocks.size();
+    int64 newCount = newBlocks.size();
+    int64 prefix = 0;
+    while (prefix < min(oldCount, newCount) && same(prefix, prefix)) {
+        prefix++;
+    }
+    int64 suffix = 0;
+    while (suffix < min(oldCount, newCount) - prefix && same(oldCount - 1 - suffix, newCount - 1 - suffix)) {
+        suffix++;
+    }
+    oldCount -= prefix + suffix;
+    newCount -= prefix + suffix;
+    if (oldCount == 0 && newCount == 0) {
+        return;
+    }
+
+    vector<diff_change> runs;
+    bool found = Myers(oldCount, newCount,
+        [&](int64 oldIndex, int64 newIndex) { return same(prefix + oldIndex, prefix + newIndex); }, &runs);
+    if (!found) {
+        printf("BlockDiff: more than %d blocks changed, comparing them as a whole.\n", kMaxEditDistance);
+        runs.assign(1, {0, oldCount, 0, newCount});
+    }
+
+    // then find the changed text within each run of changed blocks
+    for (auto& run : runs) {
+        Refine(oldText, BlockOffset(oldBlocks, prefix + run.oldStart), BlockOffset(oldBlocks, prefix + run.oldEnd),
+               newText, BlockOffset(newBlocks, prefix + run.newStart), BlockOffset(newBlocks, prefix + run.newEnd),
+               changes);
+    }
+    printf("BlockDiff: %zu changed block runs in %zu / %zu blocks, %zu changes.\n",
+        runs.size(), oldBlocks.size(), newBlocks.size(), changes->size());
+}
+
+void BlockDiff::Refine(const char* oldText, int64 oldStart, int64 oldEnd,
+                       const char* newText, int64 newStart, int64 newEnd,
+                       vector<diff_change>* changes) {
+    if (oldEnd - oldStart > kMaxRefineSize || newEnd - newStart > kMaxRefineSize) {
+        changes->push_back({oldStart, oldEnd, newStart, newEnd});
+        return;
+    }
+    // blocks often only change in the middle
+    while (oldStart < oldEnd && newStart < newEnd && oldText[oldStart] == newText[newStart]) {
+        oldStart++;
+        newStart++;
+    }
+    while (oldStart < oldEnd && newStart < newEnd && oldText[oldEnd - 1] == newText[newEnd - 1]) {
+        oldEnd--;
+        newEnd--;
+    }
+    if (oldStart == oldEnd || newStart == newEnd) {
+        if (oldStart < oldEnd || newStart < newEnd) {
+            changes->push_back({oldStart, oldEnd, newStart, newEnd});
+        }
+        return;
+    }
+
+    vector<diff_change> refined;
+    bool found = Myers(oldEnd - oldStart, newEnd - newStart,
+        [&](int64 oldIndex, int64 newIndex) { return oldText[oldStart + oldIndex] == newText[newStart + newIndex]; },
+        &refined);
+    if (!found) {
+        changes->push_back({oldStart, oldEnd, newStart, newEnd});
+        return;
+    }
+    size_t first = changes->size();
+    for (auto change : refined) {
+        change.oldStart += oldStart;
+        change.oldEnd   += oldStart;
+        change.newStart += newStart;
+        change.newEnd   += newStart;
+
+        // single matching chars within a rewritten word are noise
+        if (changes->size() > first && change.oldStart - changes->back().oldEnd < kMinUnchangedLength) {
+            changes->back().oldEnd = change.oldEnd;
+            changes->back().newEnd = change.newEnd;
+        } else {
+            changes->push_back(change);
+        }
+    }
+}
+
+static int64 LineStart(const char* text, int64 offset) {
+    while (offset > 0 && text[offset - 1] != '\n') {
+        offset--;
+    }
+    return offset;
+}
+
+static int64 LineEnd(const char* text, int64 size, int64 offset) {
+    const char* lineEnd = static_cast<const char*>(memchr(text + offset, '\n', size - offset));
+    return (lineEnd != NULL ? lineEnd - text + 1 : size);
+}
+
+static int64 ChangeDelta(const diff_change& change) {
+    return (change.newEnd - change.newStart) - (change.oldEnd - change.oldStart);
+}
+
+static bool Touches(const diff_change& change, int64 start, int64 end) {
+    // text inserted at the same place on both sides conflicts as well
+    return change.oldStart == start || (change.oldStart < end && start < change.oldEnd);
+}
+
+int32 BlockDiff::Merge(const char* baseText, int64 baseSize,
+                       const char* ourText, const vector<diff_change>& ourChanges,
+                       const char* theirText, const vector<diff_change>& theirChanges,
+                       vector<merge_edit>* edits, BString* insertions) {
+    edits->clear();
+    insertions->Truncate(0);
+
+    // changes of both sides touching each other conflict
+    vector<pair<int64, int64>> conflicts;
+    size_t first = 0;
+    for (auto& theirChange : theirChanges) {
+        while (first < ourChanges.size() && ourChanges[first].oldEnd < theirChange.oldStart) {
+            first++;
+        }
+        for (size_t ours = first; ours < ourChanges.size() && ourChanges[ours].oldStart <= theirChange.oldEnd; ours++) {
+            if (Touches(ourChanges[ours], theirChange.oldStart, theirChange.oldEnd)) {
+                conflicts.push_back({min(ourChanges[ours].oldStart, theirChange.oldStart),
+                                     max(ourChanges[ours].oldEnd, theirChange.oldEnd)});
+            }
+        }
+    }
+
+    // conflicts cover whole lines and all changes on them, so they read well between the markers
+    bool grown = !conflicts.empty();
+    while (grown) {
+        grown = false;
+        for (auto& conflict : conflicts) {
+            int64 end = (conflict.second > conflict.first ? conflict.second - 1 : conflict.second);
+            conflict.first = LineStart(baseText, conflict.first);
+            conflict.second = LineEnd(baseText, baseSize, end);
+        }
+        sort(conflicts.begin(), conflicts.end());
+        vector<pair<int64, int64>> joined;
+        for (auto& conflict : conflicts) {
+            if (!joined.empty() && conflict.first <= joined.back().second) {
+                joined.back().second = max(joined.back().second, conflict.second);
+            } else {
+                joined.push_back(conflict);
+            }
+        }
+        conflicts.swap(joined);
+
+        for (auto changes : {&ourChanges, &theirChanges}) {
+            for (auto& change : *changes) {
+                for (auto& conflict : conflicts) {
+                    if (Touches(change, conflict.first, conflict.second)
+                        && (change.oldStart < conflict.first || change.oldEnd > conflict.second)) {
+                        conflict.first = min(conflict.first, change.oldStart);
+                        conflict.second = max(conflict.second, change.oldEnd);
+                        grown = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // take their changes outside of conflicts, each at its place in our text
+    size_t ours = 0, theirs = 0;
+    int64 ourDelta = 0, theirDelta = 0;
+    int32 conflictCount = 0;
+    for (size_t index = 0; index <= conflicts.size(); index++) {
+        int64 limit = (index < conflicts.size() ? conflicts[index].first : INT64_MAX);
+        while (true) {
+            bool ourNext = (ours < ourChanges.size() && ourChanges[ours].oldStart < limit);
+            bool theirNext = (theirs < theirChanges.size() && theirChanges[theirs].oldStart < limit);
+            if (ourNext && (!theirNext || ourChanges[ours].oldStart < theirChanges[theirs].oldStart)) {
+                ourDelta += ChangeDelta(ourChanges[ours++]);
+            } else if (theirNext) {
+                const diff_change& change = theirChanges[theirs++];
+                edits->push_back({change.oldStart + ourDelta, change.oldEnd - change.oldStart,
+                                  insertions->Length(), change.newEnd - change.newStart});
+                insertions->Append(theirText + change.newStart, change.newEnd - change.newStart);
+                theirDelta += ChangeDelta(change);
+            } else {
+                break;
+            }
+        }
+        if (index == conflicts.size()) {
+            break;
+        }
+
+        int64 start = conflicts[index].first;
+        int64 end = conflicts[index].second;
+        int64 ourStart = start + ourDelta;
+        int64 theirStart = start + theirDelta;
+        while (ours < ourChanges.size() && (ourChanges[ours].oldStart < end || ourChanges[ours].oldStart == start)) {
+            ourDelta += ChangeDelta(ourChanges[ours++]);
+        }
+        while (theirs < theirChanges.size()
+               && (theirChanges[theirs].oldStart < end || theirChanges[theirs].oldStart == start)) {
+            theirDelta += ChangeDelta(theirChanges[theirs++]);
+        }
+        int64 ourLength = end + ourDelta - ourStart;
+        int64 theirLength = end + theirDelta - theirStart;
+        if (ourLength == theirLength && memcmp(ourText + ourStart, theirText + theirStart, ourLength) == 0) {
+            // both sides changed the lines alike
+            continue;
+        }
+
+        int64 textOffset = insertions->Length();
+        insertions->Append(kConflictStart).Append(ourText + ourStart, ourLength);
+        if (ourLength > 0 && ourText[ourStart + ourLength - 1] != '\n') {
+            insertions->Append('\n', 1);
+        }
+        insertions->Append(kConflictSeparator).Append(theirText + theirStart, theirLength);
+        if (theirLength > 0 && theirText[theirStart + theirLength - 1] != '\n') {
+            insertions->Append('\n', 1);
+        }
+        insertions->Append(kConflictEnd);
+        edits->push_back({ourStart, ourLength, textOffset, insertions->Length() - textOffset});
+        conflictCount++;
+    }
+
+    printf("BlockDiff: merged %zu of their changes into %zu of ours, %d conflicts.\n",
+        theirChanges.size(), ourChanges.size(), conflictCount);
+    return conflictCount;
+}
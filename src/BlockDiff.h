@@ -0,0 +1,79 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * two stage diff between document versions. a Myers diff over the hashes of top level blocks finds
+ * the changed blocks first, then a Myers diff over the characters of each run of changed blocks
+ * narrows them down to the changed text, so the cost depends on the changes, not on the document size.
+ * see Myers, "An O(ND) Difference Algorithm and Its Variations", 1986.
+ */
+#pragma once
+
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+typedef struct diff_block {
+    int64           offset;
+    int64           length;
+    uint64          hash;
+} diff_block;
+
+typedef struct diff_change {
+    int64           oldStart;
+    int64           oldEnd;         // == oldStart for inserted text
+    int64           newStart;
+    int64           newEnd;         // == newStart for removed text
+} diff_change;
+
+typedef struct merge_edit {
+    int64           offset;         // in our text
+    int64           removed;
+    int64           textOffset;     // of the inserted text in the merged insertions
+    int64           textLength;
+} merge_edit;
+
+class BlockDiff {
+
+public:
+    /**
+     * splits text into its top level blocks, parsing the block structure. front matter is a block of its own.
+     */
+    static void         GetBlocks(const char* text, int64 size, vector<diff_block>* blocks);
+    /**
+     * splits text into blocks at the given sorted block starts, text before the first start is a block as well.
+     */
+    static void         GetBlocks(const char* text, int64 size, const vector<int64>& starts,
+                                  vector<diff_block>* blocks);
+    /**
+     * returns the changes turning oldText into newText, in document order.
+     */
+    static void         Diff(const char* oldText, const vector<diff_block>& oldBlocks,
+                             const char* newText, const vector<diff_block>& newBlocks,
+                             vector<diff_change>* changes);
+    /**
+     * merges the changes from baseText to theirText into ourText, given the changes of both sides against
+     * baseText. returns the edits of our text in document order and the number of conflicts, which are
+     * the lines changed on both sides, kept with both versions between conflict markers.
+     */
+    static int32        Merge(const char* baseText, int64 baseSize,
+                              const char* ourText, const vector<diff_change>& ourChanges,
+                              const char* theirText, const vector<diff_change>& theirChanges,
+                              vector<merge_edit>* edits, BString* insertions);
+
+    // edit distance up to which changes are located exactly, beyond it the changed range is reported as a whole
+    static const int32  kMaxEditDistance = 1024;
+    // changed block runs up to this size are compared by character
+    static const int64  kMaxRefineSize = 1024 * 1024;
+    // unchanged text shorter than this between two changes is joined into one change, to keep them readable
+    static const int32  kMinUnchangedLength = 3;
+
+private:
+    template<typename Equal>
+    static bool         Myers(int64 oldCount, int64 newCount, Equal equal, vector<diff_change>* changes);
+    static void         Refine(const char* oldText, int64 oldStart, int64 oldEnd,
+                               const char* newText, int64 newStart, int64 newEnd,
+                               vector<diff_change>* changes);
+};
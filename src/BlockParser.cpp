@@ -0,0 +1,1304 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "BlockParser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+#include <strings.h>
+
+static const int32 kTabStop = 4;
+static const int32 kCodeIndent = 4;
+
+// tags starting HTML blocks of type 1 and 6, see https://spec.commonmark.org/0.31.2/#html-blocks
+static const char* kHtmlRawTags[] = { "pre", "script", "style", "textarea" };
+static const char* kHtmlBlockTags[] = {
+    "address", "article", "aside", "base", "basefont", "blockquote", "body", "caption", "center",
+    "col", "colgroup", "dd", "details", "dialog", "dir", "div", "dl", "dt", "fieldset", "figcaption",
+    "figure", "footer", "form", "frame", "frameset", "h1", "h2", "h3", "h4", "h5", "h6", "head",
+    "header", "hr", "html", "iframe", "legend", "li", "link", "main", "menu", "menuitem", "nav",
+    "noframes", "ol", "optgroup", "option", "p", "param", "search", "section", "summary", "table",
+    "tbody", "td", "tfoot", "th", "thead", "title", "tr", "track", "ul"
+};
+
+static inline bool IsSpaceOrTab(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline bool IsAsciiLetter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int32 SkipSpace(const string& text, int32 pos, bool lineBreak) {
+    while (pos < (int32) text.size() && IsSpaceOrTab(text[pos])) {
+        pos++;
+    }
+    if (lineBreak && pos < (int32) text.size() && text[pos] == '\n') {
+        pos = SkipSpace(text, pos + 1, false);
+    }
+    return pos;
+}
+
+static int32 ScanDelimited(const string& text, int32 pos, char open, char close, bool multiLine) {
+    for (pos++; pos < (int32) text.size(); pos++) {
+        char c = text[pos];
+        if (c == '\\' && pos + 1 < (int32) text.size()) {
+            pos++;
+        } else if (c == close) {
+            return pos + 1;
+        } else if ((c == open && open != close) || (c == '\n' && !multiLine)) {
+            return -1;
+        } else if (c == '\n' && pos + 1 < (int32) text.size() && text[SkipSpace(text, pos + 1, false)] == '\n') {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * returns the end of the link reference definition starting at pos, after its line break,
+ * or -1 if there is none, see https://spec.commonmark.org/0.31.2/#link-reference-definitions
+ */
+static int32 ScanReference(const string& text, int32 pos) {
+    pos = SkipSpace(text, pos, false);
+    if (pos >= (int32) text.size() || text[pos] != '[') {
+        return -1;
+    }
+    int32 labelStart = pos;
+    pos = ScanDelimited(text, pos, '[', ']', true);
+    if (pos < 0 || pos - labelStart > 1001 || pos >= (int32) text.size() || text[pos] != ':'
+        || text.find_first_not_of(" \t\n", labelStart + 1) >= (size_t) pos - 1) {
+        return -1;
+    }
+    pos = SkipSpace(text, pos + 1, true);
+    if (pos < (int32) text.size() && text[pos] == '<') {
+        pos = ScanDelimited(text, pos, '<', '>', false);
+        if (pos < 0) {
+            return -1;
+        }
+    } else {
+        int32 start = pos;
+        int32 parens = 0;
+        for (; pos < (int32) text.size() && (unsigned char) text[pos] > ' '; pos++) {
+            if (text[pos] == '\\' && pos + 1 < (int32) text.size()) {
+                pos++;
+            } else if (text[pos] == '(') {
+                parens++;
+            } else if (text[pos] == ')' && --parens < 0) {
+                break;
+            }
+        }
+        if (pos == start || parens != 0) {
+            return -1;
+        }
+    }
+    // the definition may end after the destination if the title does not parse
+    int32 end = SkipSpace(text, pos, false);
+    end = (end >= (int32) text.size() ? end : (text[end] == '\n' ? end + 1 : -1));
+
+    int32 titleStart = SkipSpace(text, pos, true);
+    if (titleStart == pos || titleStart >= (int32) text.size()) {
+        return end;
+    }
+    char open = text[titleStart];
+    if (open != '"' && open != '\'' && open != '(') {
+        return end;
+    }
+    pos = ScanDelimited(text, titleStart, open, open == '(' ? ')' : open, true);
+    if (pos < 0) {
+        return end;
+    }
+    pos = SkipSpace(text, pos, false);
+    if (pos >= (int32) text.size()) {
+        return pos;
+    }
+    return text[pos] == '\n' ? pos + 1 : end;
+}
+
+BlockParser::BlockParser()
+    : fText(NULL),
+      fSize(0),
+      fStart(0),
+      fRoot(NULL),
+      fTip(NULL) {
+    Clear();
+}
+
+BlockParser::~BlockParser() {
+    DeleteNode(fRoot);
+}
+
+void BlockParser::Clear() {
+    DeleteNode(fRoot);
+    fRoot = new block_node();
+    fRoot->type = MD_BLOCK_DOC;
+    fRoot->open = true;
+    fTip = fRoot;
+    fBlockStarts.clear();
+}
+
+void BlockParser::Parse(const char* text, int64 size, int64 start) {
+    fText = text;
+    fSize = size;
+    fStart = start;
+
+    int64 end;
+    fBlockStarts.clear();
+    ParseLines(start, INT64_MAX, 0, NULL, &fBlockStarts, &end);
+
+    printf("BlockParser: parsed %zu top level blocks.\n", fBlockStarts.size());
+}
+
+void BlockParser::Update(const char* text, int64 size, int64 offset, int64 removed, int64 inserted,
+                         int64* start, int64* end) {
+    fText = text;
+    fSize = size;
+    int64 delta = inserted - removed;
+
+    // the edit may turn its first line into a continuation of the previous block, so start there
+    int32 containing = FindBlockStart(offset + 1) - fBlockStarts.begin() - 1;
+    int32 first = max(containing - 1, 0);
+    while (first > 0 && fBlockStarts[first].dependent) {
+        first--;
+    }
+    int64 from = (containing > 0 ? fBlockStarts[first].offset : fStart);
+
+    // blocks starting after the edit are unchanged unless the new parse runs into them differently
+    vector<block_start> syncStarts(FindBlockStart(offset + removed), fBlockStarts.end());
+    vector<block_start> starts(fBlockStarts.begin(), FindBlockStart(from));
+    ParseLines(from, offset + inserted, delta, &syncStarts, &starts, end);
+    *start = from;
+
+    for (auto tail = syncStarts.begin(); tail != syncStarts.end(); tail++) {
+        if (tail->offset + delta >= *end) {
+            starts.push_back({tail->offset + delta, tail->kind, tail->dependent});
+        }
+    }
+    fBlockStarts.swap(starts);
+}
+
+const block_node* BlockParser::UpdateLeaf(const char* text, int64 size, int64 offset, int64 removed,
+                                          int64 inserted) {
+    if (memchr(text + offset, '\n', inserted) != NULL || memchr(text + offset, '\r', inserted) != NULL) {
+        return NULL;
+    }
+    block_node* leaf = FindLeaf(offset);
+    if (leaf == NULL || leaf->type != MD_BLOCK_P || leaf->afterFence) {
+        return NULL;
+    }
+    auto line = upper_bound(leaf->lines.begin(), leaf->lines.end(), offset,
+        [](int64 offset, const block_line& line) { return offset < line.offset; });
+    if (line == leaf->lines.begin()) {
+        return NULL;
+    }
+    line--;
+    // the first char decides about container and block starts, so it must stay the same
+    int64 position = line->offset;
+    while (position < offset && IsSpaceOrTab(text[position])) {
+        position++;
+    }
+    if (position >= offset || offset + removed > line->offset + line->length) {
+        return NULL;
+    }
+    int64 delta = inserted - removed;
+    fText = text;
+    fSize = size;
+    fContentEnd = line->offset + line->length + delta;
+    if (!KeepsParagraph(leaf, line - leaf->lines.begin(), position, offset)) {
+        return NULL;
+    }
+
+    line->length += delta;
+    ShiftNode(fRoot, offset, delta);
+    for (auto start = FindBlockStart(offset + 1); start != fBlockStarts.end(); start++) {
+        start->offset += delta;
+    }
+    return leaf;
+}
+
+const block_node* BlockParser::LeafAt(int64 offset) {
+    const block_node* leaf = FindLeaf(offset);
+    if (leaf != NULL && !leaf->lines.empty() && leaf->lines.front().offset == offset) {
+        return leaf;
+    }
+    // parse the top level block holding offset again, starting before blocks depending on the line before
+    auto blockStart = FindBlockStart(offset + 1);
+    if (blockStart == fBlockStarts.begin()) {
+        return NULL;
+    }
+    int32 first = blockStart - fBlockStarts.begin() - 1;
+    while (first > 0 && fBlockStarts[first].dependent) {
+        first--;
+    }
+    vector<block_start> starts;
+    int64 end;
+    ParseLines(fBlockStarts[first].offset, offset + 1, 0, &fBlockStarts, &starts, &end);
+
+    leaf = FindLeaf(offset);
+    if (leaf == NULL || leaf->lines.empty() || leaf->lines.front().offset != offset) {
+        return NULL;
+    }
+    return leaf;
+}
+
+void BlockParser::GetBlocksAt(const char* text, int64 start, int64 end, vector<const block_node*>* blocks) {
+    blocks->clear();
+    auto blockStart = FindBlockStart(start + 1);
+    if (blockStart == fBlockStarts.begin()) {
+        return;
+    }
+    int64 lineStart = (blockStart - 1)->offset;
+    auto top = lower_bound(fRoot->children.begin(), fRoot->children.end(), lineStart,
+        [](const block_node* child, int64 offset) { return child->lineStart < offset; });
+
+    if (top == fRoot->children.end() || (*top)->lineStart != lineStart) {
+        // parse the top level block again, starting before blocks depending on the line before
+        int32 first = blockStart - fBlockStarts.begin() - 1;
+        while (first > 0 && fBlockStarts[first].dependent) {
+            first--;
+        }
+        fText = text;
+        vector<block_start> starts;
+        int64 parsedEnd;
+        ParseLines(fBlockStarts[first].offset, lineStart + 1, 0, &fBlockStarts, &starts, &parsedEnd);
+    }
+    const block_node* node = fRoot;
+    while (!node->children.empty()) {
+        auto next = upper_bound(node->children.begin(), node->children.end(), start,
+            [](int64 offset, const block_node* child) { return offset < child->lineStart; });
+        if (next == node->children.begin() || (*(next - 1))->end < end) {
+            break;
+        }
+        node = *(next - 1);
+        blocks->insert(blocks->begin(), node);
+    }
+}
+
+bool BlockParser::IsBlockStart(int64 offset) {
+    auto blockStart = FindBlockStart(offset);
+    return blockStart != fBlockStarts.end() && blockStart->offset == offset;
+}
+
+void BlockParser::GetBlockStarts(vector<int64>* offsets) {
+    offsets->clear();
+    offsets->reserve(fBlockStarts.size());
+    for (auto& blockStart : fBlockStarts) {
+        offsets->push_back(blockStart.offset);
+    }
+}
+
+void BlockParser::SwapRanges(int64 start, int64 middle, int64 end) {
+    auto from  = FindBlockStart(start);
+    auto split = FindBlockStart(middle);
+    auto to    = FindBlockStart(end);
+
+    for (auto blockStart = from; blockStart != split; blockStart++) {
+        blockStart->offset += end - middle;
+    }
+    for (auto blockStart = split; blockStart != to; blockStart++) {
+        blockStart->offset -= middle - start;
+    }
+    rotate(from, split, to);
+
+    // the blocks kept from the last parse are not worth moving, the next update parses others anyway
+    DeleteNode(fRoot);
+    fRoot = new block_node();
+    fRoot->type = MD_BLOCK_DOC;
+    fRoot->start = fStart;
+}
+
+block_node* BlockParser::FindLeaf(int64 offset) {
+    // the deepest block started before offset among the blocks kept from the last parse
+    block_node* leaf = fRoot;
+    while (!leaf->children.empty()) {
+        auto next = upper_bound(leaf->children.begin(), leaf->children.end(), offset,
+            [](int64 offset, const block_node* child) { return offset < child->lineStart; });
+        if (next == leaf->children.begin()) {
+            break;
+        }
+        leaf = *(next - 1);
+    }
+    return (leaf != fRoot ? leaf : NULL);
+}
+
+bool BlockParser::KeepsParagraph(const block_node* paragraph, size_t index, int64 position,
+                                 int64 offset) const {
+    // mirrors the block starts of ProcessLine, table rows only end at break or list lines
+    const block_line& line = paragraph->lines[index];
+    bool row = (paragraph->table && index >= 2);
+    bool continuation = (index > 0 && !line.lazy && !row);
+    char mark;
+    uint32 number;
+
+    // the task mark and link reference definitions at the paragraph start must stay as they are,
+    // other blocks depend on the definitions
+    const block_line& first = paragraph->lines.front();
+    int64 start = first.offset;
+    int64 firstEnd = (index == 0 ? fContentEnd : first.offset + first.length);
+    if (paragraph->parent->task && paragraph == paragraph->parent->children.front()) {
+        if (index == 0 && offset <= first.offset + 3) {
+            return false;
+        }
+        start += 3;
+    }
+    while (start < firstEnd && IsSpaceOrTab(fText[start])) {
+        start++;
+    }
+    if ((index == 0 && start >= offset) || (start < firstEnd && fText[start] == '[')) {
+        return false;
+    }
+    if (index > 0 && (Peek(position) == '=' || Peek(position) == '-')) {
+        // the line may have been a setext underline before
+        return false;
+    }
+    if (ScanThematicBreak(position) || ScanListMarker(position, continuation, &mark, &number) > 0) {
+        return false;
+    }
+    // list markers on the line may now be part of a break
+    int64 lineStart = line.offset;
+    while (lineStart > 0 && fText[lineStart - 1] != '\n') {
+        lineStart--;
+    }
+    while (lineStart < position && IsSpaceOrTab(fText[lineStart])) {
+        lineStart++;
+    }
+    if (lineStart < position && ScanThematicBreak(lineStart)) {
+        return false;
+    }
+    if (!row && (ScanAtxHeading(position) > 0 || ScanFenceOpen(position) > 0
+        || ScanHtmlStart(position, continuation) > 0)) {
+        return false;
+    }
+    if (index == 1 && !line.lazy && ScanTableUnderline(position) != paragraph->table) {
+        return false;
+    }
+    return true;
+}
+
+void BlockParser::ShiftNode(block_node* node, int64 offset, int64 delta) {
+    // the edit is inside a paragraph line, so only what follows it moves
+    if (node->start > offset) {
+        node->start += delta;
+    }
+    if (node->lineStart > offset) {
+        node->lineStart += delta;
+    }
+    if (node->end >= offset) {
+        node->end += delta;
+    }
+    for (auto& line : node->lines) {
+        if (line.offset > offset) {
+            line.offset += delta;
+        }
+    }
+    for (auto child : node->children) {
+        ShiftNode(child, offset, delta);
+    }
+}
+
+vector<block_start>::iterator BlockParser::FindBlockStart(int64 offset) {
+    return lower_bound(fBlockStarts.begin(), fBlockStarts.end(), offset,
+        [](const block_start& start, int64 offset) { return start.offset < offset; });
+}
+
+void BlockParser::ParseLines(int64 from, int64 syncOffset, int64 delta, const vector<block_start>* syncStarts,
+                             vector<block_start>* starts, int64* end) {
+    DeleteNode(fRoot);
+    fRoot = new block_node();
+    fRoot->type = MD_BLOCK_DOC;
+    fRoot->open = true;
+    fRoot->start = from;
+    fTip = fRoot;
+
+    for (fLineStart = from; fLineStart < fSize; fLineStart = fLineEnd) {
+        const char* eol = static_cast<const char*>(memchr(fText + fLineStart, '\n', fSize - fLineStart));
+        fLineEnd = (eol != NULL ? eol - fText + 1 : fSize);
+        fContentEnd = (eol != NULL ? eol - fText : fSize);
+        if (fContentEnd > fLineStart && fText[fContentEnd - 1] == '\r') {
+            fContentEnd--;
+        }
+
+        size_t blockCount = fRoot->children.size();
+        ProcessLine();
+        if (fRoot->children.size() == blockCount) {
+            continue;
+        }
+        block_start blockStart;
+        blockStart.offset = fLineStart;
+        blockStart.kind = FirstLineKind(fRoot->children.back(), &blockStart.dependent);
+        blockStart.dependent = blockStart.dependent || fAfterFence;
+
+        // a top level block starting at an unchanged offset after the edit means the parse is back in sync,
+        // as long as the blocks opened on its line don't depend on the line before, like indented HTML.
+        // the first block is always parsed again, the document start is emitted with it.
+        if (syncStarts != NULL && fLineStart >= syncOffset && fLineStart - delta > from) {
+            auto sync = lower_bound(syncStarts->begin(), syncStarts->end(), fLineStart - delta,
+                [](const block_start& start, int64 offset) { return start.offset < offset; });
+            if (sync != syncStarts->end() && sync->offset == fLineStart - delta && sync->kind == blockStart.kind) {
+                block_node* next = fRoot->children.back();
+                fRoot->children.pop_back();
+                DeleteNode(next);
+                fTip = fRoot;
+                FinalizeAll();
+                *end = fLineStart;
+                return;
+            }
+        }
+        starts->push_back(blockStart);
+    }
+    FinalizeAll();
+    *end = fSize;
+}
+
+void BlockParser::ProcessLine() {
+    fPosition = fLineStart;
+    fColumn = 0;
+    fPartialTab = false;
+    fAfterFence = false;
+    const block_node* lineTip = fTip;
+    // md4c misses the task mark of an item following a line that ended in a quote
+    const block_node* lastContainer = fTip;
+    while (lastContainer->type != MD_BLOCK_QUOTE && lastContainer->type != MD_BLOCK_LI && lastContainer != fRoot) {
+        lastContainer = lastContainer->parent;
+    }
+    bool afterQuote = (lastContainer->type == MD_BLOCK_QUOTE);
+
+    // first see which open blocks continue on this line
+    block_node* container = fRoot;
+    bool allMatched = true;
+
+    while (!container->children.empty() && container->children.back()->open) {
+        block_node* child = container->children.back();
+        bool lineDone = false;
+        if (!MatchContainer(child, &lineDone)) {
+            allMatched = false;
+            break;
+        }
+        if (lineDone) {
+            return;
+        }
+        container = child;
+    }
+    block_node* lastMatched = container;
+    // md4c keeps blank lines in or right after code and HTML blocks with the block if they are in
+    // the same containers, they don't make lists loose then
+    bool keepBlank = (lineTip->type == MD_BLOCK_CODE || lineTip->type == MD_BLOCK_HTML)
+        && (lastMatched == lineTip || lastMatched == lineTip->parent);
+
+    // md4c takes fence chars at the start of a line as closing fence even when the containers of the
+    // code block ended. it then looks for container, heading, fence, HTML and break starts right after
+    // them, otherwise the line is paragraph text including the fence chars.
+    if (!allMatched && fTip->type == MD_BLOCK_CODE && fTip->fenced) {
+        FindNextNonspace();
+        int64 lineContent = fNextNonspace;
+        int64 position = lineContent;
+        while (Peek(position) == fTip->fenceChar) {
+            position++;
+        }
+        if (fIndent < kCodeIndent && position > lineContent) {
+            char fenceChar = fTip->fenceChar;
+            int32 fenceLength = fTip->fenceLength;
+            while (fTip != lastMatched) {
+                Finalize(fTip);
+                fTip = fTip->parent;
+            }
+            if (position == fContentEnd) {
+                // nothing follows that could continue a list
+                while (fTip->type == MD_BLOCK_UL || fTip->type == MD_BLOCK_OL) {
+                    Finalize(fTip);
+                    fTip = fTip->parent;
+                }
+                return;
+            }
+            if (ScanFenceOpen(position) > 0) {
+                // a fence of the other char opens a code block with the old fence and the new one as info
+                fTip = AddChild(lastMatched, MD_BLOCK_CODE, lineContent);
+                fTip->fenced = true;
+                fTip->fenceChar = fenceChar;
+                fTip->fenceLength = fenceLength;
+                fTip->fenceOffset = fIndent;
+                fTip->afterFence = true;
+                AdvanceTo(lineContent);
+                AddLine(fTip);
+                return;
+            }
+            if (ScanThematicBreak(position)) {
+                // breaks include them as well
+                fTip = AddChild(lastMatched, MD_BLOCK_HR, lineContent);
+                fTip->fenceChar = fenceChar;
+                fTip->fenceLength = fenceLength;
+                fTip->afterFence = true;
+                AdvanceTo(lineContent);
+                AddLine(fTip);
+                Finalize(fTip);
+                fTip = fTip->parent;
+                return;
+            }
+            int32 htmlType = ScanHtmlStart(position, false);
+            if (htmlType > 0) {
+                // HTML blocks start right after them, but include them
+                fTip = AddChild(lastMatched, MD_BLOCK_HTML, lineContent);
+                fTip->htmlType = htmlType;
+                fTip->fenceOffset = fIndent;
+                fTip->fenceChar = fenceChar;
+                fTip->fenceLength = fenceLength;
+                fTip->afterFence = true;
+                AddLine(fTip);
+                if (htmlType <= 5 && ScanHtmlEnd(htmlType, position)) {
+                    Finalize(fTip);
+                    fTip = fTip->parent;
+                }
+                return;
+            }
+            char mark;
+            uint32 number;
+            if (IsSpaceOrTab(Peek(position)) || !(Peek(position) == '>' || ScanAtxHeading(position) > 0
+                || ScanListMarker(position, false, &mark, &number) > 0)) {
+                fTip = AddChild(lastMatched, MD_BLOCK_P, lineContent);
+                fTip->fenceChar = fenceChar;
+                fTip->fenceLength = fenceLength;
+                fTip->afterFence = true;
+                AdvanceTo(lineContent);
+                AddLine(fTip);
+                return;
+            }
+            // containers and headings start after them, which depends on the block before as well
+            fAfterFence = true;
+            AdvanceTo(position);
+        }
+    }
+
+    // then look for new block starts, tables only end at container, list or break lines
+    bool maybeLazy = (fTip->type == MD_BLOCK_P && !fTip->table);
+
+    while (container->type != MD_BLOCK_CODE && container->type != MD_BLOCK_HTML) {
+        FindNextNonspace();
+        bool indented = (fIndent >= kCodeIndent);
+        int32 length;
+        char mark;
+        uint32 number;
+
+        if (!indented && Peek(fNextNonspace) == '>') {
+            int64 marker = fNextNonspace;
+            AdvanceTo(marker + 1);
+            if (IsSpaceOrTab(Peek(fPosition))) {
+                AdvanceOffset(1, true);
+            }
+            container = AddChild(container, MD_BLOCK_QUOTE, marker);
+        } else if (!indented && !container->table && ScanAtxHeading(fNextNonspace) > 0) {
+            container = AddChild(container, MD_BLOCK_H, fNextNonspace);
+            break;
+        } else if (!indented && !container->table && (length = ScanFenceOpen(fNextNonspace)) > 0) {
+            char fenceChar = Peek(fNextNonspace);
+            container = AddChild(container, MD_BLOCK_CODE, fNextNonspace);
+            container->fenced = true;
+            container->fenceChar = fenceChar;
+            container->fenceLength = length;
+            container->fenceOffset = fIndent;
+            break;
+        } else if ((!indented || (maybeLazy && container == lastMatched)) && !container->table
+                   && (length = ScanHtmlStart(fNextNonspace, maybeLazy && container == lastMatched)) > 0) {
+            // unlike CommonMark, md4c also lets indented HTML blocks interrupt a paragraph
+            bool interrupting = (maybeLazy && container == lastMatched);
+            container = AddChild(container, MD_BLOCK_HTML, fNextNonspace);
+            container->htmlType = length;
+            container->fenceOffset = fIndent;
+            container->interrupting = interrupting;
+            break;
+        } else if (!indented && container->type == MD_BLOCK_P && !container->table
+                   && ScanSetextUnderline(fNextNonspace)) {
+            if (IsReferencesOnly(container)) {
+                // nothing is left to underline after link reference definitions, md4c keeps the line as text
+                break;
+            }
+            // the paragraph turns into a setext heading, which md4c detects from the underline
+            AddLine(container);
+            Finalize(container);
+            fTip = container->parent;
+            for (block_node* node = container; node != NULL; node = node->parent) {
+                node->lastLineBlank = false;
+            }
+            return;
+        } else if (!indented && ScanThematicBreak(fNextNonspace)) {
+            container = AddChild(container, MD_BLOCK_HR, fNextNonspace);
+            break;
+        } else if (!indented
+                   && (length = ScanListMarker(fNextNonspace, container->type == MD_BLOCK_P && !container->table,
+                                               &mark, &number)) > 0) {
+            int32 markerOffset = fIndent;
+            int64 marker = fNextNonspace;
+            AdvanceTo(marker + length);
+
+            // content starts after 1 - 4 spaces, otherwise right after the marker and a single space
+            int64 savedPosition = fPosition;
+            int32 savedColumn = fColumn;
+            bool savedPartialTab = fPartialTab;
+            while (fColumn - savedColumn <= 5 && IsSpaceOrTab(Peek(fPosition))) {
+                AdvanceOffset(1, true);
+            }
+            int32 spaces = fColumn - savedColumn;
+            int32 padding = length + spaces;
+            if (spaces >= 5 || spaces < 1 || Peek(fPosition) == '\n') {
+                padding = length + 1;
+                fPosition = savedPosition;
+                fColumn = savedColumn;
+                fPartialTab = savedPartialTab;
+                if (spaces > 0) {
+                    AdvanceOffset(1, true);
+                }
+            }
+
+            MD_BLOCKTYPE listType = (mark == '.' || mark == ')' ? MD_BLOCK_OL : MD_BLOCK_UL);
+            bool sibling = (container->type == listType && container->mark == mark);
+            // md4c starts another list for a marker right of the content of an item it cannot continue
+            if (sibling && markerOffset > container->children.back()->itemIndent) {
+                sibling = false;
+            }
+            if (!sibling) {
+                container = AddChild(container, listType, marker);
+                container->mark = mark;
+                container->number = number;
+            }
+            container = AddChild(container, MD_BLOCK_LI, marker);
+            container->mark = mark;
+            container->itemIndent = markerOffset + padding;
+
+            // md4c takes the rest of a task item's first line as paragraph text, whatever it holds
+            char taskMark = Peek(fPosition + 1);
+            if (Peek(fPosition) == '[' && (taskMark == ' ' || taskMark == 'x' || taskMark == 'X')
+                && Peek(fPosition + 2) == ']' && (IsSpaceOrTab(Peek(fPosition + 3)) || Peek(fPosition + 3) == '\n')
+                && !(sibling && afterQuote)) {
+                container->task = true;
+                FindNextNonspace();
+                container = AddChild(container, MD_BLOCK_P, fNextNonspace);
+                break;
+            }
+        } else if (indented && !(maybeLazy && container == lastMatched) && !fBlank) {
+            container = AddChild(container, MD_BLOCK_CODE, fNextNonspace);
+            break;
+        } else {
+            break;
+        }
+    }
+
+    // finally add the line content, see https://spec.commonmark.org/0.31.2/#phase-1-block-structure
+    FindNextNonspace();
+    if (fBlank && !keepBlank && !container->children.empty()) {
+        container->children.back()->lastLineBlank = true;
+    }
+    // blank lines in quotes and fenced code or after an empty item's marker don't make lists loose
+    MD_BLOCKTYPE type = container->type;
+    container->lastLineBlank = fBlank && !keepBlank && type != MD_BLOCK_QUOTE && type != MD_BLOCK_H && type != MD_BLOCK_HR
+        && !(type == MD_BLOCK_CODE && container->fenced)
+        && !(type == MD_BLOCK_LI && container->children.empty() && container->lineStart == fLineStart);
+    for (block_node* node = container; node->parent != NULL; node = node->parent) {
+        node->parent->lastLineBlank = false;
+    }
+
+    if (fTip != lastMatched && container == lastMatched && !fBlank && maybeLazy) {
+        // lazy paragraph continuation
+        AddLine(fTip);
+        fTip->lines.back().lazy = true;
+        return;
+    }
+    while (fTip != lastMatched) {
+        Finalize(fTip);
+        fTip = fTip->parent;
+    }
+    if (type == MD_BLOCK_CODE) {
+        AddLine(container);
+    } else if (type == MD_BLOCK_HTML) {
+        AddLine(container);
+        if (container->htmlType <= 5 && ScanHtmlEnd(container->htmlType, fPosition)) {
+            Finalize(container);
+            container = container->parent;
+        }
+    } else if (fBlank) {
+        // nothing to add
+    } else if (type == MD_BLOCK_H || type == MD_BLOCK_HR) {
+        AddLine(container);
+        Finalize(container);
+        container = container->parent;
+    } else if (type == MD_BLOCK_P) {
+        AddLine(container);
+        // md4c only takes a delimiter row right below the first line as a table
+        if (container->lines.size() == 2 && ScanTableUnderline(fNextNonspace)) {
+            container->table = true;
+        }
+    } else {
+        container = AddChild(container, MD_BLOCK_P, fNextNonspace);
+        AddLine(container);
+    }
+    fTip = container;
+}
+
+bool BlockParser::MatchContainer(block_node* container, bool* lineDone) {
+    FindNextNonspace();
+
+    switch (container->type) {
+        case MD_BLOCK_QUOTE: {
+            if (fIndent >= kCodeIndent || Peek(fNextNonspace) != '>') {
+                return false;
+            }
+            AdvanceTo(fNextNonspace + 1);
+            if (IsSpaceOrTab(Peek(fPosition))) {
+                AdvanceOffset(1, true);
+            }
+            return true;
+        }
+        case MD_BLOCK_LI: {
+            if (fIndent >= container->itemIndent) {
+                AdvanceOffset(container->itemIndent, true);
+                return true;
+            }
+            if (fBlank && !container->children.empty()) {
+                // md4c keeps the whitespace, e.g. as text of HTML blocks
+                return true;
+            }
+            return false;
+        }
+        case MD_BLOCK_UL:
+        case MD_BLOCK_OL:
+            return true;
+        case MD_BLOCK_CODE: {
+            // code lines are passed on with their indentation, md4c strips it when parsing the leaf
+            if (container->fenced) {
+                if (fIndent < kCodeIndent && ScanFenceClose(container, fNextNonspace)) {
+                    AddLine(container);
+                    Finalize(container);
+                    fTip = container->parent;
+                    *lineDone = true;
+                }
+                return true;
+            }
+            return fIndent >= kCodeIndent || fBlank;
+        }
+        case MD_BLOCK_HTML:
+            return !(fBlank && container->htmlType >= 6);
+        case MD_BLOCK_P:
+            return !fBlank;
+        default:
+            return false;
+    }
+}
+
+block_node* BlockParser::AddChild(block_node* parent, MD_BLOCKTYPE type, int64 start) {
+    // close blocks that cannot hold the new one, e.g. a paragraph interrupted by a heading
+    while (!((parent->type == MD_BLOCK_UL || parent->type == MD_BLOCK_OL) ? type == MD_BLOCK_LI
+             : (parent->type == MD_BLOCK_DOC || parent->type == MD_BLOCK_QUOTE || parent->type == MD_BLOCK_LI)
+               && type != MD_BLOCK_LI)) {
+        Finalize(parent);
+        parent = parent->parent;
+    }
+    block_node* node = new block_node();
+    node->type = type;
+    node->start = start;
+    node->lineStart = fLineStart;
+    node->parent = parent;
+    node->open = true;
+    node->tight = true;
+    parent->children.push_back(node);
+
+    for (block_node* block = node; block != fRoot; block = block->parent) {
+        block->end = max(block->end, fContentEnd);
+    }
+    return node;
+}
+
+void BlockParser::AddLine(block_node* node) {
+    block_line line;
+    line.offset = fPosition;
+    line.indent = 0;
+    line.lazy = false;
+    if (fPartialTab) {
+        // the rest of a tab used up by a container marker is passed on as spaces
+        line.offset++;
+        line.indent = kTabStop - (fColumn % kTabStop);
+    }
+    line.length = max(fContentEnd - line.offset, (int64)0);
+    node->lines.push_back(line);
+
+    for (block_node* block = node; block != fRoot; block = block->parent) {
+        block->end = max(block->end, fContentEnd);
+    }
+}
+
+void BlockParser::Finalize(block_node* node) {
+    if (!node->open) {
+        return;
+    }
+    node->open = false;
+    if (node->type == MD_BLOCK_UL || node->type == MD_BLOCK_OL) {
+        node->tight = IsTight(node);
+    }
+}
+
+void BlockParser::FinalizeAll() {
+    while (fTip != NULL) {
+        Finalize(fTip);
+        fTip = fTip->parent;
+    }
+    fTip = fRoot;
+}
+
+void BlockParser::DeleteNode(block_node* node) {
+    if (node == NULL) {
+        return;
+    }
+    for (auto child : node->children) {
+        DeleteNode(child);
+    }
+    delete node;
+}
+
+uint32 BlockParser::FirstLineKind(const block_node* block, bool* dependent) {
+    // types and block start details of the blocks opened on the first line of a top level block
+    uint32 kind = 0;
+    *dependent = false;
+    for (const block_node* node = block; node != NULL; ) {
+        kind = kind * 31 + node->type;
+        kind = kind * 31 + (uint8)node->fenceChar;
+        kind = kind * 31 + node->htmlType * 4 + node->interrupting * 2 + node->afterFence;
+        *dependent = *dependent || node->afterFence || node->interrupting;
+        const block_node* child = (node->children.empty() ? NULL : node->children.front());
+        node = (child != NULL && child->lineStart == block->lineStart ? child : NULL);
+    }
+    return kind;
+}
+
+bool BlockParser::IsTight(const block_node* list) {
+    // a list is loose if any of its items are separated by blank lines, or any item directly
+    // contains two blocks with a blank line between them
+    size_t itemCount = list->children.size();
+    for (size_t itemIndex = 0; itemIndex < itemCount; itemIndex++) {
+        const block_node* item = list->children[itemIndex];
+        // md4c ignores the blank line before an item or block w/o content on its first line
+        bool lastItem = (itemIndex + 1 == itemCount);
+        if (!lastItem) {
+            lastItem = StartsWithoutContent(list->children[itemIndex + 1]);
+        }
+        if (!lastItem && EndsWithBlankLine(item)) {
+            return false;
+        }
+        size_t childCount = item->children.size();
+        for (size_t childIndex = 0; childIndex < childCount; childIndex++) {
+            bool lastChild = (childIndex + 1 == childCount);
+            if ((!lastItem || !lastChild) && EndsWithBlankLine(item->children[childIndex])
+                && !(!lastChild && StartsWithoutContent(item->children[childIndex + 1]))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool BlockParser::StartsWithoutContent(const block_node* block) {
+    // only containers were opened on the first line of the block
+    const block_node* first = block;
+    while (!first->children.empty() && first->children.front()->lineStart == block->lineStart) {
+        first = first->children.front();
+    }
+    return first->type == MD_BLOCK_QUOTE || first->type == MD_BLOCK_UL || first->type == MD_BLOCK_OL
+        || first->type == MD_BLOCK_LI;
+}
+
+bool BlockParser::EndsWithBlankLine(const block_node* node) {
+    while (node != NULL) {
+        if (node->lastLineBlank) {
+            return true;
+        }
+        if ((node->type == MD_BLOCK_UL || node->type == MD_BLOCK_OL || node->type == MD_BLOCK_LI)
+            && !node->children.empty()) {
+            node = node->children.back();
+        } else {
+            break;
+        }
+    }
+    return false;
+}
+
+// line scanning
+
+char BlockParser::Peek(int64 position) const {
+    return (position < fContentEnd ? fText[position] : '\n');
+}
+
+void BlockParser::FindNextNonspace() {
+    int64 position = fPosition;
+    int32 column = fColumn;
+    char c;
+
+    while ((c = Peek(position)) == ' ' || c == '\t') {
+        column += (c == ' ' ? 1 : kTabStop - (column % kTabStop));
+        position++;
+    }
+    fNextNonspace = position;
+    fIndent = column - fColumn;
+    fBlank = (c == '\n');
+}
+
+void BlockParser::AdvanceOffset(int32 count, bool columns) {
+    while (count > 0 && fPosition < fContentEnd) {
+        if (fText[fPosition] == '\t') {
+            int32 charsToTab = kTabStop - (fColumn % kTabStop);
+            if (columns) {
+                // a tab may only be used up partially, e.g. by list item indentation
+                fPartialTab = charsToTab > count;
+                int32 charsToAdvance = min(count, charsToTab);
+                fColumn += charsToAdvance;
+                fPosition += (fPartialTab ? 0 : 1);
+                count -= charsToAdvance;
+            } else {
+                fPartialTab = false;
+                fColumn += charsToTab;
+                fPosition++;
+                count--;
+            }
+        } else {
+            fPartialTab = false;
+            fPosition++;
+            fColumn++;
+            count--;
+        }
+    }
+}
+
+void BlockParser::AdvanceTo(int64 position) {
+    AdvanceOffset(position - fPosition, false);
+}
+
+// block starts, see https://spec.commonmark.org/0.31.2/#blocks-and-inlines
+
+int32 BlockParser::ScanAtxHeading(int64 position) const {
+    int32 level = 0;
+    while (Peek(position + level) == '#') {
+        level++;
+    }
+    char next = Peek(position + level);
+    return (level >= 1 && level <= 6 && (IsSpaceOrTab(next) || next == '\n') ? level : 0);
+}
+
+int32 BlockParser::ScanFenceOpen(int64 position) const {
+    char fenceChar = Peek(position);
+    if (fenceChar != '`' && fenceChar != '~') {
+        return 0;
+    }
+    int32 length = 0;
+    while (Peek(position + length) == fenceChar) {
+        length++;
+    }
+    if (length < 3) {
+        return 0;
+    }
+    // backtick fences cannot have backticks in their info string
+    if (fenceChar == '`' && memchr(fText + position + length, '`', fContentEnd - position - length) != NULL) {
+        return 0;
+    }
+    return length;
+}
+
+bool BlockParser::ScanFenceClose(const block_node* code, int64 position) const {
+    int32 length = 0;
+    while (Peek(position + length) == code->fenceChar) {
+        length++;
+    }
+    if (length < code->fenceLength) {
+        return false;
+    }
+    for (position += length; IsSpaceOrTab(Peek(position)); position++) {
+    }
+    return Peek(position) == '\n';
+}
+
+int32 BlockParser::ScanHtmlStart(int64 position, bool interruptsParagraph) const {
+    if (Peek(position) != '<') {
+        return 0;
+    }
+    const char* text = fText + position + 1;
+    int64 available = fContentEnd - position - 1;
+
+    if (available >= 3 && strncmp(text, "!--", 3) == 0) {
+        return 2;
+    }
+    if (available >= 1 && text[0] == '?') {
+        return 3;
+    }
+    if (available >= 8 && strncmp(text, "![CDATA[", 8) == 0) {
+        return 5;
+    }
+    if (available >= 1 && text[0] == '!') {
+        // md4c does not require a letter after the '!' of declarations
+        return 4;
+    }
+
+    // raw and block level tags, case insensitive and block level tags followed by a tag end
+    bool closing = (available >= 1 && text[0] == '/');
+    int32 nameStart = (closing ? 1 : 0);
+    int32 nameLength = 0;
+    while (nameStart + nameLength < available
+           && (IsAsciiLetter(text[nameStart + nameLength]) || IsDigit(text[nameStart + nameLength]))) {
+        nameLength++;
+    }
+    char next = Peek(position + 1 + nameStart + nameLength);
+    bool tagEnd = IsSpaceOrTab(next) || next == '\n' || next == '>';
+
+    // md4c takes any tag starting with a raw tag name as such
+    for (auto tag : kHtmlRawTags) {
+        if (available >= (int64)strlen(tag) && strncasecmp(text, tag, strlen(tag)) == 0) {
+            return 1;
+        }
+    }
+    if (tagEnd || (next == '/' && Peek(position + 2 + nameStart + nameLength) == '>')) {
+        for (auto tag : kHtmlBlockTags) {
+            if ((int32)strlen(tag) == nameLength && strncasecmp(text + nameStart, tag, nameLength) == 0) {
+                return 6;
+            }
+        }
+    }
+    if (!interruptsParagraph && ScanHtmlTag(position)) {
+        return 7;
+    }
+    return 0;
+}
+
+bool BlockParser::ScanHtmlEnd(int32 htmlType, int64 position) const {
+    static const char* endMarkers[] = { NULL, NULL, "-->", "?>", ">", "]]>" };
+    const char* line = fText + position;
+    int64 length = fContentEnd - position;
+
+    if (htmlType == 1) {
+        for (auto tag : kHtmlRawTags) {
+            int32 tagLength = strlen(tag);
+            for (int64 index = 0; index + tagLength + 3 <= length; index++) {
+                if (line[index] == '<' && line[index + 1] == '/'
+                    && strncasecmp(line + index + 2, tag, tagLength) == 0 && line[index + 2 + tagLength] == '>') {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    const char* marker = endMarkers[htmlType];
+    int32 markerLength = strlen(marker);
+    for (int64 index = 0; index + markerLength <= length; index++) {
+        if (strncmp(line + index, marker, markerLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BlockParser::ScanHtmlTag(int64 position) const {
+    // a complete open or closing tag alone on its line
+    int64 pos = position + 1;
+    bool closing = (Peek(pos) == '/');
+    if (closing) {
+        pos++;
+    }
+    if (!IsAsciiLetter(Peek(pos))) {
+        return false;
+    }
+    while (IsAsciiLetter(Peek(pos)) || IsDigit(Peek(pos)) || Peek(pos) == '-') {
+        pos++;
+    }
+    if (closing) {
+        while (IsSpaceOrTab(Peek(pos))) {
+            pos++;
+        }
+    } else {
+        // attributes
+        while (true) {
+            int64 attributeStart = pos;
+            while (IsSpaceOrTab(Peek(pos))) {
+                pos++;
+            }
+            char c = Peek(pos);
+            if (pos == attributeStart || !(IsAsciiLetter(c) || c == '_' || c == ':')) {
+                break;
+            }
+            while (IsAsciiLetter(Peek(pos)) || IsDigit(Peek(pos)) || strchr("_.:-", Peek(pos)) != NULL) {
+                pos++;
+            }
+            // optional value
+            int64 valueStart = pos;
+            while (IsSpaceOrTab(Peek(pos))) {
+                pos++;
+            }
+            if (Peek(pos) != '=') {
+                pos = valueStart;
+                continue;
+            }
+            pos++;
+            while (IsSpaceOrTab(Peek(pos))) {
+                pos++;
+            }
+            char quote = Peek(pos);
+            if (quote == '"' || quote == '\'') {
+                pos++;
+                while (Peek(pos) != quote && Peek(pos) != '\n') {
+                    pos++;
+                }
+                if (Peek(pos) != quote) {
+                    return false;
+                }
+                pos++;
+            } else {
+                int64 unquotedStart = pos;
+                while (strchr(" \t\n\"'=<>`", Peek(pos)) == NULL) {
+                    pos++;
+                }
+                if (pos == unquotedStart) {
+                    return false;
+                }
+            }
+        }
+        while (IsSpaceOrTab(Peek(pos))) {
+            pos++;
+        }
+        if (Peek(pos) == '/') {
+            pos++;
+        }
+    }
+    if (Peek(pos) != '>') {
+        return false;
+    }
+    for (pos++; IsSpaceOrTab(Peek(pos)); pos++) {
+    }
+    return Peek(pos) == '\n';
+}
+
+bool BlockParser::ScanSetextUnderline(int64 position) const {
+    char c = Peek(position);
+    if (c != '=' && c != '-') {
+        return false;
+    }
+    while (Peek(position) == c) {
+        position++;
+    }
+    while (IsSpaceOrTab(Peek(position))) {
+        position++;
+    }
+    return Peek(position) == '\n';
+}
+
+bool BlockParser::IsReferencesOnly(const block_node* paragraph) const {
+    string text;
+    for (auto line : paragraph->lines) {
+        text.append(fText + line.offset, line.length).append("\n");
+    }
+    // skip the task mark, see ProcessLine
+    int32 pos = 0;
+    if (paragraph->parent->task && paragraph->parent->children.front() == paragraph) {
+        pos = text.find('[') + 3;
+    }
+    return ScanReferences(text, pos) >= (int32) text.size();
+}
+
+int32 BlockParser::ScanReferences(const string& text, int32 pos) {
+    for (int32 end; pos < (int32) text.size() && (end = ScanReference(text, pos)) > 0; ) {
+        pos = end;
+    }
+    return pos;
+}
+
+bool BlockParser::ScanTableUnderline(int64 position) const {
+    // cells of dashes with optional alignment colons, separated by at least one pipe
+    bool pipe = (Peek(position) == '|');
+    if (pipe) {
+        position++;
+    }
+    while (true) {
+        while (IsSpaceOrTab(Peek(position))) {
+            position++;
+        }
+        if (Peek(position) == ':') {
+            position++;
+        }
+        if (Peek(position) != '-') {
+            return false;
+        }
+        while (Peek(position) == '-') {
+            position++;
+        }
+        if (Peek(position) == ':') {
+            position++;
+        }
+        while (IsSpaceOrTab(Peek(position))) {
+            position++;
+        }
+        if (Peek(position) != '|') {
+            return pipe && Peek(position) == '\n';
+        }
+        pipe = true;
+        position++;
+        while (IsSpaceOrTab(Peek(position))) {
+            position++;
+        }
+        if (Peek(position) == '\n') {
+            return true;
+        }
+    }
+}
+
+bool BlockParser::ScanThematicBreak(int64 position) const {
+    char c = Peek(position);
+    if (c != '*' && c != '-' && c != '_') {
+        return false;
+    }
+    int32 count = 0;
+    for (char next = Peek(position); next != '\n'; next = Peek(++position)) {
+        if (next == c) {
+            count++;
+        } else if (!IsSpaceOrTab(next)) {
+            return false;
+        }
+    }
+    return count >= 3;
+}
+
+int32 BlockParser::ScanListMarker(int64 position, bool interruptsParagraph, char* mark, uint32* number) const {
+    char c = Peek(position);
+    int32 length;
+
+    if (c == '-' || c == '+' || c == '*') {
+        *mark = c;
+        *number = 0;
+        length = 1;
+    } else if (IsDigit(c)) {
+        uint32 value = 0;
+        length = 0;
+        while (length < 9 && IsDigit(Peek(position + length))) {
+            value = value * 10 + (Peek(position + length) - '0');
+            length++;
+        }
+        char delimiter = Peek(position + length);
+        if (delimiter != '.' && delimiter != ')') {
+            return 0;
+        }
+        // only lists starting with 1 can interrupt a paragraph
+        if (interruptsParagraph && value != 1) {
+            return 0;
+        }
+        *mark = delimiter;
+        *number = value;
+        length++;
+    } else {
+        return 0;
+    }
+    char next = Peek(position + length);
+    if (!IsSpaceOrTab(next) && next != '\n') {
+        return 0;
+    }
+    // empty items cannot interrupt a paragraph, md4c only checks for a line end right after the marker
+    if (interruptsParagraph && next == '\n') {
+        return 0;
+    }
+    return length;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * incremental parser for the block structure of a Markdown document, following the CommonMark
+ * parsing strategy, see https://spec.commonmark.org/0.31.2/#appendix-a-parsing-strategy
+ * it keeps container blocks (quotes, lists, items) and leaf blocks with their lines, so md4c is only
+ * needed for the inline content of single leaf blocks. after an edit, parsing restarts at the top level
+ * block before the edit and stops as soon as a top level block starts where one started before.
+ * edits within the text of a paragraph line that cannot change the block structure skip parsing,
+ * only the lines of the paragraph are updated then.
+ */
+#pragma once
+
+#include "include/md4c.h"
+#include <string>
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+typedef struct block_line {
+    int64           offset;         // start of the line content after container markers
+    int32           length;         // w/o line break
+    int32           indent;         // columns left of a tab partially consumed by container markers
+    bool            lazy;           // paragraph continuation outside of the paragraph's containers
+} block_line;
+
+typedef struct block_start {
+    int64           offset;         // start of the line a top level block was opened on
+    uint32          kind;           // blocks opened on that line, which may depend on the line before
+    bool            dependent;      // opened differently after a paragraph or fenced block
+} block_start;
+
+typedef struct block_node {
+    MD_BLOCKTYPE    type;           // quote, list, item or leaf block, tables are paragraph lines for md4c
+    int64           start;          // offset of the container marker or of the leaf content
+    int64           end;            // end of the last line with content
+    int64           lineStart;      // start of the line the block was opened on
+    block_node*     parent;
+    vector<block_node*> children;
+    vector<block_line>  lines;      // leaf blocks only
+    bool            table;          // paragraph with a delimiter row as second line
+    bool            open;
+    bool            lastLineBlank;
+    // lists and list items
+    bool            tight;
+    char            mark;           // bullet char or delimiter of ordered lists
+    uint32          number;         // start number of ordered lists
+    int32           itemIndent;     // columns of item content, marker offset and padding
+    bool            task;           // item content starts with a task mark
+    // fenced code and HTML blocks
+    bool            fenced;
+    char            fenceChar;
+    int32           fenceLength;
+    int32           fenceOffset;    // indentation of the fence or HTML block start
+    int32           htmlType;
+    bool            interrupting;   // HTML block started right below a paragraph line
+    bool            afterFence;     // started with the fence chars md4c took as end of the fenced block before,
+                                    // fenceChar and fenceLength are those of that block
+} block_node;
+
+class BlockParser {
+
+public:
+                        BlockParser();
+    virtual             ~BlockParser();
+
+    void                Clear();
+    /**
+     * parses the block structure of text from start on, which is the end of front matter if any.
+     */
+    void                Parse(const char* text, int64 size, int64 start = 0);
+    /**
+     * updates the block structure after removed bytes at offset were replaced by inserted bytes,
+     * with text holding the complete new text. returns the range of the new text that was parsed
+     * again, its top level blocks are then available from Blocks().
+     */
+    void                Update(const char* text, int64 size, int64 offset, int64 removed, int64 inserted,
+                               int64* start, int64* end);
+    /**
+     * updates the paragraph holding the edit if it keeps the block structure, that is removed and inserted
+     * bytes are within the text of a single line after its first char and the line cannot start another
+     * block now. returns the paragraph, or NULL if Update() is needed. blocks stay valid as with Update().
+     */
+    const block_node*   UpdateLeaf(const char* text, int64 size, int64 offset, int64 removed, int64 inserted);
+    /**
+     * returns the leaf block whose content starts at offset, parsing the top level block holding it
+     * again if it is not among the blocks kept from the last parse. NULL if there is no such block.
+     */
+    const block_node*   LeafAt(int64 offset);
+    /**
+     * returns the blocks holding text from start to end, innermost first, parsing the top level block
+     * holding them again if it is not among the blocks kept from the last parse. text is the current text.
+     */
+    void                GetBlocksAt(const char* text, int64 start, int64 end, vector<const block_node*>* blocks);
+    /**
+     * returns whether a top level block starts on the line at offset.
+     */
+    bool                IsBlockStart(int64 offset);
+    /**
+     * returns the line starts of all top level blocks, in document order.
+     */
+    void                GetBlockStarts(vector<int64>* offsets);
+    /**
+     * moves the top level blocks after the text from start to middle and from middle to end swapped places,
+     * all three must be top level block starts or the end of text. the blocks at the seams may depend on
+     * the lines before them, so they need to be parsed again with Update().
+     */
+    void                SwapRanges(int64 start, int64 middle, int64 end);
+
+    /**
+     * top level blocks of the range parsed last, valid until the next parse.
+     */
+    const vector<block_node*>* Blocks()         { return &fRoot->children; }
+    int64               Start()                 { return fStart; }
+    int32               CountTopLevelBlocks()   { return fBlockStarts.size(); }
+
+    /**
+     * returns the end of the link reference definitions in text starting at pos, pos if there are none.
+     */
+    static int32        ScanReferences(const string& text, int32 pos = 0);
+
+private:
+    void                ParseLines(int64 from, int64 syncOffset, int64 delta,
+                                   const vector<block_start>* syncStarts, vector<block_start>* starts,
+                                   int64* end);
+    vector<block_start>::iterator FindBlockStart(int64 offset);
+    block_node*         FindLeaf(int64 offset);
+    bool                KeepsParagraph(const block_node* paragraph, size_t index, int64 position,
+                                       int64 offset) const;
+    static void         ShiftNode(block_node* node, int64 offset, int64 delta);
+    void                ProcessLine();
+    bool                MatchContainer(block_node* container, bool* lineDone);
+    block_node*         AddChild(block_node* parent, MD_BLOCKTYPE type, int64 start);
+    void                AddLine(block_node* node);
+    void                Finalize(block_node* node);
+    void                FinalizeAll();
+    static void         DeleteNode(block_node* node);
+    static uint32       FirstLineKind(const block_node* block, bool* dependent);
+    static bool         IsTight(const block_node* list);
+    static bool         StartsWithoutContent(const block_node* block);
+    static bool         EndsWithBlankLine(const block_node* node);
+
+    // line scanning
+    char                Peek(int64 position) const;
+    void                FindNextNonspace();
+    void                AdvanceOffset(int32 count, bool columns);
+    void                AdvanceTo(int64 position);
+
+    // block starts
+    int32               ScanAtxHeading(int64 position) const;
+    int32               ScanFenceOpen(int64 position) const;
+    bool                ScanFenceClose(const block_node* code, int64 position) const;
+    int32               ScanHtmlStart(int64 position, bool interruptsParagraph) const;
+    bool                ScanHtmlEnd(int32 htmlType, int64 position) const;
+    bool                ScanSetextUnderline(int64 position) const;
+    bool                ScanTableUnderline(int64 position) const;
+    bool                IsReferencesOnly(const block_node* paragraph) const;
+    bool                ScanThematicBreak(int64 position) const;
+    int32               ScanListMarker(int64 position, bool interruptsParagraph,
+                                       char* mark, uint32* number) const;
+    bool                ScanHtmlTag(int64 position) const;
+
+    const char*         fText;
+    int64               fSize;
+    int64               fStart;
+    block_node*         fRoot;
+    block_node*         fTip;               // deepest open block
+    vector<block_start> fBlockStarts;       // all top level blocks, in document order
+
+    // state of the current line
+    int64               fLineStart;
+    int64               fLineEnd;           // start of the next line
+    int64               fContentEnd;        // w/o line break
+    int64               fPosition;
+    int32               fColumn;
+    bool                fPartialTab;
+    int64               fNextNonspace;
+    int32               fIndent;
+    bool                fBlank;
+    bool                fAfterFence;        // blocks start after the fence chars ending a fenced block
+};
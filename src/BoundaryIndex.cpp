@@ -0,0 +1,425 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "BoundaryIndex.h"
+
+#include <algorithm>
+#include <string.h>
+
+enum CHAR_CLASS {
+    CHAR_SPACE = 0,
+    CHAR_WORD,
+    CHAR_IDEOGRAPH,     // a word of its own, scripts w/o spaces between words
+    CHAR_TERMINATOR,    // ends a sentence
+    CHAR_CLOSING,       // quotes and brackets that still belong to the sentence they close
+    CHAR_JOINER,        // part of a word between word characters, as in "don't", "e.g" or "3.14"
+    CHAR_OTHER
+};
+
+// lower case, sorted, w/o the trailing period. words with inner periods and initials are found w/o a list
+static const char* kAbbreviations[] = {
+    "al", "approx", "apr", "aug", "bzw", "ca", "cf", "co", "corp", "dec", "dept", "dr", "eg", "est", "etc",
+    "evtl", "feb", "fig", "figs", "ggf", "ie", "inc", "inkl", "jan", "jr", "jul", "jun", "lt", "ltd", "mar",
+    "max", "min", "mr", "mrs", "ms", "no", "nov", "nr", "oct", "prof", "sen", "sep", "sept", "sr", "st",
+    "usw", "vgl", "vol", "vs"
+};
+
+template<typename Range>
+static bool CompareRangeStart(const Range& range, int64 offset) {
+    return range.start < offset;
+}
+
+static int32 DecodeChar(const char* text, int64 length, uint32* codePoint) {
+    const uint8* bytes = reinterpret_cast<const uint8*>(text);
+    uint8 first = bytes[0];
+    int32 size = first < 0x80 ? 1 : first >= 0xf0 ? 4 : first >= 0xe0 ? 3 : first >= 0xc0 ? 2 : 0;
+    if (size == 0 || size > length) {
+        // invalid or cut off, taken as a single byte
+        *codePoint = 0xfffd;
+        return 1;
+    }
+    uint32 value = size == 1 ? first : first & (0x7f >> size);
+    for (int32 index = 1; index < size; index++) {
+        if ((bytes[index] & 0xc0) != 0x80) {
+            *codePoint = 0xfffd;
+            return 1;
+        }
+        value = (value << 6) | (bytes[index] & 0x3f);
+    }
+    *codePoint = value;
+    return size;
+}
+
+static CHAR_CLASS ClassifyChar(uint32 c) {
+    if (c < 0x80) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+            return CHAR_WORD;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+            return CHAR_SPACE;
+        if (c == '.' || c == '!' || c == '?')
+            return CHAR_TERMINATOR;
+        if (c == '"' || c == ')' || c == ']' || c == '}')
+            return CHAR_CLOSING;
+        if (c == '\'' || c == '-' || c == ',')
+            return CHAR_JOINER;
+        return CHAR_OTHER;
+    }
+    switch (c) {
+        case 0x00a0: case 0x202f: case 0x205f: case 0x3000:
+            return CHAR_SPACE;
+        case 0x2026: case 0x203c: case 0x2047: case 0x2048: case 0x2049: case 0x3002: case 0xff01:
+        case 0xff0e: case 0xff1f: case 0xff61: case 0x061f: case 0x06d4: case 0x0964: case 0x0965:
+            return CHAR_TERMINATOR;
+        case 0x00bb: case 0x201d: case 0x203a: case 0x300d: case 0x300f: case 0xff09:
+            return CHAR_CLOSING;
+        case 0x2019:
+            return CHAR_JOINER;
+        case 0x00aa: case 0x00b5: case 0x00ba:
+            return CHAR_WORD;
+    }
+    if (c >= 0x2000 && c <= 0x200b)
+        return CHAR_SPACE;
+    if ((c >= 0x3400 && c <= 0x4dbf) || (c >= 0x4e00 && c <= 0x9fff) || (c >= 0xf900 && c <= 0xfaff)
+        || (c >= 0x20000 && c <= 0x2ffff)) {
+        return CHAR_IDEOGRAPH;
+    }
+    // punctuation and symbol blocks, emoji and the like
+    if ((c >= 0x00a1 && c <= 0x00bf) || c == 0x00d7 || c == 0x00f7 || (c >= 0x2010 && c <= 0x2bff)
+        || (c >= 0x2e00 && c <= 0x2e7f) || (c >= 0x3001 && c <= 0x303f) || (c >= 0xfe30 && c <= 0xfe6f)
+        || (c >= 0xff00 && c <= 0xff0f) || (c >= 0xff1a && c <= 0xff20) || (c >= 0xff3b && c <= 0xff40)
+        || (c >= 0xff5b && c <= 0xff65) || c >= 0x1f000 || c == 0xfffd) {
+        return CHAR_OTHER;
+    }
+    // letters, digits and marks of all other scripts
+    return CHAR_WORD;
+}
+
+BoundaryIndex::BoundaryIndex() {
+}
+
+BoundaryIndex::~BoundaryIndex() {
+}
+
+void BoundaryIndex::Clear() {
+    fSentences.clear();
+    fWordBlocks.clear();
+}
+
+void BoundaryIndex::Update(markup_map* markupMap, const char* text, int64 start, int64 end,
+                           int64 textOffset) {
+    vector<text_range> sentences;
+    vector<word_block> wordBlocks;
+    vector<scan_run> runs;
+
+    auto mapEnd = markupMap->upper_bound(end);
+    for (auto mapIter = markupMap->lower_bound(start); mapIter != mapEnd; mapIter++) {
+        for (auto item : *mapIter->second) {
+            if (item->markup_class == MD_BLOCK_BEGIN || item->markup_class == MD_BLOCK_END) {
+                // every block boundary ends a sentence
+                ScanRuns(text, textOffset, runs, &sentences, &wordBlocks);
+                runs.clear();
+            } else if (item->markup_class == MD_TEXT && item->length > 0) {
+                MD_TEXTTYPE type = item->markup_type.text_type;
+                if (type == MD_TEXT_HTML || type == MD_TEXT_NULLCHAR)
+                    continue;
+                // code blocks hold no sentences, unlike code spans their text is not opened by a backtick
+                if (type == MD_TEXT_CODE && !IsCodeSpan(text, textOffset, item->offset))
+                    continue;
+                runs.push_back({item->offset, item->offset + item->length, type});
+            }
+        }
+    }
+    ScanRuns(text, textOffset, runs, &sentences, &wordBlocks);
+
+    Replace(&fSentences, start, end, sentences);
+    Replace(&fWordBlocks, start, end, wordBlocks);
+}
+
+void BoundaryIndex::ShiftOffsets(int64 start, int64 end, int64 delta) {
+    Shift(&fSentences, start, end, delta);
+    Shift(&fWordBlocks, start, end, delta);
+}
+
+void BoundaryIndex::SwapRanges(int64 start, int64 middle, int64 end) {
+    Swap(&fSentences, start, middle, end);
+    Swap(&fWordBlocks, start, middle, end);
+}
+
+int32 BoundaryIndex::CountWords() {
+    int32 count = 0;
+    for (auto& block : fWordBlocks)
+        count += block.words.size();
+    return count;
+}
+
+bool BoundaryIndex::GetSentenceAt(int64 offset, text_range* sentence) {
+    // the end of a sentence still belongs to it, so the caret after its period finds it
+    int32 index = FindRangeIndex(fSentences, offset);
+    if (index < 0 || fSentences[index].end < offset)
+        return false;
+
+    *sentence = fSentences[index];
+    return true;
+}
+
+bool BoundaryIndex::GetNextSentence(int64 offset, text_range* sentence) {
+    uint32 index = FindRangeIndex(fSentences, offset) + 1;
+    if (index >= fSentences.size())
+        return false;
+
+    *sentence = fSentences[index];
+    return true;
+}
+
+bool BoundaryIndex::GetPreviousSentence(int64 offset, text_range* sentence) {
+    int32 index = FindRangeIndex(fSentences, offset - 1);
+    if (index < 0)
+        return false;
+
+    *sentence = fSentences[index];
+    return true;
+}
+
+bool BoundaryIndex::GetWordAt(int64 offset, text_range* word) {
+    int32 index = FindRangeIndex(fWordBlocks, offset);
+    if (index < 0 || fWordBlocks[index].end < offset)
+        return false;
+
+    // the block starts with its first word, so there is one starting at or before offset
+    const word_block& block = fWordBlocks[index];
+    const text_range& found = block.words[FindRangeIndex(block.words, offset - block.start)];
+    if (block.start + found.end < offset)
+        return false;
+
+    word->start = block.start + found.start;
+    word->end = block.start + found.end;
+    return true;
+}
+
+bool BoundaryIndex::SnapToWords(int64* start, int64* end) {
+    auto endsAfter = [](const auto& range, int64 offset) { return range.end <= offset; };
+
+    // the first word ending after start and the last one starting before end
+    auto firstBlock = lower_bound(fWordBlocks.begin(), fWordBlocks.end(), *start, endsAfter);
+    if (firstBlock == fWordBlocks.end())
+        return false;
+    auto first = lower_bound(firstBlock->words.begin(), firstBlock->words.end(), *start - firstBlock->start,
+        endsAfter);
+    if (firstBlock->start + first->start >= *end)
+        return false;
+
+    auto lastBlock = lower_bound(firstBlock, fWordBlocks.end(), *end, CompareRangeStart<word_block>) - 1;
+    auto last = lower_bound(lastBlock->words.begin(), lastBlock->words.end(), *end - lastBlock->start,
+        CompareRangeStart<text_range>) - 1;
+
+    *start = firstBlock->start + first->start;
+    *end = lastBlock->start + last->end;
+    return true;
+}
+
+void BoundaryIndex::ScanRuns(const char* text, int64 textOffset, const vector<scan_run>& runs,
+                             vector<text_range>* sentences, vector<word_block>* wordBlocks) {
+    vector<text_range> words;
+    int64 sentenceStart = -1;
+    int64 contentEnd = -1;
+
+    // the next character that is not space after offset, 0 at the end of the block
+    auto nextContent = [&](size_t run, int64 offset, bool* spaceBefore) -> uint32 {
+        *spaceBefore = false;
+        for (; run < runs.size(); run++) {
+            if (runs[run].type == MD_TEXT_SOFTBR || runs[run].type == MD_TEXT_BR) {
+                *spaceBefore = true;
+                continue;
+            }
+            offset = max(offset, runs[run].start);
+            while (offset < runs[run].end) {
+                uint32 c;
+                offset += DecodeChar(text + offset - textOffset, runs[run].end - offset, &c);
+                if (ClassifyChar(c) != CHAR_SPACE)
+                    return c;
+                *spaceBefore = true;
+            }
+        }
+        *spaceBefore = true;
+        return 0;
+    };
+
+    for (size_t run = 0; run < runs.size(); run++) {
+        const scan_run& current = runs[run];
+        if (current.type == MD_TEXT_SOFTBR || current.type == MD_TEXT_BR)
+            continue;
+        if (current.type != MD_TEXT_NORMAL) {
+            // code spans, entities and math are part of the sentence, but have no words or sentence ends
+            if (sentenceStart < 0)
+                sentenceStart = current.start;
+            contentEnd = current.end;
+            continue;
+        }
+        int64 offset = current.start;
+        while (offset < current.end) {
+            uint32 c;
+            int32 size = DecodeChar(text + offset - textOffset, current.end - offset, &c);
+            CHAR_CLASS charClass = ClassifyChar(c);
+            if (charClass == CHAR_SPACE) {
+                offset += size;
+                continue;
+            }
+            if (sentenceStart < 0)
+                sentenceStart = offset;
+
+            if (charClass == CHAR_IDEOGRAPH) {
+                words.push_back({offset, offset + size});
+                offset += size;
+                contentEnd = offset;
+                continue;
+            }
+            if (charClass == CHAR_WORD) {
+                int64 wordStart = offset;
+                offset += size;
+                while (offset < current.end) {
+                    size = DecodeChar(text + offset - textOffset, current.end - offset, &c);
+                    charClass = ClassifyChar(c);
+                    if (charClass == CHAR_JOINER || c == '.') {
+                        // only joins if a word character follows right away, a comma only between digits
+                        uint32 next = 0;
+                        if (offset + size < current.end) {
+                            DecodeChar(text + offset + size - textOffset, current.end - offset - size, &next);
+                        }
+                        bool digits = next >= '0' && next <= '9' && text[offset - 1 - textOffset] >= '0'
+                            && text[offset - 1 - textOffset] <= '9';
+                        if (ClassifyChar(next) != CHAR_WORD || (c == ',' && !digits)) {
+                            break;
+                        }
+                    } else if (charClass != CHAR_WORD) {
+                        break;
+                    }
+                    offset += size;
+                }
+                words.push_back({wordStart, offset});
+                contentEnd = offset;
+                continue;
+            }
+            if (charClass == CHAR_TERMINATOR) {
+                int64 terminator = offset;
+                // full stops of scripts w/o spaces end a sentence right away
+                bool needsSpace = c < 0x80 || c == 0x2026;
+                // repeated terminators and closing quotes belong to the sentence they end
+                offset += size;
+                while (offset < current.end) {
+                    size = DecodeChar(text + offset - textOffset, current.end - offset, &c);
+                    charClass = ClassifyChar(c);
+                    if (charClass != CHAR_TERMINATOR && charClass != CHAR_CLOSING)
+                        break;
+                    offset += size;
+                }
+                contentEnd = offset;
+
+                bool ends = true;
+                if (needsSpace) {
+                    // a space and no lower case letter has to follow, so "3.5", "approx. five" don't end it
+                    bool spaceBefore;
+                    uint32 next = nextContent(run, offset, &spaceBefore);
+                    ends = spaceBefore && !(next >= 'a' && next <= 'z');
+                    // nor a period after an abbreviation or an initial, as in "Dr. Smith" or "J. Smith"
+                    if (ends && text[terminator - textOffset] == '.' && !words.empty()
+                        && words.back().end == terminator) {
+                        const text_range& word = words.back();
+                        ends = !IsAbbreviation(text + word.start - textOffset, word.end - word.start);
+                    }
+                }
+                if (ends) {
+                    sentences->push_back({sentenceStart, offset});
+                    sentenceStart = -1;
+                }
+                continue;
+            }
+            offset += size;
+            contentEnd = offset;
+        }
+    }
+    if (sentenceStart >= 0 && contentEnd > sentenceStart)
+        sentences->push_back({sentenceStart, contentEnd});
+
+    if (!words.empty()) {
+        int64 start = words.front().start;
+        int64 end = words.back().end;
+        for (auto& word : words) {
+            word.start -= start;
+            word.end -= start;
+        }
+        wordBlocks->push_back({start, end, move(words)});
+    }
+}
+
+bool BoundaryIndex::IsCodeSpan(const char* text, int64 textOffset, int64 offset) {
+    // a single space after the backticks is stripped from code spans
+    int64 position = offset - 1;
+    if (position >= textOffset && text[position - textOffset] == ' ')
+        position--;
+    return position >= textOffset && text[position - textOffset] == '`';
+}
+
+bool BoundaryIndex::IsAbbreviation(const char* word, int64 length) {
+    // initials and words with inner periods, as "e.g" or "U.S"
+    if (length == 1 && word[0] >= 'A' && word[0] <= 'Z')
+        return true;
+    if (memchr(word, '.', length) != NULL)
+        return true;
+
+    char lowerWord[8];
+    if (length >= (int64) sizeof(lowerWord))
+        return false;
+    for (int64 index = 0; index < length; index++)
+        lowerWord[index] = (word[index] >= 'A' && word[index] <= 'Z') ? word[index] + 'a' - 'A' : word[index];
+    lowerWord[length] = '\0';
+
+    return binary_search(begin(kAbbreviations), end(kAbbreviations), lowerWord,
+        [](const char* abbreviation, const char* other) { return strcmp(abbreviation, other) < 0; });
+}
+
+template<typename Range>
+int32 BoundaryIndex::FindRangeIndex(const vector<Range>& ranges, int64 offset) {
+    // the last range starting at or before offset, or -1
+    auto iter = upper_bound(ranges.begin(), ranges.end(), offset,
+        [](int64 value, const Range& range) { return value < range.start; });
+
+    return (iter - ranges.begin()) - 1;
+}
+
+template<typename Range>
+void BoundaryIndex::Replace(vector<Range>* ranges, int64 start, int64 end, const vector<Range>& found) {
+    auto from = lower_bound(ranges->begin(), ranges->end(), start, CompareRangeStart<Range>);
+    auto to   = lower_bound(from, ranges->end(), end + 1, CompareRangeStart<Range>);
+    auto insertPos = ranges->erase(from, to);
+    ranges->insert(insertPos, found.begin(), found.end());
+}
+
+template<typename Range>
+void BoundaryIndex::Shift(vector<Range>* ranges, int64 start, int64 end, int64 delta) {
+    auto from = lower_bound(ranges->begin(), ranges->end(), start, CompareRangeStart<Range>);
+    auto to   = lower_bound(from, ranges->end(), end, CompareRangeStart<Range>);
+
+    for (auto range = ranges->erase(from, to); range != ranges->end(); range++) {
+        range->start += delta;
+        range->end += delta;
+    }
+}
+
+template<typename Range>
+void BoundaryIndex::Swap(vector<Range>* ranges, int64 start, int64 middle, int64 end) {
+    auto from  = lower_bound(ranges->begin(), ranges->end(), start, CompareRangeStart<Range>);
+    auto split = lower_bound(from, ranges->end(), middle, CompareRangeStart<Range>);
+    auto to    = lower_bound(split, ranges->end(), end, CompareRangeStart<Range>);
+
+    for (auto range = from; range != split; range++) {
+        range->start += end - middle;
+        range->end += end - middle;
+    }
+    for (auto range = split; range != to; range++) {
+        range->start -= middle - start;
+        range->end -= middle - start;
+    }
+    rotate(from, split, to);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * keeps the sentences and words of a document sorted by offset, found in the normal text of each leaf block.
+ * sentences never cross block boundaries, so the index is kept up to date block by block like the headings.
+ * words are kept per block relative to its first word, so an edit only moves the blocks after it.
+ */
+#pragma once
+
+#include <SupportDefs.h>
+#include <vector>
+
+#include "MarkdownParser.h"
+
+using namespace std;
+
+typedef struct text_range {
+    int64           start;
+    int64           end;
+} text_range;
+
+class BoundaryIndex {
+
+public:
+                        BoundaryIndex();
+    virtual             ~BoundaryIndex();
+
+    void                Clear();
+    /**
+     * replaces all sentences and words in the given range with those found in the markup map for that range,
+     * which must start and end at block boundaries.
+     * text holds the document text starting at textOffset, which must cover the range.
+     */
+    void                Update(markup_map* markupMap, const char* text, int64 start, int64 end,
+                               int64 textOffset = 0);
+    /**
+     * drops the entries from start to end of the text before an edit and moves those after it by delta.
+     */
+    void                ShiftOffsets(int64 start, int64 end, int64 delta);
+    /**
+     * moves the entries after the text from start to middle and from middle to end swapped places.
+     */
+    void                SwapRanges(int64 start, int64 middle, int64 end);
+
+    int32               CountSentences()    { return fSentences.size(); }
+    int32               CountWords();
+
+    // all lookups in O(log n)
+    bool                GetSentenceAt(int64 offset, text_range* sentence);
+    /**
+     * returns the first sentence starting after offset.
+     */
+    bool                GetNextSentence(int64 offset, text_range* sentence);
+    /**
+     * returns the last sentence starting before offset.
+     */
+    bool                GetPreviousSentence(int64 offset, text_range* sentence);
+    bool                GetWordAt(int64 offset, text_range* word);
+    /**
+     * widens a range to the whole words it cuts through, leading and trailing text between words is dropped.
+     * returns false if the range holds no word.
+     */
+    bool                SnapToWords(int64* start, int64* end);
+
+private:
+    typedef struct scan_run {
+        int64           start;
+        int64           end;
+        MD_TEXTTYPE     type;
+    } scan_run;
+
+    typedef struct word_block {
+        int64               start;
+        int64               end;
+        vector<text_range>  words;      // relative to start
+    } word_block;
+
+    static void         ScanRuns(const char* text, int64 textOffset, const vector<scan_run>& runs,
+                                 vector<text_range>* sentences, vector<word_block>* wordBlocks);
+    static bool         IsCodeSpan(const char* text, int64 textOffset, int64 offset);
+    static bool         IsAbbreviation(const char* word, int64 length);
+    template<typename Range>
+    static int32        FindRangeIndex(const vector<Range>& ranges, int64 offset);
+    template<typename Range>
+    static void         Replace(vector<Range>* ranges, int64 start, int64 end, const vector<Range>& found);
+    template<typename Range>
+    static void         Shift(vector<Range>* ranges, int64 start, int64 end, int64 delta);
+    template<typename Range>
+    static void         Swap(vector<Range>* ranges, int64 start, int64 middle, int64 end);
+
+    vector<text_range>  fSentences;
+    vector<word_block>  fWordBlocks;
+};
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "DocumentScanner.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <cstring>
+#include <functional>
+#include <stdio.h>
+#include <strings.h>
+
+DocumentScanner::DocumentScanner(BPositionIO* source, int32 windowSize)
+    : fSource(source),
+      fWindowSize(windowSize),
+      fParser(new MarkdownParser()) {
+    fParser->Init();
+}
+
+DocumentScanner::~DocumentScanner() {
+    delete fParser;
+}
+
+int64 DocumentScanner::Size() {
+    off_t size;
+    if (fSource->GetSize(&size) != B_OK) {
+        return 0;
+    }
+    return size;
+}
+
+status_t DocumentScanner::Scan(window_visitor visit, int64 start, int64 end, const CancelToken& token) {
+    int64 size = Size();
+    vector<char> buffer(fWindowSize);
+
+    for (int64 position = start; position < size && position <= end; ) {
+        if (token.IsCanceled()) {
+            return B_CANCELED;
+        }
+        ssize_t bytesRead = fSource->ReadAt(position, buffer.data(), fWindowSize);
+        if (bytesRead <= 0) {
+            return bytesRead < 0 ? bytesRead : B_ERROR;
+        }
+        // the last window takes the rest, all others end at a block boundary
+        int32 windowSize = bytesRead;
+        if (position + bytesRead < size) {
+            windowSize = FindWindowEnd(buffer.data(), bytesRead);
+        }
+
+        fParser->Parse(buffer.data(), windowSize, position);
+        bool proceed = visit(fParser->GetMarkupMap(), buffer.data(), position, windowSize);
+        fParser->ClearTextInfo();
+
+        if (!proceed) {
+            break;
+        }
+        position += windowSize;
+    }
+    return B_OK;
+}
+
+status_t DocumentScanner::BuildOutline(HeadingIndex* index, const CancelToken& token) {
+    index->Clear();
+
+    return Scan([index](markup_map* markupMap, const char* text, int64 textOffset, int32 size) {
+        index->Update(markupMap, text, textOffset, textOffset + size, textOffset);
+        return true;
+    }, 0, INT64_MAX, token);
+}
+
+status_t DocumentScanner::Find(const char* pattern, vector<int64>* results, int32 maxResults,
+                               const CancelToken& token) {
+    int32 patternLength = strlen(pattern);
+    if (patternLength == 0 || patternLength >= fWindowSize) {
+        return B_BAD_VALUE;
+    }
+    int64 size = Size();
+    vector<char> buffer(fWindowSize);
+    boyer_moore_horspool_searcher<const char*> searcher(pattern, pattern + patternLength);
+
+    // consecutive windows overlap by the pattern length, so matches across window borders are found
+    for (int64 position = 0; position < size; position += fWindowSize - patternLength + 1) {
+        if (token.IsCanceled()) {
+            return B_CANCELED;
+        }
+        ssize_t bytesRead = fSource->ReadAt(position, buffer.data(), fWindowSize);
+        if (bytesRead < 0) {
+            return bytesRead;
+        }
+        const char* text = buffer.data();
+        const char* textEnd = text + bytesRead;
+
+        for (const char* match = search(text, textEnd, searcher); match != textEnd;
+             match = search(match + 1, textEnd, searcher)) {
+            results->push_back(position + (match - text));
+            if ((int32)results->size() >= maxResults) {
+                return B_OK;
+            }
+        }
+        if (position + bytesRead >= size) {
+            break;
+        }
+    }
+    return B_OK;
+}
+
+/**
+ * returns the end condition of the HTML block of type 1 - 5 starting at line, or NULL.
+ * these blocks may hold blank lines and only end at a line containing their end marker.
+ */
+static const char* HtmlBlockEnd(const char* line, int32 length) {
+    static const struct {
+        const char* start;
+        const char* end;
+    } kHtmlBlocks[] = {
+        { "<script", "</script>" }, { "<pre", "</pre>" }, { "<style", "</style>" },
+        { "<textarea", "</textarea>" }, { "<!--", "-->" }, { "<![CDATA[", "]]>" }, { "<?", "?>" }
+    };
+    for (int32 index = 0; index < (int32) B_COUNT_OF(kHtmlBlocks); index++) {
+        const char* start = kHtmlBlocks[index].start;
+        int32 startLength = strlen(start);
+        if (length < startLength || strncasecmp(line, start, startLength) != 0) {
+            continue;
+        }
+        // tag names of type 1 must end right there
+        char next = startLength < length ? line[startLength] : '\n';
+        if (index < 4 && next != ' ' && next != '\t' && next != '>' && next != '\n' && next != '\r') {
+            continue;
+        }
+        return kHtmlBlocks[index].end;
+    }
+    // type 4, a declaration like <!DOCTYPE
+    if (length > 2 && line[0] == '<' && line[1] == '!' && isalpha((uint8) line[2])) {
+        return ">";
+    }
+    return NULL;
+}
+
+static bool ContainsMarker(const char* line, int32 length, const char* marker) {
+    int32 markerLength = strlen(marker);
+    for (int32 pos = 0; pos + markerLength <= length; pos++) {
+        if (strncasecmp(line + pos, marker, markerLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * whether a line after a blank line surely starts a new top level block. indented lines may continue
+ * a list item or indented code, list items may continue a loose list.
+ */
+static bool StartsTopLevelBlock(const char* line, int32 length) {
+    char c = line[0];
+    if (c == ' ' || c == '\t') {
+        return false;
+    }
+    char next = length > 1 ? line[1] : '\n';
+    if ((c == '-' || c == '+' || c == '*') && (next == ' ' || next == '\t' || next == '\n' || next == '\r')) {
+        return false;
+    }
+    int32 digits = 0;
+    while (digits < length && digits < 10 && isdigit((uint8) line[digits])) {
+        digits++;
+    }
+    if (digits > 0 && digits < length && (line[digits] == '.' || line[digits] == ')')) {
+        return false;
+    }
+    return true;
+}
+
+int32 DocumentScanner::FindWindowEnd(const char* text, int32 size) {
+    int32 lastBoundary = -1;
+    int32 lastLineEnd = -1;
+    int32 blankEnd = -1;        // after a blank line that ends a block if the next line starts a new one
+    char fenceChar = 0;
+    int32 fenceLength = 0;
+    const char* htmlEnd = NULL;
+
+    for (int32 lineStart = 0; lineStart < size; ) {
+        const char* eol = static_cast<const char*>(memchr(text + lineStart, '\n', size - lineStart));
+        if (eol == NULL) {
+            break;  // incomplete line, belongs to the next window
+        }
+        int32 lineEnd = eol - text + 1;
+
+        bool blank = true;
+        for (int32 blankPos = lineStart; blankPos < lineEnd - 1 && blank; blankPos++) {
+            blank = (text[blankPos] == ' ' || text[blankPos] == '\t' || text[blankPos] == '\r');
+        }
+        if (!blank && blankEnd > 0) {
+            if (StartsTopLevelBlock(text + lineStart, lineEnd - lineStart)) {
+                lastBoundary = blankEnd;
+            }
+            blankEnd = -1;
+        }
+
+        // skip up to 3 spaces of indentation as allowed for fences and HTML blocks
+        int32 pos = lineStart;
+        while (pos < lineEnd && pos - lineStart < 3 && text[pos] == ' ') {
+            pos++;
+        }
+        char c = text[pos];
+        if (htmlEnd != NULL) {
+            if (ContainsMarker(text + lineStart, lineEnd - lineStart, htmlEnd)) {
+                htmlEnd = NULL;
+            }
+        } else if (c == '`' || c == '~') {
+            int32 run = 0;
+            while (pos + run < lineEnd && text[pos + run] == c) {
+                run++;
+            }
+            if (run >= 3) {
+                if (fenceChar == 0) {
+                    fenceChar = c;
+                    fenceLength = run;
+                } else if (c == fenceChar && run >= fenceLength) {
+                    fenceChar = 0;
+                }
+            }
+        } else if (fenceChar == 0) {
+            htmlEnd = HtmlBlockEnd(text + pos, lineEnd - pos);
+            if (htmlEnd != NULL && ContainsMarker(text + pos + 1, lineEnd - pos - 1, htmlEnd)) {
+                htmlEnd = NULL;     // ends on its first line
+            }
+            if (blank) {
+                blankEnd = lineEnd;
+            }
+        }
+        lastLineEnd = lineEnd;
+        lineStart = lineEnd;
+    }
+
+    // no blank line in the whole window (e.g. a huge fenced block): fall back to a line boundary
+    if (lastBoundary > 0) {
+        return lastBoundary;
+    }
+    if (lastLineEnd > 0) {
+        printf("DocumentScanner: no block boundary inside window, splitting at line end %d.\n", lastLineEnd);
+        return lastLineEnd;
+    }
+    return size;
+}
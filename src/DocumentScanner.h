@@ -0,0 +1,66 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * drives md4c over consecutive windows of a document of any size, so outline, indexing and search
+ * also work on files far beyond the 32 bit offsets of md4c and BTextView.
+ * windows end after a blank line followed by a new top level block, outside of fenced code and HTML
+ * blocks, so blocks are not cut in half, and all markup is rebased to 64 bit document offsets.
+ * note that link reference definitions only resolve within the window they are defined in.
+ */
+#pragma once
+
+#include <DataIO.h>
+#include <functional>
+#include <SupportDefs.h>
+#include <vector>
+
+#include "HeadingIndex.h"
+#include "MarkdownParser.h"
+#include "TaskScheduler.h"
+
+using namespace std;
+
+/**
+ * receives the markup of one window, with text holding the window content starting at textOffset.
+ * return false to stop scanning.
+ */
+typedef function<bool(markup_map* markupMap, const char* text, int64 textOffset, int32 size)> window_visitor;
+
+class DocumentScanner {
+
+public:
+                        DocumentScanner(BPositionIO* source, int32 windowSize = kDefaultWindowSize);
+    virtual             ~DocumentScanner();
+
+    int64               Size();
+
+    /**
+     * parses the document window by window from start, which must be a block boundary,
+     * until the window containing end was visited.
+     */
+    status_t            Scan(window_visitor visit, int64 start = 0, int64 end = INT64_MAX,
+                             const CancelToken& token = CancelToken());
+
+    /**
+     * collects all headings of the document into index.
+     */
+    status_t            BuildOutline(HeadingIndex* index, const CancelToken& token = CancelToken());
+    /**
+     * finds up to maxResults occurrences of pattern and returns their document offsets.
+     */
+    status_t            Find(const char* pattern, vector<int64>* results, int32 maxResults = INT32_MAX,
+                             const CancelToken& token = CancelToken());
+
+    /**
+     * returns the length of the part of text that ends at a safe block boundary.
+     */
+    static int32        FindWindowEnd(const char* text, int32 size);
+
+    static const int32  kDefaultWindowSize = 8 * 1024 * 1024;
+
+private:
+    BPositionIO*        fSource;
+    int32               fWindowSize;
+    MarkdownParser*     fParser;
+};
@@ -8,17 +8,42 @@
 #include <GradientLinear.h>
 #include <Messenger.h>
 #include <Polygon.h>
+#include <random>
 #include <Region.h>
 #include <ScrollView.h>
 #include <stdio.h>
+#include <string.h>
 #include <Window.h>
 
 #include "EditorTextView.h"
 #include "Messages.h"
 #include "MessageUtil.h"
+#include "RevisionStore.h"
+#include "TaskMessenger.h"
 
 using namespace std;
 
+// local edits are sent this often while sharing
+static const bigtime_t kSendInterval = 50000;
+// suggested in the context menu
+static const int32 kKeywordCount = 8;
+
+static int64 LineStartAt(const char* text, int64 offset) {
+    while (offset > 0 && text[offset - 1] != '\n') {
+        offset--;
+    }
+    return offset;
+}
+
+static void MoveOffset(int32* offset, int32 editOffset, int32 removed, int32 inserted) {
+    // offsets in replaced text move to its start
+    if (*offset >= editOffset + removed) {
+        *offset += inserted - removed;
+    } else if (*offset > editOffset) {
+        *offset = editOffset;
+    }
+}
+
 EditorTextView::EditorTextView(StatusBar *statusBar, BHandler *editorHandler)
 : BTextView("editor_text_view")
 {
@@ -34,32 +59,128 @@ EditorTextView::EditorTextView(StatusBar *statusBar, BHandler *editorHandler)
     fStatusBar = statusBar;
     fEditorHandler = editorHandler;
 
-    // setup fonts
-    fTextFont = new BFont(be_plain_font);
-    fLinkFont = new BFont(be_plain_font);
-    fCodeFont = new BFont(be_fixed_font);
+    // setup theme, styles are resolved lazily per markup context
+    fStyleResolver = new StyleResolver(Theme::DefaultTheme(), be_plain_font, be_fixed_font);
 
     // setup markdown syntax styler
     fMarkdownParser = new MarkdownParser();
     fMarkdownParser->Init();
-
-    fTextHighlights = new map<int32, text_highlight*>();
+    fMarkupIndex = new MarkupIndex();
+
+    fTextNormalizer = new TextNormalizer();
+    fHeadingIndex = new HeadingIndex();
+    fBoundaryIndex = new BoundaryIndex();
+
+    fTextHighlights = new map<int64, text_highlight*>();
+    fLongestHighlight = 0;
+
+    fPagedDocument = NULL;
+    fWindowStart = 0;
+    fLoadingWindow = false;
+    fSplicing = false;
+    fCompareVersion = 0;
+    fTextVersion = 0;
+    fMergeVersion = 0;
+
+    fSharedDocument = NULL;
+    fRelayConnection = NULL;
+    fSendRunner = NULL;
+    fIntegrating = false;
+
+    fRelatedNotes = NULL;
+    RelatedNotesIndex::ClearSignature(&fSignature);
+    fDirtyStart = INT64_MAX;
+    fDirtyEnd = -1;
 }
 
 EditorTextView::~EditorTextView() {
     RemoveSelf();
 
     delete fMarkdownParser;
-    delete fTextFont;
-    delete fLinkFont;
-    delete fCodeFont;
-
+    delete fMarkupIndex;
+    delete fTextNormalizer;
+    delete fHeadingIndex;
+    delete fBoundaryIndex;
+    delete fStyleResolver;
+    delete fPagedDocument;
+
+    fCompareTask.Cancel();
+    fMergeTask.Cancel();
+    StopSharing();
     fTextHighlights->clear();
     delete fTextHighlights;
 }
 
 void EditorTextView::MessageReceived(BMessage* message) {
     switch (message->what) {
+        case MSG_DIFF_READY:
+        {
+            // the document may have changed since the comparison started
+            if (message->GetUInt32("version", 0) != fCompareVersion) {
+                break;
+            }
+            const void* data;
+            ssize_t size;
+            if (message->FindData("changes", B_RAW_TYPE, &data, &size) == B_OK) {
+                const diff_change* changes = static_cast<const diff_change*>(data);
+                fDiffChanges.assign(changes, changes + size / sizeof(diff_change));
+            }
+            printf("showing %zu changes.\n", fDiffChanges.size());
+            ShowComparison();
+            break;
+        }
+        case MSG_MERGE_READY:
+        {
+            if (message->GetUInt32("merge", 0) != fMergeVersion) {
+                break;
+            }
+            if (message->GetUInt32("version", 0) != fTextVersion) {
+                // edited while merging, so merge into the current text again
+                MergeFileText();
+                break;
+            }
+            ApplyMerge(message);
+            break;
+        }
+        case MSG_SESSION_JOINED:
+        {
+            if (IsSessionMessage(message)) {
+                JoinSession(message);
+            }
+            break;
+        }
+        case MSG_REMOTE_OPS:
+        {
+            const void* data;
+            ssize_t size;
+            if (!IsSessionMessage(message) || message->FindData("ops", B_RAW_TYPE, &data, &size) != B_OK) {
+                break;
+            }
+            vector<shared_edit> edits;
+            if (fSharedDocument->Integrate(static_cast<const uint8*>(data), size, &edits) == B_OK) {
+                ApplySharedEdits(edits);
+            }
+            break;
+        }
+        case MSG_SEND_OPS:
+        {
+            vector<uint8> ops;
+            if (fSharedDocument != NULL && fSharedDocument->TakeLocalOps(&ops)) {
+                status_t status = fRelayConnection->SendOps(ops);
+                if (status != B_OK) {
+                    printf("could not send edits to the session: %s\n", strerror(status));
+                }
+            }
+            break;
+        }
+        case MSG_SESSION_LEFT:
+        {
+            if (IsSessionMessage(message)) {
+                printf("left the session, the relay went away.\n");
+                StopSharing();
+            }
+            break;
+        }
         case MSG_INSERT_ENTITY:
         {
             printf("TV: insert entity:\n");
@@ -77,32 +198,515 @@ void EditorTextView::MessageReceived(BMessage* message) {
 }
 
 void EditorTextView::SetText(const char* text, const text_run_array* runs) {
+    delete fPagedDocument;
+    fPagedDocument = NULL;
+    fWindowStart = 0;
+
     ClearHighlights();
+    CancelMerge();
+    StopSharing();
+    fMarkdownParser->ClearTextInfo();
+    fMarkupIndex->Clear();
     BTextView::SetText(text, runs);
-    MarkupText(0, TextLength());
+    fTextNormalizer->Clear();
+    fBaseText.SetTo(Text(), TextLength());
+    MarkupText();
     UpdateStatus();
 }
 
-void EditorTextView::SetText(BFile* file, int32 offset, size_t size) {
+status_t EditorTextView::SetText(BPositionIO* file, int32 offset, size_t size) {
+    delete fPagedDocument;
+    fPagedDocument = NULL;
+    fWindowStart = 0;
+
     ClearHighlights();
-    BTextView::SetText(file, offset, size);
-    MarkupText(offset, TextLength());
+    CancelMerge();
+    StopSharing();
+
+    // read raw file content and normalize line endings and BOM before md4c and the view get to see it
+    BString textStr;
+    char* text = textStr.LockBuffer(size);
+    if (text == NULL) {
+        return B_NO_MEMORY;
+    }
+    ssize_t bytesRead = file->ReadAt(offset, text, size);
+    if (bytesRead < 0) {
+        textStr.UnlockBuffer(0);
+        printf("could not read file: %s\n", strerror(bytesRead));
+        return bytesRead;
+    }
+    // use a fresh normalizer so the edit hooks triggered by SetText don't shift the new mapping
+    TextNormalizer normalizer;
+    int32 textSize = normalizer.Normalize(text, bytesRead);
+    textStr.UnlockBuffer(textSize);
+
+    fMarkdownParser->ClearTextInfo();
+    fMarkupIndex->Clear();
+    BTextView::SetText(textStr.String(), textSize);
+    *fTextNormalizer = normalizer;
+    fBaseText = textStr;
+
+    MarkupText();
+    UpdateStatus();
+    return B_OK;
+}
+
+status_t EditorTextView::SaveText(BFile* file) {
+    if (fPagedDocument != NULL) {
+        return fPagedDocument->Save(file);
+    }
+    BString fileText;
+    status_t result = fTextNormalizer->Denormalize(Text(), TextLength(), &fileText);
+    if (result != B_OK) {
+        return result;
+    }
+
+    ssize_t written = file->WriteAt(0, fileText.String(), fileText.Length());
+    if (written < 0) {
+        return written;
+    }
+    result = file->SetSize(fileText.Length());
+    if (result == B_OK) {
+        fBaseText.SetTo(Text(), TextLength());
+    }
+    return result;
+}
+
+status_t EditorTextView::ReloadText(BPositionIO* file, off_t size) {
+    if (fPagedDocument != NULL) {
+        // paged documents are written through their mapping, there is no base text to merge with
+        return B_NOT_SUPPORTED;
+    }
+    BString fileText;
+    char* text = fileText.LockBuffer(size);
+    ssize_t bytesRead = file->ReadAt(0, text, size);
+    if (bytesRead < 0) {
+        fileText.UnlockBuffer(0);
+        printf("could not read changed file: %s\n", strerror(bytesRead));
+        return bytesRead;
+    }
+    TextNormalizer normalizer;
+    fileText.UnlockBuffer(normalizer.Normalize(text, bytesRead));
+
+    // saving changes the file as well
+    CancelMerge();
+    if (fileText == fBaseText) {
+        return B_OK;
+    }
+    fFileText = fileText;
+    fFileNormalizer = normalizer;
+    MergeFileText();
+    return B_OK;
+}
+
+void EditorTextView::MergeFileText() {
+    BString base(fBaseText);
+    BString fileText(fFileText);
+    BString text(Text(), TextLength());
+    vector<int64> blockStarts;
+    GetBlockStarts(&blockStarts);
+
+    uint32 version = fTextVersion;
+    uint32 merge = fMergeVersion;
+    fMergeTask.Cancel();
+    fMergeTask = TaskMessenger(BMessenger(this)).Submit(TASK_PRIORITY_DOCUMENT,
+        [base, text, fileText, blockStarts, version, merge](const CancelToken& token) -> BMessage* {
+            bigtime_t startTime = system_time();
+            vector<diff_block> baseBlocks, blocks, fileBlocks;
+            BlockDiff::GetBlocks(base.String(), base.Length(), &baseBlocks);
+            BlockDiff::GetBlocks(text.String(), text.Length(), blockStarts, &blocks);
+            if (token.IsCanceled()) {
+                return NULL;
+            }
+            BlockDiff::GetBlocks(fileText.String(), fileText.Length(), &fileBlocks);
+            if (token.IsCanceled()) {
+                return NULL;
+            }
+            vector<diff_change> changes, fileChanges;
+            BlockDiff::Diff(base.String(), baseBlocks, text.String(), blocks, &changes);
+            BlockDiff::Diff(base.String(), baseBlocks, fileText.String(), fileBlocks, &fileChanges);
+
+            vector<merge_edit> edits;
+            BString insertions;
+            int32 conflicts = BlockDiff::Merge(base.String(), base.Length(), text.String(), changes,
+                fileText.String(), fileChanges, &edits, &insertions);
+            printf("merged %d file bytes in %" B_PRId64 " ms.\n", fileText.Length(),
+                (system_time() - startTime) / 1000);
+
+            BMessage* message = new BMessage(MSG_MERGE_READY);
+            message->AddUInt32("merge", merge);
+            message->AddUInt32("version", version);
+            message->AddBool("local", !changes.empty());
+            message->AddInt32("conflicts", conflicts);
+            if (!edits.empty()) {
+                message->AddData("edits", B_RAW_TYPE, edits.data(), edits.size() * sizeof(merge_edit), false);
+                message->AddData("text", B_RAW_TYPE, insertions.String(), insertions.Length(), false);
+            }
+            return message;
+        });
+}
+
+void EditorTextView::CancelMerge() {
+    fMergeTask.Cancel();
+    fMergeVersion++;
+    fFileText = "";
+}
+
+void EditorTextView::ApplyMerge(BMessage* message) {
+    const void* data;
+    ssize_t size;
+    vector<merge_edit> edits;
+    if (message->FindData("edits", B_RAW_TYPE, &data, &size) == B_OK) {
+        const merge_edit* merged = static_cast<const merge_edit*>(data);
+        edits.assign(merged, merged + size / sizeof(merge_edit));
+    }
+    const char* insertions = NULL;
+    if (message->FindData("text", B_RAW_TYPE, &data, &size) == B_OK) {
+        insertions = static_cast<const char*>(data);
+    }
+
+    int32 selectionStart, selectionEnd;
+    GetSelection(&selectionStart, &selectionEnd);
+    int32 top = OffsetAt(Bounds().LeftTop());
+
+    // comparisons are of the text before
+    ClearComparison();
+    // edits from the end on keep the earlier offsets valid
+    for (auto edit = edits.rbegin(); edit != edits.rend(); edit++) {
+        SpliceText(edit->offset, edit->removed, insertions + edit->textOffset, edit->textLength);
+        MoveOffset(&selectionStart, edit->offset, edit->removed, edit->textLength);
+        MoveOffset(&selectionEnd, edit->offset, edit->removed, edit->textLength);
+        MoveOffset(&top, edit->offset, edit->removed, edit->textLength);
+    }
+    if (!message->GetBool("local")) {
+        // the text is the file text now, so are its line endings
+        *fTextNormalizer = fFileNormalizer;
+    }
+    fBaseText = fFileText;
+    CancelMerge();
+
+    Select(selectionStart, selectionEnd);
+    ScrollTo(BPoint(Bounds().left, PointAt(top).y));
+    UpdateStatus();
+    printf("took over %zu changes of the file, %d conflicts.\n", edits.size(), message->GetInt32("conflicts", 0));
+}
+
+void EditorTextView::GetBlockBoundaries(vector<int64>* boundaries) {
+    boundaries->clear();
+    const char* text = Text();
+    int32 depth = 0;
+
+    MarkupIndex::Reader reader(fMarkupIndex);
+    reader.Snapshot()->ForEach(0, INT64_MAX, [&](int64 offset, const markup_record& record) {
+        if (record.markupClass == MD_BLOCK_BEGIN) {
+            // top level blocks are the children of the document
+            if (depth == 1) {
+                int64 lineStart = LineStartAt(text, offset);
+                int64 fileOffset = (fPagedDocument != NULL ? fWindowStart + lineStart
+                                                           : fTextNormalizer->ToFileOffset(lineStart));
+                if (boundaries->empty() || boundaries->back() < fileOffset) {
+                    boundaries->push_back(fileOffset);
+                }
+            }
+            depth++;
+        } else if (record.markupClass == MD_BLOCK_END) {
+            depth--;
+        }
+        return true;
+    });
+}
+
+void EditorTextView::GetSignature(minhash_signature* signature) {
+    UpdateBlockIndex();
+    *signature = fSignature;
+}
+
+void EditorTextView::GetKeywords(int32 count, vector<BString>* keywords) {
+    int32 start, end;
+    GetSelection(&start, &end);
+    vector<term_count> terms;
+    if (start != end) {
+        // the normal text of the selection, a run overlapping its start begins in the same block
+        UpdateBlockIndex();
+        int64 scanStart = start;
+        auto block = fIndexedBlocks.upper_bound(start);
+        if (block != fIndexedBlocks.begin() && (--block)->second.end > start) {
+            scanStart = block->first;
+        }
+        const char* text = Text();
+        BString selectedText;
+        MarkupIndex::Reader reader(fMarkupIndex);
+        reader.Snapshot()->ForEach(scanStart, end, [&](int64 offset, const markup_record& record) {
+            if (record.markupClass == MD_TEXT && record.markupType.text_type == MD_TEXT_NORMAL) {
+                int64 runStart = max(offset, (int64) start);
+                int64 runEnd = min(offset + record.length, (int64) end);
+                if (runStart < runEnd) {
+                    selectedText << ' ';
+                    selectedText.Append(text + runStart, runEnd - runStart);
+                }
+            }
+            return true;
+        });
+        RelatedNotesIndex::GetTerms(selectedText.String(), selectedText.Length(), &terms);
+    } else {
+        UpdateBlockIndex();
+        terms.reserve(fNoteTerms.size());
+        for (auto& entry : fNoteTerms) {
+            terms.push_back(entry.second);
+        }
+    }
+
+    if (fRelatedNotes != NULL) {
+        fRelatedNotes->GetKeywords(terms, count, keywords);
+        return;
+    }
+    // w/o the vault words are only weighed by how often they occur
+    sort(terms.begin(), terms.end(), [](const term_count& term, const term_count& other) {
+        return term.count > other.count;
+    });
+    keywords->clear();
+    for (int32 index = 0; index < count && index < (int32) terms.size(); index++) {
+        keywords->push_back(terms[index].word);
+    }
+}
+
+void EditorTextView::ClearBlockIndex() {
+    // signatures and terms are kept by hash until the update, blocks found again are not signed again
+    for (auto& entry : fBlockIndex) {
+        entry.second.occurrences = 0;
+        entry.second.merged = false;
+        fChangedBlocks.insert(entry.first);
+    }
+    fNoteTerms.clear();
+    fIndexedBlocks.clear();
+    RelatedNotesIndex::ClearSignature(&fSignature);
+    fDirtyStart = 0;
+    fDirtyEnd = TextLength();
+}
+
+void EditorTextView::ShiftBlockIndex(int64 start, int64 end, int64 delta) {
+    // blocks touching the edit are dropped and indexed again with their new text, later ones move
+    int64 dirtyStart = start;
+    int64 dirtyEnd = end + delta;
+    auto first = fIndexedBlocks.lower_bound(start);
+    if (first != fIndexedBlocks.begin() && prev(first)->second.end >= start) {
+        first--;
+    }
+    auto last = first;
+    for (; last != fIndexedBlocks.end() && last->first <= end; last++) {
+        dirtyStart = min(dirtyStart, last->first);
+        dirtyEnd = max(dirtyEnd, last->second.end + delta);
+        if (last->second.hasText) {
+            CountBlock(last->second.hash, -1);
+        }
+    }
+    vector<pair<int64, indexed_block>> shifted;
+    for (auto block = last; block != fIndexedBlocks.end(); block++) {
+        shifted.push_back({block->first + delta, {block->second.end + delta, block->second.hash,
+            block->second.hasText}});
+    }
+    fIndexedBlocks.erase(first, fIndexedBlocks.end());
+    fIndexedBlocks.insert(shifted.begin(), shifted.end());
+
+    // the range left by earlier edits moves with this one, where it overlaps it is covered anyway
+    if (fDirtyStart <= fDirtyEnd) {
+        if (fDirtyStart > end) {
+            fDirtyStart += delta;
+        }
+        if (fDirtyEnd > end) {
+            fDirtyEnd += delta;
+        }
+        dirtyStart = min(dirtyStart, fDirtyStart);
+        dirtyEnd = max(dirtyEnd, fDirtyEnd);
+    }
+    fDirtyStart = dirtyStart;
+    fDirtyEnd = dirtyEnd;
+}
+
+void EditorTextView::UpdateBlockIndex() {
+    if (fDirtyStart > fDirtyEnd) {
+        return;
+    }
+    // blocks between two edits are in the range as well
+    auto first = fIndexedBlocks.lower_bound(fDirtyStart);
+    auto last = fIndexedBlocks.upper_bound(fDirtyEnd);
+    for (auto block = first; block != last; block++) {
+        if (block->second.hasText) {
+            CountBlock(block->second.hash, -1);
+        }
+    }
+    fIndexedBlocks.erase(first, last);
+
+    // only the top level blocks in the range are hashed, blocks not seen before are signed and counted
+    const char* text = Text();
+    vector<pair<int64, int32>> runs;
+    uint64 hash = RevisionStore::kHashSeed;
+    int64 lastEnd = -1;
+    int64 blockStart = 0;
+    int32 depth = 0;
+
+    auto endBlock = [&](int64 blockEnd) {
+        fIndexedBlocks[blockStart] = {blockEnd, hash, !runs.empty()};
+        if (runs.empty()) {
+            return;
+        }
+        if (fBlockIndex.find(hash) == fBlockIndex.end()) {
+            BString blockText;
+            int64 runEnd = -1;
+            for (auto run : runs) {
+                if (run.first != runEnd) {
+                    blockText << ' ';
+                }
+                blockText.Append(text + run.first, run.second);
+                runEnd = run.first + run.second;
+            }
+            block_index& blockIndex = fBlockIndex[hash];
+            blockIndex.occurrences = 0;
+            blockIndex.merged = false;
+            RelatedNotesIndex::ClearSignature(&blockIndex.signature);
+            RelatedNotesIndex::Sign(blockText.String(), blockText.Length(), &blockIndex.signature);
+            RelatedNotesIndex::GetTerms(blockText.String(), blockText.Length(), &blockIndex.terms);
+        }
+        CountBlock(hash, 1);
+    };
+
+    MarkupIndex::Reader reader(fMarkupIndex);
+    reader.Snapshot()->ForEach(fDirtyStart, INT64_MAX, [&](int64 offset, const markup_record& record) {
+        bool block = (record.markupClass == MD_BLOCK_BEGIN || record.markupClass == MD_BLOCK_END)
+            && record.markupType.block_type != MD_BLOCK_DOC;
+        if (block && record.markupClass == MD_BLOCK_BEGIN) {
+            if (depth++ == 0) {
+                if (offset > fDirtyEnd) {
+                    return false;
+                }
+                blockStart = offset;
+                hash = RevisionStore::kHashSeed;
+                lastEnd = -1;
+                runs.clear();
+            }
+        } else if (block) {
+            if (depth > 0 && --depth == 0) {
+                endBlock(offset);
+            }
+        } else if (depth > 0 && record.markupClass == MD_TEXT && record.markupType.text_type == MD_TEXT_NORMAL) {
+            // runs of normal text are joined as in RelatedNotesIndex::IndexFile()
+            if (offset != lastEnd) {
+                hash = RevisionStore::HashBlock(" ", 1, hash);
+            }
+            hash = RevisionStore::HashBlock(text + offset, record.length, hash);
+            runs.push_back({offset, record.length});
+            lastEnd = offset + record.length;
+        }
+        return true;
+    });
+
+    // the note signature follows the blocks that came and went, minimums of blocks gone are searched again
+    bool stale[kMinHashCount] = {};
+    bool anyStale = false;
+    for (uint64 changed : fChangedBlocks) {
+        auto entry = fBlockIndex.find(changed);
+        if (entry == fBlockIndex.end() || entry->second.occurrences > 0) {
+            continue;
+        }
+        for (int32 index = 0; entry->second.merged && index < kMinHashCount; index++) {
+            if (entry->second.signature.values[index] == fSignature.values[index]) {
+                stale[index] = anyStale = true;
+            }
+        }
+        fBlockIndex.erase(entry);
+    }
+    if (anyStale) {
+        for (int32 index = 0; index < kMinHashCount; index++) {
+            if (!stale[index]) {
+                continue;
+            }
+            fSignature.values[index] = UINT32_MAX;
+            for (auto& entry : fBlockIndex) {
+                fSignature.values[index] = min(fSignature.values[index], entry.second.signature.values[index]);
+            }
+        }
+    }
+    for (uint64 changed : fChangedBlocks) {
+        auto entry = fBlockIndex.find(changed);
+        if (entry != fBlockIndex.end() && !entry->second.merged) {
+            RelatedNotesIndex::Merge(&fSignature, entry->second.signature);
+            entry->second.merged = true;
+        }
+    }
+    fChangedBlocks.clear();
+    fDirtyStart = INT64_MAX;
+    fDirtyEnd = -1;
+}
+
+void EditorTextView::CountBlock(uint64 hash, int32 delta) {
+    // the terms of the note are summed over all blocks, blocks with the same text count each time
+    block_index& blockIndex = fBlockIndex[hash];
+    blockIndex.occurrences += delta;
+    for (auto& term : blockIndex.terms) {
+        term_count& noteTerm = fNoteTerms[term.term];
+        noteTerm.term = term.term;
+        noteTerm.word = term.word;
+        noteTerm.count += delta * term.count;
+        if (noteTerm.count <= 0) {
+            fNoteTerms.erase(term.term);
+        }
+    }
+    fChangedBlocks.insert(hash);
+}
+
+void EditorTextView::SetDocument(PagedDocument* document) {
+    delete fPagedDocument;
+    fPagedDocument = document;
+    fBaseText = "";
+    CancelMerge();
+    StopSharing();
+
+    // paged documents are shown as is, line endings are not normalized
+    fTextNormalizer->Clear();
+    LoadWindow(fPagedDocument->PageIndexAt(0), 0);
     UpdateStatus();
 }
 
 // hook methods
 void EditorTextView::DeleteText(int32 start, int32 finish) {
-    ClearHighlights();
+    fTextVersion++;
+    if (fSharedDocument != NULL && !fIntegrating) {
+        fSharedDocument->LocalDelete(start, finish - start);
+    }
+    if (fLoadingWindow || fSplicing) {
+        BTextView::DeleteText(start, finish);
+        return;
+    }
+    if (fPagedDocument != NULL) {
+        fPagedDocument->Replace(fWindowStart + start, finish - start, NULL, 0);
+    }
+    ClearComparison();
+    ShiftHighlights(start, finish - start, 0);
+    fTextNormalizer->ShiftOffsets(start, start - finish);
     BTextView::DeleteText(start, finish);
-    MarkupText(start, finish);
+    MarkupEdit(start, finish - start, 0);
     UpdateStatus();
 }
 
 void EditorTextView::InsertText(const char* text, int32 length, int32 offset,
                                 const text_run_array* runs)
 {
+    fTextVersion++;
+    if (fSharedDocument != NULL && !fIntegrating) {
+        fSharedDocument->LocalInsert(offset, text, length);
+    }
+    if (fLoadingWindow || fSplicing) {
+        BTextView::InsertText(text, length, offset, runs);
+        return;
+    }
+    if (fPagedDocument != NULL) {
+        fPagedDocument->Replace(fWindowStart + offset, 0, text, length);
+    }
+    ClearComparison();
+    ShiftHighlights(offset, 0, length);
+    fTextNormalizer->ShiftOffsets(offset, length);
     BTextView::InsertText(text, length, offset, runs);
-    MarkupText(offset, offset + length);
+    MarkupEdit(offset, 0, length);
     UpdateStatus();
 }
 
@@ -125,14 +729,18 @@ void EditorTextView::MouseDown(BPoint where) {
         int32 offset = OffsetAt(where);
 
         if ((modifiers() & B_COMMAND_KEY) != 0) {
-            // highlight block
-            int32 begin, end;
-            fMarkdownParser->GetMarkupBoundariesAt(offset, &begin, &end, BLOCK, BOTH);
-            if (begin >= 0 && end > 0) {
-                printf("selecting text from %d - %d\n", begin, end);
-                Highlight(begin, end, NULL, &linkColor, false, true);
+            // select the innermost block, expanding and shrinking the selection goes on from there
+            vector<pair<int64, int64>> spans, blocks;
+            fMarkdownParser->GetEnclosingRanges(Text(), offset, offset, &spans, &blocks);
+            if (!blocks.empty()) {
+                printf("selecting text from %" B_PRId64 " - %" B_PRId64 "\n", blocks.front().first,
+                    blocks.front().second);
+                fSelectionHistory.assign(1, {offset, offset});
+                fExpandedSelection = blocks.front();
+                Select(fExpandedSelection.first, fExpandedSelection.second);
+                UpdateStatus();
             } else {
-                printf("got no boundaries for offset %d!\n", offset);
+                printf("got no block at offset %d!\n", offset);
             }
         } else {
             auto data = fMarkdownParser->GetMarkupStackAt(offset);
@@ -182,13 +790,33 @@ void EditorTextView::MouseDown(BPoint where) {
             new BMessage(msgCode), "label", "Category"), '4');
         contextMenu->AddItem(contextItem);
 
-        contextItem = new BMenuItem("Topic", MessageUtil::CreateBMessage(
-            new BMessage(msgCode), "label", "Topic"), '5');
-        contextMenu->AddItem(contextItem);
-
-        contextItem = new BMenuItem("Tag", MessageUtil::CreateBMessage(
-            new BMessage(msgCode), "label", "Tag"), '6');
-        contextMenu->AddItem(contextItem);
+        // topics and tags offer the keywords of the selection or document
+        bigtime_t startTime = system_time();
+        vector<BString> keywords;
+        GetKeywords(kKeywordCount, &keywords);
+        printf("suggesting %zu keywords took %" B_PRId64 " us.\n", keywords.size(), system_time() - startTime);
+
+        const char* metaLabels[] = { "Topic", "Tag" };
+        char shortcut = '5';
+        for (auto metaLabel : metaLabels) {
+            BMenu* labelMenu = contextMenu;
+            if (!keywords.empty()) {
+                labelMenu = new BMenu(metaLabel);
+                contextMenu->AddItem(labelMenu);
+            }
+            contextItem = new BMenuItem(metaLabel, MessageUtil::CreateBMessage(
+                new BMessage(msgCode), "label", metaLabel), shortcut++);
+            labelMenu->AddItem(contextItem);
+            if (keywords.empty()) {
+                continue;
+            }
+            labelMenu->AddSeparatorItem();
+            for (auto& keyword : keywords) {
+                labelMenu->AddItem(new BMenuItem(keyword.String(), MessageUtil::CreateBMessage(
+                    new BMessage(msgCode), "label", metaLabel, MSG_PROP_VALUE, keyword.String())));
+            }
+            labelMenu->SetTargetForItems(fEditorHandler);
+        }
 
         contextMenu->SetTargetForItems(fEditorHandler);
 
@@ -204,20 +832,45 @@ void EditorTextView::MouseMoved(BPoint where, uint32 code, const BMessage* dragM
 void EditorTextView::Draw(BRect updateRect) {
     BTextView::Draw(updateRect);
 
-    // redraw text highlights if any inside updateRect
-
-    // TODO: optimize later via smart map lookup
-    // int32 updateOffset = OffsetAt(updateRect.LeftTop());
-    // auto highlight = fTextHighlights->find(updateOffset); //todo: get nearest offsets to updateRect boundaries
+    // redraw text highlights if any inside updateRect, only those starting from the longest highlight before
+    // its first line up to its last line are looked at
+    int32 firstOffset = OffsetAt(BPoint(Bounds().left, updateRect.top));
+    int32 lastOffset = OffsetAt(BPoint(Bounds().right, updateRect.bottom));
 
-    for (auto highlight : *fTextHighlights) {
-        auto textHighlight = highlight.second;
-        if (textHighlight->region->Intersects(updateRect)) {
-            RedrawHighlight(textHighlight);
+    auto entry = fTextHighlights->lower_bound(firstOffset - fLongestHighlight);
+    for (; entry != fTextHighlights->end() && entry->first <= lastOffset; entry++) {
+        text_highlight* highlight = entry->second;
+        if (highlight->endOffset < firstOffset) {
+            continue;
+        }
+        if (highlight->region == NULL) {
+            highlight->region = new BRegion();
+            GetTextRegion(highlight->startOffset, highlight->endOffset, highlight->region);
+        }
+        if (highlight->region->Intersects(updateRect)) {
+            RedrawHighlight(highlight);
         }
     }
 }
 
+void EditorTextView::ScrollTo(BPoint where) {
+    BTextView::ScrollTo(where);
+
+    if (fPagedDocument == NULL || fLoadingWindow) {
+        return;
+    }
+    // move the window by one page once the top of the view passes the middle of a page,
+    // so scrolling back a bit does not move it back right away
+    int32 top = OffsetAt(Bounds().LeftTop());
+    int32 split = fPagedDocument->PageAt(fPagedDocument->PageIndexAt(fWindowStart)).length;
+
+    if (split < TextLength() && top >= split + (TextLength() - split) / 2) {
+        MoveWindow(1);
+    } else if (fWindowStart > 0 && top < split / 2) {
+        MoveWindow(-1);
+    }
+}
+
 void EditorTextView::HighlightSelection(const rgb_color *fgColor, const rgb_color *bgColor, bool generated, bool outline) {
     int32 startSelection, endSelection;
     GetSelection(&startSelection, &endSelection);
@@ -228,8 +881,105 @@ void EditorTextView::HighlightSelection(const rgb_color *fgColor, const rgb_colo
     Highlight(startSelection, endSelection, fgColor, bgColor, generated, outline);
 }
 
+void EditorTextView::SnapSelectionToWords() {
+    int32 start, end;
+    GetSelection(&start, &end);
+    int64 wordStart = start, wordEnd = end;
+    if (start == end || !fBoundaryIndex->SnapToWords(&wordStart, &wordEnd))
+        return;
+
+    Select(wordStart, wordEnd);
+}
+
+void EditorTextView::LabelSelection(const char* type, const char* value, const rgb_color* color) {
+    int32 start, end;
+    GetSelection(&start, &end);
+    if (start == end) {
+        printf("nothing to label.\n");
+        return;
+    }
+    if (value == NULL) {
+        value = "";
+    }
+    int32 label = 0;
+    for (; label < (int32) fHighlightLabels.size(); label++) {
+        if (fHighlightLabels[label].type == type && fHighlightLabels[label].value == value)
+            break;
+    }
+    if (label == (int32) fHighlightLabels.size()) {
+        fHighlightLabels.push_back({ type, value });
+    }
+    Highlight(start, end, NULL, color);
+
+    auto entry = fTextHighlights->find(start);
+    if (entry != fTextHighlights->end()) {
+        entry->second->label = label;
+    }
+}
+
+status_t EditorTextView::GetHighlights(highlight_set* highlights) {
+    highlights->labels.clear();
+    highlights->records.clear();
+    if (fPagedDocument != NULL) {
+        // highlights are only kept within the window
+        return B_NOT_SUPPORTED;
+    }
+    // only the labels still in use are kept
+    vector<int32> labelIndex(fHighlightLabels.size(), -1);
+    const char* text = Text();
+    for (auto entry : *fTextHighlights) {
+        text_highlight* highlight = entry.second;
+        if (highlight->label < 0) {
+            continue;
+        }
+        int32& label = labelIndex[highlight->label];
+        if (label < 0) {
+            label = highlights->labels.size();
+            highlights->labels.push_back(fHighlightLabels[highlight->label]);
+        }
+        highlight_record record;
+        record.offset = highlight->startOffset;
+        record.length = highlight->endOffset - highlight->startOffset;
+        record.label = label;
+        record.color = HighlightStore::PackColor(*highlight->bgColor);
+        record.flags = (highlight->generated ? HIGHLIGHT_GENERATED : 0) | (highlight->outline ? HIGHLIGHT_OUTLINE : 0);
+        record.fingerprint = HighlightStore::Fingerprint(text + record.offset, record.length);
+        highlights->records.push_back(record);
+    }
+    return B_OK;
+}
+
+void EditorTextView::SetHighlights(highlight_set* highlights) {
+    ClearHighlights();
+    fHighlightLabels = highlights->labels;
+    if (fPagedDocument != NULL) {
+        return;
+    }
+    bigtime_t startTime = system_time();
+    int32 dropped = HighlightStore::Anchor(Text(), TextLength(), highlights);
+
+    // records come sorted, so the map is built in one pass, regions are computed once drawn
+    rgb_color highColor = HighColor();
+    for (auto& record : highlights->records) {
+        text_highlight* highlight = new text_highlight;
+        highlight->startOffset = record.offset;
+        highlight->endOffset = record.offset + record.length;
+        highlight->generated = (record.flags & HIGHLIGHT_GENERATED) != 0;
+        highlight->outline = (record.flags & HIGHLIGHT_OUTLINE) != 0;
+        highlight->label = record.label;
+        highlight->region = NULL;
+        highlight->fgColor = new rgb_color(highColor);
+        highlight->bgColor = new rgb_color(HighlightStore::UnpackColor(record.color));
+        fTextHighlights->insert(fTextHighlights->end(), {highlight->startOffset, highlight});
+        fLongestHighlight = max(fLongestHighlight, (int64) record.length);
+    }
+    printf("restored %zu highlights, dropped %d no longer found, in %" B_PRId64 " us.\n",
+        highlights->records.size(), dropped, system_time() - startTime);
+    Invalidate();
+}
+
 void
-EditorTextView::Highlight(int32 startOffset, int32 endOffset,
+EditorTextView::Highlight(int64 startOffset, int64 endOffset,
                           const rgb_color *fgColor, const rgb_color *bgColor,
                           bool generated, bool outline)
 {
@@ -246,10 +996,25 @@ EditorTextView::Highlight(int32 startOffset, int32 endOffset,
 	if (startOffset >= endOffset)
 		return;
 
-    printf("Highlight: from %d - %d\n", startOffset, endOffset);
+    printf("Highlight: from %" B_PRId64 " - %" B_PRId64 "\n", startOffset, endOffset);
+
+    text_highlight *highlight = AddHighlight(startOffset, endOffset, fgColor, bgColor, generated, outline);
+    Invalidate(new BRegion(*highlight->region));
+
+    BMessage resizeMsg(B_WINDOW_RESIZED);
+    BRect windowBounds(Window()->Bounds());
+    resizeMsg.AddInt32("width", windowBounds.Width());
+    resizeMsg.AddInt32("height", windowBounds.Height());
+
+    fEditorHandler->MessageReceived(new BMessage(resizeMsg));
+}
 
+EditorTextView::text_highlight*
+EditorTextView::AddHighlight(int64 startOffset, int64 endOffset, const rgb_color *fgColor,
+                             const rgb_color *bgColor, bool generated, bool outline)
+{
 	BRegion selRegion;
-	GetTextRegion(startOffset, endOffset, &selRegion);
+	GetTextRegion((int32)startOffset, (int32)endOffset, &selRegion);
 
     text_highlight *highlight;
     auto savedHighlight = fTextHighlights->find(startOffset);
@@ -270,7 +1035,9 @@ EditorTextView::Highlight(int32 startOffset, int32 endOffset,
 
     highlight->startOffset = startOffset;
     highlight->endOffset   = endOffset;
+    highlight->label       = -1;
     highlight->region      = new BRegion(selRegion);
+    fLongestHighlight = max(fLongestHighlight, endOffset - startOffset);
 
     rgb_color hiCol = HighColor();
     rgb_color loCol = LowColor();
@@ -284,14 +1051,7 @@ EditorTextView::Highlight(int32 startOffset, int32 endOffset,
     highlight->generated   = generated;
     highlight->outline     = outline;
 
-    Invalidate(new BRegion(selRegion));
-
-    BMessage resizeMsg(B_WINDOW_RESIZED);
-    BRect windowBounds(Window()->Bounds());
-    resizeMsg.AddInt32("width", windowBounds.Width());
-    resizeMsg.AddInt32("height", windowBounds.Height());
-
-    fEditorHandler->MessageReceived(new BMessage(resizeMsg));
+    return highlight;
 }
 
 void EditorTextView::RedrawHighlight(text_highlight* highlight)
@@ -339,14 +1099,199 @@ void EditorTextView::RedrawHighlight(text_highlight* highlight)
     SetLowColor(oldLo);
 }
 
-void EditorTextView::ClearHighlights() {
-    for (auto highlight : *fTextHighlights) {
-        highlight.second = NULL;
+void EditorTextView::ClearHighlights(bool keepLabels) {
+    for (auto entry = fTextHighlights->begin(); entry != fTextHighlights->end(); ) {
+        if (keepLabels && entry->second->label >= 0) {
+            entry++;
+            continue;
+        }
+        DeleteHighlight(entry->second);
+        entry = fTextHighlights->erase(entry);
+    }
+    if (fTextHighlights->empty()) {
+        fLongestHighlight = 0;
     }
-    fTextHighlights->clear();
     Invalidate(Bounds());
 }
 
+void EditorTextView::CompareWith(BPositionIO* other, off_t size, const rgb_color* addedColor,
+                                 const rgb_color* removedColor) {
+    ClearComparison();
+    fDiffAddedColor = *addedColor;
+    fDiffRemovedColor = *removedColor;
+
+    BString otherText;
+    char* buffer = otherText.LockBuffer(size);
+    ssize_t bytesRead = other->ReadAt(0, buffer, size);
+    if (bytesRead < 0) {
+        otherText.UnlockBuffer(0);
+        printf("could not read text to compare with: %s\n", strerror(bytesRead));
+        return;
+    }
+    // paged documents are shown as is, all other text is compared with normalized line endings
+    BString text;
+    vector<int64> blockStarts;
+    if (fPagedDocument != NULL) {
+        otherText.UnlockBuffer(bytesRead);
+        off_t documentSize;
+        fPagedDocument->GetSize(&documentSize);
+        char* documentText = text.LockBuffer(documentSize);
+        text.UnlockBuffer(max(fPagedDocument->ReadAt(0, documentText, documentSize), (ssize_t)0));
+    } else {
+        TextNormalizer normalizer;
+        otherText.UnlockBuffer(normalizer.Normalize(buffer, bytesRead));
+        text.SetTo(Text(), TextLength());
+        // the blocks of the document are known already
+        GetBlockStarts(&blockStarts);
+    }
+
+    uint32 version = fCompareVersion;
+    bool paged = (fPagedDocument != NULL);
+    fCompareTask = TaskMessenger(BMessenger(this)).Submit(TASK_PRIORITY_DOCUMENT,
+        [text, otherText, blockStarts, paged, version](const CancelToken& token) -> BMessage* {
+            bigtime_t startTime = system_time();
+            vector<diff_block> blocks, otherBlocks;
+            if (paged) {
+                BlockDiff::GetBlocks(text.String(), text.Length(), &blocks);
+            } else {
+                BlockDiff::GetBlocks(text.String(), text.Length(), blockStarts, &blocks);
+            }
+            if (token.IsCanceled()) {
+                return NULL;
+            }
+            BlockDiff::GetBlocks(otherText.String(), otherText.Length(), &otherBlocks);
+            if (token.IsCanceled()) {
+                return NULL;
+            }
+            vector<diff_change> changes;
+            BlockDiff::Diff(otherText.String(), otherBlocks, text.String(), blocks, &changes);
+            printf("compared %d with %d bytes in %" B_PRId64 " ms.\n", text.Length(), otherText.Length(),
+                (system_time() - startTime) / 1000);
+
+            BMessage* message = new BMessage(MSG_DIFF_READY);
+            message->AddUInt32("version", version);
+            if (!changes.empty()) {
+                message->AddData("changes", B_RAW_TYPE, changes.data(), changes.size() * sizeof(diff_change), false);
+            }
+            return message;
+        });
+}
+
+void EditorTextView::ClearComparison() {
+    fCompareTask.Cancel();
+    fCompareVersion++;
+    if (!fDiffChanges.empty()) {
+        fDiffChanges.clear();
+        ClearHighlights(true);
+    }
+}
+
+void EditorTextView::ShowComparison() {
+    // only the changes within the window of paged documents can be shown
+    int64 windowEnd = fWindowStart + TextLength();
+    for (auto& change : fDiffChanges) {
+        if (change.newEnd < fWindowStart || change.newStart >= windowEnd) {
+            continue;
+        }
+        int64 start = max(change.newStart, fWindowStart) - fWindowStart;
+        int64 end = min(change.newEnd, windowEnd) - fWindowStart;
+        if (start < end) {
+            AddHighlight(start, end, NULL, &fDiffAddedColor, false, false);
+        } else if (start < TextLength()) {
+            // removed text has no extent in the document, so the char after it is marked
+            AddHighlight(start, start + 1, &fDiffRemovedColor, &fDiffRemovedColor, false, true);
+        }
+    }
+    Invalidate();
+}
+
+status_t EditorTextView::StartSharing(const char* host, uint16 port) {
+    if (fPagedDocument != NULL) {
+        return B_NOT_SUPPORTED;
+    }
+    StopSharing();
+
+    // client ids only need to differ between the editors of a session
+    uint32 client = max((uint32) random_device()(), (uint32) 1);
+    fSharedDocument = new SharedDocument(client);
+    fSharedDocument->SetText(Text(), TextLength());
+    fRelayConnection = new RelayConnection(BMessenger(this));
+    status_t status = fRelayConnection->Connect(host, port, client);
+    if (status != B_OK) {
+        StopSharing();
+    }
+    return status;
+}
+
+void EditorTextView::StopSharing() {
+    delete fSendRunner;
+    fSendRunner = NULL;
+    delete fRelayConnection;
+    fRelayConnection = NULL;
+    delete fSharedDocument;
+    fSharedDocument = NULL;
+}
+
+bool EditorTextView::IsSessionMessage(BMessage* message) {
+    // messages of an earlier session may still arrive
+    return fSharedDocument != NULL && message->GetUInt32("client", 0) == fSharedDocument->Client();
+}
+
+void EditorTextView::JoinSession(BMessage* message) {
+    if (message->GetBool("first")) {
+        // the others start from this text
+        vector<uint8> state;
+        fSharedDocument->EncodeState(&state);
+        fRelayConnection->SendOps(state);
+    } else {
+        // take over the text of the session, local edits since joining are dropped with it
+        fSharedDocument->Clear();
+        const void* data;
+        ssize_t size;
+        vector<shared_edit> edits;
+        if (message->FindData("ops", B_RAW_TYPE, &data, &size) == B_OK) {
+            fSharedDocument->Integrate(static_cast<const uint8*>(data), size, &edits);
+        }
+        BString text;
+        fSharedDocument->GetText(&text);
+        ClearComparison();
+        fIntegrating = true;
+        SpliceText(0, TextLength(), text.String(), text.Length());
+        fIntegrating = false;
+        Select(0, 0);
+        UpdateStatus();
+    }
+    printf("joined the session as client %08x, %s.\n", fSharedDocument->Client(),
+        message->GetBool("first") ? "sharing this note" : "took over the shared note");
+
+    BMessage send(MSG_SEND_OPS);
+    fSendRunner = new BMessageRunner(BMessenger(this), &send, kSendInterval);
+}
+
+void EditorTextView::ApplySharedEdits(const vector<shared_edit>& edits) {
+    if (edits.empty()) {
+        return;
+    }
+    int32 selectionStart, selectionEnd;
+    GetSelection(&selectionStart, &selectionEnd);
+    int32 top = OffsetAt(Bounds().LeftTop());
+
+    // each edit applies to the text left by the ones before
+    ClearComparison();
+    fIntegrating = true;
+    for (auto& edit : edits) {
+        SpliceText(edit.offset, edit.removed, edit.text.String(), edit.text.Length());
+        MoveOffset(&selectionStart, edit.offset, edit.removed, edit.text.Length());
+        MoveOffset(&selectionEnd, edit.offset, edit.removed, edit.text.Length());
+        MoveOffset(&top, edit.offset, edit.removed, edit.text.Length());
+    }
+    fIntegrating = false;
+
+    Select(selectionStart, selectionEnd);
+    ScrollTo(BPoint(Bounds().left, PointAt(top).y));
+    UpdateStatus();
+}
+
 void EditorTextView::UpdateStatus() {
     int32 start, end, line;
     line = CurrentLine();
@@ -438,7 +1383,7 @@ BMessage* EditorTextView::GetDocumentOutline(bool withDetails, bool withNames) {
             }
             if (addOffset) {
                 // reference to location inside text
-                outlineMsg->AddInt32("offset", item->offset);
+                outlineMsg->AddInt64("offset", item->offset);
                 addOffset = false;
             }
         }
@@ -446,273 +1391,788 @@ BMessage* EditorTextView::GetDocumentOutline(bool withDetails, bool withNames) {
     return outlineMsg;
 }
 
-// interaction with MarkupStyler - should become its own class later
-void EditorTextView::MarkupText(int32 start, int32 end) {
-    if (TextLength() == 0) {
+void EditorTextView::GetHeadingLabels(vector<BString>* labels) {
+    labels->clear();
+    labels->reserve(fHeadingIndex->CountHeadings());
+
+    for (auto heading : *fHeadingIndex->Headings()) {
+        BString label;
+        label.Append("######", heading.level) << " " << heading.title;
+        labels->push_back(label);
+    }
+}
+
+void EditorTextView::GoToHeading(int32 index) {
+    if (index < 0 || index >= fHeadingIndex->CountHeadings()) {
         return;
     }
-    int32 blockStart, blockEnd;
-    // extend to block offsets for start and end so markup can be determined and styled correctly
-    // since we have 2 possibly overlapping boundaries for block around start and end offset from edit,
-    // we need to use temp vars here and just take the first start boundary and the last end boundary.
-    int32 from, to;
-    if (start > 0) {
-        fMarkdownParser->GetMarkupBoundariesAt(start, &from, &to);
-        blockStart = from;
-    } else {
-        blockStart = 0;
+    int32 offset = (int32)fHeadingIndex->HeadingAt(index)->offset;
+    Select(offset, offset);
+    ScrollToSelection();
+    MakeFocus(true);
+    UpdateStatus();
+}
+
+void EditorTextView::ExpandSelection() {
+    int32 start, end;
+    GetSelection(&start, &end);
+    if (make_pair(start, end) != fExpandedSelection) {
+        // selected otherwise since the last expansion, so there is nothing to shrink back to
+        fSelectionHistory.clear();
     }
-    if (end < TextLength()) {
-        fMarkdownParser->GetMarkupBoundariesAt(end, &from, &to, BLOCK, END);
-        blockEnd = to;
-    } else {
-        blockEnd = TextLength();
+    vector<pair<int64, int64>> ranges;
+    GetEnclosingRanges(start, end, &ranges);
+
+    for (auto range : ranges) {
+        if (range.first <= start && range.second >= end && (range.first < start || range.second > end)) {
+            fSelectionHistory.push_back({start, end});
+            fExpandedSelection = range;
+            Select(range.first, range.second);
+            ScrollToSelection();
+            UpdateStatus();
+            return;
+        }
     }
-    int32 size = blockEnd - blockStart;
+}
 
-    printf("markup text %d - %d\n", blockStart, blockEnd);
-    // clear the map section affected by the parser update
-    fMarkdownParser->ClearTextInfo(start, end);
+void EditorTextView::ShrinkSelection() {
+    int32 start, end;
+    GetSelection(&start, &end);
+    if (fSelectionHistory.empty() || make_pair(start, end) != fExpandedSelection) {
+        fSelectionHistory.clear();
+        return;
+    }
+    fExpandedSelection = fSelectionHistory.back();
+    fSelectionHistory.pop_back();
+    Select(fExpandedSelection.first, fExpandedSelection.second);
+    ScrollToSelection();
+    UpdateStatus();
+}
 
-    BString textStr("", size);
-    char* text = textStr.LockBuffer(size);
-    GetText(blockStart, size, text);
-    textStr.UnlockBuffer();
+void EditorTextView::SelectSentence() {
+    int32 start, end;
+    GetSelection(&start, &end);
+    text_range sentence;
+    if (!fBoundaryIndex->GetSentenceAt(start, &sentence))
+        return;
 
-    // perform a partial or complete update of the text map
-    fMarkdownParser->Parse(text, size);
+    Select(sentence.start, sentence.end);
+    ScrollToSelection();
+    UpdateStatus();
+}
 
-    printf("\n*** parsing finished, now styling... ***\n");
+void EditorTextView::MoveToSentence(bool next) {
+    int32 start, end;
+    GetSelection(&start, &end);
+    text_range sentence;
+    bool found = next ? fBoundaryIndex->GetNextSentence(start, &sentence)
+                      : fBoundaryIndex->GetPreviousSentence(start, &sentence);
+    if (!found)
+        return;
 
-    // we need to use a stack for caching the last active block/span style to return to on BLOCK_END or SPAN_END,
-    // since we cannot simply "undo" the last style, as they might be stacked inside each other.
-    // see https://github.com/mity/md4c/wiki/Embedding-Parser%3A-Calling-MD4C#typical-implementation
-    BFont font(be_fixed_font);
-    rgb_color color(textColor);
-    stack<text_run> styleStack;
+    Select(sentence.start, sentence.start);
+    ScrollToSelection();
+    UpdateStatus();
+}
 
-    // process all text map items in the parsed text
-    for (auto info : *(fMarkdownParser->GetMarkupMap())) {
-        auto item = *info.second->begin();
-        // reset for text-only parts
-        if (info.second->size() == 1 && item->markup_class == MD_TEXT) {
-            font = *fTextFont;
-            color = textColor;
-        }
-        // process all markup stack items at this map offset
-        for (auto stackItem : *info.second) {
-            StyleText(stackItem, &styleStack, &font, &color);
+void EditorTextView::GetEnclosingRanges(int32 start, int32 end, vector<pair<int64, int64>>* ranges) {
+    ranges->clear();
+    const char* text = Text();
+    int32 length = TextLength();
+
+    // words found by the boundary index keep decimals and abbreviations whole, code falls back to BTextView
+    text_range word;
+    if (fBoundaryIndex->GetWordAt(start, &word)) {
+        ranges->push_back({word.start, word.end});
+    } else {
+        int32 wordStart, wordEnd;
+        FindWord(start, &wordStart, &wordEnd);
+        if (wordEnd > wordStart) {
+            ranges->push_back({wordStart, wordEnd});
         }
     }
+    vector<pair<int64, int64>> spans, blocks;
+    fMarkdownParser->GetEnclosingRanges(text, start, end, &spans, &blocks);
+    ranges->insert(ranges->end(), spans.begin(), spans.end());
+
+    // a sentence may lie inside a span or hold several, so both are ordered by size
+    text_range sentence;
+    if (fBoundaryIndex->GetSentenceAt(start, &sentence) && sentence.end >= end) {
+        ranges->push_back({sentence.start, sentence.end});
+    }
+    stable_sort(ranges->begin(), ranges->end(), [](const pair<int64, int64>& a, const pair<int64, int64>& b) {
+        return a.second - a.first < b.second - b.first;
+    });
+    ranges->insert(ranges->end(), blocks.begin(), blocks.end());
+
+    // sections, starting with the innermost one
+    for (int32 index = SectionIndexAt(start); index >= 0; index = fHeadingIndex->HeadingAt(index)->parent) {
+        int32 sectionStart, sectionEnd;
+        GetSectionRange(index, &sectionStart, &sectionEnd);
+        ranges->push_back({sectionStart, sectionEnd});
+    }
+    ranges->push_back({0, length});
+}
 
-    printf("DocumentOutline:\n");
-    GetDocumentOutline(true)->PrintToStream();
+int32 EditorTextView::SectionIndexAt(int32 offset) {
+    // the heading line holding offset may start before the heading's content
+    const char* text = Text();
+    const char* lineEnd = static_cast<const char*>(memchr(text + offset, '\n', TextLength() - offset));
+    return fHeadingIndex->FindHeadingIndex(lineEnd != NULL ? lineEnd - text : TextLength());
 }
 
-void EditorTextView::StyleText(text_data* markupData,
-                               stack<text_run> *styleStack,
-                               BFont* font, rgb_color* color) {
-    const char *typeInfo;
+void EditorTextView::GetSectionRange(int32 index, int32* start, int32* end) {
+    // from the heading line on up to the next heading of the same or a higher level
+    const heading_entry* heading = fHeadingIndex->HeadingAt(index);
+    *start = LineStartAt(Text(), heading->offset);
+    *end = TextLength();
+    if (heading->sectionEnd < fHeadingIndex->CountHeadings()) {
+        *end = LineStartAt(Text(), fHeadingIndex->HeadingAt(heading->sectionEnd)->offset);
+    }
+}
 
-    switch (markupData->markup_class) {
-        case MD_BLOCK_BEGIN:
-        case MD_SPAN_BEGIN: {
-            if (markupData->markup_class == MD_BLOCK_BEGIN) {
-                SetBlockStyle(markupData, font, color);
-            }
-            else {
-                SetSpanStyle(markupData, font, color);
-            }
-            text_run run;
-            run.color = *color;
-            run.font  = *font;
-            styleStack->push(text_run(run));
-            printf("> pushing %s style -> %zu runs.\n", MarkdownParser::GetMarkupClassName(markupData->markup_class),
-                styleStack->size());
-            break;
+void EditorTextView::MoveSection(bool down) {
+    int32 selectionStart, selectionEnd;
+    GetSelection(&selectionStart, &selectionEnd);
+    int32 index = SectionIndexAt(selectionStart);
+    if (index < 0) {
+        return;
+    }
+    const heading_entry* heading = fHeadingIndex->HeadingAt(index);
+    int32 sibling;
+    if (down) {
+        sibling = heading->sectionEnd;
+        if (sibling >= fHeadingIndex->CountHeadings() || fHeadingIndex->HeadingAt(sibling)->parent != heading->parent) {
+            return;
         }
-        case MD_BLOCK_END:
-        case MD_SPAN_END: {
-            if (!styleStack->empty()) {
-                text_run run = styleStack->top();
-                *font = run.font;
-                *color = run.color;
-
-                styleStack->pop();
-            }
-            printf("< popping %s style -> %zu runs.\n", MarkdownParser::GetMarkupClassName(markupData->markup_class),
-                styleStack->size());
-            break;
+    } else {
+        // the previous sibling is the outermost section ending right at this one
+        sibling = index - 1;
+        while (sibling >= 0 && fHeadingIndex->HeadingAt(sibling)->parent != heading->parent) {
+            sibling = fHeadingIndex->HeadingAt(sibling)->parent;
         }
-        case MD_TEXT: {         // here the styles set before are actually applied to rendered text
-            int32 start   = markupData->offset;
-            int32 end     = start + markupData->length;
-
-            // reset for text-only parts
-            if (styleStack->size() == 0) {
-                *font = *fTextFont;
-                *color = textColor;
-            }
-
-            SetTextStyle(markupData, font, color);
-            SetFontAndColor(start, end, font, B_FONT_ALL, color);
-
-            typeInfo = MarkdownParser::GetTextTypeName(markupData->markup_type.text_type);
-            printf("StyleText @%d - %d: applied style for class %s and type %s\n",
-                start, end, MarkdownParser::GetMarkupClassName(markupData->markup_class), typeInfo);
-
-            break;
+        if (sibling < 0) {
+            return;
         }
-        default:
-            break;
     }
+    if (Text()[TextLength() - 1] != '\n') {
+        // the last line needs a line break to end before the other section
+        Insert(TextLength(), "\n", 1);
+    }
+    int32 sectionStart, sectionEnd, siblingStart, siblingEnd;
+    GetSectionRange(index, &sectionStart, &sectionEnd);
+    GetSectionRange(sibling, &siblingStart, &siblingEnd);
+
+    int32 start  = min(sectionStart, siblingStart);
+    int32 middle = max(sectionStart, siblingStart);
+    int32 end    = max(sectionEnd, siblingEnd);
+    if (!SwapText(start, middle, end)) {
+        return;
+    }
+    // the section keeps its length, only its position changed
+    int32 length = sectionEnd - sectionStart;
+    int32 newStart = (down ? start + (end - middle) : start);
+    fSelectionHistory.clear();
+    Select(newStart, newStart + length);
+    ScrollToSelection();
+    UpdateStatus();
 }
 
-void EditorTextView::SetBlockStyle(text_data* markupInfo, BFont *font, rgb_color *color) {
-    MD_BLOCKTYPE blockType = markupInfo->markup_type.block_type;
-    const char* blockTypeName = MarkdownParser::GetBlockTypeName(blockType);
-
-    printf("> SetBlockStyle for %s\n", blockTypeName);
-
-    switch (blockType) {
-        case MD_BLOCK_CODE: {
-            *font = *fCodeFont;
-            *color = codeColor;
-            break;
+void EditorTextView::ChangeSectionLevel(int32 delta) {
+    int32 selectionStart, selectionEnd;
+    GetSelection(&selectionStart, &selectionEnd);
+    int32 index = SectionIndexAt(selectionStart);
+    if (index < 0) {
+        return;
+    }
+    const char* text = Text();
+    int32 last = fHeadingIndex->HeadingAt(index)->sectionEnd;
+
+    // collect the changed heading marks first, so the section is left alone if any heading can't change
+    vector<pair<int32, int32>> marks;
+    vector<BString> replacements;
+    for (int32 current = index; current < last; current++) {
+        const heading_entry* heading = fHeadingIndex->HeadingAt(current);
+        int32 level = heading->level + delta;
+        if (level < 1 || level > 6) {
+            printf("heading level %d of '%s' is out of range.\n", level, heading->title.String());
+            return;
         }
-        case MD_BLOCK_H: {
-            *font = fTextFont;
-            uint8 level;
-            BMessage *detail = markupInfo->detail;
-            if (detail == NULL) {
-                printf("    bogus markup, no detail found for H block!\n");
-            } else if (detail->FindUInt8("level", &level) == B_OK) {
-                float headerSizeFac = (7 - level) / 3.2;       // max 6 levels in markdown
-                font->SetSize(font->Size() * headerSizeFac);   // H1 = 2*normal size
-                font->SetFace(B_HEAVY_FACE);
-            }
-            *color = headerColor;
-            break;
+        // ATX headings have their level in the '#' chars before the content
+        int32 lineStart = LineStartAt(text, heading->offset);
+        int32 markEnd = heading->offset;
+        while (markEnd > lineStart && (text[markEnd - 1] == ' ' || text[markEnd - 1] == '\t')) {
+            markEnd--;
         }
-        case MD_BLOCK_QUOTE: {
-            *font = fTextFont;
-            font->SetFace(font->Face() | B_ITALIC_FACE);
-            *color = codeColor;
-            break;
+        int32 markStart = markEnd;
+        while (markStart > lineStart && text[markStart - 1] == '#') {
+            markStart--;
         }
-        case MD_BLOCK_HR: {
-            *font = *fTextFont;
-            *color = headerColor;
-            font->SetFace(font->Face() | B_LIGHT_FACE);
-            break;
+        if (markStart < markEnd) {
+            marks.push_back({markStart, markEnd});
+            replacements.push_back(BString().Append('#', level));
+            continue;
         }
-        case MD_BLOCK_HTML: {
-            *font = fCodeFont;
-            *color = codeColor;
-            break;
+        // setext headings have it in their underline, which only allows levels 1 and 2
+        const char* underline = static_cast<const char*>(memchr(text + heading->endOffset, '\n',
+            TextLength() - heading->endOffset));
+        char mark = (heading->level == 1 ? '=' : '-');
+        if (level > 2 || underline == NULL) {
+            printf("setext heading '%s' can't have level %d.\n", heading->title.String(), level);
+            return;
         }
-        case MD_BLOCK_UL: {
-            *font = fTextFont;
-            *color = textColor;
-            break;
+        markStart = strchr(underline, mark) - text;
+        markEnd = markStart;
+        while (markEnd < TextLength() && text[markEnd] == mark) {
+            markEnd++;
         }
-        case MD_BLOCK_OL: {
-            *font = fTextFont;
-            *color = textColor;
-            break;
+        marks.push_back({markStart, markEnd});
+        replacements.push_back(BString().Append(level == 1 ? '=' : '-', markEnd - markStart));
+    }
+
+    // edit from the last heading on, so the offsets of the earlier ones stay valid
+    int32 sectionStart, sectionEnd;
+    GetSectionRange(index, &sectionStart, &sectionEnd);
+    int64 publishStart = INT64_MAX;
+    int64 publishEnd = 0;
+    int32 totalDelta = 0;
+    for (int32 current = marks.size() - 1; current >= 0; current--) {
+        int32 offset = marks[current].first;
+        int32 removed = marks[current].second - offset;
+        const BString& replacement = replacements[current];
+        int32 editDelta = replacement.Length() - removed;
+
+        if (fPagedDocument != NULL) {
+            fPagedDocument->Replace(fWindowStart + offset, removed, replacement.String(), replacement.Length());
         }
-        case MD_BLOCK_LI: {
-            *font = fTextFont;
-            *color = linkColor;
-            break;
+        fTextNormalizer->ShiftOffsets(offset, -removed);
+        fTextNormalizer->ShiftOffsets(offset, replacement.Length());
+        ShiftHighlights(offset, removed, replacement.Length());
+        fSplicing = true;
+        Delete(offset, offset + removed);
+        Insert(offset, replacement.String(), replacement.Length());
+        fSplicing = false;
+
+        // only the heading and the block before it are parsed again
+        int64 start, end;
+        fMarkdownParser->UpdateBlocks(Text(), TextLength(), offset, removed, replacement.Length(), &start, &end);
+        fHeadingIndex->ShiftOffsets(start, end - editDelta, editDelta);
+        fHeadingIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), start, end - 1);
+        fBoundaryIndex->ShiftOffsets(start, end - editDelta, editDelta);
+        fBoundaryIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), start, end - 1);
+        ShiftBlockIndex(start, end - editDelta, editDelta);
+        ShiftStyleRuns(start, end - editDelta, editDelta);
+        RestyleBlocks(start, end);
+
+        publishStart = min(publishStart, start);
+        publishEnd = max(publishEnd + editDelta, end);
+        totalDelta += editDelta;
+        sectionEnd += editDelta;
+    }
+    if (!marks.empty()) {
+        fMarkupIndex->Publish(fMarkdownParser->GetMarkupMap(), publishStart, publishEnd, totalDelta);
+    }
+    fSelectionHistory.clear();
+    Select(sectionStart, sectionEnd);
+    UpdateStatus();
+}
+
+bool EditorTextView::SwapText(int32 start, int32 middle, int32 end) {
+    // both parts must consist of whole top level blocks for their markup to move along
+    if (!fMarkdownParser->IsBlockStart(start) || !fMarkdownParser->IsBlockStart(middle)
+        || (end < TextLength() && !fMarkdownParser->IsBlockStart(end))) {
+        printf("text %d - %d and %d - %d don't consist of whole blocks, not swapped.\n", start, middle, middle, end);
+        return false;
+    }
+    BString swapped;
+    swapped.Append(Text() + middle, end - middle).Append(Text() + start, middle - start);
+
+    // styles move with the text in the same splice, so nothing needs to be styled again
+    text_run_array* firstRuns = RunArray(start, middle);
+    text_run_array* secondRuns = RunArray(middle, end);
+    text_run_array* runs = AllocRunArray(firstRuns->count + secondRuns->count);
+    for (int32 run = 0; run < secondRuns->count; run++) {
+        runs->runs[run] = secondRuns->runs[run];
+    }
+    for (int32 run = 0; run < firstRuns->count; run++) {
+        runs->runs[secondRuns->count + run] = firstRuns->runs[run];
+        runs->runs[secondRuns->count + run].offset += end - middle;
+    }
+    FreeRunArray(firstRuns);
+    FreeRunArray(secondRuns);
+
+    if (fPagedDocument != NULL) {
+        fPagedDocument->Replace(fWindowStart + start, end - start, swapped.String(), swapped.Length());
+    }
+    fTextNormalizer->SwapRanges(start, middle, end);
+    fSplicing = true;
+    Delete(start, end);
+    Insert(start, swapped.String(), swapped.Length(), runs);
+    fSplicing = false;
+    FreeRunArray(runs);
+
+    // markup and everything keyed by offsets moves along, only the blocks at the seams are parsed again
+    vector<pair<int64, int64>> ranges;
+    fMarkdownParser->SwapRanges(Text(), TextLength(), start, middle, end, &ranges);
+    fHeadingIndex->SwapRanges(start, middle, end);
+    fBoundaryIndex->SwapRanges(start, middle, end);
+    ShiftBlockIndex(start, end, 0);
+    SwapStyleRuns(start, middle, end);
+    SwapHighlights(start, middle, end);
+
+    int64 publishStart = start;
+    int64 publishEnd = end;
+    for (auto range : ranges) {
+        fHeadingIndex->ShiftOffsets(range.first, range.second, 0);
+        fHeadingIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), range.first, range.second - 1);
+        fBoundaryIndex->ShiftOffsets(range.first, range.second, 0);
+        fBoundaryIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), range.first, range.second - 1);
+        ShiftBlockIndex(range.first, range.second, 0);
+        RestyleBlocks(range.first, range.second);
+        publishStart = min(publishStart, range.first);
+        publishEnd = max(publishEnd, range.second);
+    }
+    fMarkupIndex->Publish(fMarkdownParser->GetMarkupMap(), publishStart, publishEnd, 0);
+    return true;
+}
+
+void EditorTextView::SwapStyleRuns(int32 start, int32 middle, int32 end) {
+    auto first = fStyleRuns.lower_bound(start);
+    auto last  = fStyleRuns.lower_bound(end);
+    vector<pair<int32, style_run>> swapped;
+    for (auto run = first; run != last; run++) {
+        int32 shift = (run->first < middle ? end - middle : start - middle);
+        swapped.push_back({run->first + shift, {run->second.end + shift, run->second.styleId}});
+    }
+    fStyleRuns.erase(first, last);
+    fStyleRuns.insert(swapped.begin(), swapped.end());
+}
+
+void EditorTextView::SwapHighlights(int32 start, int32 middle, int32 end) {
+    // highlights within one part move along, those torn apart are dropped
+    vector<text_highlight*> moved;
+    for (auto entry = fTextHighlights->begin(); entry != fTextHighlights->end(); ) {
+        text_highlight* highlight = entry->second;
+        if (highlight->endOffset <= start || highlight->startOffset >= end) {
+            entry++;
+            continue;
         }
-        case MD_BLOCK_P: {
-            *font = fTextFont;
-            *color = textColor;
-            break;
+        entry = fTextHighlights->erase(entry);
+        bool first = (highlight->startOffset >= start && highlight->endOffset <= middle);
+        bool second = (highlight->startOffset >= middle && highlight->endOffset <= end);
+        if (!first && !second) {
+            DeleteHighlight(highlight);
+            continue;
         }
-        case MD_BLOCK_TABLE: {
-            *font = fCodeFont;
-            *color = codeColor;
-            break;
+        int32 shift = (first ? end - middle : start - middle);
+        highlight->startOffset += shift;
+        highlight->endOffset += shift;
+        moved.push_back(highlight);
+    }
+    for (auto highlight : moved) {
+        delete highlight->region;
+        highlight->region = NULL;
+        fTextHighlights->insert({highlight->startOffset, highlight});
+    }
+    Invalidate();
+}
+
+void EditorTextView::ShiftHighlights(int32 offset, int32 removed, int32 inserted) {
+    // highlights holding the replaced text grow or shrink with it, those cut by it are dropped and later ones
+    // move along. their regions are computed again when drawn
+    int32 delta = inserted - removed;
+    vector<text_highlight*> shifted;
+    auto entry = fTextHighlights->lower_bound(offset - fLongestHighlight);
+    while (entry != fTextHighlights->end()) {
+        text_highlight* highlight = entry->second;
+        if (highlight->endOffset <= offset) {
+            entry++;
+            continue;
+        }
+        delete highlight->region;
+        highlight->region = NULL;
+        if (highlight->startOffset <= offset && offset + removed <= highlight->endOffset
+            && highlight->startOffset < offset + removed) {
+            highlight->endOffset += delta;
+            if (highlight->endOffset > highlight->startOffset) {
+                fLongestHighlight = max(fLongestHighlight, highlight->endOffset - highlight->startOffset);
+                entry++;
+                continue;
+            }
+        }
+        entry = fTextHighlights->erase(entry);
+        if (highlight->startOffset < offset + removed) {
+            DeleteHighlight(highlight);
+            continue;
+        }
+        highlight->startOffset += delta;
+        highlight->endOffset += delta;
+        shifted.push_back(highlight);
+    }
+    // the highlights left start before the shifted ones
+    for (auto highlight : shifted) {
+        size_t count = fTextHighlights->size();
+        fTextHighlights->insert(fTextHighlights->end(), {highlight->startOffset, highlight});
+        if (fTextHighlights->size() == count) {
+            DeleteHighlight(highlight);
         }
-        default:
-            break;
     }
 }
 
-void EditorTextView::SetSpanStyle(text_data* markupInfo, BFont *font, rgb_color *color) {
-    MD_SPANTYPE spanType = markupInfo->markup_type.span_type;
-    const char* spanTypeName = MarkdownParser::GetSpanTypeName(spanType);
+void EditorTextView::DeleteHighlight(text_highlight* highlight) {
+    delete highlight->region;
+    delete highlight->fgColor;
+    delete highlight->bgColor;
+    delete highlight;
+}
 
-    printf("> SetSpanStyle for %s\n", spanTypeName);
+void EditorTextView::RestyleBlocks(int32 start, int32 end) {
+    ShiftStyleRuns(start, end, 0);
+    if (start > fFrontMatter.length && !fMarkdownParser->IsBlockStart(start)) {
+        // blocks using changed reference definitions were parsed as well, their containers are unknown here
+        fStyleRuns.clear();
+        StyleMarkup();
+        return;
+    }
+    // the range starts at a top level block, so only the document is open there
+    style_context context;
+    if (start > fFrontMatter.length) {
+        context.blockPath.push_back(MD_BLOCK_DOC);
+    }
+    StyleRange(start, end, &context);
+}
 
-    switch (spanType) {
-        case MD_SPAN_A:
-        case MD_SPAN_WIKILINK: {    // fallthrough
-            font->SetFace(font->Face() | B_UNDERSCORE_FACE);
-            *color = linkColor;
-            break;
+void EditorTextView::SpliceText(int32 offset, int32 removed, const char* text, int32 length) {
+    fTextNormalizer->ShiftOffsets(offset, -removed);
+    fTextNormalizer->ShiftOffsets(offset, length);
+    ShiftHighlights(offset, removed, length);
+    fSplicing = true;
+    if (removed > 0) {
+        Delete(offset, offset + removed);
+    }
+    if (length > 0) {
+        Insert(offset, text, length);
+    }
+    fSplicing = false;
+
+    int32 frontMatterLength = fFrontMatter.length;
+    if (offset < frontMatterLength || UpdateFrontMatter(offset) != frontMatterLength) {
+        MarkupText();
+        return;
+    }
+    // only the blocks touched are parsed and styled again, unlike typing this never restyles the whole text
+    int64 start, end;
+    int32 delta = length - removed;
+    fMarkdownParser->UpdateBlocks(Text(), TextLength(), offset, removed, length, &start, &end);
+    fMarkupIndex->Publish(fMarkdownParser->GetMarkupMap(), start, end, delta);
+    fHeadingIndex->ShiftOffsets(start, end - delta, delta);
+    fHeadingIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), start, end - 1);
+    fBoundaryIndex->ShiftOffsets(start, end - delta, delta);
+    fBoundaryIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), start, end - 1);
+    ShiftBlockIndex(start, end - delta, delta);
+    ShiftStyleRuns(start, end - delta, delta);
+    RestyleBlocks(start, end);
+}
+
+void EditorTextView::SetTheme(Theme* theme) {
+    // style IDs stay valid, so only re-apply the recorded runs with their new fonts and colors
+    fStyleResolver->SetTheme(theme);
+
+    for (auto run : fStyleRuns) {
+        ApplyStyle(run.first, run.second.end, run.second.styleId);
+    }
+    Invalidate();
+}
+
+void EditorTextView::ApplyStyle(int32 start, int32 end, uint16 styleId) {
+    const resolved_style* style = fStyleResolver->StyleAt(styleId);
+    SetFontAndColor(start, end, &style->font, B_FONT_ALL, &style->color);
+}
+
+void EditorTextView::GetBlockStarts(vector<int64>* starts) {
+    // front matter is a block of its own
+    fMarkdownParser->GetBlockStarts(starts);
+    if (fFrontMatter.length > 0) {
+        starts->insert(starts->begin(), fFrontMatter.length);
+    }
+}
+
+// interaction with MarkupStyler - should become its own class later
+void EditorTextView::MarkupText() {
+    // styling below covers the whole markup map, so the recorded runs are rebuilt as well
+    fStyleRuns.clear();
+
+    // front matter is metadata, not markdown, so keep it away from md4c
+    int32 frontMatterLength = UpdateFrontMatter(0);
+
+    printf("markup text %d - %d\n", frontMatterLength, TextLength());
+    fMarkdownParser->ClearTextInfo();
+    fMarkdownParser->ParseBlocks(Text(), TextLength(), frontMatterLength);
+
+    // make the markup visible to background readers
+    fMarkupIndex->Clear();
+    fMarkupIndex->Publish(fMarkdownParser->GetMarkupMap(), 0, TextLength());
+    fHeadingIndex->Clear();
+    fHeadingIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), 0, TextLength());
+    fBoundaryIndex->Clear();
+    fBoundaryIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), 0, TextLength());
+    ClearBlockIndex();
+
+    StyleMarkup();
+}
+
+void EditorTextView::MarkupEdit(int32 offset, int32 removed, int32 inserted) {
+    int32 frontMatterLength = fFrontMatter.length;
+    if (offset < frontMatterLength || UpdateFrontMatter(offset) != frontMatterLength) {
+        // the markdown text starts somewhere else now
+        MarkupText();
+        return;
+    }
+    // the block parser only parses the blocks touched by the edit again, markup after them is moved
+    int64 start, end;
+    int64 delta = inserted - removed;
+    bool leafOnly = fMarkdownParser->UpdateBlocks(Text(), TextLength(), offset, removed, inserted, &start, &end);
+
+    fMarkupIndex->Publish(fMarkdownParser->GetMarkupMap(), start, end, delta);
+    fHeadingIndex->ShiftOffsets(start, end - delta, delta);
+    fHeadingIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), start, end - 1);
+    fBoundaryIndex->ShiftOffsets(start, end - delta, delta);
+    fBoundaryIndex->Update(fMarkdownParser->GetMarkupMap(), Text(), start, end - 1);
+    ShiftBlockIndex(start, end - delta, delta);
+
+    ShiftStyleRuns(start, end - delta, delta);
+    if (!leafOnly) {
+        // only the blocks parsed again are styled again, like spliced text
+        RestyleBlocks(start, end);
+        return;
+    }
+    // only the inline content of a single paragraph changed, so only its text is styled again,
+    // starting from the blocks around it
+    vector<MD_BLOCKTYPE> containers;
+    fMarkdownParser->GetLeafContainers(&containers);
+    style_context context;
+    context.blockPath.assign(containers.begin(), containers.end());
+    StyleRange(start, end, &context);
+}
+
+void EditorTextView::ShiftStyleRuns(int32 start, int32 end, int32 delta) {
+    // runs from start to end of the old text are restyled, later ones move with the edit
+    auto first = fStyleRuns.lower_bound(start);
+    auto last  = fStyleRuns.lower_bound(end);
+    vector<pair<int32, style_run>> shifted;
+    for (auto run = last; run != fStyleRuns.end(); run++) {
+        shifted.push_back({run->first + delta, {run->second.end + delta, run->second.styleId}});
+    }
+    fStyleRuns.erase(first, fStyleRuns.end());
+    fStyleRuns.insert(shifted.begin(), shifted.end());
+}
+
+void EditorTextView::StyleMarkup() {
+    // the style context tracks the active block path and span set, which are resolved to a memoized style ID
+    // on each text item, see https://github.com/mity/md4c/wiki/Embedding-Parser%3A-Calling-MD4C#typical-implementation
+    style_context context;
+    StyleRange(0, INT32_MAX, &context);
+}
+
+void EditorTextView::StyleRange(int32 start, int32 end, style_context* context) {
+    markup_map* markupMap = fMarkdownParser->GetMarkupMap();
+
+    // process all text map items in the range
+    for (auto info = markupMap->lower_bound(start); info != markupMap->end() && info->first < end; info++) {
+        // process all markup stack items at this map offset
+        for (auto stackItem : *info->second) {
+            StyleText(stackItem, context);
         }
-        case MD_SPAN_IMG: {
-            font->SetFace(font->Face() | B_REGULAR_FACE);
-            *color = linkColor;
-            break;
+    }
+}
+
+int32 EditorTextView::UpdateFrontMatter(int32 start) {
+    // front matter is only changed by edits reaching into it, or closed by edits after an opening fence
+    if (start > fFrontMatter.length) {
+        bool opened = fFrontMatter.length == 0 && start <= FrontMatter::kMaxFrontMatterSize
+            && TextLength() >= 3 && strncmp(Text(), "---", 3) == 0;
+        if (!opened) {
+            return fFrontMatter.length;
         }
-        case MD_SPAN_CODE: {
-            font->SetFace(font->Face() | B_REGULAR_FACE);
-            *color = codeColor;
+    }
+    fFrontMatter = front_matter();
+    // windows of paged documents only have front matter at the document start
+    if (fWindowStart == 0) {
+        FrontMatter::Parse(Text(), TextLength(), &fFrontMatter);
+    }
+    if (fFrontMatter.length > 0) {
+        vector<uint8> blockPath = {MD_BLOCK_CODE};
+        uint16 styleId = fStyleResolver->Resolve(blockPath, 0, MD_TEXT_CODE);
+        ApplyStyle(0, fFrontMatter.length, styleId);
+        fStyleRuns[0] = {fFrontMatter.length, styleId};
+    }
+    return fFrontMatter.length;
+}
+
+void EditorTextView::StyleText(text_data* markupData, style_context* context) {
+    const char *typeInfo;
+
+    switch (markupData->markup_class) {
+        case MD_BLOCK_BEGIN: {
+            MD_BLOCKTYPE blockType = markupData->markup_type.block_type;
+            uint8 level;
+            if (blockType == MD_BLOCK_H && markupData->detail != NULL
+                && markupData->detail->FindUInt8("level", &level) == B_OK) {
+                context->blockPath.push_back(STYLE_PATH_HEADING(level));
+            } else {
+                context->blockPath.push_back(blockType);
+            }
             break;
         }
-        case MD_SPAN_DEL: {
-            font->SetFace(font->Face() | B_STRIKEOUT_FACE);
-            *color = codeColor;
+        case MD_BLOCK_END: {
+            if (!context->blockPath.empty()) {
+                context->blockPath.pop_back();
+            }
             break;
         }
-        case MD_SPAN_U: {
-            font->SetFace(font->Face() | B_UNDERSCORE_FACE);
-            *color = textColor;
+        case MD_SPAN_BEGIN: {
+            MD_SPANTYPE spanType = markupData->markup_type.span_type;
+            context->spanDepth[spanType]++;
+            context->spans |= (1 << spanType);
             break;
         }
-        case MD_SPAN_STRONG: {
-            font->SetFace(font->Face() | B_BOLD_FACE);
-            *color = textColor;
+        case MD_SPAN_END: {
+            MD_SPANTYPE spanType = markupData->markup_type.span_type;
+            if (context->spanDepth[spanType] > 0 && --context->spanDepth[spanType] == 0) {
+                context->spans &= ~(1 << spanType);
+            }
             break;
         }
-        case MD_SPAN_EM: {
-            font->SetFace(font->Face() | B_ITALIC_FACE);
-            *color = textColor;
+        case MD_TEXT: {         // here the styles set before are actually applied to rendered text
+            int32 start   = (int32)markupData->offset;
+            int32 end     = start + markupData->length;
+
+            uint16 styleId = fStyleResolver->Resolve(context->blockPath, context->spans,
+                                                     markupData->markup_type.text_type);
+            ApplyStyle(start, end, styleId);
+            fStyleRuns[start] = {end, styleId};
+
+            typeInfo = MarkdownParser::GetTextTypeName(markupData->markup_type.text_type);
+            printf("StyleText @%d - %d: applied style %u for class %s and type %s\n",
+                start, end, styleId, MarkdownParser::GetMarkupClassName(markupData->markup_class), typeInfo);
+
             break;
         }
         default:
-            font->SetFace(font->Face() | B_REGULAR_FACE);
-            *color = textColor;
             break;
     }
 }
 
-void EditorTextView::SetTextStyle(text_data* markupInfo, BFont *font, rgb_color *color) {
-    MD_TEXTTYPE textType = markupInfo->markup_type.text_type;
+void EditorTextView::LoadWindow(int32 pageIndex, int64 topOffset) {
+    document_page page = fPagedDocument->PageAt(pageIndex);
+    int32 nextIndex = fPagedDocument->NextPage(pageIndex);
+    int32 length = page.length;
+    if (nextIndex >= 0) {
+        length += fPagedDocument->PageAt(nextIndex).length;
+    }
 
-    switch (textType) {
-        case MD_TEXT_CODE: {
-            font->SetSpacing(B_FIXED_SPACING);
-            *color = codeColor;
-            break;
-        }
-        case MD_TEXT_HTML: {
-            font->SetSpacing(B_FIXED_SPACING);
-            *color = linkColor;
-            break;
-        }
-        case MD_TEXT_NORMAL: {
-            // use span/block style here!
-            break;
+    BString textStr;
+    char* text = textStr.LockBuffer(length);
+    ssize_t bytesRead = fPagedDocument->ReadAt(page.start, text, length);
+    if (bytesRead < 0) {
+        textStr.UnlockBuffer(0);
+        printf("could not read document window: %s\n", strerror(bytesRead));
+        return;
+    }
+    textStr.UnlockBuffer(bytesRead);
+
+    // the edit hooks triggered by SetText must not reach the document
+    fLoadingWindow = true;
+
+    ClearHighlights();
+    fMarkdownParser->ClearTextInfo();
+    fMarkupIndex->Clear();
+    fHeadingIndex->Clear();
+    fBoundaryIndex->Clear();
+    fStyleRuns.clear();
+    fWindowStart = page.start;
+    BTextView::SetText(textStr.String(), textStr.Length());
+
+    // revisited pages are styled from their cached markup, all others are parsed
+    markup_map* markupMap = fMarkdownParser->GetMarkupMap();
+    bool cached = fPagedDocument->RestoreMarkup(pageIndex, markupMap, 0)
+        && (nextIndex < 0 || fPagedDocument->RestoreMarkup(nextIndex, markupMap, page.length));
+    if (cached) {
+        UpdateFrontMatter(0);
+        fMarkupIndex->Publish(markupMap, 0, TextLength());
+        fHeadingIndex->Update(markupMap, Text(), 0, TextLength());
+        fBoundaryIndex->Update(markupMap, Text(), 0, TextLength());
+        ClearBlockIndex();
+        StyleMarkup();
+    } else {
+        fMarkdownParser->ClearTextInfo();
+        MarkupText();
+    }
+
+    int32 top = max((int64)0, min(topOffset - fWindowStart, (int64)TextLength()));
+    ScrollTo(BPoint(Bounds().left, PointAt(top).y));
+
+    fLoadingWindow = false;
+    if (!fDiffChanges.empty()) {
+        ShowComparison();
+    }
+
+    printf("showing document window %" B_PRId64 " - %" B_PRId64 " (%s markup).\n",
+        fWindowStart, fWindowStart + TextLength(), cached ? "cached" : "parsed");
+
+    // get the neighbours ready for scrolling on
+    if (nextIndex >= 0) {
+        fPagedDocument->PrefetchMarkup(fPagedDocument->NextPage(nextIndex));
+    }
+    fPagedDocument->PrefetchMarkup(fPagedDocument->PreviousPage(pageIndex));
+}
+
+void EditorTextView::MoveWindow(int32 direction) {
+    int64 oldStart = fWindowStart;
+    int64 oldEnd   = fWindowStart + TextLength();
+    int64 topOffset = fWindowStart + OffsetAt(Bounds().LeftTop());
+
+    int32 selectionStart, selectionEnd;
+    GetSelection(&selectionStart, &selectionEnd);
+    int64 documentSelectionStart = fWindowStart + selectionStart;
+    int64 documentSelectionEnd   = fWindowStart + selectionEnd;
+
+    StoreWindowMarkup();
+
+    int32 pageIndex = fPagedDocument->PageIndexAt(fWindowStart);
+    pageIndex = (direction > 0 ? fPagedDocument->NextPage(pageIndex) : fPagedDocument->PreviousPage(pageIndex));
+    if (pageIndex < 0) {
+        return;
+    }
+    LoadWindow(pageIndex, topOffset);
+
+    // keep resident memory bounded by giving back the mapped text that left the window
+    int64 newEnd = fWindowStart + TextLength();
+    if (oldStart < fWindowStart) {
+        fPagedDocument->ReleaseRange(oldStart, min(oldEnd, fWindowStart) - oldStart);
+    }
+    if (oldEnd > newEnd) {
+        int64 releaseStart = max(oldStart, newEnd);
+        fPagedDocument->ReleaseRange(releaseStart, oldEnd - releaseStart);
+    }
+
+    if (documentSelectionStart >= fWindowStart && documentSelectionEnd <= newEnd) {
+        Select(documentSelectionStart - fWindowStart, documentSelectionEnd - fWindowStart);
+    }
+    UpdateStatus();
+}
+
+void EditorTextView::StoreWindowMarkup() {
+    markup_map* markupMap = fMarkdownParser->GetMarkupMap();
+    int32 pageIndex = fPagedDocument->PageIndexAt(fWindowStart);
+    int64 pageLength = fPagedDocument->PageAt(pageIndex).length;
+
+    fPagedDocument->StoreMarkup(pageIndex, markupMap, 0);
+    if (pageLength < TextLength()) {
+        int32 nextIndex = fPagedDocument->NextPage(pageIndex);
+        if (nextIndex >= 0) {
+            fPagedDocument->StoreMarkup(nextIndex, markupMap, pageLength);
         }
-        default:
-            *font = *fTextFont;
-            *color = textColor;
-            break;
     }
 }
 
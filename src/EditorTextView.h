@@ -5,31 +5,68 @@
 
 #pragma once
 
+#include <DataIO.h>
+#include <MessageRunner.h>
 #include <PopUpMenu.h>
-#include <stack>
 #include <SupportDefs.h>
 #include <TextView.h>
 
+#include "BlockDiff.h"
+#include "BoundaryIndex.h"
+#include "FrontMatter.h"
+#include "HeadingIndex.h"
+#include "HighlightStore.h"
 #include "MarkdownParser.h"
+#include "MarkupIndex.h"
+#include "PagedDocument.h"
+#include "RelatedNotesIndex.h"
+#include "RelayConnection.h"
+#include "SharedDocument.h"
 #include "StatusBar.h"
+#include "StyleResolver.h"
+#include "TaskScheduler.h"
+#include "TextNormalizer.h"
+#include "Theme.h"
 
 const rgb_color linkColor   = ui_color(B_LINK_TEXT_COLOR);
-const rgb_color codeColor   = ui_color(B_SHADOW_COLOR);
-const rgb_color textColor   = ui_color(B_DOCUMENT_TEXT_COLOR);
-const rgb_color headerColor = ui_color(B_CONTROL_HIGHLIGHT_COLOR);  // todo: use tinting
 
 class EditorTextView : public BTextView {
 
 typedef struct text_highlight {
-    int32           startOffset;
-    int32           endOffset;
+    int64           startOffset;
+    int64           endOffset;
     bool            generated = false;
     bool            outline = false;
-    BRegion         *region;
+    int32           label = -1;     // index into the labels, -1 for highlights not kept with the note
+    BRegion         *region;        // NULL until drawn after the text moved
     const rgb_color *fgColor;
     const rgb_color *bgColor;
 } text_highlight;
 
+typedef struct style_context {
+    vector<uint8>   blockPath;
+    uint8           spanDepth[MD_SPAN_U + 1] = {};
+    uint16          spans = 0;
+} style_context;
+
+typedef struct style_run {
+    int32           end;
+    uint16          styleId;
+} style_run;
+
+typedef struct block_index {
+    int32               occurrences;    // of blocks with the same normal text
+    bool                merged;         // into the signature of the note
+    minhash_signature   signature;
+    vector<term_count>  terms;
+} block_index;
+
+typedef struct indexed_block {
+    int64               end;
+    uint64              hash;           // of the normal text, see fBlockIndex
+    bool                hasText;
+} indexed_block;
+
 #define TEXTVIEW_OFFSET = "offset";
 
 public:
@@ -37,9 +74,24 @@ public:
     virtual         ~EditorTextView();
 
     virtual void    Draw(BRect updateRect);
+    virtual void    ScrollTo(BPoint where);
+    using BTextView::ScrollTo;
 
-    virtual void    SetText(BFile *file, int32 offset, size_t size);
+    virtual status_t SetText(BPositionIO *file, int32 offset, size_t size);
     virtual void    SetText(const char* text, const text_run_array* runs = NULL);
+    status_t        SaveText(BFile *file);
+    /**
+     * takes over the changes of the file the document was loaded from or saved to since then, merged in the
+     * background and applied as edits, so highlights and markup of unchanged blocks are kept.
+     * local changes are merged three-way, lines changed on both sides are kept between conflict markers.
+     */
+    status_t        ReloadText(BPositionIO *file, off_t size);
+    /**
+     * shows a paged document and takes ownership of it. the view then only holds a window of two pages
+     * that follows scrolling, all view offsets (markup, highlights, status) are relative to WindowStart().
+     */
+    void            SetDocument(PagedDocument* document);
+    int64           WindowStart()   { return fWindowStart; }
 
 	virtual	void    DeleteText(int32 start, int32 finish);
 	virtual	void    InsertText(const char* text, int32 length, int32 offset,
@@ -55,26 +107,160 @@ public:
     // highlighting/labelling
     void            HighlightSelection(const rgb_color *fgColor = NULL, const rgb_color *bgColor = NULL,
                                        bool generated = false, bool outline = false);
-    void            Highlight(int32 startOffset, int32 endOffset,
+    /**
+     * widens the selection to the whole words it cuts through, so labels never start or end mid-word.
+     */
+    void            SnapSelectionToWords();
+    /**
+     * highlights the selection with a label kept with the note, value may be NULL if the text is the value.
+     */
+    void            LabelSelection(const char* type, const char* value, const rgb_color* color);
+    /**
+     * returns the labeled highlights with a fingerprint of their text, for storing them with the note.
+     */
+    status_t        GetHighlights(highlight_set* highlights);
+    /**
+     * replaces all highlights with those stored with the note, moved to where their text is now.
+     */
+    void            SetHighlights(highlight_set* highlights);
+    void            Highlight(int64 startOffset, int64 endOffset,
                               const rgb_color *fgColor = NULL, const rgb_color *bgColor = NULL,
                               bool generated = false, bool outline = false);
-    void            ClearHighlights();
+    void            ClearHighlights(bool keepLabels = false);
+
+    // comparison
+    /**
+     * compares the document with the other text in the background and shows the changes as highlights,
+     * changed text filled with addedColor and the places of removed text outlined with removedColor.
+     * edits end the comparison.
+     */
+    void            CompareWith(BPositionIO* other, off_t size, const rgb_color* addedColor,
+                                const rgb_color* removedColor);
+    /**
+     * ends the comparison, this removes all highlights.
+     */
+    void            ClearComparison();
+
+    // shared editing
+    /**
+     * joins the editing session of the relay at host and port. the first editor of a session brings in its
+     * text, all others take over the text of the session. local edits are sent in batches, remote ones
+     * are applied as edits like typing, parsing only the blocks they touch.
+     */
+    status_t        StartSharing(const char* host, uint16 port);
+    void            StopSharing();
+    bool            IsSharing()     { return fSharedDocument != NULL; }
+
+    const front_matter* GetFrontMatter() { return &fFrontMatter; }
+    /**
+     * snapshot access to the markup of this document for background readers.
+     */
+    MarkupIndex*    GetMarkupIndex() { return fMarkupIndex; }
+    /**
+     * returns the file offsets of all top level blocks from the markup index, for paged documents
+     * those of the blocks in the current window.
+     */
+    void            GetBlockBoundaries(vector<int64>* boundaries);
+    /**
+     * returns the MinHash signature of the normal text, for paged documents that of the current window.
+     * signatures and terms are kept per top level block, so only changed blocks are signed again.
+     */
+    void            GetSignature(minhash_signature* signature);
+    /**
+     * returns up to count keywords of the selection or, w/o selection, of the whole document,
+     * weighed by the document frequencies of the vault index if one was set.
+     */
+    void            GetKeywords(int32 count, vector<BString>* keywords);
+    void            SetRelatedNotesIndex(RelatedNotesIndex* index) { fRelatedNotes = index; }
+
+    // theming
+    void            SetTheme(Theme* theme);
+    const char*     ThemeName()     { return fStyleResolver->GetTheme()->Name(); }
+
+    // navigation
+    void            GetHeadingLabels(vector<BString>* labels);
+    void            GoToHeading(int32 index);
+
+    // structural selection
+    /**
+     * selects the next larger unit holding the selection: word, span, sentence, leaf block, list item, list,
+     * heading section and document. the previous selection is kept for ShrinkSelection().
+     */
+    void            ExpandSelection();
+    void            ShrinkSelection();
+    void            SelectSentence();
+    /**
+     * puts the caret at the start of the next sentence, or of the current or previous one going back.
+     */
+    void            MoveToSentence(bool next);
+
+    // sections
+    /**
+     * swaps the heading section holding the selection with its previous or next sibling section in a
+     * single splice. markup, styles and highlights move along, only the blocks at the seams are parsed again.
+     */
+    void            MoveSection(bool down);
+    /**
+     * raises (delta < 0) or lowers (delta > 0) the level of all headings in the section holding the selection,
+     * only the changed heading lines are parsed again.
+     */
+    void            ChangeSectionLevel(int32 delta);
 
 private:
-    void            MarkupText(int32 start, int32 end);
-    void            StyleText(text_data* markupInfo,
-                              stack<text_run> *styleStack,
-                              BFont* font, rgb_color* color);
+    void            MarkupText();
+    void            MarkupEdit(int32 offset, int32 removed, int32 inserted);
+    int32           UpdateFrontMatter(int32 start);
+    void            GetBlockStarts(vector<int64>* starts);
+    void            StyleText(text_data* markupInfo, style_context* context);
+    void            StyleMarkup();
+    void            StyleRange(int32 start, int32 end, style_context* context);
+    void            ShiftStyleRuns(int32 start, int32 end, int32 delta);
+    void            ApplyStyle(int32 start, int32 end, uint16 styleId);
 
-    void            SetBlockStyle(text_data* markupInfo, BFont* font, rgb_color* color);
-    void            SetSpanStyle(text_data* markupInfo, BFont* font, rgb_color* color);
-    void            SetTextStyle(text_data* markupInfo, BFont *font, rgb_color *color);
+    // paged documents
+    void            LoadWindow(int32 pageIndex, int64 topOffset);
+    void            MoveWindow(int32 direction);
+    void            StoreWindowMarkup();
 
     BMessage*       GetOutlineAt(int32 offset, bool withNames = false);
     BMessage*       GetDocumentOutline(bool withNames = false, bool withDetails = false);
 
+    void            GetEnclosingRanges(int32 start, int32 end, vector<pair<int64, int64>>* ranges);
+    int32           SectionIndexAt(int32 offset);
+    void            GetSectionRange(int32 index, int32* start, int32* end);
+    bool            SwapText(int32 start, int32 middle, int32 end);
+    void            SwapStyleRuns(int32 start, int32 middle, int32 end);
+    void            SwapHighlights(int32 start, int32 middle, int32 end);
+    void            ShiftHighlights(int32 offset, int32 removed, int32 inserted);
+    void            DeleteHighlight(text_highlight* highlight);
+    void            RestyleBlocks(int32 start, int32 end);
+    void            SpliceText(int32 offset, int32 removed, const char* text, int32 length);
+
+    // reloading
+    void            MergeFileText();
+    void            CancelMerge();
+    void            ApplyMerge(BMessage* message);
+
+    // sharing
+    bool            IsSessionMessage(BMessage* message);
+    void            JoinSession(BMessage* message);
+    void            ApplySharedEdits(const vector<shared_edit>& edits);
+
+    // keywords
+    void            ClearBlockIndex();
+    /**
+     * marks the top level blocks from start to end of the text before an edit for indexing
+     * and moves those after it by delta.
+     */
+    void            ShiftBlockIndex(int64 start, int64 end, int64 delta);
+    void            UpdateBlockIndex();
+    void            CountBlock(uint64 hash, int32 delta);
+
     void            UpdateStatus();
     void            RedrawHighlight(text_highlight *highlight);
+    text_highlight* AddHighlight(int64 startOffset, int64 endOffset, const rgb_color *fgColor,
+                                 const rgb_color *bgColor, bool generated, bool outline);
+    void            ShowComparison();
 
     void            BuildContextMenu();
     void            BuildContextSelectionMenu();
@@ -82,9 +268,48 @@ private:
     BHandler*       fEditorHandler;
     StatusBar*      fStatusBar;
     MarkdownParser* fMarkdownParser;
-    BFont*          fTextFont;
-    BFont*          fLinkFont;
-    BFont*          fCodeFont;
+    MarkupIndex*    fMarkupIndex;
+    TextNormalizer* fTextNormalizer;
+    front_matter    fFrontMatter;
+    HeadingIndex*   fHeadingIndex;
+    BoundaryIndex*  fBoundaryIndex;
+    StyleResolver*  fStyleResolver;
+    map<int32, style_run> fStyleRuns;       // style IDs applied per text offset, re-mapped on theme change
+    PagedDocument*  fPagedDocument;         // NULL unless a large file is shown in pages
+    int64           fWindowStart;
+    bool            fLoadingWindow;
+    bool            fSplicing;              // edit hooks only change the text, the caller updates all the rest
+
+    map<int64, text_highlight*> *fTextHighlights;
+    vector<highlight_label> fHighlightLabels;
+    int64           fLongestHighlight;      // highlights overlapping an offset start at most this far before it
+    vector<pair<int32, int32>> fSelectionHistory;  // selections before each expansion
+    pair<int32, int32> fExpandedSelection;          // result of the last expansion, history is only valid for it
+
+    vector<diff_change> fDiffChanges;       // document offsets, new side is the document
+    rgb_color       fDiffAddedColor;
+    rgb_color       fDiffRemovedColor;
+    uint32          fCompareVersion;        // results of older comparisons are dropped
+    TaskHandle      fCompareTask;
+
+    uint32          fTextVersion;           // counts edits, merges of older text are done again
+    BString         fBaseText;              // as loaded from or saved to the file
+    BString         fFileText;              // changed file text to merge
+    TextNormalizer  fFileNormalizer;        // line endings of fFileText
+    uint32          fMergeVersion;          // results of canceled merges are dropped
+    TaskHandle      fMergeTask;
+
+    SharedDocument* fSharedDocument;        // NULL unless sharing
+    RelayConnection* fRelayConnection;
+    BMessageRunner* fSendRunner;
+    bool            fIntegrating;           // applying remote edits, which are not sent again
 
-    map<int32, text_highlight*> *fTextHighlights;
+    RelatedNotesIndex* fRelatedNotes;       // not owned, may be NULL
+    map<uint64, block_index> fBlockIndex;   // by hash of the normal text of a top level block
+    map<uint32, term_count> fNoteTerms;     // summed over all blocks
+    minhash_signature fSignature;           // merged from all blocks
+    map<int64, indexed_block> fIndexedBlocks;  // top level blocks by start offset
+    set<uint64>     fChangedBlocks;         // hashes counted up or down since the last update
+    int64           fDirtyStart;            // blocks to index again, none if start > end
+    int64           fDirtyEnd;
 };
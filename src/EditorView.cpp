@@ -41,7 +41,7 @@ void EditorView::MessageReceived(BMessage* message) {
             printf("EditorView::insert type:\n");
             const char* label = message->GetString(MSG_PROP_LABEL);
             if (label != NULL) {
-                printf("will insert entity type %s.\n", label);
+                printf("will insert entity type %s %s.\n", label, message->GetString(MSG_PROP_VALUE, ""));
             }
             break;
         }
@@ -50,14 +50,15 @@ void EditorView::MessageReceived(BMessage* message) {
             printf("EditorView::add highlight for selection:\n");
             const char* label = message->GetString(MSG_PROP_LABEL);
             if (label != NULL) {
-                printf("highlight with label %s\n", label);
+                printf("highlight with label %s %s\n", label, message->GetString(MSG_PROP_VALUE, ""));
                 // calculate highlight color
                 uint32 hash = BString(label).HashValue();
                 int colorIndex = (hash >> 2) % NUM_COLORS - 1;
 
                 printf("=== highlighting with screen color #%d.\n", colorIndex);
                 const rgb_color *col = fColorDefs->GetColor(static_cast<COLOR_NAME>(colorIndex));
-                fTextView->HighlightSelection(NULL, col);
+                fTextView->SnapSelectionToWords();
+                fTextView->LabelSelection(label, message->GetString(MSG_PROP_VALUE, NULL), col);
             }
             break;
         }
@@ -69,6 +70,108 @@ void EditorView::MessageReceived(BMessage* message) {
     }
 }
 
-void EditorView::SetText(BFile* file, size_t size) {
-    fTextView->SetText(file, 0, size);
+status_t EditorView::SetText(BPositionIO* file, size_t size) {
+    return fTextView->SetText(file, 0, size);
+}
+
+status_t EditorView::SetDocument(const char* path) {
+    PagedDocument* document = new PagedDocument();
+    status_t status = document->SetTo(path);
+    if (status != B_OK) {
+        delete document;
+        return status;
+    }
+    fTextView->SetDocument(document);
+    return B_OK;
+}
+
+status_t EditorView::SaveText(BFile* file) {
+    return fTextView->SaveText(file);
+}
+
+status_t EditorView::ReloadText(BPositionIO* file, off_t size) {
+    return fTextView->ReloadText(file, size);
+}
+
+status_t EditorView::LoadHighlights(const char* path) {
+    highlight_set highlights;
+    status_t status = HighlightStore::Read(path, &highlights);
+    if (status != B_OK)
+        return status;
+
+    fTextView->SetHighlights(&highlights);
+    return B_OK;
+}
+
+status_t EditorView::SaveHighlights(const char* path) {
+    highlight_set highlights;
+    status_t status = fTextView->GetHighlights(&highlights);
+    if (status != B_OK)
+        return status;
+
+    return HighlightStore::Write(path, highlights);
+}
+
+void EditorView::GetBlockBoundaries(vector<int64>* boundaries) {
+    fTextView->GetBlockBoundaries(boundaries);
+}
+
+void EditorView::GetSignature(minhash_signature* signature) {
+    fTextView->GetSignature(signature);
+}
+
+void EditorView::SetRelatedNotesIndex(RelatedNotesIndex* index) {
+    fTextView->SetRelatedNotesIndex(index);
+}
+
+void EditorView::CompareWith(BPositionIO* other, off_t size) {
+    fTextView->CompareWith(other, size, fColorDefs->GetColor(LIGHT_GREEN), fColorDefs->GetColor(LIGHT_RED));
+}
+
+void EditorView::ClearComparison() {
+    fTextView->ClearComparison();
+}
+
+status_t EditorView::StartSharing(const char* host, uint16 port) {
+    return fTextView->StartSharing(host, port);
+}
+
+void EditorView::StopSharing() {
+    fTextView->StopSharing();
+}
+
+void EditorView::GetHeadingLabels(vector<BString>* labels) {
+    fTextView->GetHeadingLabels(labels);
+}
+
+void EditorView::GoToHeading(int32 index) {
+    fTextView->GoToHeading(index);
+}
+
+void EditorView::ExpandSelection() {
+    fTextView->ExpandSelection();
+}
+
+void EditorView::ShrinkSelection() {
+    fTextView->ShrinkSelection();
+}
+
+void EditorView::SelectSentence() {
+    fTextView->SelectSentence();
+}
+
+void EditorView::MoveToSentence(bool next) {
+    fTextView->MoveToSentence(next);
+}
+
+void EditorView::MoveSection(bool down) {
+    fTextView->MoveSection(down);
+}
+
+void EditorView::ChangeSectionLevel(int32 delta) {
+    fTextView->ChangeSectionLevel(delta);
+}
+
+void EditorView::SetTheme(Theme* theme) {
+    fTextView->SetTheme(theme);
 }
@@ -20,7 +20,30 @@ public:
     virtual         ~EditorView();
     virtual void    MessageReceived(BMessage* message);
 
-    void            SetText(BFile *file, size_t size);
+    status_t        SetText(BPositionIO *file, size_t size);
+    status_t        SetDocument(const char* path);
+    status_t        SaveText(BFile *file);
+    status_t        ReloadText(BPositionIO *file, off_t size);
+    status_t        LoadHighlights(const char* path);
+    status_t        SaveHighlights(const char* path);
+    void            GetBlockBoundaries(vector<int64>* boundaries);
+    void            GetSignature(minhash_signature* signature);
+    void            SetRelatedNotesIndex(RelatedNotesIndex* index);
+    void            CompareWith(BPositionIO *other, off_t size);
+    void            ClearComparison();
+    status_t        StartSharing(const char* host, uint16 port);
+    void            StopSharing();
+
+    void            GetHeadingLabels(vector<BString>* labels);
+    void            GoToHeading(int32 index);
+    void            ExpandSelection();
+    void            ShrinkSelection();
+    void            SelectSentence();
+    void            MoveToSentence(bool next);
+    void            MoveSection(bool down);
+    void            ChangeSectionLevel(int32 delta);
+
+    void            SetTheme(Theme* theme);
 
 private:
     EditorTextView* fTextView;
@@ -0,0 +1,403 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "EntityStore.h"
+
+#include <Autolock.h>
+#include <Entry.h>
+#include <File.h>
+#include <FindDirectory.h>
+#include <Message.h>
+#include <OS.h>
+#include <Path.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "HighlightStore.h"
+#include "TextNormalizer.h"
+
+static const char* kEntityStoreFile = "senity_entities";
+
+EntityStore::EntityStore()
+    : fLock("entity_store_lock"),
+      fDirty(false) {
+}
+
+EntityStore::~EntityStore() {
+    Cancel();
+}
+
+status_t EntityStore::Load() {
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kEntityStoreFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_READ_ONLY);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    status = archive.Unflatten(&file);
+    if (status != B_OK)
+        return status;
+
+    const void* entityData;
+    const void* noteData;
+    ssize_t entitySize, noteSize;
+    if (archive.FindData("entities", B_RAW_TYPE, &entityData, &entitySize) != B_OK
+        || archive.FindData("notes", B_RAW_TYPE, &noteData, &noteSize) != B_OK
+        || entitySize % sizeof(entity_entry) != 0 || noteSize % sizeof(note_entry) != 0) {
+        return B_BAD_DATA;
+    }
+
+    BAutolock lock(&fLock);
+    fStrings.clear();
+    fStringIds.clear();
+    fPaths.clear();
+    fModified.clear();
+    fNoteIds.clear();
+
+    BString string;
+    for (int32 index = 0; archive.FindString("string", index, &string) == B_OK; index++) {
+        fStringIds[string] = fStrings.size();
+        fStrings.push_back(string);
+    }
+    int64 modified;
+    for (int32 index = 0; archive.FindString("path", index, &string) == B_OK
+                          && archive.FindInt64("modified", index, &modified) == B_OK; index++) {
+        if (!string.IsEmpty())
+            fNoteIds[string] = fPaths.size();
+        fPaths.push_back(string);
+        fModified.push_back(modified);
+    }
+
+    // both indexes were saved in order, so their pages are built w/o sorting
+    const entity_entry* entities = static_cast<const entity_entry*>(entityData);
+    const note_entry* notes = static_cast<const note_entry*>(noteData);
+    fEntityIndex.Build(vector<entity_entry>(entities, entities + entitySize / sizeof(entity_entry)));
+    fNoteIndex.Build(vector<note_entry>(notes, notes + noteSize / sizeof(note_entry)));
+    fDirty = false;
+    printf("EntityStore: loaded %zu mentions in %zu notes.\n", fNoteIndex.Count(), fNoteIds.size());
+
+    return B_OK;
+}
+
+status_t EntityStore::Save() {
+    BAutolock lock(&fLock);
+    if (!fDirty)
+        return B_OK;
+
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kEntityStoreFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    for (auto& string : fStrings)
+        archive.AddString("string", string);
+    for (size_t index = 0; index < fPaths.size(); index++) {
+        archive.AddString("path", fPaths[index]);
+        archive.AddInt64("modified", fModified[index]);
+    }
+    vector<entity_entry> entities;
+    vector<note_entry> notes;
+    fEntityIndex.Export(&entities);
+    fNoteIndex.Export(&notes);
+    archive.AddData("entities", B_RAW_TYPE, entities.data(), entities.size() * sizeof(entity_entry), false);
+    archive.AddData("notes", B_RAW_TYPE, notes.data(), notes.size() * sizeof(note_entry), false);
+
+    status = archive.Flatten(&file);
+    if (status == B_OK)
+        fDirty = false;
+
+    return status;
+}
+
+status_t EntityStore::UpdateNote(const char* path) {
+    struct stat stat;
+    status_t status = BEntry(path).GetStat(&stat);
+    if (status != B_OK)
+        return status;
+
+    vector<found_mention> mentions;
+    status = ReadMentions(path, &mentions);
+    if (status != B_OK)
+        return status;
+
+    ReplaceMentions(path, stat.st_mtime, mentions);
+    return B_OK;
+}
+
+void EntityStore::Update(const vector<BString>& paths) {
+    Cancel();
+
+    fUpdateTask = TaskScheduler::Default()->Submit(TASK_PRIORITY_MAINTENANCE,
+        [this, paths](const CancelToken& token) {
+            bigtime_t startTime = system_time();
+            map<BString, time_t> known;
+            {
+                BAutolock lock(&fLock);
+                for (auto& note : fNoteIds)
+                    known[note.first] = fModified[note.second];
+            }
+            int32 updatedNotes = 0;
+            vector<found_mention> mentions;
+            for (auto& path : paths) {
+                if (token.IsCanceled())
+                    return;
+
+                struct stat stat;
+                if (BEntry(path.String()).GetStat(&stat) != B_OK)
+                    continue;
+
+                auto entry = known.find(path);
+                if (entry != known.end()) {
+                    bool unchanged = entry->second == stat.st_mtime;
+                    known.erase(entry);
+                    if (unchanged)
+                        continue;
+                }
+                // notes w/o labels are kept as well, so they are not read again
+                if (ReadMentions(path.String(), &mentions) != B_OK)
+                    continue;
+                ReplaceMentions(path.String(), stat.st_mtime, mentions);
+                updatedNotes++;
+            }
+
+            // what is left went away
+            BAutolock lock(&fLock);
+            for (auto& note : known) {
+                auto entry = fNoteIds.find(note.first);
+                if (entry != fNoteIds.end())
+                    RemoveNote(entry->second);
+            }
+            printf("EntityStore: updated %d notes, dropped %zu, %zu mentions in %lld ms.\n", updatedNotes,
+                known.size(), fNoteIndex.Count(), (long long) (system_time() - startTime) / 1000);
+        });
+}
+
+void EntityStore::Cancel() {
+    fUpdateTask.Cancel();
+    fUpdateTask.Wait();
+}
+
+void EntityStore::Query(const char* type, const char* value, time_t since, time_t until, int32 count,
+                        vector<entity_mention>* results) {
+    results->clear();
+
+    BAutolock lock(&fLock);
+    auto typeId = fStringIds.find(type);
+    if (typeId == fStringIds.end())
+        return;
+
+    entity_entry from = { typeId->second, 0, 0, 0, 0, 0 };
+    if (value != NULL) {
+        auto valueId = fStringIds.find(value);
+        if (valueId == fStringIds.end())
+            return;
+        from.value = valueId->second;
+    }
+    fEntityIndex.Scan(from, [&](const entity_entry& entry) {
+        if (entry.type != from.type || (value != NULL && entry.value != from.value))
+            return false;
+        if ((since != 0 && entry.labeled < since) || (until != 0 && entry.labeled >= until))
+            return true;
+
+        results->push_back(MakeMention({ entry.note, entry.offset, entry.length, entry.type, entry.value,
+                                         entry.labeled }));
+        return (int32) results->size() < count;
+    });
+}
+
+void EntityStore::GetNoteMentions(const char* path, int64 start, int64 end, vector<entity_mention>* results) {
+    results->clear();
+
+    BAutolock lock(&fLock);
+    auto note = fNoteIds.find(path);
+    if (note == fNoteIds.end())
+        return;
+
+    note_entry from = { note->second, (uint32) max(start, (int64) 0), 0, 0, 0, 0 };
+    fNoteIndex.Scan(from, [&](const note_entry& entry) {
+        if (entry.note != from.note || entry.offset >= end)
+            return false;
+        results->push_back(MakeMention(entry));
+        return true;
+    });
+}
+
+void EntityStore::GetEntities(vector<entity_count>* entities) {
+    entities->clear();
+
+    BAutolock lock(&fLock);
+    // mentions of an entity are next to each other, ordered by note
+    entity_entry from = {};
+    const entity_entry* last = NULL;
+    fEntityIndex.Scan(from, [&](const entity_entry& entry) {
+        if (last == NULL || entry.type != last->type || entry.value != last->value) {
+            entities->push_back({ fStrings[entry.type], fStrings[entry.value], 1, 0 });
+        } else if (entry.note != last->note) {
+            entities->back().notes++;
+        }
+        entities->back().mentions++;
+        last = &entry;
+        return true;
+    });
+}
+
+int32 EntityStore::CountMentions() {
+    BAutolock lock(&fLock);
+    return fNoteIndex.Count();
+}
+
+status_t EntityStore::ReadMentions(const char* path, vector<found_mention>* mentions) {
+    mentions->clear();
+    highlight_set highlights;
+    status_t status = HighlightStore::Read(path, &highlights);
+    if (status != B_OK || highlights.records.empty())
+        return status;
+
+    BFile file(path, B_READ_ONLY);
+    off_t size;
+    status = file.InitCheck();
+    if (status == B_OK)
+        status = file.GetSize(&size);
+    if (status != B_OK)
+        return status;
+
+    // the note may have changed since its labels were stored, they are looked up in its text as it is now
+    vector<char> text(size);
+    ssize_t bytesRead = file.ReadAt(0, text.data(), size);
+    if (bytesRead < 0)
+        return bytesRead;
+
+    // normalized like the editor does, so the offsets stored are those of the text it shows
+    TextNormalizer normalizer;
+    int32 textSize = normalizer.Normalize(text.data(), bytesRead);
+
+    HighlightStore::Anchor(text.data(), textSize, &highlights);
+    for (auto& record : highlights.records) {
+        const highlight_label& label = highlights.labels[record.label];
+        found_mention mention = { record.offset, (int32) record.length, label.type, label.value };
+        if (mention.value.IsEmpty())
+            CleanValue(text.data() + record.offset, record.length, &mention.value);
+        else
+            CleanValue(label.value.String(), label.value.Length(), &mention.value);
+        if (!mention.type.IsEmpty() && !mention.value.IsEmpty())
+            mentions->push_back(mention);
+    }
+    return B_OK;
+}
+
+void EntityStore::CleanValue(const char* text, int64 length, BString* value) {
+    // runs of white space become one space, so values split over lines are the same
+    value->Truncate(0);
+    bool space = false;
+    for (int64 index = 0; index < length; index++) {
+        char c = text[index];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            space = !value->IsEmpty();
+            continue;
+        }
+        // long values are cut before a character, never within
+        if ((c & 0xC0) != 0x80 && value->Length() >= kMaxValueLength)
+            break;
+        if (space)
+            *value << ' ';
+        space = false;
+        *value << c;
+    }
+}
+
+void EntityStore::ReplaceMentions(const char* path, time_t modified, const vector<found_mention>& mentions) {
+    BAutolock lock(&fLock);
+    uint32 note;
+    auto noteId = fNoteIds.find(path);
+    if (noteId != fNoteIds.end()) {
+        note = noteId->second;
+    } else {
+        note = fPaths.size();
+        fNoteIds[path] = note;
+        fPaths.push_back(path);
+        fModified.push_back(0);
+    }
+
+    // labels seen before keep the time they were first seen
+    map<pair<uint32, uint32>, uint32> labeled;
+    vector<note_entry> old;
+    fNoteIndex.Scan({ note, 0, 0, 0, 0, 0 }, [&](const note_entry& entry) {
+        if (entry.note != note)
+            return false;
+        old.push_back(entry);
+        return true;
+    });
+    for (auto& entry : old) {
+        auto known = labeled.insert({{ entry.type, entry.value }, entry.labeled });
+        known.first->second = min(known.first->second, entry.labeled);
+        fNoteIndex.Erase(entry);
+        fEntityIndex.Erase({ entry.type, entry.value, entry.note, entry.offset, entry.length, entry.labeled });
+    }
+
+    uint32 now = time(NULL);
+    for (auto& mention : mentions) {
+        uint32 type = InternString(mention.type);
+        uint32 value = InternString(mention.value);
+        auto known = labeled.find({ type, value });
+        uint32 labeledTime = known != labeled.end() ? known->second : now;
+        fNoteIndex.Insert({ note, (uint32) mention.offset, (uint32) mention.length, type, value, labeledTime });
+        fEntityIndex.Insert({ type, value, note, (uint32) mention.offset, (uint32) mention.length, labeledTime });
+    }
+    fModified[note] = modified;
+    fDirty = true;
+}
+
+void EntityStore::RemoveNote(uint32 note) {
+    vector<note_entry> old;
+    fNoteIndex.Scan({ note, 0, 0, 0, 0, 0 }, [&](const note_entry& entry) {
+        if (entry.note != note)
+            return false;
+        old.push_back(entry);
+        return true;
+    });
+    for (auto& entry : old) {
+        fNoteIndex.Erase(entry);
+        fEntityIndex.Erase({ entry.type, entry.value, entry.note, entry.offset, entry.length, entry.labeled });
+    }
+    fNoteIds.erase(fPaths[note]);
+    fPaths[note] = "";
+    fModified[note] = 0;
+    fDirty = true;
+}
+
+uint32 EntityStore::InternString(const BString& string) {
+    auto entry = fStringIds.find(string);
+    if (entry != fStringIds.end())
+        return entry->second;
+
+    uint32 id = fStrings.size();
+    fStringIds[string] = id;
+    fStrings.push_back(string);
+    return id;
+}
+
+entity_mention EntityStore::MakeMention(const note_entry& entry) {
+    return { fPaths[entry.note], entry.offset, (int32) entry.length, fStrings[entry.type], fStrings[entry.value],
+             (time_t) entry.labeled };
+}
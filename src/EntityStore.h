@@ -0,0 +1,144 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * vault-wide store of the entities labeled in notes, fed by the highlights kept with each note.
+ * every mention is kept in two B+ tree indexes, by label type and value to find the notes mentioning
+ * an entity, and by note and offset to update a note or list what it mentions.
+ * labels and paths are stored once and referred to by number, the store is saved as one file.
+ */
+#pragma once
+
+#include <Locker.h>
+#include <map>
+#include <String.h>
+#include <SupportDefs.h>
+#include <time.h>
+#include <vector>
+
+#include "TaskScheduler.h"
+#include "TreeIndex.h"
+
+using namespace std;
+
+typedef struct entity_mention {
+    BString         path;
+    int64           offset;
+    int32           length;
+    BString         type;
+    BString         value;
+    time_t          labeled;        // when the label was first seen
+} entity_mention;
+
+typedef struct entity_count {
+    BString         type;
+    BString         value;
+    int32           notes;
+    int32           mentions;
+} entity_count;
+
+// index entries, all fields are numbers of strings, notes or seconds
+typedef struct entity_entry {
+    uint32          type;
+    uint32          value;
+    uint32          note;
+    uint32          offset;
+    uint32          length;
+    uint32          labeled;
+} entity_entry;
+
+typedef struct note_entry {
+    uint32          note;
+    uint32          offset;
+    uint32          length;
+    uint32          type;
+    uint32          value;
+    uint32          labeled;
+} note_entry;
+
+inline bool operator<(const entity_entry& entry, const entity_entry& other) {
+    if (entry.type != other.type)
+        return entry.type < other.type;
+    if (entry.value != other.value)
+        return entry.value < other.value;
+    if (entry.note != other.note)
+        return entry.note < other.note;
+    return entry.offset < other.offset;
+}
+
+inline bool operator<(const note_entry& entry, const note_entry& other) {
+    if (entry.note != other.note)
+        return entry.note < other.note;
+    return entry.offset < other.offset;
+}
+
+class EntityStore {
+
+public:
+                        EntityStore();
+    virtual             ~EntityStore();
+
+    status_t            Load();
+    status_t            Save();
+
+    /**
+     * indexes the labels kept with the note at path again, labels seen before keep their time.
+     */
+    status_t            UpdateNote(const char* path);
+    /**
+     * indexes the notes at paths that changed since in the background and drops notes no longer in paths.
+     * an update still running is canceled.
+     */
+    void                Update(const vector<BString>& paths);
+    void                Cancel();
+
+    /**
+     * returns up to count mentions of type, and of value unless it is NULL, labeled from since up to
+     * before until, ordered by note and offset. 0 leaves a time open.
+     */
+    void                Query(const char* type, const char* value, time_t since, time_t until, int32 count,
+                              vector<entity_mention>* results);
+    /**
+     * returns the mentions in the note at path from start to before end, by offset.
+     */
+    void                GetNoteMentions(const char* path, int64 start, int64 end, vector<entity_mention>* results);
+    /**
+     * returns all entities with the number of notes mentioning them, ordered by type and value.
+     */
+    void                GetEntities(vector<entity_count>* entities);
+    int32               CountMentions();
+
+    // longer label values are cut
+    static const int32  kMaxValueLength = 200;
+
+private:
+    typedef struct found_mention {
+        int64           offset;
+        int32           length;
+        BString         type;
+        BString         value;
+    } found_mention;
+
+    /**
+     * reads the highlights of the note at path with their values, the text of the note is only read
+     * if a label takes its value from it.
+     */
+    static status_t     ReadMentions(const char* path, vector<found_mention>* mentions);
+    static void         CleanValue(const char* text, int64 length, BString* value);
+
+    void                ReplaceMentions(const char* path, time_t modified, const vector<found_mention>& mentions);
+    void                RemoveNote(uint32 note);
+    uint32              InternString(const BString& string);
+    entity_mention      MakeMention(const note_entry& entry);
+
+    BLocker             fLock;
+    vector<BString>     fStrings;           // label types and values
+    map<BString, uint32> fStringIds;
+    vector<BString>     fPaths;             // empty for notes no longer in the vault
+    vector<time_t>      fModified;
+    map<BString, uint32> fNoteIds;
+    TreeIndex<entity_entry> fEntityIndex;
+    TreeIndex<note_entry> fNoteIndex;
+    bool                fDirty;
+    TaskHandle          fUpdateTask;
+};
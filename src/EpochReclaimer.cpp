@@ -0,0 +1,73 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "EpochReclaimer.h"
+
+#include <thread>
+
+EpochReclaimer::EpochReclaimer()
+    : fEpoch(1) {
+    for (auto& slot : fSlots) {
+        slot.epoch.store(0, memory_order_relaxed);
+    }
+}
+
+EpochReclaimer::~EpochReclaimer() {
+    for (auto item : fRetired) {
+        item.reclaim();
+    }
+    fRetired.clear();
+}
+
+int32 EpochReclaimer::Enter() {
+    // start at the slot used last by this thread, so a reader usually claims its slot at the first try
+    static thread_local int32 slotHint = hash<thread::id>()(this_thread::get_id()) % EPOCH_MAX_READERS;
+
+    int32 slot = slotHint;
+    for (int32 attempt = 1; ; attempt++) {
+        uint64 unused = 0;
+        uint64 epoch = fEpoch.load();
+        // a stale epoch is fine here, it only keeps retired items around a little longer
+        if (fSlots[slot].epoch.compare_exchange_strong(unused, epoch)) {
+            slotHint = slot;
+            return slot;
+        }
+        slot = (slot + 1) % EPOCH_MAX_READERS;
+        if (attempt % EPOCH_MAX_READERS == 0) {
+            this_thread::yield();   // more concurrent readers than slots
+        }
+    }
+}
+
+void EpochReclaimer::Exit(int32 slot) {
+    fSlots[slot].epoch.store(0, memory_order_release);
+}
+
+void EpochReclaimer::Retire(function<void()> reclaim) {
+    // readers entering after the increment can no longer reach the retired item
+    fRetired.push_back({fEpoch.fetch_add(1), reclaim});
+}
+
+int32 EpochReclaimer::Reclaim() {
+    if (fRetired.empty()) {
+        return 0;
+    }
+    uint64 oldestReader = UINT64_MAX;
+    for (auto& slot : fSlots) {
+        uint64 epoch = slot.epoch.load();
+        if (epoch != 0 && epoch < oldestReader) {
+            oldestReader = epoch;
+        }
+    }
+
+    int32 reclaimed = 0;
+    // retired items are ordered by epoch
+    while (!fRetired.empty() && fRetired.front().epoch < oldestReader) {
+        fRetired.front().reclaim();
+        fRetired.pop_front();
+        reclaimed++;
+    }
+    return reclaimed;
+}
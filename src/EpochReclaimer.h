@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * epoch based reclamation for data shared between one writer and many lock-free readers.
+ * readers announce the epoch they entered in a reader slot, the writer retires unlinked objects
+ * with the current epoch and only frees them once no reader could still see them.
+ * the writer never waits for readers, retired objects are simply kept until a later Reclaim().
+ */
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <SupportDefs.h>
+
+using namespace std;
+
+#define EPOCH_MAX_READERS 128
+
+typedef struct retired_item {
+    uint64          epoch;
+    function<void()> reclaim;
+} retired_item;
+
+class EpochReclaimer {
+
+public:
+                        EpochReclaimer();
+    /**
+     * frees all retired items, there must be no active readers left at this point.
+     */
+    virtual             ~EpochReclaimer();
+
+    /**
+     * pins the current epoch for the calling reader and returns the reader slot to pass to Exit().
+     * shared data must only be loaded after entering.
+     */
+    int32               Enter();
+    void                Exit(int32 slot);
+
+    /**
+     * hands over an object that is no longer reachable for new readers, writer only.
+     */
+    void                Retire(function<void()> reclaim);
+    /**
+     * frees all retired items no active reader can still reference, writer only.
+     * returns the number of items freed.
+     */
+    int32               Reclaim();
+
+    int32               CountRetired()      { return fRetired.size(); }
+
+private:
+    // one cache line per slot so readers on different cores don't contend
+    typedef struct alignas(64) reader_slot {
+        atomic<uint64>  epoch;              // 0 if unused
+    } reader_slot;
+
+    reader_slot         fSlots[EPOCH_MAX_READERS];
+    atomic<uint64>      fEpoch;
+    deque<retired_item> fRetired;
+};
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "FrameSocket.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+status_t FrameSocket::Connect(const char* host, uint16 port, int* result) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    int error = getaddrinfo(host, service, &hints, &addresses);
+    if (error != 0) {
+        printf("FrameSocket: could not resolve %s: %s\n", host, gai_strerror(error));
+        return B_NAME_NOT_FOUND;
+    }
+    status_t status = B_ERROR;
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address != NULL; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            status = errno;
+            continue;
+        }
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            status = B_OK;
+            break;
+        }
+        status = errno;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (status != B_OK) {
+        return status;
+    }
+
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    *result = fd;
+    return B_OK;
+}
+
+status_t FrameSocket::WriteFrame(int socket, uint8 type, const void* data, size_t size) {
+    uint32 frameSize = htonl(size + 1);
+    vector<uint8> frame(sizeof(frameSize) + 1 + size);
+    memcpy(frame.data(), &frameSize, sizeof(frameSize));
+    frame[sizeof(frameSize)] = type;
+    if (size > 0) {
+        memcpy(frame.data() + sizeof(frameSize) + 1, data, size);
+    }
+
+    size_t sent = 0;
+    while (sent < frame.size()) {
+        ssize_t written = send(socket, frame.data() + sent, frame.size() - sent, 0);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        sent += written;
+    }
+    return B_OK;
+}
+
+status_t FrameSocket::ReadFrame(int socket, uint32 maxSize, uint8* type, vector<uint8>* payload) {
+    uint32 size;
+    status_t status = ReadFully(socket, &size, sizeof(size));
+    if (status != B_OK) {
+        return status;
+    }
+    size = ntohl(size);
+    if (size == 0 || size > maxSize) {
+        return B_BAD_DATA;
+    }
+    status = ReadFully(socket, type, sizeof(*type));
+    if (status != B_OK) {
+        return status;
+    }
+    payload->resize(size - 1);
+    return ReadFully(socket, payload->data(), payload->size());
+}
+
+status_t FrameSocket::ReadFully(int socket, void* data, size_t size) {
+    uint8* buffer = static_cast<uint8*>(data);
+    while (size > 0) {
+        ssize_t bytesRead = recv(socket, buffer, size, 0);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            return errno;
+        }
+        if (bytesRead == 0) {
+            return B_IO_ERROR;      // closed by the other side
+        }
+        buffer += bytesRead;
+        size -= bytesRead;
+    }
+    return B_OK;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * blocking frame I/O on TCP sockets, shared by the session relay and vault sync connections.
+ * a frame is the size of type and payload as uint32 in network byte order, a uint8 type and the payload.
+ */
+#pragma once
+
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+class FrameSocket {
+
+public:
+    /**
+     * connects to host and port, with small frames going out right away.
+     */
+    static status_t     Connect(const char* host, uint16 port, int* socket);
+    static status_t     WriteFrame(int socket, uint8 type, const void* data, size_t size);
+    /**
+     * reads the next frame, failing on frames larger than maxSize and on a closed connection.
+     */
+    static status_t     ReadFrame(int socket, uint32 maxSize, uint8* type, vector<uint8>* payload);
+
+    static const size_t kHeaderSize = sizeof(uint32) + sizeof(uint8);
+
+private:
+    static status_t     ReadFully(int socket, void* data, size_t size);
+};
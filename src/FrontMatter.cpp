@@ -0,0 +1,190 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "FrontMatter.h"
+
+#include <cstring>
+#include <stdio.h>
+
+static bool IsDelimiterLine(const char* line, int32 length, const char* delimiter) {
+    if (length < 3 || strncmp(line, delimiter, 3) != 0) {
+        return false;
+    }
+    // allow trailing whitespace after the delimiter
+    for (int32 pos = 3; pos < length; pos++) {
+        if (line[pos] != ' ' && line[pos] != '\t') {
+            return false;
+        }
+    }
+    return true;
+}
+
+int32 FrontMatter::Detect(const char* text, int32 size) {
+    if (size < 3 || strncmp(text, "---", 3) != 0) {
+        return 0;
+    }
+    const char* end = text + (size < kMaxFrontMatterSize ? size : kMaxFrontMatterSize);
+    const char* eol = static_cast<const char*>(memchr(text, '\n', end - text));
+    if (eol == NULL || !IsDelimiterLine(text, eol - text, "---")) {
+        return 0;
+    }
+
+    const char* line = eol + 1;
+    while (line < end) {
+        eol = static_cast<const char*>(memchr(line, '\n', end - line));
+        const char* lineEnd = (eol != NULL ? eol : end);
+
+        if (IsDelimiterLine(line, lineEnd - line, "---") || IsDelimiterLine(line, lineEnd - line, "...")) {
+            return (eol != NULL ? eol + 1 : end) - text;
+        }
+        if (eol == NULL) {
+            break;
+        }
+        line = eol + 1;
+    }
+    // unclosed, so this is just a thematic break
+    return 0;
+}
+
+status_t FrontMatter::Parse(const char* text, int32 size, front_matter* result) {
+    int32 length = Detect(text, size);
+    if (length == 0) {
+        return B_NAME_NOT_FOUND;
+    }
+    result->length = length;
+
+    // skip opening delimiter line, stop before closing delimiter line
+    const char* pos = static_cast<const char*>(memchr(text, '\n', length)) + 1;
+    const char* end = text + length;
+    BString listKey;    // key of a block list ("key:" followed by "- item" lines)
+
+    while (pos < end) {
+        const char* eol = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        const char* lineEnd = (eol != NULL ? eol : end);
+        BString line(pos, lineEnd - pos);
+        pos = lineEnd + 1;
+
+        if (pos >= end) {
+            break;      // closing delimiter
+        }
+        BString trimmed(line);
+        trimmed.Trim();
+        if (trimmed.IsEmpty() || trimmed.ByteAt(0) == '#') {
+            continue;
+        }
+
+        if (trimmed.ByteAt(0) == '-' && (trimmed.Length() == 1 || trimmed.ByteAt(1) == ' ')) {
+            if (!listKey.IsEmpty()) {
+                BString item;
+                trimmed.CopyInto(item, 1, trimmed.Length() - 1);
+                AddValue(listKey, Unquote(item.Trim()), result);
+            }
+            continue;
+        }
+        // nested mappings are not supported
+        if (line.ByteAt(0) == ' ' || line.ByteAt(0) == '\t') {
+            continue;
+        }
+
+        int32 colon = line.FindFirst(':');
+        if (colon <= 0) {
+            continue;
+        }
+        BString key, value;
+        line.CopyInto(key, 0, colon);
+        line.CopyInto(value, colon + 1, line.Length() - colon - 1);
+        key.Trim().ToLower();
+        value.Trim();
+
+        if (value.IsEmpty()) {
+            listKey = key;
+            continue;
+        }
+        listKey = "";
+
+        if (value.ByteAt(0) == '[' || key == "tags" || key == "aliases") {
+            vector<BString> items;
+            ParseList(value, &items);
+            for (auto item : items) {
+                AddValue(key, item, result);
+            }
+        } else {
+            AddValue(key, Unquote(value), result);
+        }
+    }
+    return B_OK;
+}
+
+void FrontMatter::AddValue(const BString& key, BString value, front_matter* result) {
+    if (value.IsEmpty()) {
+        return;
+    }
+    if (key == "tags" || key == "tag" || key == "keywords") {
+        if (value.ByteAt(0) == '#') {
+            value.Remove(0, 1);
+        }
+        result->tags.push_back(value);
+    } else if (key == "aliases" || key == "alias") {
+        result->aliases.push_back(value);
+    } else if (key == "title") {
+        result->title = value;
+    } else if (key == "date" || (key == "created" && result->date == 0)) {
+        result->date = ParseDate(value.String());
+    } else {
+        result->fields.AddString(key.String(), value.String());
+    }
+}
+
+void FrontMatter::ParseList(BString value, vector<BString>* list) {
+    if (value.ByteAt(0) == '[') {
+        value.Remove(0, 1);
+        int32 close = value.FindFirst(']');
+        if (close >= 0) {
+            value.Truncate(close);
+        }
+    }
+    int32 start = 0;
+    while (start <= value.Length()) {
+        int32 comma = value.FindFirst(',', start);
+        if (comma < 0) {
+            comma = value.Length();
+        }
+        BString item;
+        value.CopyInto(item, start, comma - start);
+        item = Unquote(item.Trim());
+        if (!item.IsEmpty()) {
+            list->push_back(item);
+        }
+        start = comma + 1;
+    }
+}
+
+BString FrontMatter::Unquote(BString value) {
+    int32 length = value.Length();
+    if (length >= 2) {
+        char first = value.ByteAt(0);
+        if ((first == '"' || first == '\'') && value.ByteAt(length - 1) == first) {
+            value.Remove(length - 1, 1);
+            value.Remove(0, 1);
+        }
+    }
+    return value;
+}
+
+time_t FrontMatter::ParseDate(const char* value) {
+    struct tm date;
+    memset(&date, 0, sizeof(date));
+
+    int matched = sscanf(value, "%4d-%2d-%2d%*[ T]%2d:%2d:%2d",
+        &date.tm_year, &date.tm_mon, &date.tm_mday, &date.tm_hour, &date.tm_min, &date.tm_sec);
+    if (matched < 3) {
+        printf("FrontMatter: could not parse date '%s'.\n", value);
+        return 0;
+    }
+    date.tm_year -= 1900;
+    date.tm_mon  -= 1;
+
+    return timegm(&date);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * detects and parses a YAML front matter block at the start of a note, e.g.
+ *
+ * ---
+ * title: My Note
+ * date: 2024-05-01
+ * tags: [haiku, markdown]
+ * aliases:
+ *   - note
+ * ---
+ *
+ * only the flat subset of YAML commonly used for note metadata is supported.
+ */
+#pragma once
+
+#include <Message.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+typedef struct front_matter {
+    BString             title;
+    vector<BString>     tags;
+    vector<BString>     aliases;
+    time_t              date = 0;       // 0 if not set or not parseable
+    /**
+     * all other scalar fields as raw strings, keyed by field name
+     */
+    BMessage            fields;
+    /**
+     * size of the whole block including delimiters, markdown starts after it
+     */
+    int32               length = 0;
+} front_matter;
+
+class FrontMatter {
+
+public:
+    /**
+     * returns the length of the front matter block at the start of text, or 0 if there is none.
+     * only the first kMaxFrontMatterSize bytes are searched for the closing delimiter.
+     */
+    static int32        Detect(const char* text, int32 size);
+    /**
+     * parses the front matter into typed fields, returns B_NAME_NOT_FOUND if there is none.
+     */
+    static status_t     Parse(const char* text, int32 size, front_matter* result);
+    /**
+     * parses ISO 8601 dates like 2024-05-01, 2024-05-01 12:30 or 2024-05-01T12:30:00 (UTC).
+     */
+    static time_t       ParseDate(const char* value);
+
+    static const int32  kMaxFrontMatterSize = 64 * 1024;
+
+private:
+    static void         AddValue(const BString& key, BString value, front_matter* result);
+    static void         ParseList(BString value, vector<BString>* list);
+    static BString      Unquote(BString value);
+};
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "FuzzyMatcher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+
+#include "TaskScheduler.h"
+
+// scoring weights
+static const int32 kBonusMatch       = 1;
+static const int32 kBonusFirstChar   = 8;
+static const int32 kBonusWordStart   = 6;
+static const int32 kBonusConsecutive = 5;
+static const int32 kMaxGapPenalty    = 3;
+
+static inline bool IsSeparator(char c) {
+    return c == ' ' || c == '_' || c == '-' || c == '/' || c == '.' || c == ':';
+}
+
+FuzzyMatcher::FuzzyMatcher() {
+}
+
+FuzzyMatcher::~FuzzyMatcher() {
+}
+
+void FuzzyMatcher::SetCandidates(const vector<BString>& candidates) {
+    fCandidates.clear();
+    fCandidates.reserve(candidates.size());
+    fMasks.clear();
+    fMasks.reserve(candidates.size());
+
+    for (auto candidate : candidates) {
+        candidate.ToLower();
+        fMasks.push_back(CharMask(candidate.String(), candidate.Length()));
+        fCandidates.push_back(candidate);
+    }
+    fLastQuery = "";
+    fLastMatches.clear();
+}
+
+vector<fuzzy_match> FuzzyMatcher::Match(const char* query, int32 maxResults) {
+    BString lowerQuery(query);
+    lowerQuery.ToLower();
+    int32 queryLength = lowerQuery.Length();
+    vector<fuzzy_match> matches;
+
+    if (queryLength == 0) {
+        // no query, keep original order
+        int32 count = min((int32)fCandidates.size(), maxResults);
+        for (int32 index = 0; index < count; index++) {
+            matches.push_back({index, 0});
+        }
+        fLastQuery = "";
+        fLastMatches.clear();
+        return matches;
+    }
+
+    uint64 queryMask = CharMask(lowerQuery.String(), queryLength);
+
+    // a longer query can only match a subset of what the shorter one matched
+    bool narrow = !fLastQuery.IsEmpty() && queryLength >= fLastQuery.Length()
+                  && strncmp(lowerQuery.String(), fLastQuery.String(), fLastQuery.Length()) == 0;
+    if (narrow) {
+        ScoreCandidates(fLastMatches.data(), fLastMatches.size(),
+            lowerQuery.String(), queryLength, queryMask, &matches);
+    } else {
+        ScoreCandidates(NULL, fCandidates.size(),
+            lowerQuery.String(), queryLength, queryMask, &matches);
+    }
+
+    fLastQuery = lowerQuery;
+    fLastMatches.clear();
+    fLastMatches.reserve(matches.size());
+    for (auto match : matches) {
+        fLastMatches.push_back(match.index);
+    }
+    // keep indices sorted for cache friendly access on the next narrowing pass
+    sort(fLastMatches.begin(), fLastMatches.end());
+
+    SelectTop(&matches, maxResults);
+
+    return matches;
+}
+
+void FuzzyMatcher::ScoreCandidates(const int32* indices, int32 count,
+                                   const char* query, int32 queryLength, uint64 queryMask,
+                                   vector<fuzzy_match>* matches) {
+    // branch free mask test over a flat array, which the compiler can vectorize
+    vector<uint8> candidates(count);
+    const uint64* masks = fMasks.data();
+    if (indices == NULL) {
+        for (int32 item = 0; item < count; item++) {
+            candidates[item] = (masks[item] & queryMask) == queryMask;
+        }
+    } else {
+        for (int32 item = 0; item < count; item++) {
+            candidates[item] = (masks[indices[item]] & queryMask) == queryMask;
+        }
+    }
+
+    for (int32 item = 0; item < count; item++) {
+        if (!candidates[item]) {
+            continue;
+        }
+        int32 index = (indices == NULL ? item : indices[item]);
+        const BString& candidate = fCandidates[index];
+        int32 score = Score(query, queryLength, candidate.String(), candidate.Length());
+        if (score >= 0) {
+            matches->push_back({index, score});
+        }
+    }
+}
+
+void FuzzyMatcher::SelectTop(vector<fuzzy_match>* matches, int32 maxResults) {
+    auto better = [](const fuzzy_match& a, const fuzzy_match& b) {
+        return a.score > b.score || (a.score == b.score && a.index < b.index);
+    };
+    if ((int32)matches->size() > maxResults) {
+        partial_sort(matches->begin(), matches->begin() + maxResults, matches->end(), better);
+        matches->resize(maxResults);
+    } else {
+        sort(matches->begin(), matches->end(), better);
+    }
+}
+
+int32 FuzzyMatcher::Score(const char* query, int32 queryLength,
+                          const char* candidate, int32 candidateLength) {
+    int32 score = 0;
+    int32 queryPos = 0;
+    int32 lastMatch = -1;
+
+    for (int32 pos = 0; pos < candidateLength && queryPos < queryLength; pos++) {
+        if (candidate[pos] != query[queryPos]) {
+            continue;
+        }
+        score += kBonusMatch;
+        if (pos == 0) {
+            score += kBonusFirstChar;
+        } else if (IsSeparator(candidate[pos - 1])) {
+            score += kBonusWordStart;
+        }
+        if (lastMatch >= 0) {
+            if (lastMatch == pos - 1) {
+                score += kBonusConsecutive;
+            } else {
+                score -= min(pos - lastMatch - 1, kMaxGapPenalty);
+            }
+        }
+        lastMatch = pos;
+        queryPos++;
+    }
+    if (queryPos < queryLength) {
+        return -1;
+    }
+    // prefer shorter candidates on equal matches
+    score -= (candidateLength - queryLength) / 16;
+
+    return max(score, (int32)0);
+}
+
+uint64 FuzzyMatcher::CharMask(const char* text, int32 length) {
+    uint64 mask = 0;
+    for (int32 pos = 0; pos < length; pos++) {
+        uint8 c = text[pos];
+        if (c >= 'a' && c <= 'z') {
+            mask |= 1ULL << (c - 'a');
+        } else if (c >= '0' && c <= '9') {
+            mask |= 1ULL << (26 + c - '0');
+        } else {
+            mask |= 1ULL << (36 + c % 28);
+        }
+    }
+    return mask;
+}
+
+ParallelFuzzyMatcher::ParallelFuzzyMatcher(int32 threadCount)
+    : fThreadCount(threadCount > 0 ? threadCount : TaskScheduler::Default()->CountThreads()) {
+}
+
+void ParallelFuzzyMatcher::ScoreCandidates(const int32* indices, int32 count,
+                                           const char* query, int32 queryLength, uint64 queryMask,
+                                           vector<fuzzy_match>* matches) {
+    if (count < kMinParallelCount || fThreadCount == 1) {
+        FuzzyMatcher::ScoreCandidates(indices, count, query, queryLength, queryMask, matches);
+        return;
+    }
+
+    // score equally sized chunks into separate result lists, so no locking is needed.
+    // the calling thread scores the first chunk itself while the scheduler runs the others.
+    int32 chunkSize = (count + fThreadCount - 1) / fThreadCount;
+    vector<vector<fuzzy_match>> chunkMatches(fThreadCount);
+    vector<TaskHandle> tasks;
+
+    auto scoreChunk = [=, &chunkMatches](int32 chunk, int32 from, int32 to) {
+        if (indices != NULL) {
+            FuzzyMatcher::ScoreCandidates(indices + from, to - from,
+                query, queryLength, queryMask, &chunkMatches[chunk]);
+        } else {
+            // without an index list, the chunk needs its own index range
+            vector<int32> chunkIndices(to - from);
+            for (int32 item = from; item < to; item++) {
+                chunkIndices[item - from] = item;
+            }
+            FuzzyMatcher::ScoreCandidates(chunkIndices.data(), to - from,
+                query, queryLength, queryMask, &chunkMatches[chunk]);
+        }
+    };
+
+    for (int32 chunk = 1; chunk < fThreadCount; chunk++) {
+        int32 from = chunk * chunkSize;
+        int32 to = min(from + chunkSize, count);
+        if (from >= to) {
+            break;
+        }
+        tasks.push_back(TaskScheduler::Default()->Submit(TASK_PRIORITY_VIEWPORT,
+            [=, &scoreChunk](const CancelToken&) { scoreChunk(chunk, from, to); }));
+    }
+    scoreChunk(0, 0, min(chunkSize, count));
+
+    for (auto& task : tasks) {
+        task.Wait();
+    }
+    for (auto& chunk : chunkMatches) {
+        matches->insert(matches->end(), chunk.begin(), chunk.end());
+    }
+}
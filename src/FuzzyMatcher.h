@@ -0,0 +1,80 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * fuzzy subsequence matcher for quick navigation palettes.
+ * results narrow down incrementally while a query is typed.
+ */
+#pragma once
+
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+typedef struct fuzzy_match {
+    int32           index;      // index into candidates
+    int32           score;      // higher is better
+} fuzzy_match;
+
+class FuzzyMatcher {
+
+public:
+                        FuzzyMatcher();
+    virtual             ~FuzzyMatcher();
+
+    void                SetCandidates(const vector<BString>& candidates);
+    int32               CountCandidates()   { return fCandidates.size(); }
+
+    /**
+     * returns the best maxResults matches for query, sorted by descending score.
+     * if the query extends the previous one, only the previous matches are re-scored.
+     */
+    vector<fuzzy_match> Match(const char* query, int32 maxResults);
+
+    /**
+     * scores a lower case query against a lower case candidate, returns -1 if it does not match.
+     */
+    static int32        Score(const char* query, int32 queryLength,
+                              const char* candidate, int32 candidateLength);
+    /**
+     * bit set of characters contained in text, used to quickly rule out candidates.
+     */
+    static uint64       CharMask(const char* text, int32 length);
+
+protected:
+    /**
+     * filters candidates by character mask first, then scores the remaining ones.
+     */
+    virtual void        ScoreCandidates(const int32* indices, int32 count,
+                                        const char* query, int32 queryLength, uint64 queryMask,
+                                        vector<fuzzy_match>* matches);
+    static void         SelectTop(vector<fuzzy_match>* matches, int32 maxResults);
+
+    vector<BString>     fCandidates;    // lower case
+    vector<uint64>      fMasks;
+
+private:
+    BString             fLastQuery;
+    vector<int32>       fLastMatches;   // all matching indices for the last query
+};
+
+/**
+ * scores large candidate lists in parallel chunks on the shared task scheduler.
+ */
+class ParallelFuzzyMatcher : public FuzzyMatcher {
+
+public:
+                        ParallelFuzzyMatcher(int32 threadCount = 0);
+
+    static const int32  kMinParallelCount = 8192;
+
+protected:
+    virtual void        ScoreCandidates(const int32* indices, int32 count,
+                                        const char* query, int32 queryLength, uint64 queryMask,
+                                        vector<fuzzy_match>* matches);
+
+private:
+    int32               fThreadCount;
+};
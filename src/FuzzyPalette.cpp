@@ -0,0 +1,141 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "FuzzyPalette.h"
+
+#include <LayoutBuilder.h>
+#include <ScrollView.h>
+#include <StringItem.h>
+#include <algorithm>
+#include <stdio.h>
+
+static const uint32 kMsgQueryChanged  = 'fqch';
+static const uint32 kMsgResultInvoked = 'fqiv';
+
+FuzzyPalette::FuzzyPalette(const char* title, BMessenger target, BMessage* invokeMessage,
+                           FuzzyMatcher* matcher)
+    : BWindow(BRect(0.0, 0.0, 420.0, 320.0), title, B_FLOATING_WINDOW_LOOK, B_FLOATING_APP_WINDOW_FEEL,
+              B_ASYNCHRONOUS_CONTROLS | B_AUTO_UPDATE_SIZE_LIMITS | B_CLOSE_ON_ESCAPE | B_NOT_ZOOMABLE),
+      fMatcher(matcher != NULL ? matcher : new FuzzyMatcher()),
+      fTarget(target),
+      fInvokeMessage(invokeMessage)
+{
+    fQueryControl = new BTextControl("query", NULL, "", NULL);
+    fQueryControl->SetModificationMessage(new BMessage(kMsgQueryChanged));
+
+    fResultList = new BListView("results");
+    fResultList->SetInvocationMessage(new BMessage(kMsgResultInvoked));
+
+    BLayoutBuilder::Group<>(this, B_VERTICAL, 0.0)
+        .SetInsets(4.0)
+        .Add(fQueryControl)
+        .Add(new BScrollView("resultScrollView", fResultList, 0, false, true));
+}
+
+FuzzyPalette::~FuzzyPalette() {
+    delete fMatcher;
+    delete fInvokeMessage;
+}
+
+void FuzzyPalette::SetItems(const vector<BString>& labels) {
+    fLabels = labels;
+    fMatcher->SetCandidates(labels);
+    UpdateResults();
+}
+
+void FuzzyPalette::Show() {
+    fQueryControl->SetText("");
+    fQueryControl->MakeFocus(true);
+    UpdateResults();
+
+    if (IsHidden()) {
+        BWindow::Show();
+    } else {
+        Activate();
+    }
+}
+
+bool FuzzyPalette::QuitRequested() {
+    // palettes are reused, so only hide on close, the owner quits them explicitly
+    if (!IsHidden()) {
+        Hide();
+    }
+    return false;
+}
+
+void FuzzyPalette::MessageReceived(BMessage* message) {
+    switch (message->what) {
+        case kMsgQueryChanged:
+        {
+            UpdateResults();
+            break;
+        }
+        case kMsgResultInvoked:
+        {
+            Invoke();
+            break;
+        }
+        default:
+        {
+            BWindow::MessageReceived(message);
+            break;
+        }
+    }
+}
+
+void FuzzyPalette::DispatchMessage(BMessage* message, BHandler* handler) {
+    if (message->what == B_KEY_DOWN) {
+        const char* bytes = message->GetString("bytes", "");
+        int32 selection = fResultList->CurrentSelection();
+
+        switch (bytes[0]) {
+            case B_UP_ARROW:
+                fResultList->Select(max(selection - 1, (int32)0));
+                fResultList->ScrollToSelection();
+                return;
+            case B_DOWN_ARROW:
+                fResultList->Select(min(selection + 1, fResultList->CountItems() - 1));
+                fResultList->ScrollToSelection();
+                return;
+            case B_ENTER:
+                Invoke();
+                return;
+            case B_ESCAPE:
+                Hide();
+                return;
+        }
+    }
+    BWindow::DispatchMessage(message, handler);
+}
+
+void FuzzyPalette::UpdateResults() {
+    bigtime_t startTime = system_time();
+    fMatches = fMatcher->Match(fQueryControl->Text(), kMaxResults);
+    bigtime_t matchTime = system_time() - startTime;
+
+    for (int32 index = fResultList->CountItems() - 1; index >= 0; index--) {
+        delete fResultList->RemoveItem(index);
+    }
+    for (auto match : fMatches) {
+        fResultList->AddItem(new BStringItem(fLabels[match.index].String()));
+    }
+    if (!fMatches.empty()) {
+        fResultList->Select(0);
+    }
+    printf("FuzzyPalette: %zu results for '%s' in %lld us.\n", fMatches.size(), fQueryControl->Text(),
+        (long long)matchTime);
+}
+
+void FuzzyPalette::Invoke() {
+    int32 selection = fResultList->CurrentSelection();
+    if (selection < 0 || selection >= (int32)fMatches.size()) {
+        return;
+    }
+    BMessage message(*fInvokeMessage);
+    message.AddInt32("index", fMatches[selection].index);
+    fTarget.SendMessage(&message);
+
+    Hide();
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * floating quick navigation palette with a query field and a list of fuzzy matched results.
+ * on invocation, a copy of the invoke message with the candidate "index" is sent to the target.
+ */
+#pragma once
+
+#include <ListView.h>
+#include <Messenger.h>
+#include <TextControl.h>
+#include <Window.h>
+#include <vector>
+
+#include "FuzzyMatcher.h"
+
+using namespace std;
+
+class FuzzyPalette : public BWindow {
+
+public:
+                        FuzzyPalette(const char* title, BMessenger target, BMessage* invokeMessage,
+                                     FuzzyMatcher* matcher = NULL);
+    virtual             ~FuzzyPalette();
+
+    /**
+     * sets the candidate labels, must be called with the window locked.
+     */
+    void                SetItems(const vector<BString>& labels);
+
+    virtual void        MessageReceived(BMessage* message);
+    virtual void        DispatchMessage(BMessage* message, BHandler* handler);
+    virtual bool        QuitRequested();
+    virtual void        Show();
+
+    static const int32  kMaxResults = 50;
+
+protected:
+    void                UpdateResults();
+    void                Invoke();
+
+    FuzzyMatcher*       fMatcher;
+
+private:
+    BTextControl*       fQueryControl;
+    BListView*          fResultList;
+
+    vector<BString>     fLabels;
+    vector<fuzzy_match> fMatches;
+
+    BMessenger          fTarget;
+    BMessage*           fInvokeMessage;
+};
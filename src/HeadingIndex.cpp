@@ -0,0 +1,160 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "HeadingIndex.h"
+
+#include <algorithm>
+
+static bool CompareHeadingOffset(const heading_entry& heading, int64 offset) {
+    return heading.offset < offset;
+}
+
+HeadingIndex::HeadingIndex()
+    : fSectionsValid(true),
+      fChangedIndex(-1),
+      fInsertedCount(0) {
+}
+
+HeadingIndex::~HeadingIndex() {
+}
+
+void HeadingIndex::Clear() {
+    fHeadings.clear();
+    fSectionsValid = true;
+    fChangedIndex = -1;
+    fReplaced.clear();
+}
+
+void HeadingIndex::Update(markup_map* markupMap, const char* text, int64 start, int64 end,
+                          int64 textOffset) {
+    // remove stale headings in the updated range
+    auto from = lower_bound(fHeadings.begin(), fHeadings.end(), start, CompareHeadingOffset);
+    auto to   = lower_bound(from, fHeadings.end(), end + 1, CompareHeadingOffset);
+    int32 index = from - fHeadings.begin();
+    int32 removedEnd = to - fHeadings.begin();
+
+    vector<heading_entry> found;
+    heading_entry heading;
+    bool inHeading = false;
+
+    auto mapEnd = markupMap->upper_bound(end);
+    for (auto mapIter = markupMap->lower_bound(start); mapIter != mapEnd; mapIter++) {
+        for (auto item : *mapIter->second) {
+            if (item->markup_class == MD_BLOCK_BEGIN && item->markup_type.block_type == MD_BLOCK_H) {
+                heading = heading_entry();
+                heading.offset = item->offset;
+                heading.level  = (item->detail != NULL ? item->detail->GetUInt8("level", 1) : 1);
+                inHeading = true;
+            } else if (inHeading && item->markup_class == MD_TEXT) {
+                heading.title.Append(text + (item->offset - textOffset), item->length);
+            } else if (inHeading && item->markup_class == MD_BLOCK_END
+                       && item->markup_type.block_type == MD_BLOCK_H) {
+                heading.endOffset = item->offset;
+                found.push_back(heading);
+                inHeading = false;
+            }
+        }
+    }
+    ReplaceSections(index, removedEnd, found.size());
+    auto insertPos = fHeadings.erase(fHeadings.begin() + index, fHeadings.begin() + removedEnd);
+    fHeadings.insert(insertPos, found.begin(), found.end());
+}
+
+void HeadingIndex::ShiftOffsets(int64 start, int64 end, int64 delta) {
+    auto from = lower_bound(fHeadings.begin(), fHeadings.end(), start, CompareHeadingOffset);
+    auto to   = lower_bound(from, fHeadings.end(), end, CompareHeadingOffset);
+
+    ReplaceSections(from - fHeadings.begin(), to - fHeadings.begin(), 0);
+    for (auto heading = fHeadings.erase(from, to); heading != fHeadings.end(); heading++) {
+        heading->offset += delta;
+        heading->endOffset += delta;
+    }
+}
+
+void HeadingIndex::SwapRanges(int64 start, int64 middle, int64 end) {
+    auto from  = lower_bound(fHeadings.begin(), fHeadings.end(), start, CompareHeadingOffset);
+    auto split = lower_bound(from, fHeadings.end(), middle, CompareHeadingOffset);
+    auto to    = lower_bound(split, fHeadings.end(), end, CompareHeadingOffset);
+
+    for (auto heading = from; heading != split; heading++) {
+        heading->offset += end - middle;
+        heading->endOffset += end - middle;
+    }
+    for (auto heading = split; heading != to; heading++) {
+        heading->offset -= middle - start;
+        heading->endOffset -= middle - start;
+    }
+    rotate(from, split, to);
+    // levels change places, which moves section ends
+    if (from != split && split != to) {
+        fSectionsValid = false;
+    }
+}
+
+int32 HeadingIndex::FindHeadingIndex(int64 offset) {
+    auto iter = upper_bound(fHeadings.begin(), fHeadings.end(), offset,
+        [](int64 value, const heading_entry& heading) { return value < heading.offset; });
+
+    return (iter - fHeadings.begin()) - 1;
+}
+
+void HeadingIndex::ReplaceSections(int32 index, int32 end, int32 inserted) {
+    if (!fSectionsValid || (index == end && inserted == 0)) {
+        return;
+    }
+    // an edit removes the headings of the blocks it touched and inserts those parsed again at the same place
+    if (fChangedIndex < 0 || (fInsertedCount == 0 && index == fChangedIndex)) {
+        if (fChangedIndex < 0) {
+            fChangedIndex = index;
+            fReplaced.clear();
+        }
+        for (int32 replaced = index; replaced < end; replaced++) {
+            const heading_entry& heading = fHeadings[replaced];
+            fReplaced.push_back({heading.level, heading.parent, heading.sectionEnd});
+        }
+        fInsertedCount = inserted;
+    } else if (index == end && index == fChangedIndex + fInsertedCount) {
+        fInsertedCount += inserted;
+    } else {
+        fSectionsValid = false;
+    }
+}
+
+void HeadingIndex::UpdateSections() {
+    if (fSectionsValid && fChangedIndex < 0) {
+        return;
+    }
+    if (fSectionsValid && fInsertedCount == (int32) fReplaced.size()) {
+        bool sameLevels = true;
+        for (int32 index = 0; index < fInsertedCount && sameLevels; index++) {
+            sameLevels = fHeadings[fChangedIndex + index].level == fReplaced[index].level;
+        }
+        if (sameLevels) {
+            for (int32 index = 0; index < fInsertedCount; index++) {
+                fHeadings[fChangedIndex + index].parent = fReplaced[index].parent;
+                fHeadings[fChangedIndex + index].sectionEnd = fReplaced[index].sectionEnd;
+            }
+            fChangedIndex = -1;
+            return;
+        }
+    }
+    fSectionsValid = true;
+    fChangedIndex = -1;
+
+    // headings with open sections, each one lower in level than the one before
+    vector<int32> open;
+    for (int32 index = 0; index < (int32) fHeadings.size(); index++) {
+        heading_entry& heading = fHeadings[index];
+        while (!open.empty() && fHeadings[open.back()].level >= heading.level) {
+            fHeadings[open.back()].sectionEnd = index;
+            open.pop_back();
+        }
+        heading.parent = (open.empty() ? -1 : open.back());
+        open.push_back(index);
+    }
+    for (auto index : open) {
+        fHeadings[index].sectionEnd = fHeadings.size();
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * keeps all headings of a document sorted by offset, built from the markup map of the parser.
+ */
+#pragma once
+
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+#include "MarkdownParser.h"
+
+using namespace std;
+
+typedef struct heading_entry {
+    int64           offset;         // start of the heading block
+    int64           endOffset;      // end of the heading block
+    uint8           level;          // 1 - 6
+    BString         title;          // heading text w/o markup
+    int32           parent;         // index of the heading whose section holds this one, -1 at top level
+    int32           sectionEnd;     // index of the next heading outside of this section, or the count
+} heading_entry;
+
+class HeadingIndex {
+
+public:
+                        HeadingIndex();
+    virtual             ~HeadingIndex();
+
+    void                Clear();
+    /**
+     * replaces all headings in the given range with those found in the markup map for that range.
+     * text holds the document text starting at textOffset, which must cover the range.
+     */
+    void                Update(markup_map* markupMap, const char* text, int64 start, int64 end,
+                               int64 textOffset = 0);
+    /**
+     * drops the headings from start to end of the text before an edit and moves those after it by delta.
+     */
+    void                ShiftOffsets(int64 start, int64 end, int64 delta);
+    /**
+     * moves the headings after the text from start to middle and from middle to end swapped places.
+     */
+    void                SwapRanges(int64 start, int64 middle, int64 end);
+
+    int32               CountHeadings()             { return fHeadings.size(); }
+    const heading_entry* HeadingAt(int32 index)     { UpdateSections(); return &fHeadings[index]; }
+    const vector<heading_entry>* Headings()         { UpdateSections(); return &fHeadings; }
+
+    /**
+     * returns the index of the last heading starting at or before offset, or -1, in O(log n).
+     */
+    int32               FindHeadingIndex(int64 offset);
+
+private:
+    typedef struct section_link {
+        uint8               level;
+        int32               parent;
+        int32               sectionEnd;
+    } section_link;
+
+    /**
+     * notes that the headings from index to end were replaced by inserted new ones.
+     */
+    void                ReplaceSections(int32 index, int32 end, int32 inserted);
+    /**
+     * brings parents and section ends up to date before they are read. new headings taking the levels
+     * of those they replaced take their links as well, only other changes need a pass over all headings.
+     */
+    void                UpdateSections();
+
+    vector<heading_entry>   fHeadings;
+    bool                    fSectionsValid;     // w/o a pass over all headings, see UpdateSections()
+    int32                   fChangedIndex;      // of the first heading replaced, -1 if none
+    int32                   fInsertedCount;     // headings inserted there
+    vector<section_link>    fReplaced;          // links of the headings replaced
+};
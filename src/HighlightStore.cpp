@@ -0,0 +1,324 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "HighlightStore.h"
+
+#include <algorithm>
+#include <Entry.h>
+#include <File.h>
+#include <fs_attr.h>
+#include <map>
+#include <Node.h>
+#include <Path.h>
+#include <stdio.h>
+#include <string.h>
+#include <TypeConstants.h>
+
+static const char* kHighlightAttribute = "senity:highlights";
+static const char* kSidecarSuffix = ".highlights";
+
+static const uint32 kHighlightMagic = 'SHLT';
+static const uint32 kHighlightVersion = 1;
+static const uint32 kFingerprintPrime = 0x01000193;
+// distance searched around a record before searching the whole text
+static const int64 kNearbyDistance = 256;
+// bits of the filter the whole text search tests before looking a fingerprint up
+static const uint32 kSearchFilterSize = 1 << 20;
+
+typedef struct highlight_header {
+    uint32          magic;
+    uint32          version;
+    uint32          labelCount;
+    uint32          recordCount;
+} highlight_header;
+
+static inline uint32 FilterBucket(uint32 fingerprint) {
+    return (fingerprint ^ fingerprint >> 16) % kSearchFilterSize;
+}
+
+status_t HighlightStore::Read(const char* path, highlight_set* highlights) {
+    highlights->labels.clear();
+    highlights->records.clear();
+
+    BNode node(path);
+    status_t status = node.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    vector<uint8> data;
+    attr_info info;
+    if (node.GetAttrInfo(kHighlightAttribute, &info) == B_OK) {
+        data.resize(info.size);
+        ssize_t bytesRead = node.ReadAttr(kHighlightAttribute, B_RAW_TYPE, 0, data.data(), info.size);
+        if (bytesRead < 0)
+            return bytesRead;
+        data.resize(bytesRead);
+    } else {
+        BFile sidecar(SidecarPath(path).String(), B_READ_ONLY);
+        off_t size;
+        if (sidecar.InitCheck() != B_OK || sidecar.GetSize(&size) != B_OK)
+            return B_OK;
+
+        data.resize(size);
+        ssize_t bytesRead = sidecar.ReadAt(0, data.data(), size);
+        if (bytesRead < 0)
+            return bytesRead;
+        data.resize(bytesRead);
+    }
+    return Parse(data.data(), data.size(), highlights);
+}
+
+status_t HighlightStore::Write(const char* path, const highlight_set& highlights) {
+    BNode node(path);
+    status_t status = node.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    BString sidecarPath = SidecarPath(path);
+    if (highlights.records.empty()) {
+        node.RemoveAttr(kHighlightAttribute);
+        BEntry(sidecarPath.String()).Remove();
+        return B_OK;
+    }
+
+    highlight_header header = { kHighlightMagic, kHighlightVersion, (uint32) highlights.labels.size(),
+                                (uint32) highlights.records.size() };
+    vector<uint8> data(sizeof(header));
+    memcpy(data.data(), &header, sizeof(header));
+    for (auto& label : highlights.labels) {
+        data.insert(data.end(), label.type.String(), label.type.String() + label.type.Length() + 1);
+        data.insert(data.end(), label.value.String(), label.value.String() + label.value.Length() + 1);
+    }
+    // records start aligned after the labels
+    data.resize((data.size() + 3) & ~3);
+    size_t recordStart = data.size();
+    data.resize(recordStart + highlights.records.size() * sizeof(highlight_record));
+    memcpy(data.data() + recordStart, highlights.records.data(), highlights.records.size() * sizeof(highlight_record));
+
+    ssize_t written = node.WriteAttr(kHighlightAttribute, B_RAW_TYPE, 0, data.data(), data.size());
+    if (written >= 0) {
+        BEntry(sidecarPath.String()).Remove();
+        return written == (ssize_t) data.size() ? B_OK : B_IO_ERROR;
+    }
+
+    // volumes w/o attributes get a hidden file next to the note
+    BFile sidecar(sidecarPath.String(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    status = sidecar.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    written = sidecar.WriteAt(0, data.data(), data.size());
+    if (written < 0)
+        return written;
+    return written == (ssize_t) data.size() ? B_OK : B_IO_ERROR;
+}
+
+uint32 HighlightStore::Fingerprint(const char* text, int64 length) {
+    uint32 hash = 0;
+    for (int64 index = 0; index < min(length, (int64) kFingerprintLength); index++)
+        hash = hash * kFingerprintPrime + (uint8) text[index];
+    return hash;
+}
+
+int32 HighlightStore::Anchor(const char* text, int64 length, highlight_set* highlights) {
+    vector<highlight_record>& records = highlights->records;
+    vector<bool> found(records.size(), false);
+    vector<int32> missing;
+    vector<uint32> offsets(records.size());
+    for (uint32 index = 0; index < records.size(); index++)
+        offsets[index] = records[index].offset;
+
+    // an edit moves all highlights after it by the same distance, so once one was found moved,
+    // those after it are tried there first. after one not found nearby, those following were likely
+    // moved further as well and are left to the search over the whole text.
+    int64 delta = 0;
+    bool previousFound = true;
+    for (uint32 index = 0; index < records.size(); index++) {
+        highlight_record& record = records[index];
+        if (Matches(text, length, record, record.offset + delta)) {
+            record.offset += delta;
+            found[index] = previousFound = true;
+            continue;
+        }
+        if (delta != 0 && Matches(text, length, record, record.offset)) {
+            delta = 0;
+            found[index] = previousFound = true;
+            continue;
+        }
+        // words repeat, so the nearest place is only taken for sure if the next record moved as far
+        int64 nearest = -1;
+        for (int64 distance = 1; previousFound && distance <= kNearbyDistance && !found[index]; distance++) {
+            for (int64 offset : { record.offset - distance, record.offset + distance }) {
+                if (!Matches(text, length, record, offset))
+                    continue;
+                if (nearest < 0)
+                    nearest = offset;
+                if (index + 1 == records.size()
+                    || Matches(text, length, records[index + 1], records[index + 1].offset + offset - record.offset)) {
+                    nearest = offset;
+                    found[index] = true;
+                    break;
+                }
+            }
+        }
+        if (nearest >= 0) {
+            delta = nearest - record.offset;
+            record.offset = nearest;
+            found[index] = true;
+        }
+        if (!found[index])
+            missing.push_back(index);
+        previousFound = found[index];
+    }
+    if (!missing.empty()) {
+        Search(text, length, offsets, missing, highlights, &found);
+    }
+
+    // keep the records found, sorted again and w/o overlaps
+    vector<highlight_record> anchored;
+    anchored.reserve(records.size());
+    for (uint32 index = 0; index < records.size(); index++) {
+        if (found[index])
+            anchored.push_back(records[index]);
+    }
+    stable_sort(anchored.begin(), anchored.end(), [](const highlight_record& a, const highlight_record& b) {
+        return a.offset < b.offset;
+    });
+    int32 dropped = records.size();
+    records.clear();
+    for (auto& record : anchored) {
+        if (records.empty() || record.offset >= records.back().offset + records.back().length)
+            records.push_back(record);
+    }
+    dropped -= records.size();
+    return dropped;
+}
+
+uint32 HighlightStore::PackColor(const rgb_color& color) {
+    return (uint32) color.red << 24 | (uint32) color.green << 16 | (uint32) color.blue << 8 | color.alpha;
+}
+
+rgb_color HighlightStore::UnpackColor(uint32 color) {
+    rgb_color unpacked;
+    unpacked.red = color >> 24;
+    unpacked.green = color >> 16;
+    unpacked.blue = color >> 8;
+    unpacked.alpha = color;
+    return unpacked;
+}
+
+BString HighlightStore::SidecarPath(const char* path) {
+    BPath notePath(path), parent;
+    BString sidecarPath;
+    if (notePath.GetParent(&parent) == B_OK)
+        sidecarPath << parent.Path() << "/";
+    sidecarPath << "." << notePath.Leaf() << kSidecarSuffix;
+    return sidecarPath;
+}
+
+status_t HighlightStore::Parse(const uint8* data, size_t size, highlight_set* highlights) {
+    highlight_header header;
+    if (size < sizeof(header))
+        return B_BAD_DATA;
+
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kHighlightMagic || header.version != kHighlightVersion || header.labelCount > size)
+        return B_BAD_DATA;
+
+    const char* labels = reinterpret_cast<const char*>(data) + sizeof(header);
+    const char* labelsEnd = reinterpret_cast<const char*>(data) + size;
+    highlights->labels.resize(header.labelCount);
+    for (auto& label : highlights->labels) {
+        for (BString* field : { &label.type, &label.value }) {
+            const char* fieldEnd = static_cast<const char*>(memchr(labels, '\0', labelsEnd - labels));
+            if (fieldEnd == NULL)
+                return B_BAD_DATA;
+            field->SetTo(labels, fieldEnd - labels);
+            labels = fieldEnd + 1;
+        }
+    }
+
+    size_t recordStart = ((labels - reinterpret_cast<const char*>(data)) + 3) & ~3;
+    if (recordStart > size || (size - recordStart) / sizeof(highlight_record) < header.recordCount)
+        return B_BAD_DATA;
+
+    highlights->records.resize(header.recordCount);
+    memcpy(highlights->records.data(), data + recordStart, header.recordCount * sizeof(highlight_record));
+    for (auto& record : highlights->records) {
+        if (record.label >= header.labelCount)
+            return B_BAD_DATA;
+    }
+    return B_OK;
+}
+
+bool HighlightStore::Matches(const char* text, int64 length, const highlight_record& record, int64 offset) {
+    if (offset < 0 || offset + record.length > length)
+        return false;
+
+    return Fingerprint(text + offset, record.length) == record.fingerprint;
+}
+
+void HighlightStore::Search(const char* text, int64 length, const vector<uint32>& offsets,
+                            const vector<int32>& indices, highlight_set* highlights, vector<bool>* found) {
+    vector<highlight_record>& records = highlights->records;
+
+    // records to search by the length of text their fingerprint covers, then by fingerprint
+    map<int32, multimap<uint32, int32>> searches;
+    for (auto index : indices) {
+        int32 hashLength = min(records[index].length, (uint32) kFingerprintLength);
+        if (hashLength > 0)
+            searches[hashLength].insert({records[index].fingerprint, index});
+    }
+
+    vector<int64> bestOffsets(records.size(), -1);
+    vector<bool> confirmed(records.size(), false);
+    for (auto& search : searches) {
+        int32 hashLength = search.first;
+        const multimap<uint32, int32>& wanted = search.second;
+        if (hashLength > length)
+            continue;
+
+        // most places of the text match no fingerprint, a bit per bucket passes them w/o a lookup
+        vector<bool> filter(kSearchFilterSize, false);
+        for (auto& entry : wanted)
+            filter[FilterBucket(entry.first)] = true;
+
+        // rolls the hash of hashLength bytes over the text, the byte leaving the window is taken out again
+        uint32 outFactor = 1;
+        for (int32 step = 1; step < hashLength; step++)
+            outFactor *= kFingerprintPrime;
+
+        uint32 hash = Fingerprint(text, hashLength);
+        for (int64 offset = 0; ; offset++) {
+            auto matches = filter[FilterBucket(hash)]
+                ? wanted.equal_range(hash) : make_pair(wanted.end(), wanted.end());
+            for (auto match = matches.first; match != matches.second; match++) {
+                int32 index = match->second;
+                const highlight_record& record = records[index];
+                if (offset + record.length > length)
+                    continue;
+                // places where the next record follows at the same distance as before are taken first
+                bool follows = index + 1 == (int32) records.size()
+                    || Matches(text, length, records[index + 1], offset + offsets[index + 1] - offsets[index]);
+                if (bestOffsets[index] < 0 || (follows && !confirmed[index])
+                    || (follows == confirmed[index]
+                        && llabs(offset - (int64) record.offset) < llabs(bestOffsets[index] - (int64) record.offset))) {
+                    bestOffsets[index] = offset;
+                    confirmed[index] = follows;
+                }
+            }
+            if (offset + hashLength >= length)
+                break;
+            hash = (hash - (uint8) text[offset] * outFactor) * kFingerprintPrime + (uint8) text[offset + hashLength];
+        }
+    }
+
+    for (auto index : indices) {
+        if (bestOffsets[index] >= 0) {
+            records[index].offset = bestOffsets[index];
+            (*found)[index] = true;
+        }
+    }
+}
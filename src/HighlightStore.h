@@ -0,0 +1,81 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * keeps the highlights and labels of a note in a binary attribute of the note file, or in a hidden file
+ * next to it on volumes w/o attributes. records are sorted by offset and carry a hash of the first bytes
+ * of their text, so they find their text again after the note was changed by other programs.
+ */
+#pragma once
+
+#include <GraphicsDefs.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+enum {
+    HIGHLIGHT_GENERATED = 1 << 0,
+    HIGHLIGHT_OUTLINE   = 1 << 1
+};
+
+typedef struct highlight_label {
+    BString         type;           // Person, Location, Topic...
+    BString         value;          // empty if the highlighted text is the value
+} highlight_label;
+
+typedef struct highlight_record {
+    uint32          offset;
+    uint32          length;
+    uint32          label;          // index into the labels
+    uint32          color;          // background as r, g, b, a
+    uint32          flags;
+    uint32          fingerprint;
+} highlight_record;
+
+typedef struct highlight_set {
+    vector<highlight_label>  labels;
+    vector<highlight_record> records;   // sorted by offset
+} highlight_set;
+
+class HighlightStore {
+
+public:
+    /**
+     * reads the highlights of the note at path in one go, a note w/o highlights gives an empty set.
+     */
+    static status_t     Read(const char* path, highlight_set* highlights);
+    /**
+     * replaces the highlights of the note at path, an empty set removes them.
+     */
+    static status_t     Write(const char* path, const highlight_set& highlights);
+
+    /**
+     * hashes the first bytes of text, a polynomial hash so it can be rolled over a text when searching.
+     */
+    static uint32       Fingerprint(const char* text, int64 length);
+    /**
+     * moves records whose text is no longer at their offset to where it moved, or else to the nearest place
+     * it is found. drops those not found and those overlapping an earlier one, returns how many were dropped.
+     */
+    static int32        Anchor(const char* text, int64 length, highlight_set* highlights);
+
+    static uint32       PackColor(const rgb_color& color);
+    static rgb_color    UnpackColor(uint32 color);
+
+    // only the first bytes of the text are hashed
+    static const int32  kFingerprintLength = 16;
+
+private:
+    static BString      SidecarPath(const char* path);
+    static status_t     Parse(const uint8* data, size_t size, highlight_set* highlights);
+    static bool         Matches(const char* text, int64 length, const highlight_record& record, int64 offset);
+    /**
+     * moves the records at indices to the nearest offset their fingerprint is found at, one pass over
+     * text per fingerprint length, and marks those found. places the next record follows at its former
+     * distance from offsets are preferred.
+     */
+    static void         Search(const char* text, int64 length, const vector<uint32>& offsets,
+                               const vector<int32>& indices, highlight_set* highlights, vector<bool>* found);
+};
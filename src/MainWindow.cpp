@@ -7,25 +7,77 @@
 
 #include <Application.h>
 #include <Catalog.h>
+#include <DataIO.h>
+#include <Directory.h>
+#include <Entry.h>
 #include <File.h>
 #include <FindDirectory.h>
 #include <LayoutBuilder.h>
 #include <Menu.h>
 #include <MenuBar.h>
+#include <NodeMonitor.h>
 #include <Path.h>
+#include <PathMonitor.h>
 #include <View.h>
 
+#include <algorithm>
 #include <cstdio>
+#include <ctime>
 #include <glog/logging.h>
 
+#include "Messages.h"
+#include "RelayProtocol.h"
+#include "SyncProtocol.h"
+
 #undef B_TRANSLATION_CONTEXT
 #define B_TRANSLATION_CONTEXT "Window"
 
 static const uint32 kMsgNewFile = 'fnew';
 static const uint32 kMsgOpenFile = 'fopn';
 static const uint32 kMsgSaveFile = 'fsav';
+static const uint32 kMsgGoToHeading = 'gthd';
+static const uint32 kMsgHeadingSelected = 'hdsl';
+static const uint32 kMsgQuickOpen = 'qopn';
+static const uint32 kMsgNoteSelected = 'ntsl';
+static const uint32 kMsgOpenByTag = 'optg';
+static const uint32 kMsgTagSelected = 'tgsl';
+static const uint32 kMsgRecentNotes = 'rcnt';
+static const uint32 kMsgFilteredNoteSelected = 'ftsl';
+static const uint32 kMsgSetTheme = 'sthm';
+static const uint32 kMsgExpandSelection = 'exsl';
+static const uint32 kMsgShrinkSelection = 'shsl';
+static const uint32 kMsgSelectSentence = 'slsn';
+static const uint32 kMsgNextSentence = 'nxsn';
+static const uint32 kMsgPreviousSentence = 'pvsn';
+static const uint32 kMsgMoveSectionUp = 'mvsu';
+static const uint32 kMsgMoveSectionDown = 'mvsd';
+static const uint32 kMsgPromoteSection = 'prsc';
+static const uint32 kMsgDemoteSection = 'dmsc';
+static const uint32 kMsgRestoreRevision = 'rsrv';
+static const uint32 kMsgCompareSaved = 'cmsv';
+static const uint32 kMsgCompareRevision = 'cmrv';
+static const uint32 kMsgCompareNote = 'cmnt';
+static const uint32 kMsgCompareNoteSelected = 'cmns';
+static const uint32 kMsgClearComparison = 'cmcl';
+static const uint32 kMsgJoinSession = 'shjn';
+static const uint32 kMsgLeaveSession = 'shlv';
+static const uint32 kMsgSyncVault = 'sync';
+static const uint32 kMsgPublishAttributes = 'pbat';
+static const uint32 kMsgRelatedNotes = 'rlnt';
+static const uint32 kMsgRelatedNoteSelected = 'rlns';
+static const uint32 kMsgFindMentions = 'fmnt';
+static const uint32 kMsgEntitySelected = 'ents';
+static const uint32 kMsgMentionSelected = 'mnts';
+
+static const int32 kRelatedNoteCount = 20;
+static const int32 kMentionCount = 1000;
+// front matter dates shown as recent notes
+static const time_t kRecentPeriod = 30 * 24 * 60 * 60;
+
+static const off_t kPagedDocumentSize = 32 * 1024 * 1024;
 
 static const char* kSettingsFile = "senity_settings";
+static const char* kThemesDirectory = "senity_themes";
 
 MainWindow::MainWindow()
 	:
@@ -43,10 +95,50 @@ MainWindow::MainWindow()
 	BMessenger messenger(this);
 	fOpenPanel = new BFilePanel(B_OPEN_PANEL, &messenger, NULL, B_FILE_NODE, false);
 	fSavePanel = new BFilePanel(B_SAVE_PANEL, &messenger, NULL, B_FILE_NODE, false);
+	fComparePanel = new BFilePanel(B_OPEN_PANEL, &messenger, NULL, B_FILE_NODE, false,
+		new BMessage(kMsgCompareNoteSelected));
+
+	fHeadingPalette = NULL;
+	fNotePalette = NULL;
+	fTagPalette = NULL;
+	fFilterPalette = NULL;
+	fRelatedPalette = NULL;
+	fEntityPalette = NULL;
+	fMentionPalette = NULL;
+
+	fVaultFileCache = new VaultFileCache(BMessenger(this));
+	AddHandler(fVaultFileCache);
+	if (fVaultFileCache->Load() == B_OK)
+		fVaultFileCache->SetRoot(fVaultFileCache->Root());
+
+	fVaultSync = new VaultSync(BMessenger(this));
+	fVaultSync->Load();
+
+	// signatures of unchanged notes are taken over when the vault was scanned
+	fRelatedNotes = new RelatedNotesIndex();
+	fRelatedNotes->Load();
+	fEditorView->SetRelatedNotesIndex(fRelatedNotes);
+
+	fEntityStore = new EntityStore();
+	fEntityStore->Load();
+
+	fNoteAttributes = new NoteAttributes();
+
+	fMetadataIndex = new MetadataIndex();
+	fMetadataIndex->Load();
+
+	fRevisionStore = new RevisionStore();
+	if (fRevisionStore->Open() != B_OK)
+		fprintf(stderr, "could not open revision store, revisions are not kept.\n");
 
 	BMessage settings;
 	_LoadSettings(settings);
 
+	fThemePath = settings.GetString("theme", "");
+	if (!fThemePath.IsEmpty() && _SetTheme(fThemePath.String()) != B_OK)
+		fThemePath = "";
+	_UpdateThemeMenu();
+
 	BRect frame;
 	if (settings.FindRect("main_window_rect", &frame) == B_OK) {
 		MoveTo(frame.LeftTop());
@@ -61,10 +153,51 @@ MainWindow::MainWindow()
 MainWindow::~MainWindow()
 {
 	_SaveSettings();
+	_StoreHighlights();
+	fMetadataIndex->Cancel();
+	fMetadataIndex->Save();
+	BPathMonitor::StopWatching(BMessenger(this));
+
+	if (fHeadingPalette != NULL && fHeadingPalette->Lock())
+		fHeadingPalette->Quit();
+	if (fNotePalette != NULL && fNotePalette->Lock())
+		fNotePalette->Quit();
+	if (fTagPalette != NULL && fTagPalette->Lock())
+		fTagPalette->Quit();
+	if (fFilterPalette != NULL && fFilterPalette->Lock())
+		fFilterPalette->Quit();
+	if (fRelatedPalette != NULL && fRelatedPalette->Lock())
+		fRelatedPalette->Quit();
+	if (fEntityPalette != NULL && fEntityPalette->Lock())
+		fEntityPalette->Quit();
+	if (fMentionPalette != NULL && fMentionPalette->Lock())
+		fMentionPalette->Quit();
+
+	fVaultFileCache->Save();
+	RemoveHandler(fVaultFileCache);
+	delete fVaultFileCache;
+
+	fVaultSync->Cancel();
+	fVaultSync->Save();
+	delete fVaultSync;
+
+	fRelatedNotes->Cancel();
+	fRelatedNotes->Save();
+	delete fRelatedNotes;
+
+	fEntityStore->Cancel();
+	fEntityStore->Save();
+	delete fEntityStore;
+
+	fNoteAttributes->Cancel();
+	delete fNoteAttributes;
 
 	delete fOpenPanel;
 	delete fSavePanel;
+	delete fComparePanel;
     delete fEditorView;
+    delete fMetadataIndex;
+    delete fRevisionStore;
 }
 
 void MainWindow::MessageReceived(BMessage* message)
@@ -95,9 +228,33 @@ void MainWindow::MessageReceived(BMessage* message)
                 break;
             }
 
+			BPath path(&ref);
+			_StoreHighlights();
+
             // TODO: check MIME type
-            // LATER: only load portion of file if above certain size
-			fEditorView->SetText(&file, size);
+            // files too large to keep resident are mapped and shown in pages
+			if (size > kPagedDocumentSize) {
+				if ((result = fEditorView->SetDocument(path.Path())) != B_OK) {
+					fprintf(stderr, "could not map file: %s\n", strerror(result));
+					break;
+				}
+			} else {
+				if ((result = fEditorView->SetText(&file, size)) != B_OK) {
+					fprintf(stderr, "could not load file: %s\n", strerror(result));
+					break;
+				}
+				if ((result = fEditorView->LoadHighlights(path.Path())) != B_OK)
+					fprintf(stderr, "could not load highlights: %s\n", strerror(result));
+			}
+
+			fMetadataIndex->IndexFile(path.Path());
+			_WatchDocument(path.Path());
+			_UpdateRevisionMenu();
+
+			// the folder of the first opened note becomes the vault for quick open
+			BPath parent;
+			if (strlen(fVaultFileCache->Root()) == 0 && path.GetParent(&parent) == B_OK)
+				fVaultFileCache->SetRoot(parent.Path());
 
             break;
 		}
@@ -112,7 +269,31 @@ void MainWindow::MessageReceived(BMessage* message)
 				BEntry entry(&directory, name);
 				BPath path = BPath(&entry);
 
-				printf("would save to path: %s\n", path.Path());
+				BFile file(&entry, B_WRITE_ONLY | B_CREATE_FILE);
+				status_t result = file.InitCheck();
+				if (result == B_OK)
+					result = fEditorView->SaveText(&file);
+				if (result != B_OK)
+					fprintf(stderr, "could not save to %s: %s\n", path.Path(), strerror(result));
+				else {
+					printf("saved to path: %s\n", path.Path());
+					fMetadataIndex->IndexFile(path.Path());
+					result = fEditorView->SaveHighlights(path.Path());
+					if (result != B_OK && result != B_NOT_SUPPORTED)
+						fprintf(stderr, "could not store highlights of %s: %s\n", path.Path(), strerror(result));
+					else
+						fEntityStore->UpdateNote(path.Path());
+					fNoteAttributes->Publish(path.Path());
+
+					// the saved file becomes a new revision, split at the blocks known to the editor
+					vector<int64> boundaries;
+					fEditorView->GetBlockBoundaries(&boundaries);
+					result = fRevisionStore->AddRevision(path.Path(), boundaries);
+					if (result != B_OK)
+						fprintf(stderr, "could not add revision of %s: %s\n", path.Path(), strerror(result));
+					_WatchDocument(path.Path());
+					_UpdateRevisionMenu();
+				}
 			}
 		} break;
 
@@ -132,6 +313,264 @@ void MainWindow::MessageReceived(BMessage* message)
 			fSavePanel->Show();
 		} break;
 
+		case kMsgGoToHeading:
+		{
+			_ShowHeadingPalette();
+		} break;
+
+		case kMsgHeadingSelected:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				fEditorView->GoToHeading(index);
+		} break;
+
+		case kMsgExpandSelection:
+		{
+			fEditorView->ExpandSelection();
+		} break;
+
+		case kMsgShrinkSelection:
+		{
+			fEditorView->ShrinkSelection();
+		} break;
+
+		case kMsgSelectSentence:
+		{
+			fEditorView->SelectSentence();
+		} break;
+
+		case kMsgNextSentence:
+		case kMsgPreviousSentence:
+		{
+			fEditorView->MoveToSentence(message->what == kMsgNextSentence);
+		} break;
+
+		case kMsgMoveSectionUp:
+		case kMsgMoveSectionDown:
+		{
+			fEditorView->MoveSection(message->what == kMsgMoveSectionDown);
+		} break;
+
+		case kMsgPromoteSection:
+		case kMsgDemoteSection:
+		{
+			fEditorView->ChangeSectionLevel(message->what == kMsgPromoteSection ? -1 : 1);
+		} break;
+
+		case kMsgQuickOpen:
+		{
+			_ShowNotePalette();
+		} break;
+
+		case kMsgNoteSelected:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				_OpenNote(index);
+		} break;
+
+		case kMsgOpenByTag:
+		{
+			_ShowTagPalette();
+		} break;
+
+		case kMsgTagSelected:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				_ShowTaggedNotes(index);
+		} break;
+
+		case kMsgRecentNotes:
+		{
+			_ShowRecentNotes();
+		} break;
+
+		case kMsgFilteredNoteSelected:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				_OpenFilteredNote(index);
+		} break;
+
+		case kMsgRelatedNotes:
+		{
+			_ShowRelatedPalette();
+		} break;
+
+		case kMsgRelatedNoteSelected:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				_OpenRelatedNote(index);
+		} break;
+
+		case kMsgFindMentions:
+		{
+			_ShowEntityPalette();
+		} break;
+
+		case kMsgEntitySelected:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				_ShowMentionPalette(index);
+		} break;
+
+		case kMsgMentionSelected:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				_OpenMention(index);
+		} break;
+
+		case kMsgCompareSaved:
+		{
+			BFile file(fDocumentPath.String(), B_READ_ONLY);
+			off_t size;
+			if (file.InitCheck() == B_OK && file.GetSize(&size) == B_OK)
+				fEditorView->CompareWith(&file, size);
+		} break;
+
+		case kMsgCompareRevision:
+		{
+			// the last revision is the saved file unless it was changed elsewhere,
+			// so compare with the one before if there is one
+			vector<revision_info> revisions;
+			fRevisionStore->GetRevisions(fDocumentPath.String(), &revisions);
+			if (revisions.empty())
+				break;
+
+			BMallocIO text;
+			int32 index = max((int32)revisions.size() - 2, (int32)0);
+			if (fRevisionStore->RestoreRevision(fDocumentPath.String(), index, &text) == B_OK)
+				fEditorView->CompareWith(&text, text.BufferLength());
+		} break;
+
+		case kMsgCompareNote:
+		{
+			fComparePanel->Show();
+		} break;
+
+		case kMsgCompareNoteSelected:
+		{
+			entry_ref ref;
+			if (message->FindRef("refs", &ref) != B_OK)
+				break;
+
+			BFile file(&ref, B_READ_ONLY);
+			off_t size;
+			if (file.InitCheck() == B_OK && file.GetSize(&size) == B_OK)
+				fEditorView->CompareWith(&file, size);
+		} break;
+
+		case kMsgClearComparison:
+		{
+			fEditorView->ClearComparison();
+		} break;
+
+		case kMsgJoinSession:
+		{
+			status_t status = fEditorView->StartSharing("127.0.0.1", kRelayPort);
+			if (status != B_OK)
+				fprintf(stderr, "could not join the editing session: %s\n", strerror(status));
+		} break;
+
+		case kMsgLeaveSession:
+		{
+			fEditorView->StopSharing();
+		} break;
+
+		case kMsgSyncVault:
+		{
+			if (strlen(fVaultFileCache->Root()) == 0) {
+				fprintf(stderr, "no vault to sync, open a note first.\n");
+				break;
+			}
+			vector<BString> paths;
+			fVaultFileCache->GetPaths(&paths);
+			fVaultSync->Sync(fVaultFileCache->Root(), paths, "127.0.0.1", kSyncPort);
+		} break;
+
+		case kMsgPublishAttributes:
+		{
+			if (strlen(fVaultFileCache->Root()) == 0) {
+				fprintf(stderr, "no vault to publish, open a note first.\n");
+				break;
+			}
+			vector<BString> paths;
+			fVaultFileCache->GetPaths(&paths);
+			fNoteAttributes->Backfill(paths);
+		} break;
+
+		case MSG_VAULT_SYNCED:
+		{
+			status_t status = message->GetInt32("status", B_ERROR);
+			if (status != B_OK)
+				fprintf(stderr, "could not sync the vault: %s\n", strerror(status));
+			fVaultSync->Save();
+		} break;
+
+		case kMsgRestoreRevision:
+		{
+			int32 index;
+			if (message->FindInt32("index", &index) == B_OK)
+				_RestoreRevision(index);
+		} break;
+
+		case kMsgSetTheme:
+		{
+			const char* path;
+			if (message->FindString("path", &path) == B_OK && _SetTheme(path) == B_OK) {
+				fThemePath = path;
+				_UpdateThemeMenu();
+			}
+		} break;
+
+		case B_PATH_MONITOR:
+		{
+			// the open note was written elsewhere, or replaced like sync clients do
+			int32 opcode;
+			if (message->FindInt32("opcode", &opcode) != B_OK)
+				break;
+			if (opcode == B_STAT_CHANGED
+				&& (message->GetInt32("fields", 0) & (B_STAT_SIZE | B_STAT_MODIFICATION_TIME)) == 0)
+				break;
+			if (opcode == B_STAT_CHANGED || opcode == B_ENTRY_CREATED || opcode == B_ENTRY_MOVED)
+				_ReloadDocument();
+		} break;
+
+		case MSG_VAULT_UPDATED:
+		{
+			// refresh results if the palette is currently shown
+			if (fNotePalette != NULL && fNotePalette->Lock()) {
+				if (!fNotePalette->IsHidden()) {
+					vector<BString> labels;
+					fVaultFileCache->GetLabels(&labels);
+					fNotePalette->SetItems(labels);
+				}
+				fNotePalette->Unlock();
+			}
+
+			vector<BString> paths;
+			fVaultFileCache->GetPaths(&paths);
+			fMetadataIndex->Update(paths);
+			fRelatedNotes->Update(paths);
+			fEntityStore->Update(paths);
+		} break;
+
+		case MSG_VAULT_NOTE_CHANGED:
+		{
+			const char* path;
+			if (message->FindString("path", &path) != B_OK)
+				break;
+			if (message->GetBool("removed", false))
+				fMetadataIndex->Remove(path);
+			else
+				fMetadataIndex->IndexFile(path);
+		} break;
+
 		default:
 		{
 			BWindow::MessageReceived(message);
@@ -157,10 +596,54 @@ MainWindow::_BuildMenu()
 	item = new BMenuItem(B_TRANSLATE("Open" B_UTF8_ELLIPSIS), new BMessage(kMsgOpenFile), 'O');
 	menu->AddItem(item);
 
+	item = new BMenuItem(B_TRANSLATE("Quick open" B_UTF8_ELLIPSIS), new BMessage(kMsgQuickOpen), 'T');
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Open by tag" B_UTF8_ELLIPSIS), new BMessage(kMsgOpenByTag));
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Recent notes" B_UTF8_ELLIPSIS), new BMessage(kMsgRecentNotes));
+	menu->AddItem(item);
+
 	fSaveMenuItem = new BMenuItem(B_TRANSLATE("Save"), new BMessage(kMsgSaveFile), 'S');
 	fSaveMenuItem->SetEnabled(false);
 	menu->AddItem(fSaveMenuItem);
 
+	fRevisionMenu = new BMenu(B_TRANSLATE("Revisions"));
+	fRevisionMenu->SetEnabled(false);
+	menu->AddItem(fRevisionMenu);
+
+	BMenu* compareMenu = new BMenu(B_TRANSLATE("Compare"));
+	compareMenu->AddItem(new BMenuItem(B_TRANSLATE("With saved file"), new BMessage(kMsgCompareSaved)));
+	compareMenu->AddItem(new BMenuItem(B_TRANSLATE("With previous revision"), new BMessage(kMsgCompareRevision)));
+	compareMenu->AddItem(new BMenuItem(B_TRANSLATE("With note" B_UTF8_ELLIPSIS), new BMessage(kMsgCompareNote)));
+	compareMenu->AddSeparatorItem();
+	compareMenu->AddItem(new BMenuItem(B_TRANSLATE("Clear comparison"), new BMessage(kMsgClearComparison)));
+	menu->AddItem(compareMenu);
+
+	BMenu* shareMenu = new BMenu(B_TRANSLATE("Share"));
+	shareMenu->AddItem(new BMenuItem(B_TRANSLATE("Join session on this computer"),
+		new BMessage(kMsgJoinSession)));
+	shareMenu->AddItem(new BMenuItem(B_TRANSLATE("Leave session"), new BMessage(kMsgLeaveSession)));
+	menu->AddItem(shareMenu);
+
+	item = new BMenuItem(B_TRANSLATE("Sync vault"), new BMessage(kMsgSyncVault));
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Publish note attributes"), new BMessage(kMsgPublishAttributes));
+	menu->AddItem(item);
+
+	menu->AddSeparatorItem();
+
+	item = new BMenuItem(B_TRANSLATE("Go to heading" B_UTF8_ELLIPSIS), new BMessage(kMsgGoToHeading), 'G');
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Related notes" B_UTF8_ELLIPSIS), new BMessage(kMsgRelatedNotes), 'R');
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Find mentions" B_UTF8_ELLIPSIS), new BMessage(kMsgFindMentions), 'M');
+	menu->AddItem(item);
+
 	menu->AddSeparatorItem();
 
 	item = new BMenuItem(B_TRANSLATE("About" B_UTF8_ELLIPSIS), new BMessage(B_ABOUT_REQUESTED));
@@ -172,10 +655,523 @@ MainWindow::_BuildMenu()
 
 	menuBar->AddItem(menu);
 
+	// menu 'Edit'
+	menu = new BMenu(B_TRANSLATE("Edit"));
+
+	item = new BMenuItem(B_TRANSLATE("Expand selection"), new BMessage(kMsgExpandSelection),
+		B_UP_ARROW, B_OPTION_KEY);
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Shrink selection"), new BMessage(kMsgShrinkSelection),
+		B_DOWN_ARROW, B_OPTION_KEY);
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Select sentence"), new BMessage(kMsgSelectSentence));
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Next sentence"), new BMessage(kMsgNextSentence),
+		B_RIGHT_ARROW, B_OPTION_KEY);
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Previous sentence"), new BMessage(kMsgPreviousSentence),
+		B_LEFT_ARROW, B_OPTION_KEY);
+	menu->AddItem(item);
+
+	menu->AddSeparatorItem();
+
+	item = new BMenuItem(B_TRANSLATE("Move section up"), new BMessage(kMsgMoveSectionUp),
+		B_UP_ARROW, B_CONTROL_KEY);
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Move section down"), new BMessage(kMsgMoveSectionDown),
+		B_DOWN_ARROW, B_CONTROL_KEY);
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Promote section"), new BMessage(kMsgPromoteSection),
+		B_LEFT_ARROW, B_CONTROL_KEY);
+	menu->AddItem(item);
+
+	item = new BMenuItem(B_TRANSLATE("Demote section"), new BMessage(kMsgDemoteSection),
+		B_RIGHT_ARROW, B_CONTROL_KEY);
+	menu->AddItem(item);
+
+	menuBar->AddItem(menu);
+
+	// menu 'View'
+	menu = new BMenu(B_TRANSLATE("View"));
+
+	fThemeMenu = new BMenu(B_TRANSLATE("Theme"));
+	fThemeMenu->SetRadioMode(true);
+	menu->AddItem(fThemeMenu);
+
+	menuBar->AddItem(menu);
+
 	return menuBar;
 }
 
 
+void
+MainWindow::_ShowHeadingPalette()
+{
+	if (fHeadingPalette == NULL) {
+		fHeadingPalette = new FuzzyPalette(B_TRANSLATE("Go to heading"), BMessenger(this),
+			new BMessage(kMsgHeadingSelected));
+	}
+
+	vector<BString> labels;
+	fEditorView->GetHeadingLabels(&labels);
+
+	if (fHeadingPalette->Lock()) {
+		fHeadingPalette->SetItems(labels);
+		fHeadingPalette->CenterIn(Frame());
+		fHeadingPalette->Show();
+		fHeadingPalette->Unlock();
+	}
+}
+
+
+void
+MainWindow::_ShowNotePalette()
+{
+	if (fNotePalette == NULL) {
+		fNotePalette = new FuzzyPalette(B_TRANSLATE("Quick open"), BMessenger(this),
+			new BMessage(kMsgNoteSelected), new ParallelFuzzyMatcher());
+	}
+
+	vector<BString> labels;
+	fVaultFileCache->GetLabels(&labels);
+
+	if (fNotePalette->Lock()) {
+		fNotePalette->SetItems(labels);
+		fNotePalette->CenterIn(Frame());
+		fNotePalette->Show();
+		fNotePalette->Unlock();
+	}
+}
+
+
+void
+MainWindow::_OpenNote(int32 index)
+{
+	BString path;
+	if (fVaultFileCache->GetPathAt(index, &path) != B_OK)
+		return;
+
+	entry_ref ref;
+	BEntry entry(path.String());
+	if (entry.GetRef(&ref) != B_OK)
+		return;
+
+	BMessage refsMsg(B_REFS_RECEIVED);
+	refsMsg.AddRef("refs", &ref);
+	PostMessage(&refsMsg);
+}
+
+void
+MainWindow::_ShowTagPalette()
+{
+	if (fTagPalette == NULL) {
+		fTagPalette = new FuzzyPalette(B_TRANSLATE("Open by tag"), BMessenger(this),
+			new BMessage(kMsgTagSelected));
+	}
+
+	fMetadataIndex->GetTags(&fTags);
+	vector<BString> labels;
+	for (auto& tag : fTags) {
+		BString label;
+		label << "#" << tag.tag << "  \xE2\x80\x94 " << tag.notes;
+		labels.push_back(label);
+	}
+
+	if (fTagPalette->Lock()) {
+		fTagPalette->SetItems(labels);
+		fTagPalette->CenterIn(Frame());
+		fTagPalette->Show();
+		fTagPalette->Unlock();
+	}
+}
+
+
+void
+MainWindow::_ShowTaggedNotes(int32 index)
+{
+	if (index < 0 || index >= (int32) fTags.size())
+		return;
+
+	fFilteredPaths = fMetadataIndex->FindByTag(fTags[index].tag.String());
+	_ShowFilteredNotes(B_TRANSLATE("Notes tagged"));
+}
+
+
+void
+MainWindow::_ShowRecentNotes()
+{
+	// newest first, as long as nothing is typed into the palette
+	time_t now = time(NULL);
+	fFilteredPaths = fMetadataIndex->FindByDate(now - kRecentPeriod, now);
+	reverse(fFilteredPaths.begin(), fFilteredPaths.end());
+	_ShowFilteredNotes(B_TRANSLATE("Recent notes"));
+}
+
+
+void
+MainWindow::_ShowFilteredNotes(const char* title)
+{
+	if (fFilterPalette == NULL) {
+		fFilterPalette = new FuzzyPalette(title, BMessenger(this),
+			new BMessage(kMsgFilteredNoteSelected));
+	}
+
+	vector<BString> labels;
+	for (auto& path : fFilteredPaths) {
+		BString label;
+		if (fVaultFileCache->GetTitle(path.String(), &label) != B_OK)
+			label = BPath(path.String()).Leaf();
+
+		note_metadata metadata;
+		if (fMetadataIndex->GetMetadata(path.String(), &metadata) == B_OK && metadata.date != 0) {
+			char date[16];
+			strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&metadata.date));
+			label << "  \xE2\x80\x94 " << date;
+		}
+		labels.push_back(label);
+	}
+
+	if (fFilterPalette->Lock()) {
+		fFilterPalette->SetTitle(title);
+		fFilterPalette->SetItems(labels);
+		fFilterPalette->CenterIn(Frame());
+		fFilterPalette->Show();
+		fFilterPalette->Unlock();
+	}
+}
+
+
+void
+MainWindow::_OpenFilteredNote(int32 index)
+{
+	if (index < 0 || index >= (int32) fFilteredPaths.size())
+		return;
+
+	entry_ref ref;
+	BEntry entry(fFilteredPaths[index].String());
+	if (entry.GetRef(&ref) != B_OK)
+		return;
+
+	BMessage refsMsg(B_REFS_RECEIVED);
+	refsMsg.AddRef("refs", &ref);
+	PostMessage(&refsMsg);
+}
+
+
+void
+MainWindow::_ShowRelatedPalette()
+{
+	if (fRelatedPalette == NULL) {
+		fRelatedPalette = new FuzzyPalette(B_TRANSLATE("Related notes"), BMessenger(this),
+			new BMessage(kMsgRelatedNoteSelected));
+	}
+
+	minhash_signature signature;
+	fEditorView->GetSignature(&signature);
+
+	bigtime_t startTime = system_time();
+	vector<related_note> notes;
+	fRelatedNotes->Query(signature, kRelatedNoteCount, fDocumentPath.String(), &notes);
+	printf("found %zu related notes among %d in %lld us.\n", notes.size(), fRelatedNotes->CountNotes(),
+		(long long) (system_time() - startTime));
+
+	// most similar first, as long as nothing is typed into the palette
+	vector<BString> labels;
+	fRelatedPaths.clear();
+	for (auto& note : notes) {
+		BString label;
+		if (fVaultFileCache->GetTitle(note.path.String(), &label) != B_OK)
+			label = BPath(note.path.String()).Leaf();
+		label << "  \xE2\x80\x94 " << (int32) (note.similarity * 100 + 0.5) << "%";
+		labels.push_back(label);
+		fRelatedPaths.push_back(note.path);
+	}
+
+	if (fRelatedPalette->Lock()) {
+		fRelatedPalette->SetItems(labels);
+		fRelatedPalette->CenterIn(Frame());
+		fRelatedPalette->Show();
+		fRelatedPalette->Unlock();
+	}
+}
+
+
+void
+MainWindow::_OpenRelatedNote(int32 index)
+{
+	if (index < 0 || index >= (int32) fRelatedPaths.size())
+		return;
+
+	entry_ref ref;
+	BEntry entry(fRelatedPaths[index].String());
+	if (entry.GetRef(&ref) != B_OK)
+		return;
+
+	BMessage refsMsg(B_REFS_RECEIVED);
+	refsMsg.AddRef("refs", &ref);
+	PostMessage(&refsMsg);
+}
+
+void
+MainWindow::_ShowEntityPalette()
+{
+	if (fEntityPalette == NULL) {
+		fEntityPalette = new FuzzyPalette(B_TRANSLATE("Find mentions"), BMessenger(this),
+			new BMessage(kMsgEntitySelected));
+	}
+
+	bigtime_t startTime = system_time();
+	fEntityStore->GetEntities(&fEntities);
+	printf("found %zu entities in %d mentions in %lld us.\n", fEntities.size(), fEntityStore->CountMentions(),
+		(long long) (system_time() - startTime));
+
+	vector<BString> labels;
+	for (auto& entity : fEntities) {
+		BString label;
+		label << entity.type << ": " << entity.value << "  \xE2\x80\x94 " << entity.notes;
+		labels.push_back(label);
+	}
+
+	if (fEntityPalette->Lock()) {
+		fEntityPalette->SetItems(labels);
+		fEntityPalette->CenterIn(Frame());
+		fEntityPalette->Show();
+		fEntityPalette->Unlock();
+	}
+}
+
+
+void
+MainWindow::_ShowMentionPalette(int32 index)
+{
+	if (index < 0 || index >= (int32) fEntities.size())
+		return;
+
+	if (fMentionPalette == NULL) {
+		fMentionPalette = new FuzzyPalette(B_TRANSLATE("Notes mentioning"), BMessenger(this),
+			new BMessage(kMsgMentionSelected));
+	}
+
+	const entity_count& entity = fEntities[index];
+	vector<entity_mention> mentions;
+	fEntityStore->Query(entity.type.String(), entity.value.String(), 0, 0, kMentionCount, &mentions);
+
+	// mentions come by note, so each note is listed once with how often it mentions the entity
+	vector<BString> labels;
+	vector<int32> counts;
+	fMentionPaths.clear();
+	for (auto& mention : mentions) {
+		if (!fMentionPaths.empty() && fMentionPaths.back() == mention.path) {
+			counts.back()++;
+			continue;
+		}
+		fMentionPaths.push_back(mention.path);
+		counts.push_back(1);
+	}
+	for (uint32 note = 0; note < fMentionPaths.size(); note++) {
+		BString label;
+		if (fVaultFileCache->GetTitle(fMentionPaths[note].String(), &label) != B_OK)
+			label = BPath(fMentionPaths[note].String()).Leaf();
+		label << "  \xE2\x80\x94 " << counts[note];
+		labels.push_back(label);
+	}
+
+	if (fMentionPalette->Lock()) {
+		fMentionPalette->SetItems(labels);
+		fMentionPalette->CenterIn(Frame());
+		fMentionPalette->Show();
+		fMentionPalette->Unlock();
+	}
+}
+
+
+void
+MainWindow::_OpenMention(int32 index)
+{
+	if (index < 0 || index >= (int32) fMentionPaths.size())
+		return;
+
+	entry_ref ref;
+	BEntry entry(fMentionPaths[index].String());
+	if (entry.GetRef(&ref) != B_OK)
+		return;
+
+	BMessage refsMsg(B_REFS_RECEIVED);
+	refsMsg.AddRef("refs", &ref);
+	PostMessage(&refsMsg);
+}
+
+
+void
+MainWindow::_WatchDocument(const char* path)
+{
+	if (fDocumentPath == path)
+		return;
+
+	if (!fDocumentPath.IsEmpty())
+		BPathMonitor::StopWatching(fDocumentPath.String(), BMessenger(this));
+	fDocumentPath = path;
+
+	status_t result = BPathMonitor::StartWatching(path, B_WATCH_STAT, BMessenger(this));
+	if (result != B_OK)
+		fprintf(stderr, "could not watch %s: %s\n", path, strerror(result));
+}
+
+
+void
+MainWindow::_ReloadDocument()
+{
+	BFile file(fDocumentPath.String(), B_READ_ONLY);
+	off_t size;
+	if (file.InitCheck() != B_OK || file.GetSize(&size) != B_OK)
+		return;
+
+	status_t result = fEditorView->ReloadText(&file, size);
+	if (result != B_OK) {
+		fprintf(stderr, "could not reload %s: %s\n", fDocumentPath.String(), strerror(result));
+		return;
+	}
+	fMetadataIndex->IndexFile(fDocumentPath.String());
+}
+
+
+void
+MainWindow::_StoreHighlights()
+{
+	if (fDocumentPath.IsEmpty())
+		return;
+
+	// highlights are kept with the note even if its text was not saved, they find their text again
+	status_t result = fEditorView->SaveHighlights(fDocumentPath.String());
+	if (result != B_OK && result != B_NOT_SUPPORTED)
+		fprintf(stderr, "could not store highlights of %s: %s\n", fDocumentPath.String(), strerror(result));
+	else
+		fEntityStore->UpdateNote(fDocumentPath.String());
+	fNoteAttributes->Publish(fDocumentPath.String());
+}
+
+
+void
+MainWindow::_RestoreRevision(int32 index)
+{
+	vector<revision_info> revisions;
+	if (fRevisionStore->GetRevisions(fDocumentPath.String(), &revisions) != B_OK
+		|| index < 0 || index >= (int32)revisions.size())
+		return;
+
+	revision_diff diff;
+	if (fRevisionStore->CompareRevisions(fDocumentPath.String(), index, revisions.size() - 1, &diff) == B_OK) {
+		printf("restoring revision %d of %s, %d blocks changed since (+%d -%d).\n", index,
+			fDocumentPath.String(), diff.addedBlocks + diff.removedBlocks, diff.addedBlocks, diff.removedBlocks);
+	}
+
+	// the restored text is an unsaved edit, saving it adds a new revision
+	BMallocIO text;
+	status_t result = fRevisionStore->RestoreRevision(fDocumentPath.String(), index, &text);
+	if (result != B_OK) {
+		fprintf(stderr, "could not restore revision %d: %s\n", index, strerror(result));
+		return;
+	}
+	_StoreHighlights();
+	result = fEditorView->SetText(&text, text.BufferLength());
+	if (result != B_OK) {
+		fprintf(stderr, "could not restore revision %d: %s\n", index, strerror(result));
+		return;
+	}
+	fEditorView->LoadHighlights(fDocumentPath.String());
+	fSaveMenuItem->SetEnabled(true);
+}
+
+
+void
+MainWindow::_UpdateRevisionMenu()
+{
+	while (fRevisionMenu->CountItems() > 0)
+		delete fRevisionMenu->RemoveItem((int32)0);
+
+	vector<revision_info> revisions;
+	fRevisionStore->GetRevisions(fDocumentPath.String(), &revisions);
+	fRevisionMenu->SetEnabled(!revisions.empty());
+
+	// newest first
+	for (int32 index = revisions.size() - 1; index >= 0; index--) {
+		char time[32];
+		strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime(&revisions[index].time));
+
+		BString label;
+		label.SetToFormat("%s  \xE2\x80\x94 %" B_PRId64 " KiB, %" B_PRId64 " KiB new", time,
+			revisions[index].size / 1024, revisions[index].storedBytes / 1024);
+
+		BMessage* message = new BMessage(kMsgRestoreRevision);
+		message->AddInt32("index", index);
+		fRevisionMenu->AddItem(new BMenuItem(label.String(), message));
+	}
+}
+
+
+status_t
+MainWindow::_SetTheme(const char* path)
+{
+	Theme* theme;
+	if (path[0] == '\0') {
+		theme = Theme::DefaultTheme();
+	} else {
+		BPath themePath(path);
+		theme = new Theme(themePath.Leaf());
+		status_t status = theme->Load(path);
+		if (status != B_OK) {
+			fprintf(stderr, "could not load theme %s: %s\n", path, strerror(status));
+			delete theme;
+			return status;
+		}
+	}
+	fEditorView->SetTheme(theme);
+	return B_OK;
+}
+
+
+void
+MainWindow::_UpdateThemeMenu()
+{
+	while (fThemeMenu->CountItems() > 0)
+		delete fThemeMenu->RemoveItem((int32)0);
+
+	BMessage* message = new BMessage(kMsgSetTheme);
+	message->AddString("path", "");
+	BMenuItem* item = new BMenuItem(B_TRANSLATE("Default"), message);
+	item->SetMarked(fThemePath.IsEmpty());
+	fThemeMenu->AddItem(item);
+
+	// user themes are plain text descriptions in the settings folder
+	BPath path;
+	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) != B_OK
+		|| path.Append(kThemesDirectory) != B_OK)
+		return;
+
+	BDirectory directory(path.Path());
+	BEntry entry;
+	while (directory.GetNextEntry(&entry) == B_OK) {
+		BPath themePath(&entry);
+		BString name(themePath.Leaf());
+		if (entry.IsDirectory() || !name.EndsWith(".theme"))
+			continue;
+
+		name.Truncate(name.Length() - strlen(".theme"));
+		message = new BMessage(kMsgSetTheme);
+		message->AddString("path", themePath.Path());
+		item = new BMenuItem(name.String(), message);
+		item->SetMarked(fThemePath == themePath.Path());
+		fThemeMenu->AddItem(item);
+	}
+}
+
+
 status_t
 MainWindow::_LoadSettings(BMessage& settings)
 {
@@ -217,6 +1213,8 @@ MainWindow::_SaveSettings()
 
 	BMessage settings;
 	status = settings.AddRect("main_window_rect", Frame());
+	if (status == B_OK)
+		status = settings.AddString("theme", fThemePath);
 
 	if (status == B_OK)
 		status = settings.Flatten(&file);
@@ -11,6 +11,14 @@
 #include <Window.h>
 
 #include "EditorView.h"
+#include "EntityStore.h"
+#include "FuzzyPalette.h"
+#include "MetadataIndex.h"
+#include "NoteAttributes.h"
+#include "RelatedNotesIndex.h"
+#include "RevisionStore.h"
+#include "VaultFileCache.h"
+#include "VaultSync.h"
 
 class MainWindow : public BWindow
 {
@@ -26,8 +34,56 @@ private:
 			status_t		_LoadSettings(BMessage& settings);
 			status_t		_SaveSettings();
 
+			void			_ShowHeadingPalette();
+			void			_ShowNotePalette();
+			void			_OpenNote(int32 index);
+			void			_ShowTagPalette();
+			void			_ShowTaggedNotes(int32 index);
+			void			_ShowRecentNotes();
+			void			_ShowFilteredNotes(const char* title);
+			void			_OpenFilteredNote(int32 index);
+			void			_ShowRelatedPalette();
+			void			_OpenRelatedNote(int32 index);
+			void			_ShowEntityPalette();
+			void			_ShowMentionPalette(int32 index);
+			void			_OpenMention(int32 index);
+
+			status_t		_SetTheme(const char* path);
+			void			_UpdateThemeMenu();
+
+			void			_WatchDocument(const char* path);
+			void			_ReloadDocument();
+			void			_StoreHighlights();
+
+			void			_RestoreRevision(int32 index);
+			void			_UpdateRevisionMenu();
+
 			BMenuItem*		fSaveMenuItem;
+			BMenu*			fThemeMenu;
+			BMenu*			fRevisionMenu;
+			BString			fDocumentPath;
+			BString			fThemePath;
 			BFilePanel*		fOpenPanel;
 			BFilePanel*		fSavePanel;
+			BFilePanel*		fComparePanel;
             EditorView*     fEditorView;
+            MetadataIndex*  fMetadataIndex;
+            RevisionStore*  fRevisionStore;
+            FuzzyPalette*   fHeadingPalette;
+            FuzzyPalette*   fNotePalette;
+            FuzzyPalette*   fTagPalette;
+            FuzzyPalette*   fFilterPalette;
+            vector<tag_count> fTags;            // shown in the tag palette
+            vector<BString> fFilteredPaths;     // of the notes shown in the filter palette
+            FuzzyPalette*   fRelatedPalette;
+            vector<BString> fRelatedPaths;      // of the notes shown in the related notes palette
+            RelatedNotesIndex* fRelatedNotes;
+            FuzzyPalette*   fEntityPalette;
+            FuzzyPalette*   fMentionPalette;
+            vector<entity_count> fEntities;     // shown in the entity palette
+            vector<BString> fMentionPaths;      // of the notes shown in the mention palette
+            EntityStore*    fEntityStore;
+            NoteAttributes* fNoteAttributes;
+            VaultFileCache* fVaultFileCache;
+            VaultSync*      fVaultSync;
 };
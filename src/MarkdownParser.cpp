@@ -5,8 +5,11 @@
 
 #include "MarkdownParser.h"
 #include <String.h>
+#include <algorithm>
 #include <cassert>
+#include <ctype.h>
 #include <stdio.h>
+#include <string.h>
 
 static const char *markup_class_name[] = {"block_begin", "block_end", "span_begin", "span_end", "TEXT"};
 static const char *block_type_name[] = {"doc", "bq", "ul", "ol", "li", "hr", "h", "code", "HTML",
@@ -16,6 +19,91 @@ static const char *span_type_name[] = {"em", "strong", "hyperlink", "image", "co
 static const char *text_type_name[] = {"normal", "NULL char", "hard break", "soft break", "entity",
                                        "code", "HTML", "LaTeX math"};
 
+// labels with other than ASCII chars may match others after Unicode case folding, so they match all
+static const string kAnyLabel = "\x80";
+
+/**
+ * returns the label in text from start to end as md4c compares it, w/ ASCII letters in lower case
+ * and whitespace collapsed.
+ */
+static string NormalizeLabel(const string& text, size_t start, size_t end) {
+    string label;
+    bool space = false;
+    for (size_t pos = start; pos < end; pos++) {
+        unsigned char c = text[pos];
+        if (c >= 0x80) {
+            return kAnyLabel;
+        }
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            space = !label.empty();
+            continue;
+        }
+        if (space) {
+            label += ' ';
+            space = false;
+        }
+        label += tolower(c);
+    }
+    return label;
+}
+
+/**
+ * adds the content of all brackets in text w/o unescaped brackets inside to labels, which covers the labels
+ * of all references and reference definitions.
+ */
+static void CollectLabels(const string& text, set<string>* labels) {
+    size_t open = string::npos;
+    for (size_t pos = 0; pos < text.size(); pos++) {
+        if (text[pos] == '\\') {
+            pos++;
+        } else if (text[pos] == '[') {
+            open = pos;
+        } else if (text[pos] == ']' && open != string::npos) {
+            string label = NormalizeLabel(text, open + 1, pos);
+            if (!label.empty()) {
+                labels->insert(label);
+            }
+            open = string::npos;
+        }
+    }
+}
+
+/**
+ * drops the entries of blocks from start to end of the old text and moves the ones after them by delta.
+ */
+template<typename T>
+static void ShiftBlockEntries(map<int64, T>* entries, int64 start, int64 end, int64 delta) {
+    entries->erase(entries->lower_bound(start), entries->lower_bound(end));
+    if (delta == 0) {
+        return;
+    }
+    vector<typename map<int64, T>::node_type> shifted;
+    for (auto entry = entries->lower_bound(end); entry != entries->end(); ) {
+        auto node = entries->extract(entry++);
+        node.key() += delta;
+        shifted.push_back(move(node));
+    }
+    for (auto& node : shifted) {
+        entries->insert(entries->end(), move(node));
+    }
+}
+
+/**
+ * moves the entries of blocks after the text from start to middle and from middle to end swapped places.
+ */
+template<typename T>
+static void SwapBlockEntries(map<int64, T>* entries, int64 start, int64 middle, int64 end) {
+    vector<typename map<int64, T>::node_type> moved;
+    for (auto entry = entries->lower_bound(start); entry != entries->end() && entry->first < end; ) {
+        auto node = entries->extract(entry++);
+        node.key() += (node.key() < middle ? end - middle : start - middle);
+        moved.push_back(move(node));
+    }
+    for (auto& node : moved) {
+        entries->insert(move(node));
+    }
+}
+
 const char* MarkdownParser::GetBlockTypeName(MD_BLOCKTYPE type) { return block_type_name[type]; }
 const char* MarkdownParser::GetSpanTypeName(MD_SPANTYPE type)   { return span_type_name[type];  }
 const char* MarkdownParser::GetTextTypeName(MD_TEXTTYPE type)   { return text_type_name[type];  }
@@ -35,16 +123,26 @@ MarkdownParser::MarkdownParser()
     : fParser(new MD_PARSER) {
 
     fTextLookup = new text_lookup;
-    fTextLookup->markupMap = new std::map<int32, markup_stack*>;
-    fTextLookup->shiftMap = new std::map<int32, int32>;
+    fTextLookup->markupMap = new std::map<int64, markup_stack*>;
+    fTextLookup->shiftMap = new std::map<int64, int64>;
+    fTextLookup->parseOffset = 0;
+    fTextLookup->segments = NULL;
+    fTextLookup->parseStart = 0;
+    fTextLookup->parseLimit = 0;
+    fTextLookup->skipParagraphs = false;
+    fTextLookup->maxOffset = 0;
+
+    fBlockParser = new BlockParser();
+    fUpdatedLeaf = NULL;
 }
 
 MarkdownParser::~MarkdownParser() {
     ClearTextInfo();
     delete fParser;
+    delete fBlockParser;
 }
 
-std::map<int32, markup_stack*>* MarkdownParser::GetMarkupMap() {
+std::map<int64, markup_stack*>* MarkdownParser::GetMarkupMap() {
     return fTextLookup->markupMap;
 }
 
@@ -64,36 +162,708 @@ void MarkdownParser::Init() {
     fParser->debug_log   = &MarkdownParser::LogDebug;
 }
 
-void MarkdownParser::ClearTextInfo(int32 start, int32 end) {
-    if (fTextLookup->markupMap->empty()) {
+void MarkdownParser::ClearTextInfo(int64 start, int64 end) {
+    markup_map* markupMap = fTextLookup->markupMap;
+    if (markupMap->empty()) {
         return;
     }
 
-    for (auto mapItem : *fTextLookup->markupMap) {
-        int32 offset = mapItem.first;
-        if (offset >= start && offset <= end) {
-            mapItem.second->clear();                        // first clear stack
-            fTextLookup->markupMap->erase(mapItem.first);   // then remove map item
+    auto first = markupMap->lower_bound(start);
+    auto last  = markupMap->upper_bound(end);
+
+    for (auto mapItem = first; mapItem != last; mapItem++) {
+        for (auto item : *mapItem->second) {               // first free stack items
+            delete item->detail;
+            delete item;
         }
+        delete mapItem->second;
     }
+    markupMap->erase(first, last);                          // then remove map items
 }
 
-int MarkdownParser::Parse(char* text, int32 size) {
-    printf("Markdown parser parsing text of size %d chars\n", size);
+int MarkdownParser::Parse(char* text, int32 size, int64 offset) {
     fTextSize = size;
+    fTextLookup->parseOffset = offset;
     return md_parse(text, (uint) size, fParser, fTextLookup);
 }
 
-void MarkdownParser::InsertTextShiftAt(int32 start, int32 delta) {
+void MarkdownParser::ParseBlocks(const char* text, int64 size, int64 start) {
+    ClearTextInfo(start);
+    fBlockParser->Parse(text, size, start);
+    fUpdatedLeaf = NULL;
+
+    // references must be known before the first leaf is parsed
+    fReferenceBlocks.clear();
+    fReferenceUses.clear();
+    for (auto block : *fBlockParser->Blocks()) {
+        CollectReferences(block, text);
+    }
+    UpdateReferenceText();
+
+    EmitBlocks(text, start);
+}
+
+bool MarkdownParser::UpdateBlocks(const char* text, int64 size, int64 offset, int64 removed, int64 inserted,
+                                  int64* start, int64* end) {
+    int64 delta = inserted - removed;
+    // typing within a paragraph mostly leaves the block structure alone, then only its inline content is parsed
+    fUpdatedLeaf = fBlockParser->UpdateLeaf(text, size, offset, removed, inserted);
+    if (fUpdatedLeaf != NULL) {
+        UpdateLeaf(fUpdatedLeaf, text, offset, delta, start, end);
+        return true;
+    }
+    fBlockParser->Update(text, size, offset, removed, inserted, start, end);
+
+    // drop the markup of the range parsed again and move everything after it, the tail is unchanged
+    int64 oldEnd = *end - delta;
+    bool toEnd = (*end >= size);
+    if (toEnd || oldEnd > *start) {
+        ClearTextInfo(*start, toEnd ? INT64_MAX : oldEnd - 1);
+    }
+    if (!toEnd) {
+        ShiftMarkup(oldEnd, delta);
+    }
+
+    // keep the definitions of the range parsed again to tell which labels they change
+    int64 rangeEnd = (toEnd ? INT64_MAX : oldEnd);
+    vector<reference_block> previous;
+    for (auto reference = fReferenceBlocks.lower_bound(*start);
+         reference != fReferenceBlocks.end() && reference->first < rangeEnd; reference++) {
+        previous.push_back(reference->second);
+    }
+    ShiftBlockEntries(&fReferenceBlocks, *start, rangeEnd, delta);
+    ShiftBlockEntries(&fReferenceUses, *start, rangeEnd, delta);
+    for (auto block : *fBlockParser->Blocks()) {
+        CollectReferences(block, text);
+    }
+
+    vector<const reference_block*> current;
+    for (auto reference = fReferenceBlocks.lower_bound(*start);
+         reference != fReferenceBlocks.end() && (toEnd || reference->first < *end); reference++) {
+        current.push_back(&reference->second);
+    }
+    bool changed = (current.size() != previous.size());
+    for (size_t index = 0; !changed && index < current.size(); index++) {
+        changed = (current[index]->text != previous[index].text);
+    }
+    set<string> labels;
+    if (changed) {
+        // links to the labels defined before or now may resolve differently
+        for (auto& reference : previous) {
+            labels.insert(reference.labels.begin(), reference.labels.end());
+        }
+        for (auto reference : current) {
+            labels.insert(reference->labels.begin(), reference->labels.end());
+        }
+        UpdateReferenceText();
+    }
+    EmitBlocks(text, *start);
+
+    if (!labels.empty()) {
+        ParseReferenceUsers(labels, text, start, end);
+    }
+    return false;
+}
+
+void MarkdownParser::SwapRanges(const char* text, int64 size, int64 start, int64 middle, int64 end,
+                                vector<pair<int64, int64>>* ranges) {
+    ranges->clear();
+    fUpdatedLeaf = NULL;
+
+    // the first definition of a label wins, so definitions changing order can change links anywhere
+    map<string, int32> definitions;
+    for (auto& reference : fReferenceBlocks) {
+        for (auto& label : reference.second.labels) {
+            definitions[label]++;
+        }
+    }
+    bool reordered = false;
+    for (auto reference = fReferenceBlocks.lower_bound(start);
+         reference != fReferenceBlocks.end() && reference->first < end; reference++) {
+        for (auto& label : reference->second.labels) {
+            reordered = reordered || label == kAnyLabel || definitions[label] > 1;
+        }
+    }
+    if (reordered) {
+        printf("Markdown parser: moved reference definitions of labels defined more than once, parsing all blocks again.\n");
+        ClearTextInfo();
+        ParseBlocks(text, size, fBlockParser->Start());
+        ranges->push_back({fBlockParser->Start(), size});
+        return;
+    }
+
+    // markup moves with its text, only the document's own markup stays in place
+    markup_map* markupMap = fTextLookup->markupMap;
+    vector<markup_map::node_type> moved;
+    vector<text_data*> documentItems;
+    for (auto mapItem = markupMap->lower_bound(start); mapItem != markupMap->end() && mapItem->first < end; ) {
+        auto node = markupMap->extract(mapItem++);
+        int64 shift = (node.key() < middle ? end - middle : start - middle);
+        markup_stack* stack = node.mapped();
+        for (auto item = stack->begin(); item != stack->end(); ) {
+            bool block = ((*item)->markup_class == MD_BLOCK_BEGIN || (*item)->markup_class == MD_BLOCK_END);
+            if (block && (*item)->markup_type.block_type == MD_BLOCK_DOC) {
+                documentItems.push_back(*item);
+                item = stack->erase(item);
+            } else {
+                (*item)->offset += shift;
+                item++;
+            }
+        }
+        if (stack->empty()) {
+            delete stack;
+            continue;
+        }
+        node.key() += shift;
+        moved.push_back(move(node));
+    }
+    for (auto& node : moved) {
+        markupMap->insert(move(node));
+    }
+    for (auto item : documentItems) {
+        markup_stack*& stack = (*markupMap)[item->offset];
+        if (stack == NULL) {
+            stack = new markup_stack;
+        }
+        stack->insert(item->markup_class == MD_BLOCK_BEGIN ? stack->begin() : stack->end(), item);
+    }
+    SwapBlockEntries(&fReferenceBlocks, start, middle, end);
+    SwapBlockEntries(&fReferenceUses, start, middle, end);
+    UpdateReferenceText();
+    fBlockParser->SwapRanges(start, middle, end);
+
+    // parse the blocks at the seams again, which now follow other lines
+    int64 seams[] = {start, start + end - middle, end};
+    for (auto seam : seams) {
+        if (seam >= size) {
+            continue;
+        }
+        int64 parsedStart, parsedEnd;
+        UpdateBlocks(text, size, seam, 0, 0, &parsedStart, &parsedEnd);
+        ranges->push_back({parsedStart, parsedEnd});
+    }
+    printf("Markdown parser: swapped %" B_PRId64 " - %" B_PRId64 " and %" B_PRId64 " - %" B_PRId64 ".\n",
+        start, middle, middle, end);
+}
+
+void MarkdownParser::GetLeafContainers(vector<MD_BLOCKTYPE>* types) {
+    types->clear();
+    if (fUpdatedLeaf == NULL) {
+        return;
+    }
+    for (const block_node* node = fUpdatedLeaf->parent; node != NULL; node = node->parent) {
+        // blocks opened on the first line of the paragraph begin within the range parsed again
+        int64 begin = (node->parent == NULL ? fBlockParser->Start() : node->lineStart);
+        if (begin < fUpdatedLeaf->lineStart) {
+            types->insert(types->begin(), node->type);
+        }
+    }
+}
+
+void MarkdownParser::EmitBlocks(const char* text, int64 start) {
+    fTextLookup->parseOffset = fBlockParser->Start();
+    if (start == fBlockParser->Start()) {
+        AddBlockMarkup(MD_BLOCK_BEGIN, MD_BLOCK_DOC, start, NULL);
+        // the document begins before the markup of a first block kept from the last parse
+        markup_stack* stack = (*fTextLookup->markupMap)[start];
+        rotate(stack->begin(), stack->end() - 1, stack->end());
+    }
+    for (auto block : *fBlockParser->Blocks()) {
+        EmitBlock(block, text, false);
+    }
+}
+
+static bool IsContainer(MD_BLOCKTYPE type) {
+    return type == MD_BLOCK_QUOTE || type == MD_BLOCK_UL || type == MD_BLOCK_OL || type == MD_BLOCK_LI;
+}
+
+/**
+ * returns the number of whitespace chars at the start of the line at offset, and in columns
+ * how many columns they take up at their position in the document.
+ */
+static int32 MeasureIndentation(const char* text, int64 offset, int32 length, int32* columns) {
+    int64 lineStart = offset;
+    while (lineStart > 0 && text[lineStart - 1] != '\n') {
+        lineStart--;
+    }
+    int32 column = 0;
+    for (int64 pos = lineStart; pos < offset; pos++) {
+        column += (text[pos] == '\t' ? 4 - column % 4 : 1);
+    }
+    int32 start = column;
+    int32 count = 0;
+    for (; count < length && (text[offset + count] == ' ' || text[offset + count] == '\t'); count++) {
+        column += (text[offset + count] == '\t' ? 4 - column % 4 : 1);
+    }
+    *columns = column - start;
+    return count;
+}
+
+/**
+ * returns the offset of the mark if the paragraph starts a task item, or -1.
+ */
+static int64 FindTaskMark(const block_node* paragraph) {
+    // the block parser starts the paragraph of task items at the mark
+    if (paragraph->type != MD_BLOCK_P || !paragraph->parent->task
+        || paragraph != paragraph->parent->children.front()) {
+        return -1;
+    }
+    return paragraph->lines.front().offset + 1;
+}
+
+void MarkdownParser::EmitBlock(const block_node* node, const char* text, bool tightItem) {
+    switch (node->type) {
+        case MD_BLOCK_QUOTE: {
+            AddBlockMarkup(MD_BLOCK_BEGIN, node->type, node->start, NULL);
+            for (auto child : node->children) {
+                EmitBlock(child, text, false);
+            }
+            AddBlockMarkup(MD_BLOCK_END, node->type, node->end, NULL);
+            break;
+        }
+        case MD_BLOCK_UL:
+        case MD_BLOCK_OL: {
+            MD_BLOCK_UL_DETAIL bulletDetail;
+            bulletDetail.is_tight = node->tight;
+            bulletDetail.mark = node->mark;
+            MD_BLOCK_OL_DETAIL orderedDetail;
+            orderedDetail.start = node->number;
+            orderedDetail.is_tight = node->tight;
+            orderedDetail.mark_delimiter = node->mark;
+            void* detail = (node->type == MD_BLOCK_UL ? (void*)&bulletDetail : (void*)&orderedDetail);
+
+            AddBlockMarkup(MD_BLOCK_BEGIN, node->type, node->start, detail);
+            for (auto child : node->children) {
+                EmitBlock(child, text, false);
+            }
+            AddBlockMarkup(MD_BLOCK_END, node->type, node->end, detail);
+            break;
+        }
+        case MD_BLOCK_LI: {
+            // task items start with a paragraph whose text starts with the task mark, see md4c's MD_FLAG_TASKLISTS
+            MD_BLOCK_LI_DETAIL detail = {};
+            const block_node* paragraph = (node->children.empty() ? NULL : node->children.front());
+            int64 taskMark = (paragraph != NULL ? FindTaskMark(paragraph) : -1);
+            if (taskMark >= 0) {
+                detail.is_task = true;
+                detail.task_mark = text[taskMark];
+                detail.task_mark_offset = taskMark - fBlockParser->Start();
+            }
+            AddBlockMarkup(MD_BLOCK_BEGIN, node->type, node->start, &detail);
+            bool tight = node->parent->tight;
+            for (auto child : node->children) {
+                if (child == paragraph && detail.is_task) {
+                    ParseLeaf(child, text, tight, true);
+                } else {
+                    EmitBlock(child, text, tight);
+                }
+            }
+            AddBlockMarkup(MD_BLOCK_END, node->type, node->end, &detail);
+            break;
+        }
+        default:
+            ParseLeaf(node, text, tightItem);
+    }
+}
+
+void MarkdownParser::ParseLeaf(const block_node* node, const char* text, bool tightItem, bool taskItem) {
+    fLeafBuffer.clear();
+    fLeafSegments.clear();
+
+    // link reference definitions of other blocks go before or after the leaf like in the document,
+    // as md4c takes the first definition of a label
+    BString earlierReferences;
+    BString laterReferences;
+    if (node->type == MD_BLOCK_P || node->type == MD_BLOCK_H) {
+        // remember which labels the leaf may refer to, it is parsed again when their definitions change
+        int64 leafStart = node->lines.front().offset;
+        string content;
+        for (auto line : node->lines) {
+            content.append(text + line.offset, line.length).append("\n");
+        }
+        set<string> labels;
+        CollectLabels(content, &labels);
+        if (labels.empty()) {
+            fReferenceUses.erase(leafStart);
+        } else {
+            fReferenceUses[leafStart].swap(labels);
+        }
+    }
+    if ((node->type == MD_BLOCK_P || node->type == MD_BLOCK_H) && fReferenceText.Length() > 0) {
+        int64 leafStart = node->lines.front().offset;
+        for (auto& reference : fReferenceBlocks) {
+            if (reference.first < leafStart) {
+                earlierReferences << reference.second.text << "\n";
+            } else if (reference.first > leafStart) {
+                laterReferences << reference.second.text << "\n";
+            }
+        }
+        fLeafBuffer.insert(fLeafBuffer.end(), earlierReferences.String(),
+            earlierReferences.String() + earlierReferences.Length());
+    }
+
+    // md4c only keeps the indentation of HTML blocks as text when they interrupt a paragraph
+    if (node->type == MD_BLOCK_HTML && node->fenceOffset >= 4) {
+        fLeafBuffer.insert(fLeafBuffer.end(), {'p', '\n'});
+    }
+    // lazy lines need the other lines in a container, e.g. so they are not taken as table delimiter row
+    bool lazy = false;
+    for (auto line : node->lines) {
+        lazy = lazy || line.lazy;
+    }
+    // md4c only takes a fence as part of a paragraph, HTML block, break or code opener right after
+    // a fenced block whose containers ended
+    if (node->afterFence) {
+        const char* container = (lazy ? "> - " : ">");
+        fLeafBuffer.insert(fLeafBuffer.end(), container, container + strlen(container));
+        fLeafBuffer.insert(fLeafBuffer.end(), node->fenceLength, node->fenceChar);
+        fLeafBuffer.push_back('\n');
+    }
+    // the block parser keeps the rest of a task item's first line as paragraph text, so does md4c in an item
+    BString quote(lazy ? "> " : "");
+    BString prefix(quote);
+    BString firstPrefix(quote);
+    if (taskItem) {
+        firstPrefix << "- ";
+        prefix << "  ";
+    }
+    fLeafBuffer.insert(fLeafBuffer.end(), firstPrefix.String(), firstPrefix.String() + firstPrefix.Length());
+    fTextLookup->parseStart = fLeafBuffer.size();
+
+    // copy the leaf lines w/o container markers, each line mapping back to its document offset
+    for (size_t index = 0; index < node->lines.size(); index++) {
+        int64 offset = node->lines[index].offset;
+        int32 length = node->lines[index].length;
+        if (index > 0 && !node->lines[index].lazy) {
+            fLeafBuffer.insert(fLeafBuffer.end(), prefix.String(), prefix.String() + prefix.Length());
+        }
+        // indentation counts in document columns, so tabs are expanded before the line is moved
+        int64 spaceOffset = (node->lines[index].indent > 0 ? offset - 1 : offset);
+        int32 columns;
+        int32 whitespace = MeasureIndentation(text, offset, length, &columns);
+        int32 spaces = node->lines[index].indent + columns;
+        offset += whitespace;
+        length -= whitespace;
+        if (index == 0 && node->type == MD_BLOCK_HTML && node->parent->type == MD_BLOCK_QUOTE
+            && !node->interrupting) {
+            // md4c drops the indentation of HTML blocks starting in a quote
+            spaces = 0;
+        }
+        if (spaces > 0) {
+            fLeafSegments.push_back({(int32)fLeafBuffer.size(), spaceOffset, 0});
+            fLeafBuffer.insert(fLeafBuffer.end(), spaces, ' ');
+        }
+        fLeafSegments.push_back({(int32)fLeafBuffer.size(), offset, length});
+        fLeafBuffer.insert(fLeafBuffer.end(), text + offset, text + offset + length);
+        fLeafBuffer.push_back('\n');
+    }
+    fTextLookup->parseLimit = fLeafBuffer.size();
+    if (taskItem && !tightItem) {
+        // another item after a blank line makes the list loose, so md4c reports the paragraph
+        BString item;
+        item << quote << "\n" << quote << "- p\n";
+        fLeafBuffer.insert(fLeafBuffer.end(), item.String(), item.String() + item.Length());
+    }
+
+    if (laterReferences.Length() > 0) {
+        fLeafBuffer.push_back('\n');
+        fLeafBuffer.insert(fLeafBuffer.end(), laterReferences.String(), laterReferences.String() + laterReferences.Length());
+    }
+
+    fTextLookup->segments = &fLeafSegments;
+    fTextLookup->skipParagraphs = tightItem;
+    fTextLookup->maxOffset = 0;
+    // keep the buffer terminated like document text, for attributes logged by the callbacks
+    fLeafBuffer.push_back('\0');
+    md_parse(fLeafBuffer.data(), fLeafBuffer.size() - 1, fParser, fTextLookup);
+    fTextLookup->segments = NULL;
+    fTextLookup->skipParagraphs = false;
+    fTextLookup->maxOffset = 0;
+}
+
+void MarkdownParser::UpdateLeaf(const block_node* node, const char* text, int64 offset, int64 delta,
+                                int64* start, int64* end) {
+    const block_line& lastLine = node->lines.back();
+    *start = node->lineStart;
+    *end = lastLine.offset + lastLine.length + 1;
+    int64 oldEnd = *end - delta;
+
+    // drop the markup of the paragraph, containers starting or ending on its lines keep theirs
+    markup_map* markupMap = fTextLookup->markupMap;
+    vector<text_data*> containers;
+    auto first = markupMap->lower_bound(*start);
+    auto last  = markupMap->lower_bound(oldEnd);
+    for (auto mapItem = first; mapItem != last; mapItem++) {
+        for (auto item : *mapItem->second) {
+            bool block = (item->markup_class == MD_BLOCK_BEGIN || item->markup_class == MD_BLOCK_END);
+            MD_BLOCKTYPE type = item->markup_type.block_type;
+            if (block && (IsContainer(type) || type == MD_BLOCK_DOC)) {
+                containers.push_back(item);
+            } else {
+                delete item->detail;
+                delete item;
+            }
+        }
+        delete mapItem->second;
+    }
+    markupMap->erase(first, last);
+    ShiftMarkup(oldEnd, delta);
+
+    ShiftBlockEntries(&fReferenceBlocks, offset + 1, offset + 1, delta);
+    ShiftBlockEntries(&fReferenceUses, offset + 1, offset + 1, delta);
+
+    bool tightItem = (node->parent->type == MD_BLOCK_LI && node->parent->parent->tight);
+    ParseLeaf(node, text, tightItem, FindTaskMark(node) >= 0);
+
+    // containers open before the paragraph's markup and close after it
+    for (auto item = containers.rbegin(); item != containers.rend(); item++) {
+        if ((*item)->offset >= offset) {
+            (*item)->offset += delta;
+        }
+        if ((*item)->markup_class == MD_BLOCK_BEGIN) {
+            markup_stack*& stack = (*markupMap)[(*item)->offset];
+            if (stack == NULL) {
+                stack = new markup_stack;
+            }
+            stack->insert(stack->begin(), *item);
+        }
+    }
+    for (auto item : containers) {
+        if (item->markup_class == MD_BLOCK_END) {
+            AddMarkupAt(item, item->offset, fTextLookup);
+        }
+    }
+}
+
+void MarkdownParser::AddBlockMarkup(MD_CLASS markupClass, MD_BLOCKTYPE type, int64 offset, void* detail) {
+    text_data* data = new text_data;
+    data->markup_class = markupClass;
+    data->markup_type.block_type = type;
+    data->detail = GetDetailForBlockType(type, detail);
+    data->length = 0;
+
+    AddMarkupAt(data, offset, fTextLookup);
+}
+
+void MarkdownParser::ShiftMarkup(int64 offset, int64 delta) {
+    if (delta == 0) {
+        return;
+    }
+    markup_map* markupMap = fTextLookup->markupMap;
+    vector<markup_map::node_type> shifted;
+
+    for (auto mapItem = markupMap->lower_bound(offset); mapItem != markupMap->end(); ) {
+        for (auto item : *mapItem->second) {
+            item->offset += delta;
+            // the task mark offset is the only offset md4c passes in a detail
+            int64 taskMarkOffset;
+            if (item->markup_class == MD_BLOCK_BEGIN && item->markup_type.block_type == MD_BLOCK_LI
+                && item->detail != NULL && item->detail->GetBool("task", false)
+                && item->detail->FindInt64("taskMarkOffset", &taskMarkOffset) == B_OK) {
+                item->detail->ReplaceInt64("taskMarkOffset", taskMarkOffset + delta);
+            }
+        }
+        auto node = markupMap->extract(mapItem++);
+        node.key() += delta;
+        shifted.push_back(move(node));
+    }
+    for (auto& node : shifted) {
+        markupMap->insert(markupMap->end(), move(node));
+    }
+}
+
+void MarkdownParser::CollectReferences(const block_node* node, const char* text) {
+    if (node->type != MD_BLOCK_P) {
+        for (auto child : node->children) {
+            CollectReferences(child, text);
+        }
+        return;
+    }
+    // reference definitions can only start a paragraph, in task items after the task mark,
+    // md4c takes a delimiter row below the first line as a table first
+    if (node->table) {
+        return;
+    }
+    const block_line& first = node->lines.front();
+    int64 taskMark = FindTaskMark(node);
+    // the definition starts at column 0, so it doesn't continue a leaf it's appended to in ParseLeaf
+    int32 pos = (taskMark >= 0 ? taskMark + 2 - first.offset : 0);
+    while (pos < first.length && (text[first.offset + pos] == ' ' || text[first.offset + pos] == '\t')) {
+        pos++;
+    }
+    if (pos >= first.length || text[first.offset + pos] != '[') {
+        return;
+    }
+    // only the definitions are kept, so edits of the text after them don't affect other blocks
+    int32 start = pos;
+    string lines;
+    bool lazy = false;
+    for (auto line : node->lines) {
+        lines.append(text + line.offset + pos, line.length - pos).append("\n");
+        lazy = lazy || line.lazy;
+        pos = 0;
+    }
+    int32 length = BlockParser::ScanReferences(lines);
+    if (length == 0) {
+        return;
+    }
+    reference_block& references = fReferenceBlocks[first.offset];
+    CollectLabels(lines.substr(0, lazy ? lines.size() : length), &references.labels);
+    if (!lazy) {
+        references.text.SetTo(lines.data(), length);
+        return;
+    }
+    // keep lazy lines outside of a container like in ParseLeaf
+    BString paragraph;
+    pos = start;
+    for (auto line : node->lines) {
+        if (!line.lazy) {
+            paragraph << "> ";
+        }
+        paragraph.Append(text + line.offset + pos, line.length - pos).Append("\n");
+        pos = 0;
+    }
+    references.text = paragraph;
+}
+
+void MarkdownParser::UpdateReferenceText() {
+    fReferenceText.Truncate(0);
+    for (auto& reference : fReferenceBlocks) {
+        fReferenceText << reference.second.text << "\n";
+    }
+}
+
+void MarkdownParser::ParseReferenceUsers(const set<string>& labels, const char* text, int64* start, int64* end) {
+    // blocks in the range parsed again are up to date already
+    bool anyLabel = (labels.count(kAnyLabel) > 0);
+    vector<int64> users;
+    for (auto& use : fReferenceUses) {
+        if (use.first >= *start && use.first < *end) {
+            continue;
+        }
+        bool uses = anyLabel || use.second.count(kAnyLabel) > 0;
+        for (auto label = use.second.begin(); !uses && label != use.second.end(); label++) {
+            uses = (labels.count(*label) > 0);
+        }
+        if (uses) {
+            users.push_back(use.first);
+        }
+    }
+    for (auto offset : users) {
+        const block_node* leaf = fBlockParser->LeafAt(offset);
+        if (leaf == NULL) {
+            printf("Markdown parser: no block found at %" B_PRId64 " using a changed reference definition.\n", offset);
+            continue;
+        }
+        int64 leafStart, leafEnd;
+        UpdateLeaf(leaf, text, offset, 0, &leafStart, &leafEnd);
+        *start = min(*start, leafStart);
+        *end = max(*end, leafEnd);
+    }
+}
+
+static void CollectVerifyItems(markup_map* markupMap, int64 start, vector<text_data*>* containers,
+                               vector<text_data*>* items) {
+    for (auto mapItem : *markupMap) {
+        for (auto item : *mapItem.second) {
+            bool block = (item->markup_class == MD_BLOCK_BEGIN || item->markup_class == MD_BLOCK_END);
+            MD_BLOCKTYPE type = item->markup_type.block_type;
+            // missing table cells are only reported at the start by md4c, see AddMarkupMetadata
+            if (block && (type == MD_BLOCK_TH || type == MD_BLOCK_TD) && item->offset == start) {
+                continue;
+            }
+            if (block && IsContainer(type)) {
+                containers->push_back(item);
+            } else {
+                items->push_back(item);
+            }
+        }
+    }
+}
+
+static bool SameMarkup(const text_data* item, const text_data* other, bool container) {
+    if (item->markup_class != other->markup_class || (!container && item->offset != other->offset)) {
+        return false;
+    }
+    switch (item->markup_class) {
+        case MD_BLOCK_BEGIN:
+        case MD_BLOCK_END:
+            if (item->markup_type.block_type != other->markup_type.block_type) {
+                return false;
+            }
+            break;
+        case MD_SPAN_BEGIN:
+        case MD_SPAN_END:
+            if (item->markup_type.span_type != other->markup_type.span_type) {
+                return false;
+            }
+            break;
+        default:
+            if (item->markup_type.text_type != other->markup_type.text_type || item->length != other->length) {
+                return false;
+            }
+    }
+    // md4c also passes bogus details when leaving lists
+    if (container && item->markup_class == MD_BLOCK_END) {
+        return true;
+    }
+    if (item->detail == NULL || other->detail == NULL) {
+        return item->detail == other->detail;
+    }
+    return item->detail->HasSameData(*other->detail, true, true);
+}
+
+bool MarkdownParser::VerifyMarkup(const char* text, int64 size) {
+    int64 start = fBlockParser->Start();
+    MarkdownParser reference;
+    reference.Init();
+    // md4c may write to the text it parses, so hand it a terminated copy
+    vector<char> buffer(text + start, text + size);
+    buffer.push_back('\0');
+    reference.Parse(buffer.data(), buffer.size() - 1, start);
+
+    vector<text_data*> containers, items, referenceContainers, referenceItems;
+    CollectVerifyItems(GetMarkupMap(), start, &containers, &items);
+    CollectVerifyItems(reference.GetMarkupMap(), start, &referenceContainers, &referenceItems);
+
+    for (int pass = 0; pass < 2; pass++) {
+        vector<text_data*>& found    = (pass == 0 ? containers : items);
+        vector<text_data*>& expected = (pass == 0 ? referenceContainers : referenceItems);
+        size_t count = min(found.size(), expected.size());
+
+        for (size_t index = 0; index <= count; index++) {
+            if (index == count) {
+                if (found.size() == expected.size()) {
+                    break;
+                }
+                printf("VerifyMarkup: got %zu %s items instead of %zu.\n", found.size(),
+                    pass == 0 ? "container" : "markup", expected.size());
+                return false;
+            }
+            if (!SameMarkup(found[index], expected[index], pass == 0)) {
+                printf("VerifyMarkup: %s item %zu differs, got %s %s at %" B_PRId64 " instead of %s %s at %" B_PRId64 ".\n",
+                    pass == 0 ? "container" : "markup", index,
+                    GetMarkupClassName(found[index]->markup_class), GetMarkupItemName(found[index]), found[index]->offset,
+                    GetMarkupClassName(expected[index]->markup_class), GetMarkupItemName(expected[index]),
+                    expected[index]->offset);
+                return false;
+            }
+        }
+    }
+    printf("VerifyMarkup: %zu container and %zu markup items match.\n", containers.size(), items.size());
+    return true;
+}
+
+void MarkdownParser::InsertTextShiftAt(int64 start, int64 delta) {
     // TODO
 }
 
-int32 MarkdownParser::GetTextShiftAt(int32 offset) {
+int64 MarkdownParser::GetTextShiftAt(int64 offset) {
     // TODO
     return 0;
 }
 
-markup_map_iter MarkdownParser::GetPreviousMarkupMapIter(int32 offset) {
+markup_map_iter MarkdownParser::GetPreviousMarkupMapIter(int64 offset) {
     markup_map_iter lowIter;
     lowIter = fTextLookup->markupMap->lower_bound(offset);
 
@@ -103,7 +873,7 @@ markup_map_iter MarkdownParser::GetPreviousMarkupMapIter(int32 offset) {
     return lowIter;
 }
 
-markup_map_iter MarkdownParser::GetNextMarkupMapIter(int32 offset) {
+markup_map_iter MarkdownParser::GetNextMarkupMapIter(int64 offset) {
     markup_map_iter lowIter;
     // lower_bound is not less than offset, which is correct
     // cf https://en.cppreference.com/w/cpp/container/map/upper_bound
@@ -111,12 +881,12 @@ markup_map_iter MarkdownParser::GetNextMarkupMapIter(int32 offset) {
     return fTextLookup->markupMap->lower_bound(offset);
 }
 
-markup_stack* MarkdownParser::GetMarkupStackAt(int32 offset, int32* mapOffsetFound) {
+markup_stack* MarkdownParser::GetMarkupStackAt(int64 offset, int64* mapOffsetFound) {
     // search markup stack for nearest offset in search direction
-    printf("searching nearest markup info stack for offset %d...\n", offset);
+    printf("searching nearest markup info stack for offset %" B_PRId64 "...\n", offset);
 
     auto low = GetPreviousMarkupMapIter(offset);
-    printf("found stack at nearest lower offset %d for offset %d\n", low->first, offset);
+    printf("found stack at nearest lower offset %" B_PRId64 " for offset %" B_PRId64 "\n", low->first, offset);
 
     if (mapOffsetFound != NULL) {
         *mapOffsetFound = low->first;
@@ -125,7 +895,52 @@ markup_stack* MarkdownParser::GetMarkupStackAt(int32 offset, int32* mapOffsetFou
     return low->second;
 }
 
-outline_map* MarkdownParser::GetOutlineAt(int32 offset) {
+void MarkdownParser::GetEnclosingRanges(const char* text, int64 start, int64 end,
+                                        vector<pair<int64, int64>>* spans,
+                                        vector<pair<int64, int64>>* blocks) {
+    spans->clear();
+    blocks->clear();
+    // the block parser may parse another block again, which drops the paragraph of the last edit
+    fUpdatedLeaf = NULL;
+    vector<const block_node*> nodes;
+    fBlockParser->GetBlocksAt(text, start, end, &nodes);
+    if (nodes.empty()) {
+        return;
+    }
+    const block_node* leaf = nodes.front();
+    if (!IsContainer(leaf->type)) {
+        // spans close innermost first, their end markup is at the start of the closing delimiter
+        markup_map* markupMap = fTextLookup->markupMap;
+        vector<int64> open;
+        auto last = markupMap->upper_bound(leaf->end);
+        for (auto mapItem = markupMap->lower_bound(leaf->start); mapItem != last; mapItem++) {
+            for (auto item : *mapItem->second) {
+                if (item->markup_class == MD_SPAN_BEGIN) {
+                    open.push_back(item->offset);
+                } else if (item->markup_class == MD_SPAN_END && !open.empty()) {
+                    int64 spanStart = open.back();
+                    open.pop_back();
+                    // the delimiter reaches up to the next markup on its line
+                    auto nextItem = next(mapItem);
+                    int64 spanEnd = (nextItem != last ? nextItem->first : leaf->end);
+                    const char* lineEnd = static_cast<const char*>(
+                        memchr(text + item->offset, '\n', spanEnd - item->offset));
+                    if (lineEnd != NULL) {
+                        spanEnd = lineEnd - text;
+                    }
+                    if (spanStart <= start && spanEnd >= end) {
+                        spans->push_back({spanStart, spanEnd});
+                    }
+                }
+            }
+        }
+    }
+    for (auto node : nodes) {
+        blocks->push_back({min(node->start, start), node->end});
+    }
+}
+
+outline_map* MarkdownParser::GetOutlineAt(int64 offset) {
     outline_map* outlineElements = new outline_map();
 
     // final stack holding all outline items
@@ -167,12 +982,12 @@ outline_map* MarkdownParser::GetOutlineAt(int32 offset) {
     if (search) {
         printf("Warning: reached start of document without finding proper outline root!\n");
     }
-    printf("GetOutlineAt %d: found %zu outline items.\n", offset, resultStack->size());
+    printf("GetOutlineAt %" B_PRId64 ": found %zu outline items.\n", offset, resultStack->size());
 
     return outlineElements;
 }
 
-status_t MarkdownParser::GetMarkupBoundariesAt(int32 offset, int32* start, int32* end,
+status_t MarkdownParser::GetMarkupBoundariesAt(int64 offset, int64* start, int64* end,
                                               BOUNDARY_TYPE boundaryType,
                                               SEARCH_DIRECTION searchType,
                                               bool trimToText) {
@@ -185,12 +1000,12 @@ status_t MarkdownParser::GetMarkupBoundariesAt(int32 offset, int32* start, int32
             *start = -1;
         if (end != NULL)
             *end = -1;
-        printf("error: could not find matching previous offset in lookupMap for offset %d!\n", offset);
+        printf("error: could not find matching previous offset in lookupMap for offset %" B_PRId64 "!\n", offset);
         return B_ERROR;
     }
 
-    int32 startPos = 0;
-    int32 textPos = -1;
+    int64 startPos = 0;
+    int64 textPos = -1;
     bool  search = true;
 
     if (searchType == BEGIN || searchType == BOTH) {
@@ -206,7 +1021,7 @@ status_t MarkdownParser::GetMarkupBoundariesAt(int32 offset, int32* start, int32
                 if (stackItem->markup_class == classToSearch) {
                     startPos = stackItem->offset;
 
-                    printf("    markup START boundary search: found markup class %s [%s] at offset %d\n",
+                    printf("    markup START boundary search: found markup class %s [%s] at offset %" B_PRId64 "\n",
                             GetMarkupClassName(classToSearch),
                             (classToSearch == MD_BLOCK_BEGIN ? GetBlockTypeName(stackItem->markup_type.block_type)
                                                              : GetSpanTypeName(stackItem->markup_type.span_type)),
@@ -228,7 +1043,7 @@ status_t MarkdownParser::GetMarkupBoundariesAt(int32 offset, int32* start, int32
         }
     }
 
-    int32 endPos = offset;
+    int64 endPos = offset;
     textPos = -1;
 
     if (searchType == END || searchType == BOTH) {
@@ -240,7 +1055,7 @@ status_t MarkdownParser::GetMarkupBoundariesAt(int32 offset, int32* start, int32
             if (end != NULL)
                 *end = -1;
 
-            printf("error: could not find matching next offset in lookupMap for offset %d!\n", offset);
+            printf("error: could not find matching next offset in lookupMap for offset %" B_PRId64 "!\n", offset);
             return B_ERROR;
         }
         classToSearch = (boundaryType == BLOCK ? MD_BLOCK_END : MD_SPAN_END);
@@ -257,7 +1072,7 @@ status_t MarkdownParser::GetMarkupBoundariesAt(int32 offset, int32* start, int32
                 }
                 if (stackItem->markup_class == classToSearch) {
                     endPos = stackItem->offset;
-                    printf("    markup END boundary search: found markup class %s at offset %d\n",
+                    printf("    markup END boundary search: found markup class %s at offset %" B_PRId64 "\n",
                             GetMarkupClassName(classToSearch), endPos);
 
                     search = false;
@@ -276,7 +1091,8 @@ status_t MarkdownParser::GetMarkupBoundariesAt(int32 offset, int32* start, int32
         }
     }
 
-    printf("GetMarkupBoundary: found %s with offset %d from %d to %d.\n", boundaryType == BLOCK ? "BLOCK" : "SPAN",
+    printf("GetMarkupBoundary: found %s with offset %" B_PRId64 " from %" B_PRId64 " to %" B_PRId64 ".\n",
+        boundaryType == BLOCK ? "BLOCK" : "SPAN",
         offset, startPos, endPos);
 
     return B_OK;
@@ -316,6 +1132,12 @@ bool MarkdownParser::FindTextData(const text_data* data, map<MD_BLOCKTYPE, text_
 
 int MarkdownParser::EnterBlock(MD_BLOCKTYPE type, MD_OFFSET offset, void* detail, void* userdata)
 {
+    // on leaf parses, the document, containers and list paragraphs are handled by the block parser
+    auto lookup = reinterpret_cast<text_lookup*>(userdata);
+    if (lookup->segments != NULL && (type == MD_BLOCK_DOC || (type == MD_BLOCK_P && lookup->skipParagraphs)
+        || IsContainer(type))) {
+        return 0;
+    }
     printf("EnterBlock type %s, offset: %u, detail:\n", block_type_name[type], offset);
     BMessage *detailMsg = GetDetailForBlockType(type, detail);
 
@@ -330,6 +1152,10 @@ int MarkdownParser::LeaveBlock(MD_BLOCKTYPE type, MD_OFFSET offset, void* detail
         printf("LeaveBlock ignoring type %s, offset: %u\n", block_type_name[type], offset);
         return 0;
     }
+    auto lookup = reinterpret_cast<text_lookup*>(userdata);
+    if (lookup->segments != NULL && ((type == MD_BLOCK_P && lookup->skipParagraphs) || IsContainer(type))) {
+        return 0;
+    }
     printf("LeaveBlock type %s, offset: %u, detail:\n", block_type_name[type], offset);
     BMessage *detailMsg = GetDetailForBlockType(type, detail);
 
@@ -395,16 +1221,52 @@ void MarkdownParser::AddMarkupMetadata(MD_CLASS markupClass, MD_SPANTYPE spanTyp
  */
 void MarkdownParser::AddMarkupMetadata(text_data *data, MD_OFFSET offset, void* userdata)
 {
-    data->offset = offset;
-
     auto lookup = reinterpret_cast<text_lookup*>(userdata);
-    auto lookupMapIter = lookup->markupMap->find(offset);
+    if (lookup->segments == NULL) {
+        // md4c offsets are relative to the parsed window, rebase to 64 bit document offsets
+        AddMarkupAt(data, lookup->parseOffset + offset, lookup);
+        return;
+    }
+    if ((int32)offset >= lookup->parseLimit) {
+        // md4c reports some empty blocks at offset 0, so ignore everything from the appended text on
+        lookup->parseLimit = -1;
+    }
+    // md4c reports cells missing in a table row at offset 0, as they have no text they are dropped
+    bool missingCell = (offset == 0 && lookup->maxOffset > 0 && data->markup_class != MD_TEXT
+        && (data->markup_type.block_type == MD_BLOCK_TH || data->markup_type.block_type == MD_BLOCK_TD));
+    lookup->maxOffset = max(lookup->maxOffset, (int32)offset);
+    if (missingCell || (int32)offset < lookup->parseStart || (int32)offset >= lookup->parseLimit) {
+        delete data->detail;
+        delete data;
+        return;
+    }
+    auto findSegment = [lookup](int32 offset) {
+        return upper_bound(lookup->segments->begin(), lookup->segments->end(), offset,
+            [](int32 offset, const leaf_segment& segment) { return offset < segment.bufferOffset; }) - 1;
+    };
+    if (data->markup_class == MD_TEXT && data->markup_type.text_type == MD_TEXT_BR && offset > 0) {
+        // md4c reports backslash breaks right after the line break, before any container marks of the next line
+        auto previous = findSegment((int32)offset - 1);
+        if ((int32)offset - 1 == previous->bufferOffset + previous->length && previous->length > 0) {
+            AddMarkupAt(data, previous->documentOffset + previous->length + 1, lookup);
+            return;
+        }
+    }
+    auto segment = findSegment((int32)offset);
+    AddMarkupAt(data, segment->documentOffset + min((int32)offset - segment->bufferOffset, segment->length), lookup);
+}
+
+void MarkdownParser::AddMarkupAt(text_data *data, int64 documentOffset, text_lookup* lookup)
+{
+    data->offset = documentOffset;
+
+    auto lookupMapIter = lookup->markupMap->find(documentOffset);
 
     if (lookupMapIter == lookup->markupMap->end()) {
         // add stack elemet to new map
         markup_stack* stack = new markup_stack;
         stack->push_back(data);
-        lookup->markupMap->insert({offset, stack});
+        lookup->markupMap->insert({documentOffset, stack});
     } else {
         lookupMapIter->second->push_back(data);
     }
@@ -475,7 +1337,7 @@ BMessage* MarkdownParser::GetDetailForBlockType(MD_BLOCKTYPE type, void* detail)
             BString taskMark;
             taskMark << detailData->task_mark;
             detailMsg->AddString("taskMark", taskMark.String());
-            detailMsg->AddUInt8("taskMarkOffset", detailData->task_mark_offset);
+            detailMsg->AddInt64("taskMarkOffset", detailData->task_mark_offset);
             break;
         }
         default: {
@@ -530,7 +1392,7 @@ void MarkdownParser::LogDebug(const char* msg, void* userdata)
  */
 const char* MarkdownParser::attr_to_str(MD_ATTRIBUTE data) {
     if (data.text == NULL || data.size == 0) return "";
-    printf("attr_to_str got text %s with length %u\n", data.text, data.size);
+    printf("attr_to_str got text %.*s with length %u\n", (int) data.size, data.text, data.size);
     return (new BString(data.text, data.size))->String();
 }
 
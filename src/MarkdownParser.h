@@ -10,9 +10,14 @@
 #include "include/md4c.h"
 #include <map>
 #include <Message.h>
+#include <set>
+#include <string>
+#include <String.h>
 #include <SupportDefs.h>
 #include <vector>
 
+#include "BlockParser.h"
+
 using namespace std;
 
 typedef enum MD_CLASS {
@@ -50,16 +55,33 @@ typedef struct text_data {
     MD_CLASS        markup_class;
     MD_TYPE         markup_type;
     BMessage        *detail;
-    uint            offset;
-    uint            length;
+    int64           offset;         // document offset, 64 bit so windows of huge files can be indexed
+    uint32          length;         // md4c limits a single text run to MD_SIZE
 } text_data;
 
 // used as temporary processing buffer for styling
 typedef struct vector<text_data*>               markup_stack;
-typedef map<int32, markup_stack*>               markup_map;
-typedef map<int32, markup_stack*>::iterator     markup_map_iter;
+typedef map<int64, markup_stack*>               markup_map;
+typedef map<int64, markup_stack*>::iterator     markup_map_iter;
 typedef map<const char*, text_data*>            outline_map;
 
+/**
+ * maps a line of a leaf block parsed on its own back to its document offset.
+ */
+typedef struct leaf_segment {
+    int32           bufferOffset;
+    int64           documentOffset;
+    int32           length;
+} leaf_segment;
+
+/**
+ * link reference definitions at the start of a paragraph, with the normalized labels they may define.
+ */
+typedef struct reference_block {
+    BString         text;
+    set<string>     labels;
+} reference_block;
+
 /**
  * main structure for integrating markdown parser.
  */
@@ -67,14 +89,39 @@ typedef struct text_lookup {
     /**
      * holds markup stacks keyed by text offset, both received from parsing
      */
-    map<int32, markup_stack*>   *markupMap;
+    map<int64, markup_stack*>   *markupMap;
     /**
      * holds the delta from specific offsets onwards to all subsequent offsets
      * as caused by editing (insert -> shift back, delete -> shift forward).
      * used for efficient recalculation of markup at existing offsets without
      * causing the need to always do a full re-parse.
      */
-    map<int32, int32>   *shiftMap;
+    map<int64, int64>   *shiftMap;
+    /**
+     * offset of the parsed text inside the document, added to all offsets reported by md4c,
+     * so partial parses, text following front matter and windows of large files end up at their
+     * document offsets.
+     */
+    int64               parseOffset;
+    /**
+     * set while md4c parses a single leaf block from the block parser, whose lines are copied
+     * w/o container markers, so offsets are mapped per line instead of using parseOffset.
+     */
+    vector<leaf_segment>* segments;
+    /**
+     * markup outside of this range belongs to text added around the leaf for md4c and is dropped,
+     * like a paragraph line before indented HTML blocks or reference definitions of other blocks.
+     */
+    int32               parseStart;
+    int32               parseLimit;
+    /**
+     * paragraphs of tight list items are not reported by md4c on a full parse, so they are dropped.
+     */
+    bool                skipParagraphs;
+    /**
+     * largest offset md4c reported for the current leaf, to tell its empty table cells at offset 0.
+     */
+    int32               maxOffset;
 } text_lookup;
 
 class MarkdownParser {
@@ -83,32 +130,77 @@ public:
                         MarkdownParser();
     virtual             ~MarkdownParser();
     void                Init();
-    void                ClearTextInfo(int32 start = -1, int32 end = INT32_MAX);
+    void                ClearTextInfo(int64 start = -1, int64 end = INT64_MAX);
 
-    int                 Parse(char* text, int32 size);
+    /**
+     * parses size bytes of text located at the given document offset.
+     * md4c offsets are 32 bit, so large documents need to be parsed in windows, see DocumentScanner.
+     */
+    int                 Parse(char* text, int32 size, int64 offset = 0);
+    /**
+     * parses text from start on with the incremental block parser, leaving only the inline content of
+     * each leaf block to md4c.
+     */
+    void                ParseBlocks(const char* text, int64 size, int64 start = 0);
+    /**
+     * updates the markup after removed bytes at offset were replaced by inserted bytes, with text holding
+     * the complete new text. markup after the edit is shifted, only the range from start to end is parsed again.
+     * returns true if that is the inline content of a single paragraph, see GetLeafContainers().
+     */
+    bool                UpdateBlocks(const char* text, int64 size, int64 offset, int64 removed, int64 inserted,
+                                     int64* start, int64* end);
+    /**
+     * returns the types of the blocks around the paragraph updated last that begin before the range
+     * parsed again, starting with the document.
+     */
+    void                GetLeafContainers(vector<MD_BLOCKTYPE>* types);
+    /**
+     * updates the markup after the text from start to middle and from middle to end swapped places, both
+     * made of whole top level blocks, see IsBlockStart(). markup is moved along w/o parsing, only the blocks
+     * at the seams are parsed again as they may depend on the line before. returns the ranges parsed again,
+     * which start at top level blocks.
+     */
+    void                SwapRanges(const char* text, int64 size, int64 start, int64 middle, int64 end,
+                                   vector<pair<int64, int64>>* ranges);
+    bool                IsBlockStart(int64 offset)  { return fBlockParser->IsBlockStart(offset); }
+    void                GetBlockStarts(vector<int64>* offsets)  { fBlockParser->GetBlockStarts(offsets); }
+    /**
+     * compares the markup with a full md4c parse of text, ignoring the offsets of container blocks
+     * and details of their ends, which md4c does not report reliably. logs the first difference found.
+     */
+    bool                VerifyMarkup(const char* text, int64 size);
     markup_map*         GetMarkupMap();
 
     /**
      * looks up nearest previous position in the text markup map
      */
-    markup_map_iter     GetPreviousMarkupMapIter(int32 offset);
+    markup_map_iter     GetPreviousMarkupMapIter(int64 offset);
     /**
      * looks up nearest following position in the text markup map
      */
-    markup_map_iter     GetNextMarkupMapIter(int32 offset);
+    markup_map_iter     GetNextMarkupMapIter(int64 offset);
     /**
      * returns the text metadata stack at or near the given offset and optionally returns the effective offset.
      */
-    markup_stack*       GetMarkupStackAt(int32 offset, int32* mapOffsetFound = NULL);
+    markup_stack*       GetMarkupStackAt(int64 offset, int64* mapOffsetFound = NULL);
     /**
     * search for block or span boundaries to capture block/span markup info and collect them into text_data stack.
     */
-    status_t            GetMarkupBoundariesAt(int32 offset, int32* start, int32* end,
+    status_t            GetMarkupBoundariesAt(int64 offset, int64* start, int64* end,
                                          BOUNDARY_TYPE boundaryType = BLOCK,
                                          SEARCH_DIRECTION searchType = BOTH,
                                          bool trimToText = false);
 
-    outline_map*        GetOutlineAt(int32 offset);
+    /**
+     * returns the ranges of the spans and blocks holding text from start to end, innermost first.
+     * blocks come from the block tree and spans from the markup of the innermost leaf block only,
+     * so this takes O(log n) plus the size of that leaf. text is the current document text.
+     */
+    void                GetEnclosingRanges(const char* text, int64 start, int64 end,
+                                           vector<pair<int64, int64>>* spans,
+                                           vector<pair<int64, int64>>* blocks);
+
+    outline_map*        GetOutlineAt(int64 offset);
 
     static BMessage*    GetDetailForBlockType(MD_BLOCKTYPE type, void* detail);
     static BMessage*    GetDetailForSpanType(MD_SPANTYPE type, void* detail);
@@ -136,8 +228,34 @@ private:
      */
     text_lookup*        fTextLookup;
     int32               fTextSize;
-    void                InsertTextShiftAt(int32 start, int32 delta);
-    int32               GetTextShiftAt(int32 offset);
+    BlockParser*        fBlockParser;
+    vector<char>        fLeafBuffer;
+    vector<leaf_segment> fLeafSegments;
+    /**
+     * link reference definitions at the start of paragraphs, keyed by offset. md4c only resolves references
+     * defined in the same parse, so they are added around each leaf block with inline content.
+     */
+    map<int64, reference_block> fReferenceBlocks;
+    BString             fReferenceText;
+    /**
+     * labels each leaf block with inline content may refer to, keyed by the offset of its content.
+     * only these blocks are parsed again when definitions of their labels change.
+     */
+    map<int64, set<string>> fReferenceUses;
+    const block_node*   fUpdatedLeaf;
+
+    void                EmitBlocks(const char* text, int64 start);
+    void                EmitBlock(const block_node* node, const char* text, bool tightItem);
+    void                ParseLeaf(const block_node* node, const char* text, bool tightItem, bool taskItem = false);
+    void                UpdateLeaf(const block_node* node, const char* text, int64 offset, int64 delta,
+                                   int64* start, int64* end);
+    void                AddBlockMarkup(MD_CLASS markupClass, MD_BLOCKTYPE type, int64 offset, void* detail);
+    void                ShiftMarkup(int64 offset, int64 delta);
+    void                CollectReferences(const block_node* node, const char* text);
+    void                UpdateReferenceText();
+    void                ParseReferenceUsers(const set<string>& labels, const char* text, int64* start, int64* end);
+    void                InsertTextShiftAt(int64 start, int64 delta);
+    int64               GetTextShiftAt(int64 offset);
     bool                FindTextData(const text_data* data, map<MD_BLOCKTYPE, text_data*> blocks, map<MD_SPANTYPE, text_data*>  spans);
 
     // callback functions
@@ -152,6 +270,7 @@ private:
     static void         AddMarkupMetadata(MD_CLASS markupClass, MD_BLOCKTYPE blockType, MD_OFFSET offset, BMessage* detail, void* userdata);
     static void         AddMarkupMetadata(MD_CLASS markupClass, MD_SPANTYPE spanType, MD_OFFSET offset, BMessage* detail, void* userdata);
     static void         AddMarkupMetadata(text_data *data, MD_OFFSET offset,void* userdata);
+    static void         AddMarkupAt(text_data *data, int64 documentOffset, text_lookup* lookup);
 
     // helper
     static const char*  attr_to_str(MD_ATTRIBUTE data);
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "MarkupIndex.h"
+
+#include <algorithm>
+
+// records per segment, small enough to keep copying cheap on edits
+static const size_t kSegmentRecords = 256;
+// segments below this size next to an edit are merged into the rebuilt range to avoid fragmentation
+static const size_t kMinSegmentRecords = kSegmentRecords / 4;
+
+vector<segment_ref>::const_iterator MarkupSnapshot::FindSegment(int64 offset) const {
+    auto segment = upper_bound(fSegments.begin(), fSegments.end(), offset,
+        [](int64 offset, const segment_ref& ref) { return offset < ref.base; });
+
+    if (segment != fSegments.begin()) {
+        segment--;
+    }
+    return segment;
+}
+
+MarkupIndex::Reader::Reader(MarkupIndex* index)
+    : fReclaimer(&index->fReclaimer) {
+    fSlot = fReclaimer->Enter();
+    fSnapshot = index->fCurrent.load();
+}
+
+MarkupIndex::Reader::~Reader() {
+    fReclaimer->Exit(fSlot);
+}
+
+MarkupIndex::MarkupIndex()
+    : fCurrent(new MarkupSnapshot(0)) {
+}
+
+MarkupIndex::~MarkupIndex() {
+    delete fCurrent.load();
+}
+
+void MarkupIndex::Clear() {
+    uint64 version = fCurrent.load(memory_order_relaxed)->Version() + 1;
+    Swap(new MarkupSnapshot(version));
+}
+
+void MarkupIndex::Publish(const markup_map* markupMap, int64 start, int64 end, int64 delta) {
+    const MarkupSnapshot* current = fCurrent.load(memory_order_relaxed);
+    MarkupSnapshot* snapshot = new MarkupSnapshot(current->Version() + 1);
+
+    // end of the replaced range before the edit
+    int64 oldEnd = end - delta;
+    int64 rebuildStart = start;
+    int64 rebuildEnd = end;
+    vector<segment_ref> tail;
+
+    for (auto ref : current->fSegments) {
+        if (ref.last < start) {
+            snapshot->fSegments.push_back(ref);
+        } else if (ref.base > oldEnd) {
+            // unchanged after the edit, share it and only move its base
+            ref.base += delta;
+            ref.last += delta;
+            tail.push_back(ref);
+        } else {
+            rebuildStart = min(rebuildStart, ref.base);
+            rebuildEnd = max(rebuildEnd, ref.last + delta);
+        }
+    }
+    // fold small neighbours into the rebuild so repeated edits don't fragment the index
+    if (!snapshot->fSegments.empty()
+        && snapshot->fSegments.back().segment->records.size() < kMinSegmentRecords) {
+        rebuildStart = snapshot->fSegments.back().base;
+        snapshot->fSegments.pop_back();
+    }
+    if (!tail.empty() && tail.front().segment->records.size() < kMinSegmentRecords) {
+        rebuildEnd = tail.front().last;
+        tail.erase(tail.begin());
+    }
+
+    BuildSegments(markupMap, rebuildStart, rebuildEnd, &snapshot->fSegments);
+    snapshot->fSegments.insert(snapshot->fSegments.end(), tail.begin(), tail.end());
+
+    for (auto ref : snapshot->fSegments) {
+        snapshot->fRecordCount += ref.segment->records.size();
+    }
+    Swap(snapshot);
+}
+
+void MarkupIndex::BuildSegments(const markup_map* markupMap, int64 start, int64 end,
+                                vector<segment_ref>* segments) {
+    shared_ptr<markup_segment> segment;
+    segment_ref ref;
+
+    for (auto mapItem = markupMap->lower_bound(start);
+         mapItem != markupMap->end() && mapItem->first <= end; mapItem++) {
+        int64 offset = mapItem->first;
+
+        // only split between map offsets so a markup stack is never torn apart,
+        // and keep record offsets relative to the segment base within 32 bit
+        if (segment == NULL || segment->records.size() >= kSegmentRecords || offset - ref.base > INT32_MAX) {
+            if (segment != NULL) {
+                ref.segment = segment;
+                segments->push_back(ref);
+            }
+            segment = make_shared<markup_segment>();
+            ref.base = offset;
+        }
+        for (auto item : *mapItem->second) {
+            segment->records.push_back(CreateRecord(item, offset - ref.base));
+        }
+        ref.last = offset;
+    }
+    if (segment != NULL && !segment->records.empty()) {
+        ref.segment = segment;
+        segments->push_back(ref);
+    }
+}
+
+markup_record MarkupIndex::CreateRecord(const text_data* item, int32 offset) {
+    markup_record record;
+    record.offset = offset;
+    record.length = (item->markup_class == MD_TEXT ? item->length : 0);
+    record.markupClass = item->markup_class;
+    record.markupType = item->markup_type;
+    record.detail = (item->detail != NULL ? new BMessage(*item->detail) : NULL);
+    return record;
+}
+
+void MarkupIndex::Swap(MarkupSnapshot* snapshot) {
+    MarkupSnapshot* previous = fCurrent.exchange(snapshot);
+
+    // readers may still use the previous version, it is freed later once they are done
+    fReclaimer.Retire([previous]() { delete previous; });
+    fReclaimer.Reclaim();
+}
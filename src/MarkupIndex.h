@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * read-only snapshots of the parser markup map for background readers (search, outline, spell check...).
+ * snapshots consist of immutable, versioned segments. on every publish only the segments touched by
+ * the edit are rebuilt, all others are shared with the previous snapshot and shifted by offset only.
+ * readers never block the writer and always see one consistent version, old snapshots are freed
+ * via epoch based reclamation once no reader uses them anymore.
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <Message.h>
+#include <SupportDefs.h>
+#include <vector>
+
+#include "EpochReclaimer.h"
+#include "MarkdownParser.h"
+
+using namespace std;
+
+typedef struct markup_record {
+    int32           offset;         // relative to the segment base
+    int32           length;
+    MD_CLASS        markupClass;
+    MD_TYPE         markupType;
+    BMessage*       detail;         // owned by the segment, may be NULL
+} markup_record;
+
+/**
+ * immutable after publishing, shared by all snapshots it is part of.
+ */
+typedef struct markup_segment {
+    vector<markup_record>   records;
+
+                            markup_segment() {}
+                            markup_segment(const markup_segment&) = delete;
+                            ~markup_segment() {
+                                for (auto record : records)
+                                    delete record.detail;
+                            }
+} markup_segment;
+
+typedef struct segment_ref {
+    int64           base;           // document offset of the segment
+    int64           last;           // document offset of the last record in the segment
+    shared_ptr<const markup_segment> segment;
+} segment_ref;
+
+class MarkupSnapshot {
+
+public:
+                        MarkupSnapshot(uint64 version) : fVersion(version), fRecordCount(0) {}
+
+    uint64              Version() const         { return fVersion; }
+    int32               CountRecords() const    { return fRecordCount; }
+    int32               CountSegments() const   { return fSegments.size(); }
+
+    /**
+     * calls visit(offset, record) for all records with document offsets in [start, end],
+     * in document order, until visit returns false.
+     */
+    template<typename Visitor>
+    void                ForEach(int64 start, int64 end, Visitor visit) const {
+        for (auto segment = FindSegment(start); segment != fSegments.end() && segment->base <= end; segment++) {
+            if (segment->last < start)
+                continue;
+            for (const markup_record& record : segment->segment->records) {
+                int64 offset = segment->base + record.offset;
+                if (offset < start)
+                    continue;
+                if (offset > end || !visit(offset, record))
+                    return;
+            }
+        }
+    }
+
+private:
+    friend class MarkupIndex;
+
+    vector<segment_ref>::const_iterator FindSegment(int64 offset) const;
+
+    uint64              fVersion;
+    int32               fRecordCount;
+    vector<segment_ref> fSegments;
+};
+
+class MarkupIndex {
+
+public:
+    /**
+     * pins the current snapshot for the lifetime of the reader, may be used from any thread.
+     */
+    class Reader {
+    public:
+                            Reader(MarkupIndex* index);
+                            ~Reader();
+
+        const MarkupSnapshot* Snapshot() const  { return fSnapshot; }
+
+    private:
+        EpochReclaimer*     fReclaimer;
+        int32               fSlot;
+        const MarkupSnapshot* fSnapshot;
+    };
+
+                        MarkupIndex();
+    virtual             ~MarkupIndex();
+
+    /**
+     * publishes a new snapshot after the markup map was updated in [start, end] (new document offsets),
+     * with all offsets following the edit shifted by delta. writer only, there must be a single writer.
+     */
+    void                Publish(const markup_map* markupMap, int64 start, int64 end, int64 delta = 0);
+    void                Clear();
+
+    uint64              Version()       { return fCurrent.load(memory_order_relaxed)->Version(); }
+
+    /**
+     * copies a parser markup item into a record at the given segment relative offset.
+     */
+    static markup_record CreateRecord(const text_data* item, int32 offset);
+
+private:
+    void                BuildSegments(const markup_map* markupMap, int64 start, int64 end,
+                                      vector<segment_ref>* segments);
+    void                Swap(MarkupSnapshot* snapshot);
+
+    atomic<MarkupSnapshot*> fCurrent;
+    EpochReclaimer      fReclaimer;
+};
@@ -11,6 +11,16 @@
 static const uint32 MSG_INSERT_ENTITY   = 'Thie';
 static const uint32 MSG_ENTITY_SELECTED = 'Tens';
 static const uint32 MSG_ADD_HIGHLIGHT = 'This';
+static const uint32 MSG_VAULT_UPDATED = 'Tvup';
+static const uint32 MSG_VAULT_NOTE_CHANGED = 'Tvnc';
+static const uint32 MSG_DIFF_READY = 'Tdfr';
+static const uint32 MSG_MERGE_READY = 'Tmrg';
+static const uint32 MSG_SESSION_JOINED = 'Tsjn';
+static const uint32 MSG_SESSION_LEFT = 'Tslf';
+static const uint32 MSG_REMOTE_OPS = 'Trop';
+static const uint32 MSG_SEND_OPS = 'Tsop';
+static const uint32 MSG_VAULT_SYNCED = 'Tvsy';
 
 // message properties (may be reused)
 #define MSG_PROP_LABEL "label"
+#define MSG_PROP_VALUE "value"
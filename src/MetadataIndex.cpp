@@ -0,0 +1,309 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "MetadataIndex.h"
+
+#include <Autolock.h>
+#include <Entry.h>
+#include <File.h>
+#include <FindDirectory.h>
+#include <Message.h>
+#include <OS.h>
+#include <Path.h>
+#include <set>
+#include <stdio.h>
+
+#include "TextNormalizer.h"
+
+static const char* kMetadataIndexFile = "senity_metadata_index";
+
+MetadataIndex::MetadataIndex()
+    : fLock("metadata_index_lock"),
+      fDirty(false) {
+}
+
+MetadataIndex::~MetadataIndex() {
+    Cancel();
+}
+
+status_t MetadataIndex::Load() {
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kMetadataIndexFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_READ_ONLY);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    status = archive.Unflatten(&file);
+    if (status != B_OK)
+        return status;
+
+    BAutolock lock(&fLock);
+    BMessage noteMsg;
+    for (int32 index = 0; archive.FindMessage("note", index, &noteMsg) == B_OK; index++) {
+        BString notePath;
+        if (noteMsg.FindString("path", &notePath) != B_OK)
+            continue;
+
+        note_metadata metadata;
+        metadata.title    = noteMsg.GetString("title", "");
+        metadata.date     = noteMsg.GetInt64("date", 0);
+        metadata.modified = noteMsg.GetInt64("modified", 0);
+
+        BString value;
+        for (int32 item = 0; noteMsg.FindString("tag", item, &value) == B_OK; item++)
+            metadata.tags.push_back(value);
+        for (int32 item = 0; noteMsg.FindString("alias", item, &value) == B_OK; item++)
+            metadata.aliases.push_back(value);
+
+        fNotes[notePath] = metadata;
+        AddToIndexes(notePath, &metadata);
+    }
+    fDirty = false;
+    printf("MetadataIndex: loaded metadata for %zu notes.\n", fNotes.size());
+
+    return B_OK;
+}
+
+status_t MetadataIndex::Save() {
+    BAutolock lock(&fLock);
+    if (!fDirty)
+        return B_OK;
+
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kMetadataIndexFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    for (auto note : fNotes) {
+        const note_metadata& metadata = note.second;
+        BMessage noteMsg;
+        noteMsg.AddString("path", note.first);
+        noteMsg.AddString("title", metadata.title);
+        noteMsg.AddInt64("date", metadata.date);
+        noteMsg.AddInt64("modified", metadata.modified);
+        for (auto tag : metadata.tags)
+            noteMsg.AddString("tag", tag);
+        for (auto alias : metadata.aliases)
+            noteMsg.AddString("alias", alias);
+
+        archive.AddMessage("note", &noteMsg);
+    }
+
+    status = archive.Flatten(&file);
+    if (status == B_OK)
+        fDirty = false;
+
+    return status;
+}
+
+status_t MetadataIndex::IndexFile(const char* path) {
+    BFile file(path, B_READ_ONLY);
+    status_t status = file.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    time_t modified;
+    status = file.GetModificationTime(&modified);
+    if (status != B_OK)
+        return status;
+
+    {
+        BAutolock lock(&fLock);
+        auto existing = fNotes.find(BString(path));
+        if (existing != fNotes.end() && existing->second.modified == modified) {
+            return B_OK;    // unchanged since last indexing
+        }
+    }
+
+    // front matter is limited in size, so we only need to read the head of the file
+    BString head;
+    char* buffer = head.LockBuffer(FrontMatter::kMaxFrontMatterSize);
+    ssize_t bytesRead = file.ReadAt(0, buffer, FrontMatter::kMaxFrontMatterSize);
+    if (bytesRead < 0) {
+        head.UnlockBuffer(0);
+        return bytesRead;
+    }
+    TextNormalizer normalizer;
+    int32 size = normalizer.Normalize(buffer, bytesRead);
+    head.UnlockBuffer(size);
+
+    front_matter frontMatter;
+    if (FrontMatter::Parse(head.String(), size, &frontMatter) != B_OK) {
+        // still record the note so it is not read again until it changes
+        frontMatter = front_matter();
+    }
+    Update(path, &frontMatter, modified);
+
+    return B_OK;
+}
+
+void MetadataIndex::Update(const vector<BString>& paths) {
+    Cancel();
+
+    fUpdateTask = TaskScheduler::Default()->Submit(TASK_PRIORITY_MAINTENANCE,
+        [this, paths](const CancelToken& token) {
+            bigtime_t startTime = system_time();
+            // unchanged notes are skipped by their modification time, so only the head of changed notes is read
+            for (auto& path : paths) {
+                if (token.IsCanceled())
+                    return;
+                IndexFile(path.String());
+            }
+
+            set<BString> current(paths.begin(), paths.end());
+            BAutolock lock(&fLock);
+            vector<BString> removed;
+            for (auto& note : fNotes) {
+                if (current.find(note.first) == current.end())
+                    removed.push_back(note.first);
+            }
+            for (auto& path : removed)
+                Remove(path.String());
+            printf("MetadataIndex: indexed %zu notes, dropped %zu in %lld ms.\n", fNotes.size(), removed.size(),
+                (long long) (system_time() - startTime) / 1000);
+        });
+}
+
+void MetadataIndex::Cancel() {
+    fUpdateTask.Cancel();
+    fUpdateTask.Wait();
+}
+
+void MetadataIndex::Update(const char* path, const front_matter* frontMatter, time_t modified) {
+    BAutolock lock(&fLock);
+    BString notePath(path);
+    auto existing = fNotes.find(notePath);
+    if (existing != fNotes.end()) {
+        RemoveFromIndexes(notePath, &existing->second);
+    }
+
+    note_metadata& metadata = fNotes[notePath];
+    metadata.title    = frontMatter->title;
+    metadata.tags     = frontMatter->tags;
+    metadata.aliases  = frontMatter->aliases;
+    metadata.date     = frontMatter->date;
+    metadata.modified = modified;
+
+    AddToIndexes(notePath, &metadata);
+    fDirty = true;
+}
+
+void MetadataIndex::Remove(const char* path) {
+    BAutolock lock(&fLock);
+    BString notePath(path);
+    auto existing = fNotes.find(notePath);
+    if (existing == fNotes.end())
+        return;
+
+    RemoveFromIndexes(notePath, &existing->second);
+    fNotes.erase(existing);
+    fDirty = true;
+}
+
+status_t MetadataIndex::GetMetadata(const char* path, note_metadata* metadata) {
+    BAutolock lock(&fLock);
+    auto existing = fNotes.find(BString(path));
+    if (existing == fNotes.end())
+        return B_ENTRY_NOT_FOUND;
+
+    *metadata = existing->second;
+    return B_OK;
+}
+
+int32 MetadataIndex::CountNotes() {
+    BAutolock lock(&fLock);
+    return fNotes.size();
+}
+
+vector<BString> MetadataIndex::FindByTag(const char* tag) {
+    BAutolock lock(&fLock);
+    vector<BString> result;
+    auto tagIter = fTagIndex.find(TagKey(tag));
+    if (tagIter != fTagIndex.end()) {
+        result.assign(tagIter->second.begin(), tagIter->second.end());
+    }
+    return result;
+}
+
+vector<BString> MetadataIndex::FindByDate(time_t from, time_t to) {
+    BAutolock lock(&fLock);
+    vector<BString> result;
+    auto end = fDateIndex.upper_bound(to);
+    for (auto dateIter = fDateIndex.lower_bound(from); dateIter != end; dateIter++) {
+        result.push_back(dateIter->second);
+    }
+    return result;
+}
+
+void MetadataIndex::GetTags(vector<tag_count>* tags) {
+    BAutolock lock(&fLock);
+    tags->clear();
+    tags->reserve(fTagIndex.size());
+    for (auto& tag : fTagIndex)
+        tags->push_back({tag.first, (int32) tag.second.size()});
+}
+
+bool MetadataIndex::IsNote(const char* path) {
+    BString name(path);
+    name.ToLower();
+    int32 length = name.Length();
+
+    return (length > 3 && name.FindLast(".md") == length - 3)
+        || (length > 9 && name.FindLast(".markdown") == length - 9);
+}
+
+void MetadataIndex::AddToIndexes(const BString& path, const note_metadata* metadata) {
+    for (auto tag : metadata->tags) {
+        fTagIndex[TagKey(tag)].insert(path);
+    }
+    if (metadata->date != 0) {
+        fDateIndex.insert({metadata->date, path});
+    }
+}
+
+void MetadataIndex::RemoveFromIndexes(const BString& path, const note_metadata* metadata) {
+    for (auto tag : metadata->tags) {
+        auto tagIter = fTagIndex.find(TagKey(tag));
+        if (tagIter == fTagIndex.end())
+            continue;
+
+        tagIter->second.erase(path);
+        if (tagIter->second.empty())
+            fTagIndex.erase(tagIter);
+    }
+    if (metadata->date != 0) {
+        auto range = fDateIndex.equal_range(metadata->date);
+        for (auto dateIter = range.first; dateIter != range.second; dateIter++) {
+            if (dateIter->second == path) {
+                fDateIndex.erase(dateIter);
+                break;
+            }
+        }
+    }
+}
+
+BString MetadataIndex::TagKey(const char* tag) {
+    BString key(tag);
+    return key.ToLower();
+}
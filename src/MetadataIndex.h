@@ -0,0 +1,87 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * vault-wide index of front matter metadata, persisted in the user settings directory,
+ * so notes can be filtered by tag or date without re-parsing every file.
+ * the vault scan keeps it up to date in the background, so all methods lock the index.
+ */
+#pragma once
+
+#include <Locker.h>
+#include <map>
+#include <set>
+#include <String.h>
+#include <SupportDefs.h>
+#include <time.h>
+#include <vector>
+
+#include "FrontMatter.h"
+#include "TaskScheduler.h"
+
+using namespace std;
+
+typedef struct note_metadata {
+    BString             title;
+    vector<BString>     tags;
+    vector<BString>     aliases;
+    time_t              date = 0;
+    time_t              modified = 0;   // file modification time when indexed
+} note_metadata;
+
+typedef struct tag_count {
+    BString             tag;            // lower case
+    int32               notes;
+} tag_count;
+
+class MetadataIndex {
+
+public:
+                        MetadataIndex();
+    virtual             ~MetadataIndex();
+
+    status_t            Load();
+    status_t            Save();
+
+    /**
+     * (re-)indexes the front matter of a single note, unchanged files are skipped.
+     */
+    status_t            IndexFile(const char* path);
+    /**
+     * indexes the notes at paths that changed since in the background and drops notes no longer in paths.
+     * an update still running is canceled.
+     */
+    void                Update(const vector<BString>& paths);
+    void                Cancel();
+
+    void                Update(const char* path, const front_matter* frontMatter, time_t modified);
+    void                Remove(const char* path);
+
+    status_t            GetMetadata(const char* path, note_metadata* metadata);
+    int32               CountNotes();
+
+    // queries, all lookups in the in-memory indexes
+    vector<BString>     FindByTag(const char* tag);
+    /**
+     * returns the notes dated from from up to to, oldest first.
+     */
+    vector<BString>     FindByDate(time_t from, time_t to);
+    /**
+     * returns all tags with the number of notes carrying them, ordered by tag.
+     */
+    void                GetTags(vector<tag_count>* tags);
+
+    static bool         IsNote(const char* path);
+
+private:
+    void                AddToIndexes(const BString& path, const note_metadata* metadata);
+    void                RemoveFromIndexes(const BString& path, const note_metadata* metadata);
+    static BString      TagKey(const char* tag);
+
+    BLocker                         fLock;
+    map<BString, note_metadata>     fNotes;
+    map<BString, set<BString>>      fTagIndex;      // lower case tag -> note paths
+    multimap<time_t, BString>       fDateIndex;     // front matter date -> note path
+    bool                            fDirty;
+    TaskHandle                      fUpdateTask;
+};
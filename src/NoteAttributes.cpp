@@ -0,0 +1,332 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "NoteAttributes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <Autolock.h>
+#include <Entry.h>
+#include <errno.h>
+#include <File.h>
+#include <fs_index.h>
+#include <memory>
+#include <Node.h>
+#include <OS.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <TypeConstants.h>
+
+#include "DocumentScanner.h"
+#include "FrontMatter.h"
+#include "HighlightStore.h"
+
+static const char* kTitleAttribute = "senity:title";
+static const char* kHeadingsAttribute = "senity:headings";
+static const char* kTagsAttribute = "senity:tags";
+static const char* kOpenTasksAttribute = "senity:open_tasks";
+static const char* kLabelsAttribute = "senity:labels";
+
+// notes published by one backfill task, so the workers get to other tasks in between
+static const int32 kBackfillChunkSize = 64;
+
+typedef struct backfill_state {
+    vector<BString>     paths;
+    atomic<int32>       remaining;      // tasks not finished yet
+    atomic<int32>       changedNotes;
+    atomic<int32>       written;
+    bigtime_t           startTime;
+} backfill_state;
+
+static void CutValue(BString* value) {
+    if (value->Length() <= NoteAttributes::kMaxValueLength)
+        return;
+
+    // cut before a UTF-8 continuation byte, not in the middle of a character
+    int32 length = NoteAttributes::kMaxValueLength;
+    while (length > 0 && (value->ByteAt(length) & 0xC0) == 0x80)
+        length--;
+    value->Truncate(length);
+}
+
+static int32 WriteString(BNode* node, const char* name, const BString& value, const BString* known) {
+    BString current;
+    if (known != NULL)
+        current = *known;
+    else if (node->ReadAttrString(name, &current) != B_OK)
+        current.Truncate(0);
+
+    if (current == value)
+        return 0;
+
+    // empty values are removed, so queries for the attribute only find notes that have one
+    status_t status = value.IsEmpty() ? node->RemoveAttr(name) : node->WriteAttrString(name, &value);
+    if (status != B_OK && !(value.IsEmpty() && status == B_ENTRY_NOT_FOUND))
+        return status;
+    return 1;
+}
+
+static int32 WriteInt32(BNode* node, const char* name, int32 value, const int32* known) {
+    int32 current = -1;
+    if (known != NULL)
+        current = *known;
+    else if (node->ReadAttr(name, B_INT32_TYPE, 0, &current, sizeof(current)) != sizeof(current))
+        current = -1;
+
+    if (current == value)
+        return 0;
+
+    ssize_t written = node->WriteAttr(name, B_INT32_TYPE, 0, &value, sizeof(value));
+    if (written < 0)
+        return written;
+    return written == sizeof(value) ? 1 : B_IO_ERROR;
+}
+
+NoteAttributes::NoteAttributes()
+    : fLock("note_attributes_lock"),
+      fBatchQueued(false) {
+}
+
+NoteAttributes::~NoteAttributes() {
+    Cancel();
+}
+
+void NoteAttributes::Publish(const char* path) {
+    BAutolock lock(&fLock);
+    fPending.insert(BString(path));
+    if (fBatchQueued)
+        return;
+
+    fBatchQueued = true;
+    fBatchTask = TaskScheduler::Default()->Submit(TASK_PRIORITY_MAINTENANCE,
+        [this](const CancelToken&) {
+            RunBatch();
+        });
+}
+
+void NoteAttributes::Backfill(const vector<BString>& paths) {
+    fBackfillToken.Cancel();
+    for (auto& task : fBackfillTasks)
+        task.Wait();
+    fBackfillTasks.clear();
+    fBackfillToken = CancelToken();
+    if (paths.empty())
+        return;
+
+    status_t status = CreateIndexes(paths.front().String());
+    if (status != B_OK)
+        fprintf(stderr, "could not create the attribute indexes: %s\n", strerror(status));
+
+    shared_ptr<backfill_state> state = make_shared<backfill_state>();
+    state->paths = paths;
+    state->remaining = (paths.size() + kBackfillChunkSize - 1) / kBackfillChunkSize;
+    state->changedNotes = 0;
+    state->written = 0;
+    state->startTime = system_time();
+
+    for (size_t start = 0; start < paths.size(); start += kBackfillChunkSize) {
+        size_t end = min(start + kBackfillChunkSize, paths.size());
+        fBackfillTasks.push_back(TaskScheduler::Default()->Submit(TASK_PRIORITY_MAINTENANCE,
+            [this, state, start, end](const CancelToken& token) {
+                for (size_t index = start; index < end && !token.IsCanceled(); index++) {
+                    int32 written = PublishNote(state->paths[index], token, true);
+                    if (written > 0) {
+                        state->written += written;
+                        state->changedNotes++;
+                    }
+                }
+                if (--state->remaining == 0 && !token.IsCanceled()) {
+                    printf("NoteAttributes: published %d attributes of %d among %zu notes in %lld ms.\n",
+                        state->written.load(), state->changedNotes.load(), state->paths.size(),
+                        (long long) (system_time() - state->startTime) / 1000);
+                }
+            }, fBackfillToken));
+    }
+}
+
+void NoteAttributes::Cancel() {
+    fBackfillToken.Cancel();
+    for (auto& task : fBackfillTasks)
+        task.Wait();
+    fBackfillTasks.clear();
+
+    // saved notes are still published
+    fBatchTask.Wait();
+}
+
+status_t NoteAttributes::Collect(const char* path, const CancelToken& token, note_attributes* attributes) {
+    *attributes = note_attributes();
+
+    BFile file(path, B_READ_ONLY);
+    status_t status = file.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    off_t fileSize;
+    status = file.GetSize(&fileSize);
+    if (status == B_OK)
+        status = file.GetModificationTime(&attributes->modified);
+    if (status != B_OK)
+        return status;
+
+    // tags come from the front matter, which is not part of the markdown
+    vector<char> head(min((off_t) FrontMatter::kMaxFrontMatterSize, fileSize));
+    ssize_t headSize = file.ReadAt(0, head.data(), head.size());
+    front_matter frontMatter;
+    int64 start = 0;
+    if (headSize > 0 && FrontMatter::Parse(head.data(), headSize, &frontMatter) == B_OK) {
+        start = frontMatter.length;
+        attributes->tags = Join(frontMatter.tags);
+    }
+
+    // small notes are parsed in one window of their size
+    int32 windowSize = max((off_t) 1, min(fileSize, (off_t) DocumentScanner::kDefaultWindowSize));
+    DocumentScanner scanner(&file, windowSize);
+    bool inTitle = false;
+    bool titleFound = false;
+    status = scanner.Scan([&](markup_map* markupMap, const char* text, int64 textOffset, int32 size) {
+        for (auto& entry : *markupMap) {
+            for (auto item : *entry.second) {
+                if (item->markup_class == MD_BLOCK_BEGIN && item->markup_type.block_type == MD_BLOCK_H) {
+                    attributes->headings++;
+                    uint8 level = item->detail != NULL ? item->detail->GetUInt8("level", 1) : 1;
+                    inTitle = !titleFound && level == 1;
+                } else if (item->markup_class == MD_BLOCK_BEGIN && item->markup_type.block_type == MD_BLOCK_LI) {
+                    // md4c reports the character between the brackets, a space for open tasks
+                    if (item->detail != NULL && item->detail->GetBool("task", false)
+                        && strcmp(item->detail->GetString("taskMark", ""), " ") == 0) {
+                        attributes->openTasks++;
+                    }
+                } else if (inTitle && item->markup_class == MD_TEXT) {
+                    attributes->title.Append(text + (item->offset - textOffset), item->length);
+                } else if (inTitle && item->markup_class == MD_BLOCK_END
+                           && item->markup_type.block_type == MD_BLOCK_H) {
+                    inTitle = false;
+                    titleFound = true;
+                }
+            }
+        }
+        return true;
+    }, start, INT64_MAX, token);
+    if (status != B_OK)
+        return status;
+
+    attributes->title.Trim();
+    CutValue(&attributes->title);
+
+    // only label types with highlights, labels of removed highlights may still be kept
+    highlight_set highlights;
+    if (HighlightStore::Read(path, &highlights) == B_OK) {
+        set<BString> types;
+        for (auto& record : highlights.records) {
+            const BString& type = highlights.labels[record.label].type;
+            if (!type.IsEmpty())
+                types.insert(type);
+        }
+        attributes->labels = Join(vector<BString>(types.begin(), types.end()));
+    }
+    return B_OK;
+}
+
+int32 NoteAttributes::Write(const char* path, const note_attributes& attributes, const note_attributes* known) {
+    BNode node(path);
+    status_t status = node.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    int32 written = 0;
+    int32 results[] = {
+        WriteString(&node, kTitleAttribute, attributes.title, known != NULL ? &known->title : NULL),
+        WriteInt32(&node, kHeadingsAttribute, attributes.headings, known != NULL ? &known->headings : NULL),
+        WriteString(&node, kTagsAttribute, attributes.tags, known != NULL ? &known->tags : NULL),
+        WriteInt32(&node, kOpenTasksAttribute, attributes.openTasks, known != NULL ? &known->openTasks : NULL),
+        WriteString(&node, kLabelsAttribute, attributes.labels, known != NULL ? &known->labels : NULL)
+    };
+    for (int32 result : results) {
+        if (result < 0)
+            return result;
+        written += result;
+    }
+    return written;
+}
+
+status_t NoteAttributes::CreateIndexes(const char* path) {
+    struct stat stat;
+    status_t status = BEntry(path).GetStat(&stat);
+    if (status != B_OK)
+        return status;
+
+    const struct {
+        const char* name;
+        uint32      type;
+    } indexes[] = {
+        { kTitleAttribute, B_STRING_TYPE },
+        { kHeadingsAttribute, B_INT32_TYPE },
+        { kTagsAttribute, B_STRING_TYPE },
+        { kOpenTasksAttribute, B_INT32_TYPE },
+        { kLabelsAttribute, B_STRING_TYPE }
+    };
+    for (auto& index : indexes) {
+        if (fs_create_index(stat.st_dev, index.name, index.type, 0) != 0 && errno != B_FILE_EXISTS)
+            return errno;
+    }
+    return B_OK;
+}
+
+void NoteAttributes::RunBatch() {
+    set<BString> paths;
+    {
+        BAutolock lock(&fLock);
+        paths.swap(fPending);
+        fBatchQueued = false;
+    }
+    for (auto& path : paths)
+        PublishNote(path, CancelToken(), false);
+}
+
+int32 NoteAttributes::PublishNote(const BString& path, const CancelToken& token, bool skipUnchanged) {
+    note_attributes known;
+    bool isKnown = false;
+    {
+        BAutolock lock(&fLock);
+        auto found = fPublished.find(path);
+        if (found != fPublished.end()) {
+            known = found->second;
+            isKnown = true;
+        }
+    }
+    if (skipUnchanged && isKnown) {
+        time_t modified;
+        if (BNode(path.String()).GetModificationTime(&modified) == B_OK && modified == known.modified)
+            return 0;
+    }
+
+    note_attributes attributes;
+    if (Collect(path.String(), token, &attributes) != B_OK)
+        return 0;
+
+    // w/o the values published last, those of the file are read to compare
+    int32 written = Write(path.String(), attributes, isKnown ? &known : NULL);
+    if (written < 0) {
+        fprintf(stderr, "could not publish the attributes of %s: %s\n", path.String(), strerror(written));
+        return written;
+    }
+
+    BAutolock lock(&fLock);
+    fPublished[path] = attributes;
+    return written;
+}
+
+BString NoteAttributes::Join(const vector<BString>& values) {
+    BString joined;
+    for (auto& value : values) {
+        if (!joined.IsEmpty())
+            joined << ", ";
+        joined << value;
+    }
+    CutValue(&joined);
+    return joined;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * publishes what the indexes know about a note as attributes of the note file, so notes can be found
+ * with file system queries, e.g. senity:open_tasks > 0 or senity:tags == "*haiku*".
+ * attributes are only written if their value changed, saved notes are published in batches in the
+ * background and a backfill publishes a whole vault on all cores.
+ */
+#pragma once
+
+#include <Locker.h>
+#include <map>
+#include <set>
+#include <String.h>
+#include <SupportDefs.h>
+#include <time.h>
+#include <vector>
+
+#include "TaskScheduler.h"
+
+using namespace std;
+
+typedef struct note_attributes {
+    BString         title;          // text of the first level 1 heading
+    int32           headings = 0;
+    BString         tags;           // front matter tags, separated by ", "
+    int32           openTasks = 0;
+    BString         labels;         // label types of the highlights, sorted and separated by ", "
+    time_t          modified = 0;   // file modification time when collected
+} note_attributes;
+
+class NoteAttributes {
+
+public:
+                        NoteAttributes();
+    virtual             ~NoteAttributes();
+
+    /**
+     * publishes the attributes of the note at path in the background, a note queued again before
+     * its batch runs is only read once.
+     */
+    void                Publish(const char* path);
+    /**
+     * publishes the attributes of all notes at paths in parallel, after creating the attribute indexes
+     * on their volumes. notes unchanged since they were published are skipped, a backfill still running
+     * is canceled.
+     */
+    void                Backfill(const vector<BString>& paths);
+    /**
+     * cancels a backfill and waits for the batch of saved notes to be published.
+     */
+    void                Cancel();
+
+    /**
+     * reads the title, headings, tags and open tasks from the text of the note at path and the label
+     * types from its highlights.
+     */
+    static status_t     Collect(const char* path, const CancelToken& token, note_attributes* attributes);
+    /**
+     * writes the attributes differing from known, or from those of the file if known is NULL.
+     * returns the number of attributes written or an error.
+     */
+    static int32        Write(const char* path, const note_attributes& attributes,
+                              const note_attributes* known = NULL);
+    /**
+     * creates the indexes for the attributes on the volume of path, so queries can use them.
+     */
+    static status_t     CreateIndexes(const char* path);
+
+    // index keys are limited in length, longer values are cut
+    static const int32  kMaxValueLength = 255;
+
+private:
+    void                RunBatch();
+    int32               PublishNote(const BString& path, const CancelToken& token, bool skipUnchanged);
+    static BString      Join(const vector<BString>& values);
+
+    BLocker             fLock;
+    set<BString>        fPending;           // saved notes waiting for their batch
+    bool                fBatchQueued;
+    map<BString, note_attributes> fPublished;
+    TaskHandle          fBatchTask;
+    vector<TaskHandle>  fBackfillTasks;
+    CancelToken         fBackfillToken;
+};
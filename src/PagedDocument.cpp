@@ -0,0 +1,532 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "PagedDocument.h"
+
+#include <algorithm>
+#include <Autolock.h>
+#include <Entry.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <File.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DocumentScanner.h"
+#include "FrontMatter.h"
+
+PagedDocument::PagedDocument()
+    : fLock("paged_document_lock"),
+      fMapped(NULL),
+      fMappedSize(0),
+      fPosition(0),
+      fUseCount(0),
+      fEditCount(0) {
+}
+
+PagedDocument::~PagedDocument() {
+    for (auto task : fPrefetchTasks) {
+        task.Cancel();
+        task.Wait();
+    }
+    Unmap();
+}
+
+status_t PagedDocument::SetTo(const char* path) {
+    BAutolock lock(&fLock);
+
+    fPages.clear();
+    fPosition = 0;
+    fEditCount++;
+
+    status_t status = Map(path);
+    if (status == B_OK) {
+        fPath = path;
+    }
+    return status;
+}
+
+status_t PagedDocument::Map(const char* path) {
+    Unmap();
+
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return errno;
+    }
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0) {
+        close(file);
+        return errno;
+    }
+    if (fileStat.st_size > 0) {
+        void* mapped = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, file, 0);
+        if (mapped == MAP_FAILED) {
+            close(file);
+            return errno;
+        }
+        fMapped = static_cast<const char*>(mapped);
+        fMappedSize = fileStat.st_size;
+        fPieces.push_back({false, 0, 0, fMappedSize});
+    }
+    // the mapping keeps the file referenced
+    close(file);
+
+    printf("PagedDocument: mapped %" B_PRId64 " bytes of %s.\n", fMappedSize, path);
+    return B_OK;
+}
+
+void PagedDocument::Unmap() {
+    if (fMapped != NULL) {
+        munmap(const_cast<char*>(fMapped), fMappedSize);
+    }
+    fMapped = NULL;
+    fMappedSize = 0;
+    fPieces.clear();
+    fAdded.clear();
+}
+
+ssize_t PagedDocument::ReadAt(off_t position, void* buffer, size_t size) {
+    BAutolock lock(&fLock);
+    return ReadLocked(position, static_cast<char*>(buffer), size);
+}
+
+ssize_t PagedDocument::ReadLocked(int64 position, char* buffer, int64 size) {
+    if (position < 0) {
+        return B_BAD_VALUE;
+    }
+    auto piece = upper_bound(fPieces.begin(), fPieces.end(), position,
+        [](int64 position, const document_piece& piece) { return position < piece.offset; });
+    if (piece == fPieces.begin()) {
+        return 0;
+    }
+    piece--;
+
+    int64 bytesRead = 0;
+    for (; piece != fPieces.end() && bytesRead < size; piece++) {
+        int64 pieceOffset = position + bytesRead - piece->offset;
+        int64 count = min(piece->length - pieceOffset, size - bytesRead);
+        if (count <= 0) {
+            continue;
+        }
+        const char* source = (piece->added ? fAdded.data() : fMapped) + piece->source + pieceOffset;
+        memcpy(buffer + bytesRead, source, count);
+        bytesRead += count;
+    }
+    return bytesRead;
+}
+
+ssize_t PagedDocument::WriteAt(off_t position, const void* buffer, size_t size) {
+    // edits need to keep pages in sync, see Replace()
+    return B_NOT_ALLOWED;
+}
+
+off_t PagedDocument::Seek(off_t position, uint32 seekMode) {
+    BAutolock lock(&fLock);
+
+    switch (seekMode) {
+        case SEEK_SET:
+            fPosition = position;
+            break;
+        case SEEK_CUR:
+            fPosition += position;
+            break;
+        case SEEK_END:
+            fPosition = SizeLocked() + position;
+            break;
+        default:
+            return B_BAD_VALUE;
+    }
+    return fPosition;
+}
+
+off_t PagedDocument::Position() const {
+    return fPosition;
+}
+
+status_t PagedDocument::GetSize(off_t* size) const {
+    BAutolock lock(&fLock);
+    *size = SizeLocked();
+    return B_OK;
+}
+
+status_t PagedDocument::SetSize(off_t size) {
+    return B_NOT_ALLOWED;
+}
+
+int64 PagedDocument::SizeLocked() const {
+    if (fPieces.empty()) {
+        return 0;
+    }
+    return fPieces.back().offset + fPieces.back().length;
+}
+
+vector<document_piece>::iterator PagedDocument::SplitPiece(int64 offset) {
+    auto piece = upper_bound(fPieces.begin(), fPieces.end(), offset,
+        [](int64 offset, const document_piece& piece) { return offset < piece.offset; });
+    if (piece == fPieces.begin()) {
+        return piece;
+    }
+    piece--;
+    if (piece->offset == offset) {
+        return piece;
+    }
+    if (offset >= piece->offset + piece->length) {
+        return piece + 1;
+    }
+    int64 headLength = offset - piece->offset;
+    document_piece tail = {piece->added, piece->source + headLength, offset, piece->length - headLength};
+    piece->length = headLength;
+
+    return fPieces.insert(piece + 1, tail);
+}
+
+status_t PagedDocument::Replace(int64 offset, int64 length, const char* text, int32 textLength) {
+    BAutolock lock(&fLock);
+
+    int64 size = SizeLocked();
+    if (offset < 0 || length < 0 || offset + length > size) {
+        return B_BAD_VALUE;
+    }
+    int64 delta = textLength - length;
+
+    // update the piece table
+    // split before taking the indices, splitting may reallocate the table
+    auto split = SplitPiece(offset);
+    int32 first = split - fPieces.begin();
+    split = SplitPiece(offset + length);
+    int32 last = split - fPieces.begin();
+    fPieces.erase(fPieces.begin() + first, fPieces.begin() + last);
+
+    if (textLength > 0) {
+        document_piece* previous = (first > 0 ? &fPieces[first - 1] : NULL);
+        // typing appends to the last added piece, so the table only grows with edit locations
+        if (previous != NULL && previous->added && previous->source + previous->length == (int64)fAdded.size()) {
+            previous->length += textLength;
+        } else {
+            fPieces.insert(fPieces.begin() + first, {true, (int64)fAdded.size(), offset, textLength});
+            first++;
+        }
+        fAdded.insert(fAdded.end(), text, text + textLength);
+    }
+    for (auto piece = fPieces.begin() + first; piece != fPieces.end(); piece++) {
+        piece->offset += delta;
+    }
+
+    // move page bounds along, pages touched by the edit lose their markup
+    auto translate = [offset, length, textLength, delta](int64 position) {
+        if (position <= offset)
+            return position;
+        if (position >= offset + length)
+            return position + delta;
+        return offset + textLength;
+    };
+    for (auto page = fPages.begin(); page != fPages.end(); ) {
+        int64 end = page->start + page->length;
+        if (page->start <= offset + length && end >= offset) {
+            page->markup = NULL;
+        }
+        int64 newStart = translate(page->start);
+        int64 newEnd   = (end == size ? size + delta : translate(end));
+        if (newEnd <= newStart && fPages.size() > 1) {
+            page = fPages.erase(page);
+            continue;
+        }
+        page->start  = newStart;
+        page->length = newEnd - newStart;
+        page++;
+    }
+    fEditCount++;
+
+    return B_OK;
+}
+
+status_t PagedDocument::Save(BFile* file) {
+    BAutolock lock(&fLock);
+
+    node_ref fileRef, mappedRef;
+    BNode mappedNode(fPath.String());
+    bool inPlace = file->GetNodeRef(&fileRef) == B_OK
+        && mappedNode.GetNodeRef(&mappedRef) == B_OK
+        && fileRef == mappedRef;
+
+    // the mapped file is still the source of all unchanged text, so don't overwrite it while writing
+    BString tempPath(fPath);
+    tempPath << ".save";
+    BFile tempFile;
+    BFile* target = file;
+
+    if (inPlace) {
+        status_t status = tempFile.SetTo(tempPath.String(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+        if (status != B_OK) {
+            return status;
+        }
+        target = &tempFile;
+    }
+
+    for (auto piece : fPieces) {
+        const char* source = (piece.added ? fAdded.data() : fMapped) + piece.source;
+        ssize_t written = target->WriteAt(piece.offset, source, piece.length);
+        if (written < 0) {
+            return written;
+        }
+    }
+    status_t status = target->SetSize(SizeLocked());
+    if (status != B_OK || !inPlace) {
+        return status;
+    }
+
+    // keep the file attributes, they hold the note metadata
+    char name[B_ATTR_NAME_LENGTH];
+    mappedNode.RewindAttrs();
+    while (mappedNode.GetNextAttrName(name) == B_OK) {
+        attr_info info;
+        if (mappedNode.GetAttrInfo(name, &info) != B_OK) {
+            continue;
+        }
+        vector<char> value(info.size);
+        ssize_t bytesRead = mappedNode.ReadAttr(name, info.type, 0, value.data(), info.size);
+        if (bytesRead >= 0) {
+            tempFile.WriteAttr(name, info.type, 0, value.data(), bytesRead);
+        }
+    }
+    tempFile.Unset();
+
+    BEntry tempEntry(tempPath.String());
+    status = tempEntry.Rename(fPath.String(), true);
+    if (status != B_OK) {
+        return status;
+    }
+    // page bounds and markup stay valid, only the text source changes
+    return Map(fPath.String());
+}
+
+int32 PagedDocument::PageIndexAt(int64 offset) {
+    BAutolock lock(&fLock);
+
+    int64 size = SizeLocked();
+    if (size == 0) {
+        return fPages.empty() ? InsertPage(0, 0) : 0;
+    }
+    // the document end belongs to the last page
+    offset = max((int64)0, min(offset, size - 1));
+
+    auto page = upper_bound(fPages.begin(), fPages.end(), offset,
+        [](int64 offset, const document_page& page) { return offset < page.start; });
+    if (page != fPages.begin() && offset < (page - 1)->start + (page - 1)->length) {
+        return page - 1 - fPages.begin();
+    }
+
+    int64 start = BlockStartBefore(offset);
+    if (page != fPages.begin()) {
+        start = max(start, (page - 1)->start + (page - 1)->length);
+    }
+    int64 limit = (page != fPages.end() ? page->start : size);
+
+    // chain pages from the block boundary found until one covers offset
+    for (;;) {
+        vector<char> buffer(min((int64)kPageSize, limit - start));
+        int32 bytesRead = ReadLocked(start, buffer.data(), buffer.size());
+        int64 end = (start + bytesRead >= limit ? limit
+                                                : start + DocumentScanner::FindWindowEnd(buffer.data(), bytesRead));
+        int32 index = InsertPage(start, end);
+        if (end > offset) {
+            return index;
+        }
+        start = end;
+    }
+}
+
+document_page PagedDocument::PageAt(int32 index) {
+    BAutolock lock(&fLock);
+    return fPages[index];
+}
+
+int32 PagedDocument::PreviousPage(int32 index) {
+    BAutolock lock(&fLock);
+
+    int64 start = fPages[index].start;
+    if (start == 0) {
+        return -1;
+    }
+    if (index > 0 && fPages[index - 1].start + fPages[index - 1].length == start) {
+        return index - 1;
+    }
+    int64 previousStart = BlockStartBefore(max((int64)0, start - kPageSize));
+    if (index > 0) {
+        previousStart = max(previousStart, fPages[index - 1].start + fPages[index - 1].length);
+    }
+    return InsertPage(previousStart, start);
+}
+
+int32 PagedDocument::NextPage(int32 index) {
+    BAutolock lock(&fLock);
+
+    int64 end = fPages[index].start + fPages[index].length;
+    if (end >= SizeLocked()) {
+        return -1;
+    }
+    return PageIndexAt(end);
+}
+
+int64 PagedDocument::BlockStartBefore(int64 offset) {
+    if (offset <= 0) {
+        return 0;
+    }
+    // fences opened before the probed range are not seen here, so a boundary may end up inside
+    // a code block, which then only affects styling up to the next fence.
+    int64 probeStart = max((int64)0, offset - kBoundaryProbe);
+    vector<char> buffer(offset - probeStart);
+    int32 bytesRead = ReadLocked(probeStart, buffer.data(), buffer.size());
+    if (bytesRead <= 0) {
+        return offset;
+    }
+    int32 boundary = DocumentScanner::FindWindowEnd(buffer.data(), bytesRead);
+    if (boundary == bytesRead && probeStart == 0) {
+        return 0;
+    }
+    return probeStart + boundary;
+}
+
+int32 PagedDocument::InsertPage(int64 start, int64 end) {
+    document_page page = {start, end - start, NULL, 0};
+    auto position = upper_bound(fPages.begin(), fPages.end(), start,
+        [](int64 start, const document_page& page) { return start < page.start; });
+
+    position = fPages.insert(position, page);
+    return position - fPages.begin();
+}
+
+void PagedDocument::StoreMarkup(int32 index, const markup_map* markupMap, int64 mapOffset) {
+    BAutolock lock(&fLock);
+
+    document_page* page = &fPages[index];
+    page->markup = CopyMarkup(markupMap, mapOffset, mapOffset + page->length);
+    page->lastUsed = ++fUseCount;
+
+    TrimMarkupCache();
+}
+
+bool PagedDocument::RestoreMarkup(int32 index, markup_map* markupMap, int64 mapOffset) {
+    BAutolock lock(&fLock);
+
+    document_page* page = &fPages[index];
+    if (page->markup == NULL) {
+        return false;
+    }
+    page->lastUsed = ++fUseCount;
+
+    for (const markup_record& record : page->markup->records) {
+        int64 offset = mapOffset + record.offset;
+        markup_stack*& stack = (*markupMap)[offset];
+        if (stack == NULL) {
+            stack = new markup_stack();
+        }
+        text_data* item = new text_data;
+        item->markup_class = record.markupClass;
+        item->markup_type  = record.markupType;
+        item->detail       = (record.detail != NULL ? new BMessage(*record.detail) : NULL);
+        item->offset       = offset;
+        item->length       = record.length;
+        stack->push_back(item);
+    }
+    return true;
+}
+
+void PagedDocument::PrefetchMarkup(int32 index) {
+    BAutolock lock(&fLock);
+
+    if (index < 0 || index >= (int32)fPages.size() || fPages[index].markup != NULL) {
+        return;
+    }
+    int64 start   = fPages[index].start;
+    int64 length  = fPages[index].length;
+    uint64 edits  = fEditCount;
+
+    fPrefetchTasks.erase(remove_if(fPrefetchTasks.begin(), fPrefetchTasks.end(),
+        [](const TaskHandle& task) { return task.IsDone(); }), fPrefetchTasks.end());
+
+    fPrefetchTasks.push_back(TaskScheduler::Default()->Submit(TASK_PRIORITY_DOCUMENT,
+        [this, start, length, edits](const CancelToken& token) {
+            vector<char> text(length);
+            if (ReadAt(start, text.data(), length) != length || token.IsCanceled()) {
+                return;
+            }
+            // front matter is styled by the view, not parsed as markdown
+            int32 skip = 0;
+            if (start == 0) {
+                front_matter frontMatter;
+                FrontMatter::Parse(text.data(), length, &frontMatter);
+                skip = frontMatter.length;
+            }
+            MarkdownParser parser;
+            parser.Init();
+            parser.Parse(text.data() + skip, length - skip, skip);
+            shared_ptr<markup_segment> markup = CopyMarkup(parser.GetMarkupMap(), 0, length);
+
+            BAutolock lock(&fLock);
+            // the page may have been edited meanwhile, then the markup is outdated
+            if (fEditCount != edits) {
+                return;
+            }
+            for (auto& page : fPages) {
+                if (page.start == start && page.length == length && page.markup == NULL) {
+                    page.markup = markup;
+                    page.lastUsed = fUseCount;
+                    TrimMarkupCache();
+                    break;
+                }
+            }
+        }));
+}
+
+void PagedDocument::ReleaseRange(int64 start, int64 length) {
+    BAutolock lock(&fLock);
+
+    for (auto piece : fPieces) {
+        int64 from = max(start, piece.offset);
+        int64 to   = min(start + length, piece.offset + piece.length);
+        if (piece.added || from >= to) {
+            continue;
+        }
+        // only whole memory pages can be released
+        int64 fileFrom = (piece.source + from - piece.offset + B_PAGE_SIZE - 1) / B_PAGE_SIZE * B_PAGE_SIZE;
+        int64 fileTo   = (piece.source + to - piece.offset) / B_PAGE_SIZE * B_PAGE_SIZE;
+        if (fileFrom < fileTo) {
+            posix_madvise(const_cast<char*>(fMapped) + fileFrom, fileTo - fileFrom, POSIX_MADV_DONTNEED);
+        }
+    }
+}
+
+void PagedDocument::TrimMarkupCache() {
+    vector<document_page*> cached;
+    for (auto& page : fPages) {
+        if (page.markup != NULL) {
+            cached.push_back(&page);
+        }
+    }
+    if ((int32)cached.size() <= kMaxMarkupPages) {
+        return;
+    }
+    sort(cached.begin(), cached.end(),
+        [](const document_page* a, const document_page* b) { return a->lastUsed < b->lastUsed; });
+
+    for (int32 index = 0; index < (int32)cached.size() - kMaxMarkupPages; index++) {
+        cached[index]->markup = NULL;
+    }
+}
+
+shared_ptr<markup_segment> PagedDocument::CopyMarkup(const markup_map* markupMap, int64 start, int64 end) {
+    shared_ptr<markup_segment> segment = make_shared<markup_segment>();
+
+    for (auto mapItem = markupMap->lower_bound(start);
+         mapItem != markupMap->end() && mapItem->first < end; mapItem++) {
+        for (auto item : *mapItem->second) {
+            segment->records.push_back(MarkupIndex::CreateRecord(item, mapItem->first - start));
+        }
+    }
+    return segment;
+}
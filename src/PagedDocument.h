@@ -0,0 +1,129 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * document mode for files too large to keep resident: the file is mapped read-only and edits are
+ * kept in a piece table overlay, so only touched text and the added bytes take up memory.
+ * the document is split into pages ending at block boundaries, the view only gets a window of
+ * consecutive pages, and parsed markup is cached per page for revisited regions, up to a fixed limit.
+ */
+#pragma once
+
+#include <DataIO.h>
+#include <File.h>
+#include <Locker.h>
+#include <memory>
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+#include "MarkdownParser.h"
+#include "MarkupIndex.h"
+#include "TaskScheduler.h"
+
+using namespace std;
+
+typedef struct document_piece {
+    bool            added;          // text comes from the added buffer instead of the mapped file
+    int64           source;         // start offset in the file or added buffer
+    int64           offset;         // document offset
+    int64           length;
+} document_piece;
+
+typedef struct document_page {
+    int64           start;          // document offset, always at a block boundary when created
+    int64           length;
+    shared_ptr<const markup_segment> markup;   // offsets relative to start, NULL if not parsed yet
+    uint64          lastUsed;
+} document_page;
+
+class PagedDocument : public BPositionIO {
+
+public:
+                        PagedDocument();
+    virtual             ~PagedDocument();
+
+    status_t            SetTo(const char* path);
+    const char*         Path()      { return fPath.String(); }
+
+    // BPositionIO, reads see all edits
+    virtual ssize_t     ReadAt(off_t position, void* buffer, size_t size);
+    virtual ssize_t     WriteAt(off_t position, const void* buffer, size_t size);
+    virtual off_t       Seek(off_t position, uint32 seekMode);
+    virtual off_t       Position() const;
+    virtual status_t    GetSize(off_t* size) const;
+    virtual status_t    SetSize(off_t size);
+
+    /**
+     * replaces length bytes at offset with text, adjusting pages and dropping their outdated markup.
+     */
+    status_t            Replace(int64 offset, int64 length, const char* text, int32 textLength);
+    /**
+     * writes the edited document to file. when file is the mapped file itself, the document is saved
+     * to a temporary file next to it first which then replaces the original and is mapped instead.
+     */
+    status_t            Save(BFile* file);
+
+    /**
+     * returns the index of the page containing offset, creating pages as needed.
+     */
+    int32               PageIndexAt(int64 offset);
+    int32               CountPages()    { return fPages.size(); }
+    /**
+     * returns a copy of the page, so it stays valid while the document is edited.
+     */
+    document_page       PageAt(int32 index);
+    /**
+     * returns the index of the page preceding or following the page at index, creating it as needed,
+     * or -1 at the document start or end. indices of following pages change on creating a previous page.
+     */
+    int32               PreviousPage(int32 index);
+    int32               NextPage(int32 index);
+
+    /**
+     * caches markup of the given range of markupMap as markup of the page at index, with
+     * the page starting at mapOffset in the map.
+     */
+    void                StoreMarkup(int32 index, const markup_map* markupMap, int64 mapOffset);
+    /**
+     * adds the cached markup of the page at index to markupMap, rebased to mapOffset.
+     * returns false if the page has no cached markup.
+     */
+    bool                RestoreMarkup(int32 index, markup_map* markupMap, int64 mapOffset);
+    /**
+     * parses the page at index in the background if its markup is not cached yet.
+     */
+    void                PrefetchMarkup(int32 index);
+
+    /**
+     * tells the system that the mapped file pages of the given range are not needed anymore.
+     */
+    void                ReleaseRange(int64 start, int64 length);
+
+    static const int32  kPageSize = 1024 * 1024;
+    static const int32  kMaxMarkupPages = 8;
+    static const int32  kBoundaryProbe = 64 * 1024;
+
+private:
+    status_t            Map(const char* path);
+    void                Unmap();
+    ssize_t             ReadLocked(int64 position, char* buffer, int64 size);
+    int64               SizeLocked() const;
+    vector<document_piece>::iterator SplitPiece(int64 offset);
+    int64               BlockStartBefore(int64 offset);
+    int32               InsertPage(int64 start, int64 end);
+    void                TrimMarkupCache();
+    static shared_ptr<markup_segment> CopyMarkup(const markup_map* markupMap, int64 start, int64 end);
+
+    mutable BLocker     fLock;
+    BString             fPath;
+    const char*         fMapped;
+    int64               fMappedSize;
+    vector<char>        fAdded;
+    vector<document_piece> fPieces;
+    vector<document_page>  fPages;
+    int64               fPosition;
+    uint64              fUseCount;
+    uint64              fEditCount;
+    vector<TaskHandle>  fPrefetchTasks;
+};
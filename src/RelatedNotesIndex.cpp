@@ -0,0 +1,512 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "RelatedNotesIndex.h"
+
+#include <algorithm>
+#include <Autolock.h>
+#include <Entry.h>
+#include <File.h>
+#include <FindDirectory.h>
+#include <Message.h>
+#include <OS.h>
+#include <math.h>
+#include <Path.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "DocumentScanner.h"
+#include "FrontMatter.h"
+
+static const char* kRelatedIndexFile = "senity_related_index";
+
+typedef struct minhash_function {
+    uint64          multiplier;     // odd
+    uint64          addend;
+} minhash_function;
+
+static const minhash_function* MinHashFunctions() {
+    // fixed per build of the index, signatures made with other values do not compare
+    static const vector<minhash_function> functions = [] {
+        vector<minhash_function> values(kMinHashCount);
+        uint64 state = 0x6d696e68617368ULL;
+        auto next = [&state]() {
+            // splitmix64
+            uint64 z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        };
+        for (auto& function : values) {
+            function.multiplier = next() | 1;
+            function.addend = next();
+        }
+        return values;
+    }();
+    return functions.data();
+}
+
+static inline bool IsWordChar(uint8 c) {
+    // non-ASCII bytes are taken as letters, so words of any script are kept whole
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+/**
+ * calls visit(hash, start, length, numeric) for each word of text that is long enough,
+ * hash is the FNV-1a hash of the lower case word.
+ */
+template<typename Visitor>
+static void ForEachWord(const char* text, int64 length, Visitor visit) {
+    int64 position = 0;
+    while (position < length) {
+        while (position < length && !IsWordChar(text[position]))
+            position++;
+        int64 wordStart = position;
+        uint64 word = 0xcbf29ce484222325ULL;
+        bool numeric = true;
+        for (; position < length && IsWordChar(text[position]); position++) {
+            uint8 c = text[position];
+            word ^= (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+            word *= 0x100000001b3ULL;
+            numeric &= c >= '0' && c <= '9';
+        }
+        if (position - wordStart >= RelatedNotesIndex::kMinWordLength)
+            visit(word, wordStart, position - wordStart, numeric);
+    }
+}
+
+RelatedNotesIndex::RelatedNotesIndex()
+    : fLock("related_notes_lock"),
+      fState(new index_state()),
+      fDirty(false) {
+}
+
+RelatedNotesIndex::~RelatedNotesIndex() {
+    Cancel();
+    delete fState;
+}
+
+status_t RelatedNotesIndex::Load() {
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kRelatedIndexFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_READ_ONLY);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    status = archive.Unflatten(&file);
+    if (status != B_OK)
+        return status;
+
+    const void* data;
+    const void* termData;
+    const void* termCountData;
+    const void* frequencyTermData;
+    const void* frequencyData;
+    ssize_t size, termSize, termCountSize, frequencyTermSize, frequencySize;
+    if (archive.FindData("signatures", B_RAW_TYPE, &data, &size) != B_OK
+        || archive.FindData("terms", B_RAW_TYPE, &termData, &termSize) != B_OK
+        || archive.FindData("term_counts", B_RAW_TYPE, &termCountData, &termCountSize) != B_OK
+        || archive.FindData("frequency_terms", B_RAW_TYPE, &frequencyTermData, &frequencyTermSize) != B_OK
+        || archive.FindData("frequencies", B_RAW_TYPE, &frequencyData, &frequencySize) != B_OK
+        || frequencyTermSize != frequencySize) {
+        return B_BAD_DATA;
+    }
+
+    index_state* state = new index_state();
+    const uint16* signatures = static_cast<const uint16*>(data);
+    const uint32* terms = static_cast<const uint32*>(termData);
+    const uint32* termsEnd = terms + termSize / sizeof(uint32);
+    const int32* termCounts = static_cast<const int32*>(termCountData);
+    int32 count = min(size / (kMinHashCount * sizeof(uint16)), termCountSize / sizeof(int32));
+    BString notePath;
+    int64 modified;
+    for (int32 index = 0; index < count && archive.FindString("path", index, &notePath) == B_OK
+                          && archive.FindInt64("modified", index, &modified) == B_OK
+                          && termCounts[index] <= termsEnd - terms; index++) {
+        state->paths.push_back(notePath);
+        state->modified.push_back(modified);
+        state->terms.emplace_back(terms, terms + termCounts[index]);
+        terms += termCounts[index];
+    }
+    state->signatures.assign(signatures, signatures + state->paths.size() * kMinHashCount);
+
+    const uint32* frequencyTerms = static_cast<const uint32*>(frequencyTermData);
+    const uint32* frequencies = static_cast<const uint32*>(frequencyData);
+    state->frequencyTerms.assign(frequencyTerms, frequencyTerms + frequencySize / sizeof(uint32));
+    state->frequencies.assign(frequencies, frequencies + frequencySize / sizeof(uint32));
+    BuildBands(state);
+
+    BAutolock lock(&fLock);
+    delete fState;
+    fState = state;
+    fDirty = false;
+    printf("RelatedNotesIndex: loaded %zu notes.\n", state->paths.size());
+
+    return B_OK;
+}
+
+status_t RelatedNotesIndex::Save() {
+    BAutolock lock(&fLock);
+    if (!fDirty)
+        return B_OK;
+
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kRelatedIndexFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    vector<uint32> terms;
+    vector<int32> termCounts;
+    for (size_t index = 0; index < fState->paths.size(); index++) {
+        archive.AddString("path", fState->paths[index]);
+        archive.AddInt64("modified", fState->modified[index]);
+        terms.insert(terms.end(), fState->terms[index].begin(), fState->terms[index].end());
+        termCounts.push_back(fState->terms[index].size());
+    }
+    archive.AddData("signatures", B_RAW_TYPE, fState->signatures.data(),
+        fState->signatures.size() * sizeof(uint16), false);
+    archive.AddData("terms", B_RAW_TYPE, terms.data(), terms.size() * sizeof(uint32), false);
+    archive.AddData("term_counts", B_RAW_TYPE, termCounts.data(), termCounts.size() * sizeof(int32), false);
+    archive.AddData("frequency_terms", B_RAW_TYPE, fState->frequencyTerms.data(),
+        fState->frequencyTerms.size() * sizeof(uint32), false);
+    archive.AddData("frequencies", B_RAW_TYPE, fState->frequencies.data(),
+        fState->frequencies.size() * sizeof(uint32), false);
+
+    status = archive.Flatten(&file);
+    if (status == B_OK)
+        fDirty = false;
+
+    return status;
+}
+
+void RelatedNotesIndex::Update(const vector<BString>& paths) {
+    Cancel();
+
+    fUpdateTask = TaskScheduler::Default()->Submit(TASK_PRIORITY_MAINTENANCE,
+        [this, paths](const CancelToken& token) {
+            bigtime_t startTime = system_time();
+            map<BString, int32> known;
+            index_state* state = new index_state();
+            int32 signedNotes = 0;
+            {
+                BAutolock lock(&fLock);
+                for (size_t index = 0; index < fState->paths.size(); index++)
+                    known[fState->paths[index]] = index;
+            }
+            vector<bool> kept(known.size(), false);
+            // document frequencies are only corrected for the notes that changed
+            map<uint32, int32> frequencyChanges;
+
+            minhash_signature signature;
+            vector<uint32> terms;
+            for (auto& path : paths) {
+                if (token.IsCanceled()) {
+                    delete state;
+                    return;
+                }
+                struct stat stat;
+                if (BEntry(path.String()).GetStat(&stat) != B_OK)
+                    continue;
+
+                auto entry = known.find(path);
+                if (entry != known.end()) {
+                    // the index only changes in this task, so the entry is still there
+                    BAutolock lock(&fLock);
+                    if (fState->modified[entry->second] == stat.st_mtime) {
+                        const uint16* values = fState->signatures.data() + entry->second * kMinHashCount;
+                        state->paths.push_back(path);
+                        state->modified.push_back(stat.st_mtime);
+                        state->signatures.insert(state->signatures.end(), values, values + kMinHashCount);
+                        state->terms.push_back(fState->terms[entry->second]);
+                        kept[entry->second] = true;
+                        continue;
+                    }
+                }
+                // notes w/o word pairs are kept as well, so they are not read again
+                if (IndexFile(path.String(), token, &signature, &terms) != B_OK)
+                    continue;
+
+                state->paths.push_back(path);
+                state->modified.push_back(stat.st_mtime);
+                for (int32 index = 0; index < kMinHashCount; index++)
+                    state->signatures.push_back((uint16) signature.values[index]);
+                CountTerms(&frequencyChanges, terms, 1);
+                state->terms.push_back(terms);
+                signedNotes++;
+            }
+            {
+                // terms of notes that changed or went away are taken back
+                BAutolock lock(&fLock);
+                for (size_t index = 0; index < kept.size(); index++) {
+                    if (!kept[index])
+                        CountTerms(&frequencyChanges, fState->terms[index], -1);
+                }
+                ApplyFrequencyChanges(fState, state, frequencyChanges);
+            }
+            BuildBands(state);
+
+            BAutolock lock(&fLock);
+            fDirty |= signedNotes > 0 || state->paths.size() != fState->paths.size();
+            delete fState;
+            fState = state;
+            printf("RelatedNotesIndex: indexed %zu notes, signed %d of them in %lld ms.\n", state->paths.size(),
+                signedNotes, (long long) (system_time() - startTime) / 1000);
+        });
+}
+
+void RelatedNotesIndex::Cancel() {
+    fUpdateTask.Cancel();
+    fUpdateTask.Wait();
+}
+
+void RelatedNotesIndex::Query(const minhash_signature& signature, int32 count, const char* excludePath,
+                              vector<related_note>* results) {
+    results->clear();
+    if (IsEmpty(signature))
+        return;
+
+    uint16 values[kMinHashCount];
+    for (int32 index = 0; index < kMinHashCount; index++)
+        values[index] = (uint16) signature.values[index];
+
+    BAutolock lock(&fLock);
+    vector<int32> candidates;
+    for (int32 band = 0; band < kBandCount; band++) {
+        const vector<band_entry>& entries = fState->bands[band];
+        uint32 key = BandKey(values, band);
+        auto entry = lower_bound(entries.begin(), entries.end(), key,
+            [](const band_entry& entry, uint32 key) { return entry.key < key; });
+        for (; entry != entries.end() && entry->key == key; entry++)
+            candidates.push_back(entry->note);
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+    // candidates are ranked by the share of equal minimums, which estimates their similarity
+    vector<pair<int32, int32>> scores;
+    for (int32 note : candidates) {
+        if (fState->paths[note] == excludePath)
+            continue;
+        const uint16* other = fState->signatures.data() + note * kMinHashCount;
+        int32 equal = 0;
+        for (int32 index = 0; index < kMinHashCount; index++)
+            equal += values[index] == other[index];
+        scores.push_back({equal, note});
+    }
+    int32 resultCount = min(count, (int32) scores.size());
+    partial_sort(scores.begin(), scores.begin() + resultCount, scores.end(),
+        [](const pair<int32, int32>& score, const pair<int32, int32>& other) {
+            return score.first > other.first;
+        });
+    for (int32 index = 0; index < resultCount; index++) {
+        results->push_back({fState->paths[scores[index].second],
+            (float) scores[index].first / kMinHashCount});
+    }
+}
+
+int32 RelatedNotesIndex::CountNotes() {
+    BAutolock lock(&fLock);
+    return fState->paths.size();
+}
+
+void RelatedNotesIndex::GetKeywords(const vector<term_count>& terms, int32 count, vector<BString>* keywords) {
+    // terms are looked up in the order of their hashes, each search starts where the last one ended
+    vector<int32> order(terms.size());
+    for (size_t index = 0; index < order.size(); index++)
+        order[index] = index;
+    sort(order.begin(), order.end(), [&terms](int32 index, int32 other) {
+        return terms[index].term < terms[other].term;
+    });
+
+    vector<pair<float, int32>> scores;
+    scores.reserve(terms.size());
+    {
+        BAutolock lock(&fLock);
+        const vector<uint32>& frequencyTerms = fState->frequencyTerms;
+        float noteCount = fState->paths.size();
+        auto position = frequencyTerms.begin();
+        for (int32 index : order) {
+            // smoothed, so words of all notes still count a little and new words do not divide by 0
+            position = lower_bound(position, frequencyTerms.end(), terms[index].term);
+            float documentFrequency = 0;
+            if (position != frequencyTerms.end() && *position == terms[index].term)
+                documentFrequency = fState->frequencies[position - frequencyTerms.begin()];
+            float inverseFrequency = logf((noteCount + 1) / (documentFrequency + 1)) + 1;
+            scores.push_back({(1 + logf(terms[index].count)) * inverseFrequency, index});
+        }
+    }
+    int32 resultCount = min(count, (int32) scores.size());
+    partial_sort(scores.begin(), scores.begin() + resultCount, scores.end(),
+        [](const pair<float, int32>& score, const pair<float, int32>& other) {
+            return score.first > other.first;
+        });
+
+    keywords->clear();
+    for (int32 index = 0; index < resultCount; index++)
+        keywords->push_back(terms[scores[index].second].word);
+}
+
+void RelatedNotesIndex::ClearSignature(minhash_signature* signature) {
+    fill(signature->values, signature->values + kMinHashCount, UINT32_MAX);
+}
+
+void RelatedNotesIndex::Sign(const char* text, int64 length, minhash_signature* signature) {
+    const minhash_function* functions = MinHashFunctions();
+    uint64 previousWord = 0;
+
+    ForEachWord(text, length, [&](uint64 word, int64 start, int64 wordLength, bool numeric) {
+        if (previousWord != 0) {
+            uint64 pair = (previousWord * 0x9e3779b97f4a7c15ULL) ^ word;
+            for (int32 index = 0; index < kMinHashCount; index++) {
+                uint32 value = (uint32) ((pair * functions[index].multiplier + functions[index].addend) >> 32);
+                signature->values[index] = min(signature->values[index], value);
+            }
+        }
+        previousWord = word;
+    });
+}
+
+void RelatedNotesIndex::Merge(minhash_signature* signature, const minhash_signature& other) {
+    for (int32 index = 0; index < kMinHashCount; index++)
+        signature->values[index] = min(signature->values[index], other.values[index]);
+}
+
+bool RelatedNotesIndex::IsEmpty(const minhash_signature& signature) {
+    // w/o any word pair all minimums stay at their start value
+    return signature.values[0] == UINT32_MAX && signature.values[1] == UINT32_MAX;
+}
+
+void RelatedNotesIndex::GetTerms(const char* text, int64 length, vector<term_count>* terms) {
+    map<uint32, int32> indices;
+    terms->clear();
+    ForEachWord(text, length, [&](uint64 word, int64 start, int64 wordLength, bool numeric) {
+        if (numeric)
+            return;
+
+        auto entry = indices.insert({(uint32) word, terms->size()});
+        if (!entry.second) {
+            (*terms)[entry.first->second].count++;
+            return;
+        }
+        BString lowerWord(text + start, wordLength);
+        terms->push_back({(uint32) word, 1, lowerWord.ToLower()});
+    });
+}
+
+status_t RelatedNotesIndex::IndexFile(const char* path, const CancelToken& token, minhash_signature* signature,
+                                      vector<uint32>* terms) {
+    BFile file(path, B_READ_ONLY);
+    status_t status = file.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    // front matter is metadata, not text of the note
+    vector<char> head(FrontMatter::kMaxFrontMatterSize);
+    ssize_t headSize = file.ReadAt(0, head.data(), head.size());
+    int64 start = headSize > 0 ? FrontMatter::Detect(head.data(), headSize) : 0;
+
+    ClearSignature(signature);
+    terms->clear();
+    BString normalText;
+    DocumentScanner scanner(&file);
+    status = scanner.Scan([&](markup_map* markupMap, const char* text, int64 textOffset, int32 size) {
+        // runs of normal text are joined, with a space where markup was left out between them
+        normalText.Truncate(0);
+        int64 lastEnd = -1;
+        for (auto& entry : *markupMap) {
+            for (auto item : *entry.second) {
+                if (item->markup_class != MD_TEXT || item->markup_type.text_type != MD_TEXT_NORMAL)
+                    continue;
+                if (item->offset != lastEnd)
+                    normalText << ' ';
+                normalText.Append(text + (item->offset - textOffset), item->length);
+                lastEnd = item->offset + item->length;
+            }
+        }
+        Sign(normalText.String(), normalText.Length(), signature);
+        ForEachWord(normalText.String(), normalText.Length(),
+            [&](uint64 word, int64 wordStart, int64 wordLength, bool numeric) {
+                if (!numeric)
+                    terms->push_back((uint32) word);
+            });
+        return true;
+    }, start, INT64_MAX, token);
+
+    sort(terms->begin(), terms->end());
+    terms->erase(unique(terms->begin(), terms->end()), terms->end());
+    return status;
+}
+
+void RelatedNotesIndex::BuildBands(index_state* state) {
+    int32 count = state->paths.size();
+    for (int32 band = 0; band < kBandCount; band++) {
+        vector<band_entry>& entries = state->bands[band];
+        entries.clear();
+        entries.reserve(count);
+        for (int32 note = 0; note < count; note++) {
+            const uint16* values = state->signatures.data() + note * kMinHashCount;
+            if (values[0] != UINT16_MAX || values[1] != UINT16_MAX)
+                entries.push_back({BandKey(values, band), note});
+        }
+        sort(entries.begin(), entries.end(), [](const band_entry& entry, const band_entry& other) {
+            return entry.key < other.key;
+        });
+    }
+}
+
+void RelatedNotesIndex::CountTerms(map<uint32, int32>* changes, const vector<uint32>& terms, int32 delta) {
+    for (uint32 term : terms)
+        (*changes)[term] += delta;
+}
+
+void RelatedNotesIndex::ApplyFrequencyChanges(const index_state* from, index_state* state,
+                                              const map<uint32, int32>& changes) {
+    // both are sorted by term, so they are merged in one pass
+    size_t index = 0;
+    auto change = changes.begin();
+    while (index < from->frequencyTerms.size() || change != changes.end()) {
+        uint32 term;
+        int64 frequency;
+        if (change == changes.end()
+            || (index < from->frequencyTerms.size() && from->frequencyTerms[index] < change->first)) {
+            term = from->frequencyTerms[index];
+            frequency = from->frequencies[index++];
+        } else if (index < from->frequencyTerms.size() && from->frequencyTerms[index] == change->first) {
+            term = from->frequencyTerms[index];
+            frequency = (int64) from->frequencies[index++] + (change++)->second;
+        } else {
+            term = change->first;
+            frequency = (change++)->second;
+        }
+        if (frequency > 0) {
+            state->frequencyTerms.push_back(term);
+            state->frequencies.push_back(frequency);
+        }
+    }
+}
+
+uint32 RelatedNotesIndex::BandKey(const uint16* values, int32 band) {
+    // both 16 bit values of the band as they are, so equal keys mean equal bands
+    return ((uint32) values[band * kBandSize] << 16) | values[band * kBandSize + 1];
+}
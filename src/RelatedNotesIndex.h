@@ -0,0 +1,125 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * vault-wide index of notes by the word pairs of their plain text, to find notes related to the open one.
+ * each note is signed with the minimum hashes of its word pairs under a number of hash functions, two
+ * signatures agree in as many of them as the word pair sets of their notes have in common (MinHash, see
+ * Broder, "On the resemblance and containment of documents", 1997). only the low 16 bits of each minimum
+ * are kept (Li and König, "b-Bit Minwise Hashing", 2010), and signatures are split into bands of two,
+ * so notes sharing a band are found by lookup instead of comparing with every note (LSH).
+ * the index also counts the notes each word occurs in, to weigh the words of a note against the vault
+ * for keyword suggestions (TF-IDF).
+ */
+#pragma once
+
+#include <Locker.h>
+#include <map>
+#include <String.h>
+#include <SupportDefs.h>
+#include <time.h>
+#include <vector>
+
+#include "TaskScheduler.h"
+
+using namespace std;
+
+static const int32 kMinHashCount = 128;
+
+typedef struct minhash_signature {
+    uint32          values[kMinHashCount];
+} minhash_signature;
+
+typedef struct term_count {
+    uint32          term;           // hash of the lower case word
+    int32           count;
+    BString         word;
+} term_count;
+
+typedef struct related_note {
+    BString         path;
+    float           similarity;     // estimated share of common word pairs
+} related_note;
+
+class RelatedNotesIndex {
+
+public:
+                        RelatedNotesIndex();
+    virtual             ~RelatedNotesIndex();
+
+    status_t            Load();
+    status_t            Save();
+
+    /**
+     * signs the notes at paths that changed since they were indexed in the background and drops notes
+     * no longer in paths. an update still running is canceled.
+     */
+    void                Update(const vector<BString>& paths);
+    void                Cancel();
+
+    /**
+     * returns up to count indexed notes sharing a band with signature, most similar first.
+     */
+    void                Query(const minhash_signature& signature, int32 count, const char* excludePath,
+                              vector<related_note>* results);
+    int32               CountNotes();
+    /**
+     * returns up to count words of terms that occur often in them but in few notes of the vault,
+     * best first.
+     */
+    void                GetKeywords(const vector<term_count>& terms, int32 count, vector<BString>* keywords);
+
+    // signing
+    static void         ClearSignature(minhash_signature* signature);
+    /**
+     * adds the word pairs of text to signature.
+     */
+    static void         Sign(const char* text, int64 length, minhash_signature* signature);
+    /**
+     * adds the word pairs of another text to signature, as if its text was signed as well.
+     */
+    static void         Merge(minhash_signature* signature, const minhash_signature& other);
+    static bool         IsEmpty(const minhash_signature& signature);
+    /**
+     * returns the distinct words of text with their counts, numbers are left out.
+     */
+    static void         GetTerms(const char* text, int64 length, vector<term_count>* terms);
+    /**
+     * signs the normal text of the note at path, w/o markup, code or front matter, and returns its
+     * distinct terms, sorted.
+     */
+    static status_t     IndexFile(const char* path, const CancelToken& token, minhash_signature* signature,
+                                  vector<uint32>* terms);
+
+    static const int32  kBandSize = 2;
+    static const int32  kBandCount = kMinHashCount / kBandSize;
+    // shorter words are left out of word pairs
+    static const int32  kMinWordLength = 3;
+
+private:
+    typedef struct band_entry {
+        uint32          key;        // the values of the band
+        int32           note;
+    } band_entry;
+
+    typedef struct index_state {
+        vector<BString>     paths;
+        vector<time_t>      modified;
+        vector<uint16>      signatures;     // kMinHashCount per note
+        vector<vector<uint32>> terms;       // per note, to take them back when it changes
+        vector<uint32>      frequencyTerms;     // sorted, for lookups w/o chasing pointers
+        vector<uint32>      frequencies;        // number of notes per term
+        vector<band_entry>  bands[kBandCount];  // sorted by key
+    } index_state;
+
+    static void         BuildBands(index_state* state);
+    static void         CountTerms(map<uint32, int32>* changes, const vector<uint32>& terms, int32 delta);
+    static void         ApplyFrequencyChanges(const index_state* from, index_state* state,
+                                              const map<uint32, int32>& changes);
+    static uint32       BandKey(const uint16* values, int32 band);
+
+    BLocker             fLock;
+    index_state*        fState;
+    bool                fDirty;
+    TaskHandle          fUpdateTask;
+};
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "RelayConnection.h"
+
+#include <arpa/inet.h>
+#include <Message.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "FrameSocket.h"
+#include "Messages.h"
+#include "RelayProtocol.h"
+
+RelayConnection::RelayConnection(BMessenger target)
+    : fTarget(target),
+      fClient(0),
+      fSocket(-1),
+      fClosing(false) {
+}
+
+RelayConnection::~RelayConnection() {
+    Close();
+}
+
+status_t RelayConnection::Connect(const char* host, uint16 port, uint32 client) {
+    Close();
+    fClient = client;
+    fClosing = false;
+
+    status_t status = FrameSocket::Connect(host, port, &fSocket);
+    if (status != B_OK) {
+        return status;
+    }
+    uint32 hello = htonl(client);
+    status = SendFrame(RELAY_FRAME_HELLO, &hello, sizeof(hello));
+    if (status != B_OK) {
+        Close();
+        return status;
+    }
+    fReader = thread(&RelayConnection::ReadLoop, this);
+    printf("RelayConnection: joining session at %s:%u as client %08x.\n", host, port, client);
+    return B_OK;
+}
+
+status_t RelayConnection::SendOps(const vector<uint8>& ops) {
+    return SendFrame(RELAY_FRAME_OPS, ops.data(), ops.size());
+}
+
+void RelayConnection::Close() {
+    if (fSocket < 0) {
+        return;
+    }
+    // wakes up the reader
+    fClosing = true;
+    shutdown(fSocket, SHUT_RDWR);
+    if (fReader.joinable()) {
+        fReader.join();
+    }
+    lock_guard<mutex> lock(fWriteLock);
+    close(fSocket);
+    fSocket = -1;
+}
+
+void RelayConnection::ReadLoop() {
+    vector<uint8> payload;
+    uint8 type;
+    while (FrameSocket::ReadFrame(fSocket, kMaxRelayFrameSize, &type, &payload) == B_OK) {
+        BMessage message;
+        const uint8* ops = payload.data();
+        size_t opsSize = payload.size();
+        if (type == RELAY_FRAME_WELCOME && opsSize > 0) {
+            message.what = MSG_SESSION_JOINED;
+            message.AddBool("first", ops[0] != 0);
+            ops++;
+            opsSize--;
+        } else if (type == RELAY_FRAME_OPS) {
+            message.what = MSG_REMOTE_OPS;
+        } else {
+            printf("RelayConnection: ignoring frame of type %u.\n", type);
+            continue;
+        }
+        message.AddUInt32("client", fClient);
+        if (opsSize > 0) {
+            message.AddData("ops", B_RAW_TYPE, ops, opsSize, false);
+        }
+        Post(&message);
+    }
+
+    if (!fClosing) {
+        printf("RelayConnection: lost the connection to the relay.\n");
+        BMessage message(MSG_SESSION_LEFT);
+        message.AddUInt32("client", fClient);
+        Post(&message);
+    }
+}
+
+void RelayConnection::Post(BMessage* message) {
+    // the target may be waiting in Close() for this thread, so don't block on a full port
+    while (fTarget.SendMessage(message, (BHandler*) NULL, kPostTimeout) == B_TIMED_OUT && !fClosing) {
+    }
+}
+
+status_t RelayConnection::SendFrame(uint8 type, const void* data, size_t size) {
+    lock_guard<mutex> lock(fWriteLock);
+    if (fSocket < 0) {
+        return B_NO_INIT;
+    }
+    return FrameSocket::WriteFrame(fSocket, type, data, size);
+}
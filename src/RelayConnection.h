@@ -0,0 +1,47 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * connection of an editor to a session relay. operations are sent from the window thread, a reader
+ * thread posts the frames from the relay to the target as messages.
+ */
+#pragma once
+
+#include <atomic>
+#include <Messenger.h>
+#include <mutex>
+#include <SupportDefs.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class RelayConnection {
+
+public:
+                        RelayConnection(BMessenger target);
+    virtual             ~RelayConnection();
+
+    /**
+     * connects and joins the session as client. the target gets MSG_SESSION_JOINED once joined,
+     * MSG_REMOTE_OPS for each batch of operations of the others and MSG_SESSION_LEFT if the relay goes away,
+     * each with the client id.
+     */
+    status_t            Connect(const char* host, uint16 port, uint32 client);
+    status_t            SendOps(const vector<uint8>& ops);
+    void                Close();
+
+private:
+    void                ReadLoop();
+    void                Post(BMessage* message);
+    status_t            SendFrame(uint8 type, const void* data, size_t size);
+
+    static const bigtime_t kPostTimeout = 100000;
+
+    BMessenger          fTarget;
+    uint32              fClient;
+    int                 fSocket;
+    thread              fReader;
+    mutex               fWriteLock;
+    atomic<bool>        fClosing;
+};
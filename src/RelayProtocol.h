@@ -0,0 +1,18 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * frames exchanged between editors and the session relay in tools/relay, laid out as in FrameSocket.
+ */
+#pragma once
+
+#include <SupportDefs.h>
+
+enum RELAY_FRAME {
+    RELAY_FRAME_HELLO = 1,      // editor to relay: uint32 client id in network byte order
+    RELAY_FRAME_WELCOME,        // relay to editor: uint8 1 for the first editor of the session, then all operations so far
+    RELAY_FRAME_OPS             // both ways: a batch of operations, relayed to all other editors
+};
+
+static const uint16 kRelayPort = 7131;
+static const uint32 kMaxRelayFrameSize = 256 * 1024 * 1024;
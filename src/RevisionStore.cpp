@@ -0,0 +1,347 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "RevisionStore.h"
+
+#include <algorithm>
+#include <Directory.h>
+#include <FindDirectory.h>
+#include <Path.h>
+#include <stdio.h>
+#include <string.h>
+#include <TypeConstants.h>
+
+static const char* kRevisionDirectory = "senity_revisions";
+static const char* kBlockFile = "blocks";
+static const char* kNotesDirectory = "notes";
+
+// about every 8th block boundary past the minimum size ends a stored block
+static const uint64 kCutMask = 0x7;
+
+RevisionStore::RevisionStore()
+    : fBlockFileSize(0) {
+}
+
+RevisionStore::~RevisionStore() {
+}
+
+status_t RevisionStore::Open() {
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kRevisionDirectory);
+    if (status != B_OK)
+        return status;
+
+    fDirectory = path.Path();
+    BString notesPath(fDirectory);
+    notesPath << "/" << kNotesDirectory;
+    status = create_directory(notesPath.String(), 0755);
+    if (status != B_OK)
+        return status;
+
+    BString blockPath(fDirectory);
+    blockPath << "/" << kBlockFile;
+    status = fBlockFile.SetTo(blockPath.String(), B_READ_WRITE | B_CREATE_FILE);
+    if (status != B_OK)
+        return status;
+
+    off_t size;
+    status = fBlockFile.GetSize(&size);
+    if (status != B_OK)
+        return status;
+
+    // each block is stored with its reference in front, so the index is rebuilt from the headers only
+    fBlocks.clear();
+    off_t offset = 0;
+    block_ref header;
+    while (fBlockFile.ReadAt(offset, &header, sizeof(header)) == sizeof(header)
+           && offset + (off_t) sizeof(header) + header.length <= size) {
+        fBlocks[header.hash] = {offset + (off_t) sizeof(header), header.length};
+        offset += sizeof(header) + header.length;
+    }
+    if (offset < size) {
+        printf("RevisionStore: dropping %lld bytes of a partly written block.\n", (long long) (size - offset));
+        fBlockFile.SetSize(offset);
+    }
+    fBlockFileSize = offset;
+    printf("RevisionStore: opened store with %zu blocks in %lld bytes.\n", fBlocks.size(), (long long) offset);
+
+    return B_OK;
+}
+
+status_t RevisionStore::AddRevision(const char* path, const vector<int64>& boundaries) {
+    if (fDirectory.IsEmpty())
+        return B_NO_INIT;
+
+    BFile file(path, B_READ_ONLY);
+    status_t status = file.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    off_t size;
+    status = file.GetSize(&size);
+    if (status != B_OK)
+        return status;
+
+    vector<block_ref> blocks;
+    vector<char> buffer(kMaxBlockSize);
+    int64 storedBytes = 0;
+    auto boundary = boundaries.begin();
+
+    for (int64 position = 0; position < size; ) {
+        ssize_t bytesRead = file.ReadAt(position, buffer.data(), min((int64) kMaxBlockSize, size - position));
+        if (bytesRead <= 0)
+            return (bytesRead < 0 ? bytesRead : B_IO_ERROR);
+
+        int64 cut = FindCut(buffer.data(), bytesRead, position, position + bytesRead >= size,
+            &boundary, boundaries.end());
+        block_ref block;
+        bool added;
+        status = StoreBlock(buffer.data(), cut, &block, &added);
+        if (status != B_OK)
+            return status;
+
+        if (added)
+            storedBytes += cut;
+        blocks.push_back(block);
+        position += cut;
+    }
+
+    // saving w/o changes adds no revision
+    vector<BMessage> revisions;
+    ReadRevisions(path, &revisions);
+    if (!revisions.empty()) {
+        const void* data;
+        ssize_t dataSize = 0;
+        if (revisions.back().FindData("blocks", B_RAW_TYPE, &data, &dataSize) != B_OK)
+            dataSize = 0;
+        if (dataSize == (ssize_t) (blocks.size() * sizeof(block_ref))
+            && equal(blocks.begin(), blocks.end(), static_cast<const block_ref*>(data),
+                [](const block_ref& block, const block_ref& other) {
+                    return block.hash == other.hash && block.length == other.length;
+                })) {
+            printf("RevisionStore: %s is unchanged since the last revision.\n", path);
+            return B_OK;
+        }
+    }
+
+    BMessage revision;
+    revision.AddString("path", path);
+    revision.AddInt64("time", time(NULL));
+    revision.AddInt64("size", size);
+    revision.AddInt64("stored", storedBytes);
+    if (!blocks.empty())
+        revision.AddData("blocks", B_RAW_TYPE, blocks.data(), blocks.size() * sizeof(block_ref), false);
+
+    BFile log(RevisionPath(path).String(), B_WRITE_ONLY | B_CREATE_FILE | B_OPEN_AT_END);
+    status = log.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    status = revision.Flatten(&log);
+    if (status == B_OK) {
+        printf("RevisionStore: added revision %zu of %s with %zu blocks, %lld of %lld bytes new.\n",
+            revisions.size(), path, blocks.size(), (long long) storedBytes, (long long) size);
+    }
+    return status;
+}
+
+status_t RevisionStore::GetRevisions(const char* path, vector<revision_info>* revisions) {
+    vector<BMessage> messages;
+    status_t status = ReadRevisions(path, &messages);
+    if (status != B_OK)
+        return status;
+
+    revisions->clear();
+    for (auto& message : messages) {
+        const void* data;
+        ssize_t dataSize = 0;
+        if (message.FindData("blocks", B_RAW_TYPE, &data, &dataSize) != B_OK)
+            dataSize = 0;
+
+        revision_info info;
+        info.time        = message.GetInt64("time", 0);
+        info.size        = message.GetInt64("size", 0);
+        info.blockCount  = dataSize / sizeof(block_ref);
+        info.storedBytes = message.GetInt64("stored", 0);
+        revisions->push_back(info);
+    }
+    return B_OK;
+}
+
+status_t RevisionStore::GetRevisionBlocks(const char* path, int32 index, vector<block_ref>* blocks) {
+    vector<BMessage> revisions;
+    status_t status = ReadRevisions(path, &revisions);
+    if (status != B_OK)
+        return status;
+
+    if (index < 0 || index >= (int32) revisions.size())
+        return B_BAD_INDEX;
+
+    blocks->clear();
+    const void* data;
+    ssize_t dataSize;
+    if (revisions[index].FindData("blocks", B_RAW_TYPE, &data, &dataSize) == B_OK) {
+        const block_ref* refs = static_cast<const block_ref*>(data);
+        blocks->assign(refs, refs + dataSize / sizeof(block_ref));
+    }
+    return B_OK;
+}
+
+status_t RevisionStore::RestoreRevision(const char* path, int32 index, BPositionIO* target) {
+    vector<block_ref> blocks;
+    status_t status = GetRevisionBlocks(path, index, &blocks);
+    if (status != B_OK)
+        return status;
+
+    vector<char> buffer(kMaxBlockSize);
+    for (auto& block : blocks) {
+        auto location = fBlocks.find(block.hash);
+        if (location == fBlocks.end() || location->second.length != block.length) {
+            printf("RevisionStore: block %016llx of revision %d is missing.\n", (unsigned long long) block.hash, index);
+            return B_ENTRY_NOT_FOUND;
+        }
+        ssize_t bytesRead = fBlockFile.ReadAt(location->second.offset, buffer.data(), block.length);
+        if (bytesRead != (ssize_t) block.length || HashBlock(buffer.data(), block.length) != block.hash)
+            return B_BAD_DATA;
+
+        ssize_t written = target->Write(buffer.data(), block.length);
+        if (written < 0)
+            return written;
+    }
+    return B_OK;
+}
+
+status_t RevisionStore::CompareRevisions(const char* path, int32 from, int32 to, revision_diff* diff) {
+    vector<block_ref> fromBlocks, toBlocks;
+    status_t status = GetRevisionBlocks(path, from, &fromBlocks);
+    if (status == B_OK)
+        status = GetRevisionBlocks(path, to, &toBlocks);
+    if (status != B_OK)
+        return status;
+
+    // blocks are matched by hash, a block occurring several times is matched as often
+    map<uint64, int32> remaining;
+    for (auto& block : fromBlocks)
+        remaining[block.hash]++;
+
+    *diff = revision_diff();
+    for (auto& block : toBlocks) {
+        auto count = remaining.find(block.hash);
+        if (count != remaining.end() && count->second > 0) {
+            count->second--;
+            diff->unchangedBlocks++;
+        } else {
+            diff->addedBlocks++;
+            diff->addedBytes += block.length;
+        }
+    }
+    for (auto& block : fromBlocks) {
+        auto count = remaining.find(block.hash);
+        if (count->second > 0) {
+            count->second--;
+            diff->removedBlocks++;
+            diff->removedBytes += block.length;
+        }
+    }
+    return B_OK;
+}
+
+uint64 RevisionStore::HashBlock(const char* data, int64 length, uint64 hash) {
+    // FNV-1a, fast enough to hash a large note on every save
+    for (int64 index = 0; index < length; index++) {
+        hash ^= (uint8) data[index];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+status_t RevisionStore::ReadRevisions(const char* path, vector<BMessage>* revisions) {
+    revisions->clear();
+    BFile log(RevisionPath(path).String(), B_READ_ONLY);
+    if (log.InitCheck() != B_OK)
+        return B_OK;    // no revisions yet
+
+    // revisions are appended as flattened messages, a partly written one at the end is ignored
+    BMessage revision;
+    while (revision.Unflatten(&log) == B_OK) {
+        if (strcmp(revision.GetString("path", ""), path) == 0)
+            revisions->push_back(revision);
+    }
+    return B_OK;
+}
+
+status_t RevisionStore::StoreBlock(const char* data, uint32 length, block_ref* block, bool* added) {
+    block->hash = HashBlock(data, length);
+    block->length = length;
+    *added = false;
+
+    auto location = fBlocks.find(block->hash);
+    if (location != fBlocks.end()) {
+        if (location->second.length == length)
+            return B_OK;
+
+        printf("RevisionStore: hash collision for block %016llx.\n", (unsigned long long) block->hash);
+        return B_ERROR;
+    }
+
+    if (fBlockFile.WriteAt(fBlockFileSize, block, sizeof(block_ref)) != (ssize_t) sizeof(block_ref)
+        || fBlockFile.WriteAt(fBlockFileSize + sizeof(block_ref), data, length) != (ssize_t) length) {
+        // leave no partly written block behind
+        fBlockFile.SetSize(fBlockFileSize);
+        return B_IO_ERROR;
+    }
+    fBlocks[block->hash] = {fBlockFileSize + (off_t) sizeof(block_ref), length};
+    fBlockFileSize += sizeof(block_ref) + length;
+    *added = true;
+
+    return B_OK;
+}
+
+int64 RevisionStore::FindCut(const char* data, int64 length, int64 position, bool atEnd,
+                             vector<int64>::const_iterator* boundary, vector<int64>::const_iterator end) {
+    // possible cuts are the top level block boundaries in the buffer, or lines after blank lines w/o them
+    vector<int64> cuts;
+    while (*boundary != end && **boundary <= position)
+        (*boundary)++;
+    for (auto next = *boundary; next != end && *next - position <= length; next++)
+        cuts.push_back(*next - position);
+
+    if (cuts.empty()) {
+        for (int64 index = 1; index < length; index++) {
+            if (data[index] == '\n' && data[index - 1] == '\n' && (index + 1 == length || data[index + 1] != '\n'))
+                cuts.push_back(index + 1);
+        }
+    }
+
+    // cut depending on the content of the block just ended, so cuts resynchronize after an edit
+    int64 blockStart = 0;
+    for (auto cut : cuts) {
+        if (cut >= kMinBlockSize && (HashBlock(data + blockStart, cut - blockStart) & kCutMask) == 0)
+            return cut;
+        blockStart = cut;
+    }
+    if (atEnd)
+        return length;
+    if (!cuts.empty())
+        return cuts.back();
+
+    // a single huge block, cut at a line end at least
+    for (int64 index = length - 1; index > 0; index--) {
+        if (data[index - 1] == '\n')
+            return index;
+    }
+    return length;
+}
+
+BString RevisionStore::RevisionPath(const char* path) {
+    BString revisionPath;
+    revisionPath.SetToFormat("%s/%s/%016llx", fDirectory.String(), kNotesDirectory,
+        (unsigned long long) HashBlock(path, strlen(path)));
+    return revisionPath;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * local revision history of notes, kept in the user settings directory. each saved revision is a list
+ * of block hashes pointing into a content-addressed block store shared by all notes, so blocks that did
+ * not change between revisions are stored only once and storage grows with what changed.
+ * blocks are groups of top level markdown blocks, cut where the hash of a block says so once a minimum
+ * size is reached, so an edit only changes the blocks around it and the cuts after it stay in place.
+ */
+#pragma once
+
+#include <DataIO.h>
+#include <File.h>
+#include <map>
+#include <Message.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+typedef struct block_ref {
+    uint64          hash;
+    uint32          length;
+} block_ref;
+
+typedef struct revision_info {
+    time_t          time;
+    int64           size;
+    int32           blockCount;
+    int64           storedBytes;    // bytes of blocks that were new to the store
+} revision_info;
+
+typedef struct revision_diff {
+    int32           unchangedBlocks;
+    int32           addedBlocks;    // in the later revision only
+    int32           removedBlocks;  // in the earlier revision only
+    int64           addedBytes;
+    int64           removedBytes;
+} revision_diff;
+
+class RevisionStore {
+
+public:
+                        RevisionStore();
+    virtual             ~RevisionStore();
+
+    /**
+     * opens the block store and indexes the blocks in it, a partly written block at its end is dropped.
+     */
+    status_t            Open();
+
+    /**
+     * adds the current content of the note at path as a new revision. boundaries are sorted file offsets
+     * of top level blocks, text without known boundaries is split after blank lines.
+     */
+    status_t            AddRevision(const char* path, const vector<int64>& boundaries);
+    /**
+     * lists the revisions of the note at path, oldest first.
+     */
+    status_t            GetRevisions(const char* path, vector<revision_info>* revisions);
+    status_t            GetRevisionBlocks(const char* path, int32 index, vector<block_ref>* blocks);
+    /**
+     * writes the content of revision index of the note at path to target.
+     */
+    status_t            RestoreRevision(const char* path, int32 index, BPositionIO* target);
+    /**
+     * compares two revisions of the note at path by their block lists only, w/o reading any content.
+     */
+    status_t            CompareRevisions(const char* path, int32 from, int32 to, revision_diff* diff);
+
+    static uint64       HashBlock(const char* data, int64 length, uint64 hash = kHashSeed);
+
+    static const int32  kMinBlockSize = 4 * 1024;
+    static const int32  kMaxBlockSize = 64 * 1024;
+    static const uint64 kHashSeed = 0xcbf29ce484222325ULL;
+
+private:
+    typedef struct block_location {
+        off_t           offset;     // of the block data in the store
+        uint32          length;
+    } block_location;
+
+    status_t            ReadRevisions(const char* path, vector<BMessage>* revisions);
+    status_t            StoreBlock(const char* data, uint32 length, block_ref* block, bool* added);
+    static int64        FindCut(const char* data, int64 length, int64 position, bool atEnd,
+                                vector<int64>::const_iterator* boundary, vector<int64>::const_iterator end);
+    BString             RevisionPath(const char* path);
+
+    BString             fDirectory;
+    BFile               fBlockFile;
+    off_t               fBlockFileSize;
+    map<uint64, block_location> fBlocks;
+};
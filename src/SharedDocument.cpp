@@ -0,0 +1,637 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "SharedDocument.h"
+
+#include <algorithm>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+
+static const uint8 kOpInsert = 1;
+static const uint8 kOpDelete = 2;
+
+static const crdt_id kNoId = {0, 0};
+
+static void WriteVarint(vector<uint8>* data, uint64 value) {
+    while (value >= 0x80) {
+        data->push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    data->push_back(value);
+}
+
+static bool ReadVarint(const uint8** data, const uint8* end, uint64* value) {
+    *value = 0;
+    for (int32 shift = 0; *data < end && shift < 64; shift += 7) {
+        uint8 byte = *(*data)++;
+        *value |= (uint64) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void WriteId(vector<uint8>* data, const crdt_id& id) {
+    WriteVarint(data, id.client);
+    if (id.client != 0) {
+        WriteVarint(data, id.clock);
+    }
+}
+
+static bool ReadId(const uint8** data, const uint8* end, crdt_id* id) {
+    uint64 client, clock = 0;
+    if (!ReadVarint(data, end, &client) || client > UINT32_MAX) {
+        return false;
+    }
+    if (client != 0 && (!ReadVarint(data, end, &clock) || clock > UINT32_MAX)) {
+        return false;
+    }
+    *id = {(uint32) client, (uint32) clock};
+    return true;
+}
+
+SharedDocument::SharedDocument(uint32 client)
+    : fClient(client),
+      fClock(0),
+      fSeed(client | 1),
+      fRoot(-1) {
+}
+
+SharedDocument::~SharedDocument() {
+}
+
+void SharedDocument::SetText(const char* text, int32 length) {
+    Clear();
+    if (length > 0) {
+        LocalInsert(0, text, length);
+    }
+    fLocalOps.clear();
+}
+
+void SharedDocument::Clear() {
+    fItems.clear();
+    fRoot = -1;
+    fContent.clear();
+    fRuns.clear();
+    fClocks.clear();
+    fLocalOps.clear();
+    fPending.clear();
+    fClock = 0;
+}
+
+void SharedDocument::GetText(BString* text) {
+    char* buffer = text->LockBuffer(Length());
+    int64 length = 0;
+    for (int32 index = First(); index >= 0; index = Next(index)) {
+        if (!fItems[index].deleted) {
+            memcpy(buffer + length, fContent.data() + fItems[index].content, fItems[index].length);
+            length += fItems[index].length;
+        }
+    }
+    text->UnlockBuffer(length);
+}
+
+int64 SharedDocument::Length() {
+    return Visible(fRoot);
+}
+
+void SharedDocument::LocalInsert(int32 offset, const char* text, int32 length) {
+    // the new chars go between the visible char before offset and whatever follows it
+    shared_op op;
+    op.type = kOpInsert;
+    op.id = {fClient, fClock};
+    op.length = length;
+    op.originLeft = kNoId;
+    op.originRight = kNoId;
+    op.text.SetTo(text, length);
+
+    int32 left = -1;
+    if (offset > 0) {
+        int64 inner;
+        left = FindOffset(offset - 1, &inner);
+        if (left < 0) {
+            printf("SharedDocument: insert at %d is past the end.\n", offset);
+            return;
+        }
+        if (inner + 1 < fItems[left].length) {
+            Split(left, inner + 1);
+        }
+        op.originLeft = LastId(left);
+    }
+    int32 right = (left < 0 ? First() : Next(left));
+    if (right >= 0) {
+        op.originRight = fItems[right].id;
+    }
+    IntegrateInsert(op, NULL);
+
+    // typing on extends the last insert
+    if (!fLocalOps.empty()) {
+        shared_op& last = fLocalOps.back();
+        if (last.type == kOpInsert && last.id.clock + last.length == op.id.clock
+            && op.originLeft == crdt_id{fClient, op.id.clock - 1} && op.originRight == last.originRight) {
+            last.length += length;
+            last.text.Append(text, length);
+            return;
+        }
+    }
+    fLocalOps.push_back(op);
+}
+
+void SharedDocument::LocalDelete(int32 offset, int32 length) {
+    while (length > 0) {
+        int64 inner;
+        int32 index = FindOffset(offset, &inner);
+        if (index < 0) {
+            printf("SharedDocument: delete at %d is past the end.\n", offset);
+            return;
+        }
+        if (inner > 0) {
+            index = Split(index, inner);
+        }
+        if (fItems[index].length > (uint32) length) {
+            Split(index, length);
+        }
+        crdt_item& item = fItems[index];
+        item.deleted = true;
+        UpdatePath(index);
+        length -= item.length;
+
+        // deleting on in either direction extends the last delete
+        if (!fLocalOps.empty()) {
+            shared_op& last = fLocalOps.back();
+            if (last.type == kOpDelete && last.id.client == item.id.client) {
+                if (last.id.clock + last.length == item.id.clock) {
+                    last.length += item.length;
+                    continue;
+                }
+                if (item.id.clock + item.length == last.id.clock) {
+                    last.id.clock = item.id.clock;
+                    last.length += item.length;
+                    continue;
+                }
+            }
+        }
+        shared_op op;
+        op.type = kOpDelete;
+        op.id = item.id;
+        op.length = item.length;
+        fLocalOps.push_back(op);
+    }
+}
+
+bool SharedDocument::TakeLocalOps(vector<uint8>* ops) {
+    ops->clear();
+    for (auto& op : fLocalOps) {
+        EncodeOp(op, ops);
+    }
+    fLocalOps.clear();
+    return !ops->empty();
+}
+
+void SharedDocument::EncodeState(vector<uint8>* ops) {
+    // by client and clock, so the origins of each run are known when it arrives
+    ops->clear();
+    for (auto& client : fRuns) {
+        shared_op insert;
+        insert.type = 0;
+        for (auto& run : client.second) {
+            const crdt_item& item = fItems[run.second];
+            if (insert.type == kOpInsert && insert.id.clock + insert.length == item.id.clock
+                && item.originLeft == crdt_id{item.id.client, item.id.clock - 1}
+                && item.originRight == insert.originRight) {
+                // split runs go out as one again
+                insert.length += item.length;
+                insert.text.Append(fContent.data() + item.content, item.length);
+                continue;
+            }
+            if (insert.type == kOpInsert) {
+                EncodeOp(insert, ops);
+            }
+            insert.type = kOpInsert;
+            insert.id = item.id;
+            insert.length = item.length;
+            insert.originLeft = item.originLeft;
+            insert.originRight = item.originRight;
+            insert.text.SetTo(fContent.data() + item.content, item.length);
+        }
+        if (insert.type == kOpInsert) {
+            EncodeOp(insert, ops);
+        }
+    }
+    for (auto& item : fItems) {
+        if (item.deleted) {
+            shared_op op;
+            op.type = kOpDelete;
+            op.id = item.id;
+            op.length = item.length;
+            EncodeOp(op, ops);
+        }
+    }
+    fLocalOps.clear();
+}
+
+status_t SharedDocument::Integrate(const uint8* ops, size_t size, vector<shared_edit>* edits) {
+    edits->clear();
+    const uint8* data = ops;
+    const uint8* end = ops + size;
+    while (data < end) {
+        shared_op op;
+        if (!DecodeOp(&data, end, &op)) {
+            printf("SharedDocument: malformed operation at byte %zu.\n", (size_t) (data - ops));
+            return B_BAD_DATA;
+        }
+        fPending.push_back(op);
+    }
+
+    // operations of one client come in order, those of others they depend on may come later
+    bool progress = true;
+    while (progress && !fPending.empty()) {
+        progress = false;
+        vector<shared_op> waiting;
+        for (auto& op : fPending) {
+            if (!CanIntegrate(op)) {
+                waiting.push_back(op);
+                continue;
+            }
+            if (op.type == kOpInsert) {
+                IntegrateInsert(op, edits);
+            } else {
+                IntegrateDelete(op, edits);
+            }
+            progress = true;
+        }
+        fPending.swap(waiting);
+    }
+    return B_OK;
+}
+
+bool SharedDocument::IsKnown(const crdt_id& id) {
+    if (id.client == 0) {
+        return true;
+    }
+    auto clock = fClocks.find(id.client);
+    return clock != fClocks.end() && id.clock < clock->second;
+}
+
+bool SharedDocument::CanIntegrate(const shared_op& op) {
+    if (op.type == kOpDelete) {
+        return op.length == 0 || IsKnown({op.id.client, op.id.clock + op.length - 1});
+    }
+    auto clock = fClocks.find(op.id.client);
+    uint32 next = (clock != fClocks.end() ? clock->second : 0);
+    return op.id.clock <= next && IsKnown(op.originLeft) && IsKnown(op.originRight);
+}
+
+void SharedDocument::IntegrateInsert(shared_op& op, vector<shared_edit>* edits) {
+    // chars known already, sent again after joining for example, are skipped
+    uint32& next = fClocks[op.id.client];
+    if (op.id.clock + op.length <= next) {
+        return;
+    }
+    if (op.id.clock < next) {
+        uint32 known = next - op.id.clock;
+        op.originLeft = {op.id.client, next - 1};
+        op.id.clock = next;
+        op.length -= known;
+        op.text.Remove(0, known);
+    }
+
+    int32 left = -1;
+    if (op.originLeft.client != 0) {
+        // the run holding the left origin has to end right at it
+        SplitAt({op.originLeft.client, op.originLeft.clock + 1});
+        left = FindItem(op.originLeft);
+    }
+    int32 right = (op.originRight.client != 0 ? SplitAt(op.originRight) : -1);
+
+    // runs between the origins were inserted concurrently, the origins and client ids decide the order
+    set<int32> beforeOrigin, conflicting;
+    for (int32 other = (left < 0 ? First() : Next(left)); other >= 0 && other != right; other = Next(other)) {
+        beforeOrigin.insert(other);
+        conflicting.insert(other);
+        const crdt_item& item = fItems[other];
+        if (item.originLeft == op.originLeft) {
+            if (item.id.client < op.id.client) {
+                left = other;
+                conflicting.clear();
+            } else if (item.originRight == op.originRight) {
+                break;
+            }
+        } else if (item.originLeft.client != 0 && beforeOrigin.count(FindItem(item.originLeft)) > 0) {
+            if (conflicting.count(FindItem(item.originLeft)) == 0) {
+                left = other;
+                conflicting.clear();
+            }
+        } else {
+            break;
+        }
+    }
+
+    int64 content = fContent.size();
+    fContent.insert(fContent.end(), op.text.String(), op.text.String() + op.length);
+    next = op.id.clock + op.length;
+    if (op.id.client == fClient) {
+        fClock = next;
+    }
+
+    int32 index;
+    int64 offset;
+    if (left >= 0 && fItems[left].id.client == op.id.client && !fItems[left].deleted
+        && fItems[left].id.clock + fItems[left].length == op.id.clock
+        && op.originLeft == LastId(left) && fItems[left].originRight == op.originRight
+        && fItems[left].content + fItems[left].length == content) {
+        // typing on continues the run
+        index = left;
+        offset = OffsetOf(index) + fItems[index].length;
+        fItems[index].length += op.length;
+        UpdatePath(index);
+    } else {
+        index = AddItem(op.id, op.length, op.originLeft, op.originRight, content, false);
+        InsertAfter(left, index);
+        offset = OffsetOf(index);
+    }
+    if (edits != NULL) {
+        AddEdit(edits, offset, 0, op.text.String(), op.length);
+    }
+}
+
+void SharedDocument::IntegrateDelete(const shared_op& op, vector<shared_edit>* edits) {
+    uint32 clock = op.id.clock;
+    uint32 end = op.id.clock + op.length;
+    while (clock < end) {
+        int32 index = SplitAt({op.id.client, clock});
+        if (index < 0) {
+            return;
+        }
+        if (fItems[index].length > end - clock) {
+            Split(index, end - clock);
+        }
+        crdt_item& item = fItems[index];
+        clock += item.length;
+        if (item.deleted) {
+            continue;
+        }
+        item.deleted = true;
+        UpdatePath(index);
+        if (edits != NULL) {
+            AddEdit(edits, OffsetOf(index), item.length, NULL, 0);
+        }
+    }
+}
+
+void SharedDocument::AddEdit(vector<shared_edit>* edits, int32 offset, int32 removed, const char* text,
+                             int32 length) {
+    if (!edits->empty()) {
+        shared_edit& last = edits->back();
+        if (removed == 0 && last.removed == 0 && offset == last.offset + last.text.Length()) {
+            last.text.Append(text, length);
+            return;
+        }
+        if (length == 0 && last.text.IsEmpty()) {
+            if (offset == last.offset) {
+                last.removed += removed;
+                return;
+            }
+            if (offset + removed == last.offset) {
+                last.offset = offset;
+                last.removed += removed;
+                return;
+            }
+        }
+    }
+    shared_edit edit;
+    edit.offset = offset;
+    edit.removed = removed;
+    edit.text.SetTo(text, length);
+    edits->push_back(edit);
+}
+
+void SharedDocument::EncodeOp(const shared_op& op, vector<uint8>* data) {
+    data->push_back(op.type);
+    WriteId(data, op.id);
+    WriteVarint(data, op.length);
+    if (op.type == kOpInsert) {
+        WriteId(data, op.originLeft);
+        WriteId(data, op.originRight);
+        data->insert(data->end(), op.text.String(), op.text.String() + op.length);
+    }
+}
+
+bool SharedDocument::DecodeOp(const uint8** data, const uint8* end, shared_op* op) {
+    op->type = *(*data)++;
+    uint64 length;
+    if ((op->type != kOpInsert && op->type != kOpDelete) || !ReadId(data, end, &op->id) || op->id.client == 0
+        || !ReadVarint(data, end, &length) || length > UINT32_MAX - op->id.clock) {
+        return false;
+    }
+    op->length = length;
+    op->originLeft = kNoId;
+    op->originRight = kNoId;
+    if (op->type == kOpInsert) {
+        if (!ReadId(data, end, &op->originLeft) || !ReadId(data, end, &op->originRight)
+            || (uint64) (end - *data) < length) {
+            return false;
+        }
+        op->text.SetTo(reinterpret_cast<const char*>(*data), length);
+        *data += length;
+    }
+    return true;
+}
+
+int32 SharedDocument::FindItem(const crdt_id& id) {
+    auto client = fRuns.find(id.client);
+    if (client == fRuns.end()) {
+        return -1;
+    }
+    auto run = client->second.upper_bound(id.clock);
+    if (run == client->second.begin()) {
+        return -1;
+    }
+    run--;
+    const crdt_item& item = fItems[run->second];
+    return (id.clock < item.id.clock + item.length ? run->second : -1);
+}
+
+int32 SharedDocument::SplitAt(const crdt_id& id) {
+    // returns the run starting at id
+    int32 index = FindItem(id);
+    if (index < 0 || fItems[index].id.clock == id.clock) {
+        return index;
+    }
+    return Split(index, id.clock - fItems[index].id.clock);
+}
+
+int32 SharedDocument::Split(int32 index, uint32 length) {
+    // the run keeps its first length chars, the rest becomes a run right after it
+    crdt_item& item = fItems[index];
+    crdt_id id = {item.id.client, item.id.clock + length};
+    crdt_id originLeft = {item.id.client, id.clock - 1};
+    uint32 rest = item.length - length;
+    item.length = length;
+    UpdatePath(index);
+
+    const crdt_item& first = fItems[index];
+    int32 second = AddItem(id, rest, originLeft, first.originRight, first.content + length, first.deleted);
+    InsertAfter(index, second);
+    return second;
+}
+
+int32 SharedDocument::AddItem(const crdt_id& id, uint32 length, const crdt_id& originLeft,
+                              const crdt_id& originRight, int64 content, bool deleted) {
+    // xorshift, the treap only needs the priorities to be spread
+    fSeed ^= fSeed << 13;
+    fSeed ^= fSeed >> 17;
+    fSeed ^= fSeed << 5;
+
+    crdt_item item = {id, length, originLeft, originRight, content, deleted, -1, -1, -1, fSeed, 0};
+    fItems.push_back(item);
+    int32 index = fItems.size() - 1;
+    fRuns[id.client][id.clock] = index;
+    Update(index);
+    return index;
+}
+
+crdt_id SharedDocument::LastId(int32 index) {
+    return {fItems[index].id.client, fItems[index].id.clock + fItems[index].length - 1};
+}
+
+int64 SharedDocument::Visible(int32 index) {
+    return (index < 0 ? 0 : fItems[index].visible);
+}
+
+int64 SharedDocument::OwnVisible(int32 index) {
+    return (fItems[index].deleted ? 0 : fItems[index].length);
+}
+
+void SharedDocument::Update(int32 index) {
+    crdt_item& item = fItems[index];
+    item.visible = OwnVisible(index) + Visible(item.left) + Visible(item.right);
+}
+
+void SharedDocument::UpdatePath(int32 index) {
+    for (; index >= 0; index = fItems[index].parent) {
+        Update(index);
+    }
+}
+
+void SharedDocument::Rotate(int32 index) {
+    // index takes the place of its parent, which becomes its child
+    int32 parent = fItems[index].parent;
+    int32 grandParent = fItems[parent].parent;
+    if (fItems[parent].left == index) {
+        fItems[parent].left = fItems[index].right;
+        if (fItems[index].right >= 0) {
+            fItems[fItems[index].right].parent = parent;
+        }
+        fItems[index].right = parent;
+    } else {
+        fItems[parent].right = fItems[index].left;
+        if (fItems[index].left >= 0) {
+            fItems[fItems[index].left].parent = parent;
+        }
+        fItems[index].left = parent;
+    }
+    fItems[parent].parent = index;
+    fItems[index].parent = grandParent;
+    if (grandParent < 0) {
+        fRoot = index;
+    } else if (fItems[grandParent].left == parent) {
+        fItems[grandParent].left = index;
+    } else {
+        fItems[grandParent].right = index;
+    }
+    Update(parent);
+    Update(index);
+}
+
+void SharedDocument::InsertAfter(int32 after, int32 index) {
+    // the new run becomes the leftmost node right of after, then rises by its priority
+    if (fRoot < 0) {
+        fRoot = index;
+        return;
+    }
+    int32 parent;
+    bool asLeft;
+    if (after < 0) {
+        parent = fRoot;
+        asLeft = true;
+    } else if (fItems[after].right < 0) {
+        parent = after;
+        asLeft = false;
+    } else {
+        parent = fItems[after].right;
+        asLeft = true;
+    }
+    if (asLeft) {
+        while (fItems[parent].left >= 0) {
+            parent = fItems[parent].left;
+        }
+        fItems[parent].left = index;
+    } else {
+        fItems[parent].right = index;
+    }
+    fItems[index].parent = parent;
+
+    while (fItems[index].parent >= 0 && fItems[fItems[index].parent].priority < fItems[index].priority) {
+        Rotate(index);
+    }
+    UpdatePath(fItems[index].parent);
+}
+
+int32 SharedDocument::First() {
+    int32 index = fRoot;
+    while (index >= 0 && fItems[index].left >= 0) {
+        index = fItems[index].left;
+    }
+    return index;
+}
+
+int32 SharedDocument::Next(int32 index) {
+    if (fItems[index].right >= 0) {
+        index = fItems[index].right;
+        while (fItems[index].left >= 0) {
+            index = fItems[index].left;
+        }
+        return index;
+    }
+    int32 parent = fItems[index].parent;
+    while (parent >= 0 && fItems[parent].right == index) {
+        index = parent;
+        parent = fItems[index].parent;
+    }
+    return parent;
+}
+
+int32 SharedDocument::FindOffset(int64 offset, int64* inner) {
+    // the run holding the visible char at offset
+    int32 index = fRoot;
+    while (index >= 0) {
+        int64 leftVisible = Visible(fItems[index].left);
+        if (offset < leftVisible) {
+            index = fItems[index].left;
+            continue;
+        }
+        offset -= leftVisible;
+        if (offset < OwnVisible(index)) {
+            *inner = offset;
+            return index;
+        }
+        offset -= OwnVisible(index);
+        index = fItems[index].right;
+    }
+    return -1;
+}
+
+int64 SharedDocument::OffsetOf(int32 index) {
+    int64 offset = Visible(fItems[index].left);
+    for (int32 parent = fItems[index].parent; parent >= 0; index = parent, parent = fItems[parent].parent) {
+        if (fItems[parent].right == index) {
+            offset += Visible(fItems[parent].left) + OwnVisible(parent);
+        }
+    }
+    return offset;
+}
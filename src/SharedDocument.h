@@ -0,0 +1,145 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * text of a note shared by several editors as a sequence CRDT. every inserted char has a unique id of the
+ * inserting client and its clock, and the ids of the chars left and right of it at the time of insertion.
+ * concurrent inserts at the same place are ordered by these origins, so all clients end up with the same
+ * text whatever order they get the operations in, see Nicolaescu et al., "Near Real-Time Peer-to-Peer
+ * Shared Editing on Extensible Data Types" (YATA), 2016.
+ * chars inserted in one go are kept as one run, deleted ones stay as marked runs to keep their ids.
+ * the runs are kept in a treap by document order, weighted by their visible length.
+ */
+#pragma once
+
+#include <map>
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+typedef struct crdt_id {
+    uint32          client;         // 0 for no char
+    uint32          clock;
+
+    bool            operator==(const crdt_id& other) const
+                        { return client == other.client && clock == other.clock; }
+} crdt_id;
+
+/**
+ * a change of the visible text, made by integrating remote operations.
+ */
+typedef struct shared_edit {
+    int32           offset;
+    int32           removed;
+    BString         text;
+} shared_edit;
+
+class SharedDocument {
+
+public:
+                        SharedDocument(uint32 client);
+    virtual             ~SharedDocument();
+
+    /**
+     * starts over with text inserted by this client as a whole, w/o any operation to send.
+     */
+    void                SetText(const char* text, int32 length);
+    /**
+     * starts over with an empty text, to take over the text of a session.
+     */
+    void                Clear();
+    void                GetText(BString* text);
+
+    // local edits, recorded as operations to send
+    void                LocalInsert(int32 offset, const char* text, int32 length);
+    void                LocalDelete(int32 offset, int32 length);
+    /**
+     * encodes the operations recorded since the last call, consecutive inserts and deletes coalesced.
+     * returns false if there are none.
+     */
+    bool                TakeLocalOps(vector<uint8>* ops);
+    /**
+     * encodes the whole document as operations, for other clients to start from.
+     */
+    void                EncodeState(vector<uint8>* ops);
+
+    /**
+     * integrates a batch of remote operations and returns the resulting changes of the visible text
+     * in the order they apply, adjacent changes coalesced. operations depending on unknown ones are kept
+     * until those arrive.
+     */
+    status_t            Integrate(const uint8* ops, size_t size, vector<shared_edit>* edits);
+
+    uint32              Client()        { return fClient; }
+    int32               CountRuns()     { return fItems.size(); }
+    int32               CountPending()  { return fPending.size(); }
+    int64               Length();
+
+private:
+    typedef struct crdt_item {
+        crdt_id         id;         // of the first char of the run
+        uint32          length;
+        crdt_id         originLeft;
+        crdt_id         originRight;
+        int64           content;    // offset of the chars in fContent
+        bool            deleted;
+        // treap by document order
+        int32           parent;
+        int32           left;
+        int32           right;
+        uint32          priority;
+        int64           visible;    // visible chars in this subtree
+    } crdt_item;
+
+    typedef struct shared_op {
+        uint8           type;
+        crdt_id         id;
+        uint32          length;
+        crdt_id         originLeft;     // inserts only
+        crdt_id         originRight;
+        BString         text;
+    } shared_op;
+
+    // operations
+    bool                IsKnown(const crdt_id& id);
+    bool                CanIntegrate(const shared_op& op);
+    void                IntegrateInsert(shared_op& op, vector<shared_edit>* edits);
+    void                IntegrateDelete(const shared_op& op, vector<shared_edit>* edits);
+    static void         EncodeOp(const shared_op& op, vector<uint8>* data);
+    static bool         DecodeOp(const uint8** data, const uint8* end, shared_op* op);
+    static void         AddEdit(vector<shared_edit>* edits, int32 offset, int32 removed, const char* text,
+                                int32 length);
+
+    // runs
+    int32               FindItem(const crdt_id& id);
+    int32               SplitAt(const crdt_id& id);
+    int32               Split(int32 index, uint32 length);
+    int32               AddItem(const crdt_id& id, uint32 length, const crdt_id& originLeft,
+                                const crdt_id& originRight, int64 content, bool deleted);
+    crdt_id             LastId(int32 index);
+
+    // treap
+    int64               Visible(int32 index);
+    int64               OwnVisible(int32 index);
+    void                Update(int32 index);
+    void                UpdatePath(int32 index);
+    void                Rotate(int32 index);
+    void                InsertAfter(int32 after, int32 index);
+    int32               First();
+    int32               Next(int32 index);
+    int32               FindOffset(int64 offset, int64* inner);
+    int64               OffsetOf(int32 index);
+
+    uint32              fClient;
+    uint32              fClock;
+    uint32              fSeed;
+    vector<crdt_item>   fItems;
+    int32               fRoot;
+    vector<char>        fContent;       // chars of all runs ever inserted, in insertion order
+    map<uint32, map<uint32, int32>> fRuns;   // runs per client by the clock of their first char
+    map<uint32, uint32> fClocks;        // next unknown clock per client
+    vector<shared_op>   fLocalOps;
+    vector<shared_op>   fPending;       // remote operations waiting for the ones they depend on
+};
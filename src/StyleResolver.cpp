@@ -0,0 +1,119 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "StyleResolver.h"
+
+#include <InterfaceDefs.h>
+#include <stdio.h>
+
+StyleResolver::StyleResolver(Theme* theme, const BFont* plainFont, const BFont* fixedFont)
+    : fTheme(theme),
+      fPlainFont(plainFont),
+      fFixedFont(fixedFont) {
+}
+
+StyleResolver::~StyleResolver() {
+    delete fTheme;
+}
+
+void StyleResolver::SetTheme(Theme* theme) {
+    if (theme == fTheme) {
+        return;
+    }
+    delete fTheme;
+    fTheme = theme;
+
+    // style IDs stay stable, only their fonts and colors change
+    for (uint32 styleId = 0; styleId < fKeys.size(); styleId++) {
+        Compute(fKeys[styleId], &fStyles[styleId]);
+    }
+    printf("StyleResolver: switched to theme %s, re-resolved %zu styles.\n", fTheme->Name(), fStyles.size());
+}
+
+uint16 StyleResolver::Resolve(const vector<uint8>& blockPath, uint16 spans, MD_TEXTTYPE textType) {
+    style_key key;
+    key.blockPath = blockPath;
+    key.spans = spans;
+    key.textType = textType;
+
+    auto cached = fStyleIds.find(key);
+    if (cached != fStyleIds.end()) {
+        return cached->second;
+    }
+
+    uint16 styleId = fStyles.size();
+    resolved_style style;
+    Compute(key, &style);
+
+    fStyles.push_back(style);
+    fKeys.push_back(key);
+    fStyleIds.insert({key, styleId});
+
+    return styleId;
+}
+
+void StyleResolver::Compute(const style_key& key, resolved_style* style) {
+    style->font = fPlainFont;
+    style->color = ui_color(B_DOCUMENT_TEXT_COLOR);
+
+    // inherit from outer to inner block, then spans, then the text type
+    ApplyRule(fTheme->BaseRule(), style);
+
+    for (auto block : key.blockPath) {
+        if (block > MD_BLOCK_TD) {
+            ApplyRule(fTheme->BlockRule(MD_BLOCK_H), style);
+            ApplyRule(fTheme->HeadingRule(block - MD_BLOCK_TD), style);
+        } else {
+            ApplyRule(fTheme->BlockRule(static_cast<MD_BLOCKTYPE>(block)), style);
+        }
+    }
+    for (int32 span = MD_SPAN_EM; span <= MD_SPAN_U; span++) {
+        if ((key.spans & (1 << span)) != 0) {
+            ApplyRule(fTheme->SpanRule(static_cast<MD_SPANTYPE>(span)), style);
+        }
+    }
+    ApplyRule(fTheme->TextRule(static_cast<MD_TEXTTYPE>(key.textType)), style);
+}
+
+void StyleResolver::ApplyRule(const style_rule* rule, resolved_style* style) {
+    if (rule == NULL) {
+        return;
+    }
+    BFont* font = &style->font;
+
+    if (rule->hasFont) {
+        switch (rule->font) {
+            case STYLE_FONT_FIXED:
+                *font = fFixedFont;
+                break;
+            case STYLE_FONT_BOLD:
+                *font = fPlainFont;
+                font->SetFace(B_BOLD_FACE);
+                break;
+            default:
+                *font = fPlainFont;
+                break;
+        }
+    }
+    if (rule->hasFace) {
+        font->SetFace(rule->face);
+    }
+    if (rule->addFace != 0) {
+        uint16 face = font->Face();
+        if (face == B_REGULAR_FACE) {
+            face = 0;
+        }
+        font->SetFace(face | rule->addFace);
+    }
+    if (rule->size > 0) {
+        font->SetSize(fPlainFont.Size() * rule->size);
+    }
+    if (rule->hasSpacing) {
+        font->SetSpacing(rule->spacing);
+    }
+    if (rule->hasColor) {
+        style->color = rule->color;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * resolves the effective font and color for a markup context against a theme.
+ * results are memoized per (block path, span set, text type) and referenced by a small style ID,
+ * so switching the theme only needs to re-resolve the known style IDs.
+ */
+#pragma once
+
+#include <Font.h>
+#include <GraphicsDefs.h>
+#include <map>
+#include <SupportDefs.h>
+#include <vector>
+
+#include "Theme.h"
+
+using namespace std;
+
+/**
+ * block path entries are block types, headings are encoded with their level.
+ */
+#define STYLE_PATH_HEADING(level)   (MD_BLOCK_TD + (level))
+
+typedef struct style_key {
+    vector<uint8>   blockPath;
+    uint16          spans;          // bit set of active MD_SPANTYPEs
+    uint8           textType;
+
+    bool operator<(const style_key& other) const {
+        if (spans != other.spans)
+            return spans < other.spans;
+        if (textType != other.textType)
+            return textType < other.textType;
+        return blockPath < other.blockPath;
+    }
+} style_key;
+
+typedef struct resolved_style {
+    BFont           font;
+    rgb_color       color;
+} resolved_style;
+
+class StyleResolver {
+
+public:
+                            StyleResolver(Theme* theme, const BFont* plainFont, const BFont* fixedFont);
+    virtual                 ~StyleResolver();
+
+    /**
+     * switches to a new theme (taking ownership) and re-resolves all known style IDs.
+     */
+    void                    SetTheme(Theme* theme);
+    Theme*                  GetTheme()      { return fTheme; }
+
+    uint16                  Resolve(const vector<uint8>& blockPath, uint16 spans, MD_TEXTTYPE textType);
+    const resolved_style*   StyleAt(uint16 styleId)     { return &fStyles[styleId]; }
+    int32                   CountStyles()               { return fStyles.size(); }
+
+private:
+    void                    Compute(const style_key& key, resolved_style* style);
+    void                    ApplyRule(const style_rule* rule, resolved_style* style);
+
+    Theme*                  fTheme;
+    BFont                   fPlainFont;
+    BFont                   fFixedFont;
+
+    map<style_key, uint16>  fStyleIds;
+    vector<style_key>       fKeys;          // inputs for each style ID, used for re-resolving
+    vector<resolved_style>  fStyles;
+};
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * frames exchanged between the vault sync client and the sync server in tools/sync, laid out as in
+ * FrameSocket. per changed note the client sends its chunk list, the server answers with the chunks
+ * it does not have yet, and the client sends only those.
+ * chunks are identified by the FNV-1a hash of their content and their length, numbers are big endian.
+ */
+#pragma once
+
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+enum SYNC_FRAME {
+    SYNC_FRAME_NOTE = 1,    // client to server: uint32 path length, vault relative path, uint32 chunk count,
+                            // then per chunk uint64 hash and uint32 length
+    SYNC_FRAME_MISSING,     // server to client: uint32 count, then the uint32 indices of the missing chunks
+    SYNC_FRAME_CHUNKS,      // client to server: the content of the missing chunks in index order
+    SYNC_FRAME_STORED       // server to client: the note was put together from its chunks
+};
+
+static const uint16 kSyncPort = 7132;
+static const uint32 kMaxSyncFrameSize = 256 * 1024 * 1024;
+
+static inline void AppendUInt32(vector<uint8>* data, uint32 value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        data->push_back((uint8) (value >> shift));
+    }
+}
+
+static inline void AppendUInt64(vector<uint8>* data, uint64 value) {
+    AppendUInt32(data, (uint32) (value >> 32));
+    AppendUInt32(data, (uint32) value);
+}
+
+static inline bool ReadUInt32(const uint8** data, const uint8* end, uint32* value) {
+    if (end - *data < 4) {
+        return false;
+    }
+    *value = 0;
+    for (int index = 0; index < 4; index++) {
+        *value = (*value << 8) | *(*data)++;
+    }
+    return true;
+}
+
+static inline bool ReadUInt64(const uint8** data, const uint8* end, uint64* value) {
+    uint32 high, low;
+    if (!ReadUInt32(data, end, &high) || !ReadUInt32(data, end, &low)) {
+        return false;
+    }
+    *value = ((uint64) high << 32) | low;
+    return true;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "TaskMessenger.h"
+
+#include <stdio.h>
+
+TaskMessenger::TaskMessenger(BMessenger target, TaskScheduler* scheduler)
+    : fTarget(target),
+      fScheduler(scheduler) {
+}
+
+TaskHandle TaskMessenger::Submit(TASK_PRIORITY priority, message_task_function work, CancelToken token) {
+    BMessenger target(fTarget);
+
+    return fScheduler->Submit(priority, [target, work](const CancelToken& token) {
+        BMessage* result = work(token);
+        if (result == NULL) {
+            return;
+        }
+        // results of canceled work are stale, don't bother the looper with them
+        if (!token.IsCanceled()) {
+            status_t status = target.SendMessage(result);
+            if (status != B_OK) {
+                printf("TaskMessenger: could not deliver result: %s\n", strerror(status));
+            }
+        }
+        delete result;
+    }, token);
+}
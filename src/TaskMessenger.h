@@ -0,0 +1,35 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * connects the task scheduler to the Haiku messaging world:
+ * runs work in the background and posts its result message to a looper.
+ */
+#pragma once
+
+#include <functional>
+#include <Message.h>
+#include <Messenger.h>
+
+#include "TaskScheduler.h"
+
+using namespace std;
+
+typedef function<BMessage*(const CancelToken& token)> message_task_function;
+
+class TaskMessenger {
+
+public:
+                        TaskMessenger(BMessenger target, TaskScheduler* scheduler = TaskScheduler::Default());
+
+    /**
+     * runs work on the scheduler and sends the returned message to the target,
+     * unless the task was canceled in the meantime or returned NULL.
+     */
+    TaskHandle          Submit(TASK_PRIORITY priority, message_task_function work,
+                               CancelToken token = CancelToken());
+
+private:
+    BMessenger          fTarget;
+    TaskScheduler*      fScheduler;
+};
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdio.h>
+#include <time.h>
+
+static const char* kPriorityNames[] = {"viewport", "document", "other documents", "maintenance"};
+
+// lets tasks submitted from a worker go to that worker's own queue
+static thread_local TaskScheduler* sCurrentScheduler = NULL;
+static thread_local int32_t sCurrentWorker = -1;
+
+bool TaskHandle::IsDone() const {
+    if (fState == NULL) {
+        return true;
+    }
+    lock_guard<mutex> lock(fState->lock);
+    return fState->done;
+}
+
+void TaskHandle::Cancel() const {
+    if (fState != NULL) {
+        fState->token.Cancel();
+    }
+}
+
+void TaskHandle::Wait() const {
+    if (fState == NULL) {
+        return;
+    }
+    TaskScheduler* scheduler;
+    {
+        lock_guard<mutex> lock(fState->lock);
+        if (fState->done) {
+            return;
+        }
+        scheduler = fState->scheduler;
+    }
+    if (scheduler != NULL && scheduler->RunQueued(fState)) {
+        return;
+    }
+    unique_lock<mutex> lock(fState->lock);
+    fState->finished.wait(lock, [this]() { return fState->done; });
+}
+
+TaskScheduler::TaskScheduler(int32_t threadCount)
+    : fQueued(0),
+      fPending(0),
+      fNextQueue(0),
+      fQuitting(false) {
+    if (threadCount <= 0) {
+        threadCount = max((int32_t)thread::hardware_concurrency(), (int32_t)1);
+    }
+    for (auto& counters : fCounters) {
+        counters.cpuTime = 0;
+        counters.executed = 0;
+        counters.canceled = 0;
+        counters.stolen = 0;
+    }
+    for (int32_t index = 0; index < threadCount; index++) {
+        fQueues.push_back(unique_ptr<worker_queue>(new worker_queue));
+    }
+    // start workers only after all queues exist, they steal from each other right away
+    for (int32_t index = 0; index < threadCount; index++) {
+        fThreads.emplace_back(&TaskScheduler::WorkerLoop, this, index);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        lock_guard<mutex> lock(fSleepLock);
+        fQuitting = true;
+    }
+    fWakeUp.notify_all();
+    for (auto& worker : fThreads) {
+        worker.join();
+    }
+
+    // release anyone waiting on tasks that will never run
+    for (auto& queue : fQueues) {
+        for (auto& tasks : queue->tasks) {
+            for (auto& task : tasks) {
+                lock_guard<mutex> lock(task.state->lock);
+                task.state->done = true;
+                task.state->scheduler = NULL;
+                task.state->finished.notify_all();
+            }
+        }
+    }
+}
+
+TaskScheduler* TaskScheduler::Default() {
+    static TaskScheduler scheduler;
+    return &scheduler;
+}
+
+const char* TaskScheduler::GetPriorityName(TASK_PRIORITY priority) {
+    return kPriorityNames[priority];
+}
+
+TaskHandle TaskScheduler::Submit(TASK_PRIORITY priority, task_function work, CancelToken token) {
+    shared_ptr<task_state> state = make_shared<task_state>();
+    state->token = token;
+
+    int32_t queue;
+    if (sCurrentScheduler == this) {
+        queue = sCurrentWorker;     // keep follow-up work local, others will steal it if they are idle
+    } else {
+        queue = fNextQueue.fetch_add(1, memory_order_relaxed) % fQueues.size();
+    }
+    state->scheduler = this;
+    state->queue = queue;
+    state->priority = priority;
+
+    fPending++;
+    fQueued++;
+    {
+        lock_guard<mutex> lock(fQueues[queue]->lock);
+        fQueues[queue]->tasks[priority].push_back({work, state, queue});
+    }
+
+    {
+        // pairs with the predicate check of sleeping workers, so the wakeup can't get lost
+        lock_guard<mutex> lock(fSleepLock);
+    }
+    fWakeUp.notify_one();
+
+    return TaskHandle(state);
+}
+
+void TaskScheduler::WaitIdle() {
+    unique_lock<mutex> lock(fSleepLock);
+    fIdle.wait(lock, [this]() { return fPending.load() == 0; });
+}
+
+void TaskScheduler::GetStats(TASK_PRIORITY priority, task_class_stats* stats) {
+    class_counters& counters = fCounters[priority];
+    stats->cpuTime  = counters.cpuTime.load(memory_order_relaxed);
+    stats->executed = counters.executed.load(memory_order_relaxed);
+    stats->canceled = counters.canceled.load(memory_order_relaxed);
+    stats->stolen   = counters.stolen.load(memory_order_relaxed);
+}
+
+void TaskScheduler::WorkerLoop(int32_t index) {
+    sCurrentScheduler = this;
+    sCurrentWorker = index;
+
+    while (true) {
+        scheduled_task task;
+        TASK_PRIORITY priority;
+
+        if (TakeTask(index, &task, &priority)) {
+            fQueued--;
+            RunTask(index, task, priority);
+            continue;
+        }
+
+        unique_lock<mutex> lock(fSleepLock);
+        fWakeUp.wait(lock, [this]() { return fQuitting || fQueued.load() > 0; });
+        if (fQuitting) {
+            break;
+        }
+    }
+}
+
+bool TaskScheduler::TakeTask(int32_t index, scheduled_task* task, TASK_PRIORITY* priority) {
+    int32_t queueCount = fQueues.size();
+
+    // priority beats locality: only fall back to a lower class when no worker has higher priority work
+    for (int32_t taskClass = 0; taskClass < TASK_PRIORITY_COUNT; taskClass++) {
+        for (int32_t offset = 0; offset < queueCount; offset++) {
+            worker_queue* queue = fQueues[(index + offset) % queueCount].get();
+            lock_guard<mutex> lock(queue->lock);
+
+            deque<scheduled_task>& tasks = queue->tasks[taskClass];
+            if (tasks.empty()) {
+                continue;
+            }
+            if (offset == 0) {
+                *task = move(tasks.back());     // own queue, newest first for cache locality
+                tasks.pop_back();
+            } else {
+                *task = move(tasks.front());    // steal the oldest, usually the biggest chunk of work
+                tasks.pop_front();
+            }
+            *priority = static_cast<TASK_PRIORITY>(taskClass);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskScheduler::RunQueued(const shared_ptr<task_state>& state) {
+    scheduled_task task;
+    {
+        worker_queue* queue = fQueues[state->queue].get();
+        lock_guard<mutex> lock(queue->lock);
+
+        deque<scheduled_task>& tasks = queue->tasks[state->priority];
+        auto queued = find_if(tasks.begin(), tasks.end(),
+            [&state](const scheduled_task& task) { return task.state == state; });
+        if (queued == tasks.end()) {
+            return false;
+        }
+        task = move(*queued);
+        tasks.erase(queued);
+    }
+    fQueued--;
+    // not counted as stolen, the waiting thread stands in for the worker it was queued on
+    RunTask(task.queue, task, state->priority);
+    return true;
+}
+
+void TaskScheduler::RunTask(int32_t index, scheduled_task& task, TASK_PRIORITY priority) {
+    class_counters& counters = fCounters[priority];
+
+    if (task.state->token.IsCanceled()) {
+        counters.canceled.fetch_add(1, memory_order_relaxed);
+    } else {
+        uint64_t startTime = ThreadCPUTime();
+        try {
+            task.work(task.state->token);
+        } catch (const exception& error) {
+            printf("TaskScheduler: %s task failed: %s\n", GetPriorityName(priority), error.what());
+        } catch (...) {
+            printf("TaskScheduler: %s task failed with an unknown error.\n", GetPriorityName(priority));
+        }
+        counters.cpuTime.fetch_add(ThreadCPUTime() - startTime, memory_order_relaxed);
+        counters.executed.fetch_add(1, memory_order_relaxed);
+        if (task.queue != index) {
+            counters.stolen.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    // drop captured state before signalling, waiters may destroy what the task refers to
+    task.work = nullptr;
+    {
+        lock_guard<mutex> lock(task.state->lock);
+        task.state->done = true;
+    }
+    task.state->finished.notify_all();
+
+    if (--fPending == 0) {
+        lock_guard<mutex> lock(fSleepLock);
+        fIdle.notify_all();
+    }
+}
+
+uint64_t TaskScheduler::ThreadCPUTime() {
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+        return 0;
+    }
+    return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * one shared work stealing thread pool for all background jobs of the editor.
+ * each worker keeps a deque per priority class, takes its own newest task first and steals the oldest
+ * task from others when idle. higher priority classes are always drained before lower ones.
+ * only uses the C++ standard library so it can be built and tested on any platform,
+ * see TaskMessenger for posting results back to a looper.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+enum TASK_PRIORITY {
+    TASK_PRIORITY_VIEWPORT = 0,     // visible part of the current document
+    TASK_PRIORITY_DOCUMENT,         // rest of the current document
+    TASK_PRIORITY_OTHER_DOCUMENTS,  // open documents in the background
+    TASK_PRIORITY_MAINTENANCE,      // vault scans, indexing, export
+    TASK_PRIORITY_COUNT
+};
+
+/**
+ * shared cancellation flag, cheap to copy and pass to any number of tasks.
+ * canceled tasks are skipped if not yet started, running tasks should poll IsCanceled().
+ */
+class CancelToken {
+
+public:
+                        CancelToken() : fCanceled(make_shared<atomic<bool>>(false)) {}
+
+    void                Cancel() const      { fCanceled->store(true, memory_order_relaxed); }
+    bool                IsCanceled() const  { return fCanceled->load(memory_order_relaxed); }
+
+private:
+    shared_ptr<atomic<bool>> fCanceled;
+};
+
+typedef function<void(const CancelToken& token)> task_function;
+
+class TaskScheduler;
+
+typedef struct task_state {
+    mutex               lock;
+    condition_variable  finished;
+    bool                done = false;
+    CancelToken         token;
+    TaskScheduler*      scheduler = NULL;
+    int32_t             queue = -1;         // worker queue the task was submitted to
+    TASK_PRIORITY       priority = TASK_PRIORITY_MAINTENANCE;
+} task_state;
+
+/**
+ * refers to a single submitted task.
+ */
+class TaskHandle {
+
+public:
+                        TaskHandle() {}
+
+    bool                IsValid() const     { return fState != NULL; }
+    bool                IsDone() const;
+    void                Cancel() const;
+    /**
+     * blocks until the task has run or was skipped, must not be called from within a task.
+     * a task no worker has started yet is taken back and run on the calling thread, so waiting
+     * doesn't depend on workers busy with long tasks of lower priority.
+     */
+    void                Wait() const;
+
+private:
+    friend class TaskScheduler;
+                        TaskHandle(shared_ptr<task_state> state) : fState(state) {}
+
+    shared_ptr<task_state> fState;
+};
+
+typedef struct task_class_stats {
+    uint64_t            cpuTime = 0;        // thread CPU time spent in tasks, in microseconds
+    uint64_t            executed = 0;
+    uint64_t            canceled = 0;       // skipped because they were canceled before running
+    uint64_t            stolen = 0;         // run by another worker than the one they were queued on
+} task_class_stats;
+
+class TaskScheduler {
+
+public:
+    /**
+     * creates a pool with threadCount workers, or one per CPU core if 0.
+     */
+                        TaskScheduler(int32_t threadCount = 0);
+    /**
+     * stops all workers after their current task, queued tasks are dropped.
+     */
+    virtual             ~TaskScheduler();
+
+    /**
+     * the application wide scheduler.
+     */
+    static TaskScheduler* Default();
+
+    TaskHandle          Submit(TASK_PRIORITY priority, task_function work,
+                               CancelToken token = CancelToken());
+    /**
+     * blocks until all submitted tasks have finished, mainly for tests and shutdown.
+     */
+    void                WaitIdle();
+
+    int32_t             CountThreads()      { return fThreads.size(); }
+    void                GetStats(TASK_PRIORITY priority, task_class_stats* stats);
+
+    static const char*  GetPriorityName(TASK_PRIORITY priority);
+
+private:
+    friend class TaskHandle;
+
+    typedef struct scheduled_task {
+        task_function           work;
+        shared_ptr<task_state>  state;
+        int32_t                 queue;      // worker queue the task was submitted to
+    } scheduled_task;
+
+    // padded so workers polling their queues don't share cache lines
+    typedef struct alignas(64) worker_queue {
+        mutex                   lock;
+        deque<scheduled_task>   tasks[TASK_PRIORITY_COUNT];
+    } worker_queue;
+
+    typedef struct alignas(64) class_counters {
+        atomic<uint64_t>        cpuTime;
+        atomic<uint64_t>        executed;
+        atomic<uint64_t>        canceled;
+        atomic<uint64_t>        stolen;
+    } class_counters;
+
+    void                WorkerLoop(int32_t index);
+    bool                TakeTask(int32_t index, scheduled_task* task, TASK_PRIORITY* priority);
+    /**
+     * removes the task of state from its queue and runs it on the calling thread, false if it was
+     * already taken by a worker.
+     */
+    bool                RunQueued(const shared_ptr<task_state>& state);
+    void                RunTask(int32_t index, scheduled_task& task, TASK_PRIORITY priority);
+    static uint64_t     ThreadCPUTime();
+
+    vector<unique_ptr<worker_queue>> fQueues;
+    vector<thread>      fThreads;
+    class_counters      fCounters[TASK_PRIORITY_COUNT];
+
+    atomic<int64_t>     fQueued;            // tasks waiting in any queue
+    atomic<int64_t>     fPending;           // tasks queued or running
+    atomic<uint32_t>    fNextQueue;         // round robin target for submissions from outside the pool
+    atomic<bool>        fQuitting;
+
+    mutex               fSleepLock;
+    condition_variable  fWakeUp;
+    condition_variable  fIdle;
+};
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "TextNormalizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+
+static const char  kUTF8BOM[]   = "\xEF\xBB\xBF";
+static const int32 kUTF8BOMSize = 3;
+
+TextNormalizer::TextNormalizer() {
+    Clear();
+}
+
+TextNormalizer::~TextNormalizer() {
+}
+
+void TextNormalizer::Clear() {
+    fHasBOM = false;
+    fLineEnding = LINE_ENDING_LF;
+    fCRLFOffsets.clear();
+    fCROffsets.clear();
+    fLFOffsets.clear();
+}
+
+/*
+ * scanning is done with memchr() and the LF-only chunks between CRs are moved with memmove(),
+ * both of which are vectorized by the C library, so plain LF files are passed through at memory speed.
+ */
+int32 TextNormalizer::Normalize(char* text, int32 size) {
+    Clear();
+
+    const char* src = text;
+    const char* end = text + size;
+
+    if (size >= kUTF8BOMSize && memcmp(text, kUTF8BOM, kUTF8BOMSize) == 0) {
+        fHasBOM = true;
+        src += kUTF8BOMSize;
+    }
+
+    char* dst = text;
+    while (src < end) {
+        const char* cr = static_cast<const char*>(memchr(src, '\r', end - src));
+        const char* chunkEnd = (cr != NULL ? cr : end);
+        size_t chunkSize = chunkEnd - src;
+
+        if (dst != src) {
+            memmove(dst, src, chunkSize);
+        }
+        dst += chunkSize;
+        src = chunkEnd;
+
+        if (cr == NULL) {
+            break;
+        }
+        int32 textOffset = dst - text;
+        if (src + 1 < end && src[1] == '\n') {
+            fCRLFOffsets.push_back(textOffset);
+            src += 2;
+        } else {
+            fCROffsets.push_back(textOffset);
+            src++;
+        }
+        *dst++ = '\n';
+    }
+    int32 newSize = dst - text;
+
+    // count all line breaks to determine the dominant line ending used for new lines on save
+    int32 lineBreaks = 0;
+    for (const char* pos = text; pos < dst; pos++) {
+        pos = static_cast<const char*>(memchr(pos, '\n', dst - pos));
+        if (pos == NULL) {
+            break;
+        }
+        lineBreaks++;
+    }
+    int32 crlfCount = fCRLFOffsets.size();
+    int32 crCount   = fCROffsets.size();
+    int32 lfCount   = lineBreaks - crlfCount - crCount;
+
+    if (crlfCount > lfCount && crlfCount >= crCount) {
+        fLineEnding = LINE_ENDING_CRLF;
+    } else if (crCount > lfCount && crCount > crlfCount) {
+        fLineEnding = LINE_ENDING_CR;
+    }
+
+    // only mixed files need to remember their original LFs, so they are not taken for new lines
+    if (fLineEnding != LINE_ENDING_LF && lfCount > 0) {
+        fLFOffsets.reserve(lfCount);
+        auto crlfIter = fCRLFOffsets.begin();
+        auto crIter   = fCROffsets.begin();
+
+        for (const char* pos = text; pos < dst; pos++) {
+            pos = static_cast<const char*>(memchr(pos, '\n', dst - pos));
+            if (pos == NULL) {
+                break;
+            }
+            int32 offset = pos - text;
+            while (crlfIter != fCRLFOffsets.end() && *crlfIter < offset) crlfIter++;
+            while (crIter != fCROffsets.end() && *crIter < offset) crIter++;
+
+            if ((crlfIter == fCRLFOffsets.end() || *crlfIter != offset)
+                && (crIter == fCROffsets.end() || *crIter != offset)) {
+                fLFOffsets.push_back(offset);
+            }
+        }
+    }
+
+    return newSize;
+}
+
+status_t TextNormalizer::Denormalize(const char* text, int32 size, BString* result) {
+    if (result == NULL) {
+        return B_BAD_VALUE;
+    }
+
+    // worst case every line break gets a CR added, so count them once to size the buffer exactly
+    int32 lineBreaks = 0;
+    for (const char* pos = text; pos < text + size; pos++) {
+        pos = static_cast<const char*>(memchr(pos, '\n', text + size - pos));
+        if (pos == NULL) {
+            break;
+        }
+        lineBreaks++;
+    }
+    int32 maxSize = size + lineBreaks + (fHasBOM ? kUTF8BOMSize : 0);
+
+    char* buffer = result->LockBuffer(maxSize);
+    if (buffer == NULL) {
+        return B_NO_MEMORY;
+    }
+    char* dst = buffer;
+
+    if (fHasBOM) {
+        memcpy(dst, kUTF8BOM, kUTF8BOMSize);
+        dst += kUTF8BOMSize;
+    }
+
+    auto crlfIter = fCRLFOffsets.begin();
+    auto crIter   = fCROffsets.begin();
+    auto lfIter   = fLFOffsets.begin();
+    const char* src = text;
+    const char* end = text + size;
+
+    while (src < end) {
+        const char* lf = static_cast<const char*>(memchr(src, '\n', end - src));
+        const char* chunkEnd = (lf != NULL ? lf : end);
+
+        memcpy(dst, src, chunkEnd - src);
+        dst += chunkEnd - src;
+        src = chunkEnd;
+
+        if (lf == NULL) {
+            break;
+        }
+        int32 offset = lf - text;
+        while (crlfIter != fCRLFOffsets.end() && *crlfIter < offset) crlfIter++;
+        while (crIter != fCROffsets.end() && *crIter < offset) crIter++;
+        while (lfIter != fLFOffsets.end() && *lfIter < offset) lfIter++;
+
+        LINE_ENDING lineEnding = fLineEnding;     // new lines get the dominant line ending
+        if (crlfIter != fCRLFOffsets.end() && *crlfIter == offset) {
+            lineEnding = LINE_ENDING_CRLF;
+        } else if (crIter != fCROffsets.end() && *crIter == offset) {
+            lineEnding = LINE_ENDING_CR;
+        } else if (lfIter != fLFOffsets.end() && *lfIter == offset) {
+            lineEnding = LINE_ENDING_LF;
+        }
+
+        switch (lineEnding) {
+            case LINE_ENDING_CRLF:
+                *dst++ = '\r';
+                *dst++ = '\n';
+                break;
+            case LINE_ENDING_CR:
+                *dst++ = '\r';
+                break;
+            default:
+                *dst++ = '\n';
+                break;
+        }
+        src++;
+    }
+    result->UnlockBuffer(dst - buffer);
+
+    return B_OK;
+}
+
+void TextNormalizer::ShiftOffsets(int32 offset, int32 delta) {
+    ShiftOffsets(&fCRLFOffsets, offset, delta);
+    ShiftOffsets(&fCROffsets, offset, delta);
+    ShiftOffsets(&fLFOffsets, offset, delta);
+}
+
+void TextNormalizer::ShiftOffsets(vector<int32>* offsets, int32 offset, int32 delta) {
+    if (offsets->empty() || delta == 0) {
+        return;
+    }
+    auto from = lower_bound(offsets->begin(), offsets->end(), offset);
+
+    if (delta < 0) {
+        // drop line breaks inside the deleted range
+        auto to = lower_bound(from, offsets->end(), offset - delta);
+        from = offsets->erase(from, to);
+    }
+    for (auto iter = from; iter != offsets->end(); iter++) {
+        *iter += delta;
+    }
+}
+
+void TextNormalizer::SwapRanges(int32 start, int32 middle, int32 end) {
+    SwapRanges(&fCRLFOffsets, start, middle, end);
+    SwapRanges(&fCROffsets, start, middle, end);
+    SwapRanges(&fLFOffsets, start, middle, end);
+}
+
+void TextNormalizer::SwapRanges(vector<int32>* offsets, int32 start, int32 middle, int32 end) {
+    auto from  = lower_bound(offsets->begin(), offsets->end(), start);
+    auto split = lower_bound(from, offsets->end(), middle);
+    auto to    = lower_bound(split, offsets->end(), end);
+
+    // both parts keep their order, the second one now comes first
+    for (auto iter = from; iter != split; iter++) {
+        *iter += end - middle;
+    }
+    for (auto iter = split; iter != to; iter++) {
+        *iter -= middle - start;
+    }
+    rotate(from, split, to);
+}
+
+int32 TextNormalizer::ToFileOffset(int32 textOffset) {
+    // every CRLF before the offset had one CR removed, one at the offset starts with its CR there
+    int32 removedCRs = lower_bound(fCRLFOffsets.begin(), fCRLFOffsets.end(), textOffset)
+                       - fCRLFOffsets.begin();
+
+    return textOffset + removedCRs + (fHasBOM ? kUTF8BOMSize : 0);
+}
+
+int32 TextNormalizer::ToTextOffset(int32 fileOffset) {
+    if (fHasBOM) {
+        fileOffset = max(fileOffset - kUTF8BOMSize, 0);
+    }
+    // the k-th removed CR was at file offset (text offset + k), which is strictly increasing,
+    // so we can binary search for the number of CRs removed before the file offset.
+    int32 low = 0;
+    int32 high = fCRLFOffsets.size();
+    while (low < high) {
+        int32 mid = low + (high - low) / 2;
+        if (fCRLFOffsets[mid] + mid < fileOffset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return fileOffset - low;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * normalizes line endings and strips the UTF-8 BOM of loaded text, so md4c and the
+ * text view only ever see LF, while keeping a compact mapping back to the original file bytes.
+ */
+#pragma once
+
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+enum LINE_ENDING {
+    LINE_ENDING_LF = 0,
+    LINE_ENDING_CRLF,
+    LINE_ENDING_CR
+};
+
+class TextNormalizer {
+
+public:
+                        TextNormalizer();
+    virtual             ~TextNormalizer();
+    void                Clear();
+
+    /**
+     * normalizes text in place to LF line endings w/o BOM and returns the new size.
+     */
+    int32               Normalize(char* text, int32 size);
+    /**
+     * restores the original BOM and line endings for saving, new lines get the dominant line ending.
+     */
+    status_t            Denormalize(const char* text, int32 size, BString* result);
+
+    /**
+     * keeps the mapping in sync with edits (delta > 0: insert, delta < 0: delete at offset).
+     */
+    void                ShiftOffsets(int32 offset, int32 delta);
+    /**
+     * keeps the mapping in sync with the text from start to middle and from middle to end swapping places.
+     */
+    void                SwapRanges(int32 start, int32 middle, int32 end);
+
+    /**
+     * translate between offsets in the normalized text and the original file in O(log n).
+     */
+    int32               ToFileOffset(int32 textOffset);
+    int32               ToTextOffset(int32 fileOffset);
+
+    bool                HasBOM()        { return fHasBOM; }
+    LINE_ENDING         LineEnding()    { return fLineEnding; }
+
+private:
+    static void         ShiftOffsets(vector<int32>* offsets, int32 offset, int32 delta);
+    static void         SwapRanges(vector<int32>* offsets, int32 start, int32 middle, int32 end);
+
+    bool                fHasBOM;
+    LINE_ENDING         fLineEnding;
+    /**
+     * sorted text offsets of LF characters that were CRLF in the file, one CR removed each.
+     */
+    vector<int32>       fCRLFOffsets;
+    /**
+     * sorted text offsets of LF characters that were a lone CR in the file (no size change).
+     */
+    vector<int32>       fCROffsets;
+    /**
+     * sorted text offsets of original LF characters, only kept if LF is not the dominant ending,
+     * so they are not confused with new lines on save.
+     */
+    vector<int32>       fLFOffsets;
+};
@@ -0,0 +1,299 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "Theme.h"
+
+#include <File.h>
+#include <Font.h>
+#include <InterfaceDefs.h>
+#include <cstring>
+#include <stdio.h>
+#include <stdlib.h>
+
+// selector names, indexed by markdown type
+static const char *block_selector_name[] = {"doc", "quote", "ul", "ol", "li", "hr", "h", "code", "html",
+                                            "p", "table", "thead", "tbody", "tr", "th", "td"};
+static const char *span_selector_name[]  = {"em", "strong", "a", "img", "code", "del", "latex",
+                                            "latexdisplay", "wikilink", "u"};
+static const char *text_selector_name[]  = {"normal", "nullchar", "br", "softbr", "entity",
+                                            "code", "html", "latex"};
+
+static const struct {
+    const char*     name;
+    uint16          face;
+} kFaceNames[] = {
+    {"regular", B_REGULAR_FACE}, {"italic", B_ITALIC_FACE}, {"underscore", B_UNDERSCORE_FACE},
+    {"strikeout", B_STRIKEOUT_FACE}, {"bold", B_BOLD_FACE}, {"light", B_LIGHT_FACE},
+    {"heavy", B_HEAVY_FACE}, {"condensed", B_CONDENSED_FACE}
+};
+
+static const struct {
+    const char*     name;
+    color_which     which;
+} kUIColorNames[] = {
+    {"document-text", B_DOCUMENT_TEXT_COLOR}, {"document-background", B_DOCUMENT_BACKGROUND_COLOR},
+    {"link", B_LINK_TEXT_COLOR}, {"shadow", B_SHADOW_COLOR},
+    {"control-highlight", B_CONTROL_HIGHLIGHT_COLOR}, {"panel-background", B_PANEL_BACKGROUND_COLOR},
+    {"success", B_SUCCESS_COLOR}, {"failure", B_FAILURE_COLOR}
+};
+
+static const char* kDefaultTheme =
+    "text           font=plain color=ui:document-text\n"
+    "block.p        font=plain color=ui:document-text\n"
+    "block.ul       font=plain color=ui:document-text\n"
+    "block.ol       font=plain color=ui:document-text\n"
+    "block.li       color=ui:link\n"
+    "block.code     font=fixed color=ui:shadow\n"
+    "block.html     font=fixed color=ui:shadow\n"
+    "block.table    font=fixed color=ui:shadow\n"
+    "block.quote    addface=italic color=ui:shadow\n"
+    "block.hr       font=plain addface=light color=ui:control-highlight\n"
+    "block.h        font=plain face=heavy color=ui:control-highlight\n"
+    "block.h1       size=1.875\n"
+    "block.h2       size=1.5625\n"
+    "block.h3       size=1.25\n"
+    "block.h4       size=0.9375\n"
+    "block.h5       size=0.625\n"
+    "block.h6       size=0.3125\n"
+    "span.a         addface=underscore color=ui:link\n"
+    "span.wikilink  addface=underscore color=ui:link\n"
+    "span.img       color=ui:link\n"
+    "span.code      color=ui:shadow\n"
+    "span.del       addface=strikeout color=ui:shadow\n"
+    "span.u         addface=underscore color=ui:document-text\n"
+    "span.strong    addface=bold color=ui:document-text\n"
+    "span.em        addface=italic color=ui:document-text\n"
+    "texttype.code  spacing=fixed color=ui:shadow\n"
+    "texttype.html  spacing=fixed color=ui:link\n"
+    "texttype.nullchar  font=plain color=ui:document-text\n"
+    "texttype.br        font=plain color=ui:document-text\n"
+    "texttype.softbr    font=plain color=ui:document-text\n"
+    "texttype.entity    font=plain color=ui:document-text\n"
+    "texttype.latex     font=plain color=ui:document-text\n";
+
+Theme::Theme(const char* name)
+    : fName(name) {
+}
+
+Theme::~Theme() {
+}
+
+Theme* Theme::DefaultTheme() {
+    Theme* theme = new Theme("Default");
+    theme->Parse(kDefaultTheme);
+    return theme;
+}
+
+const style_rule* Theme::HeadingRule(uint8 level) {
+    if (level < 1 || level > NUM_HEADING_LEVELS) {
+        return NULL;
+    }
+    return &fHeadingRules[level - 1];
+}
+
+status_t Theme::Load(const char* path) {
+    BFile file(path, B_READ_ONLY);
+    status_t status = file.InitCheck();
+    if (status != B_OK) {
+        return status;
+    }
+    off_t size;
+    status = file.GetSize(&size);
+    if (status != B_OK) {
+        return status;
+    }
+
+    BString description;
+    char* buffer = description.LockBuffer(size);
+    ssize_t bytesRead = file.Read(buffer, size);
+    description.UnlockBuffer(bytesRead > 0 ? bytesRead : 0);
+    if (bytesRead < 0) {
+        return bytesRead;
+    }
+    return Parse(description.String());
+}
+
+status_t Theme::Parse(const char* description) {
+    int32 lineNumber = 0;
+    const char* line = description;
+
+    while (*line != '\0') {
+        const char* eol = strchr(line, '\n');
+        BString ruleLine(line, eol != NULL ? eol - line : strlen(line));
+        line = (eol != NULL ? eol + 1 : line + ruleLine.Length());
+        lineNumber++;
+
+        ruleLine.Trim();
+        if (ruleLine.IsEmpty() || ruleLine.ByteAt(0) == '#') {
+            continue;
+        }
+        // split selector and space separated properties
+        int32 pos = ruleLine.FindFirst(' ');
+        BString selector;
+        ruleLine.CopyInto(selector, 0, pos >= 0 ? pos : ruleLine.Length());
+
+        style_rule* rule = RuleForSelector(selector);
+        if (rule == NULL) {
+            printf("Theme %s, line %d: unknown selector '%s', ignored.\n", Name(), lineNumber, selector.String());
+            continue;
+        }
+
+        while (pos >= 0 && pos < ruleLine.Length()) {
+            int32 next = ruleLine.FindFirst(' ', pos + 1);
+            BString property;
+            ruleLine.CopyInto(property, pos + 1, (next >= 0 ? next : ruleLine.Length()) - pos - 1);
+            pos = next;
+
+            if (property.Trim().IsEmpty()) {
+                continue;
+            }
+            if (ParseProperty(property, rule) != B_OK) {
+                printf("Theme %s, line %d: invalid property '%s', ignored.\n", Name(), lineNumber,
+                    property.String());
+            }
+        }
+    }
+    return B_OK;
+}
+
+style_rule* Theme::RuleForSelector(const BString& selector) {
+    if (selector == "text") {
+        return &fBaseRule;
+    }
+    int32 dot = selector.FindFirst('.');
+    if (dot < 0) {
+        return NULL;
+    }
+    BString group, name;
+    selector.CopyInto(group, 0, dot);
+    selector.CopyInto(name, dot + 1, selector.Length() - dot - 1);
+
+    if (group == "block") {
+        if (name.Length() == 2 && name.ByteAt(0) == 'h' && name.ByteAt(1) >= '1'
+            && name.ByteAt(1) < '1' + NUM_HEADING_LEVELS) {
+            return &fHeadingRules[name.ByteAt(1) - '1'];
+        }
+        for (int32 type = MD_BLOCK_DOC; type <= MD_BLOCK_TD; type++) {
+            if (name == block_selector_name[type]) {
+                return &fBlockRules[type];
+            }
+        }
+    } else if (group == "span") {
+        for (int32 type = MD_SPAN_EM; type <= MD_SPAN_U; type++) {
+            if (name == span_selector_name[type]) {
+                return &fSpanRules[type];
+            }
+        }
+    } else if (group == "texttype") {
+        for (int32 type = MD_TEXT_NORMAL; type <= MD_TEXT_LATEXMATH; type++) {
+            if (name == text_selector_name[type]) {
+                return &fTextRules[type];
+            }
+        }
+    }
+    return NULL;
+}
+
+status_t Theme::ParseProperty(const BString& property, style_rule* rule) {
+    int32 equals = property.FindFirst('=');
+    if (equals <= 0) {
+        return B_BAD_VALUE;
+    }
+    BString key, value;
+    property.CopyInto(key, 0, equals);
+    property.CopyInto(value, equals + 1, property.Length() - equals - 1);
+
+    if (key == "font") {
+        if (value == "plain") {
+            rule->font = STYLE_FONT_PLAIN;
+        } else if (value == "fixed") {
+            rule->font = STYLE_FONT_FIXED;
+        } else if (value == "bold") {
+            rule->font = STYLE_FONT_BOLD;
+        } else {
+            return B_BAD_VALUE;
+        }
+        rule->hasFont = true;
+    } else if (key == "face") {
+        rule->hasFace = true;
+        return ParseFaces(value, &rule->face);
+    } else if (key == "addface") {
+        return ParseFaces(value, &rule->addFace);
+    } else if (key == "size") {
+        rule->size = atof(value.String());
+        if (rule->size <= 0) {
+            rule->size = 0;
+            return B_BAD_VALUE;
+        }
+    } else if (key == "spacing") {
+        if (value != "fixed") {
+            return B_BAD_VALUE;
+        }
+        rule->hasSpacing = true;
+        rule->spacing = B_FIXED_SPACING;
+    } else if (key == "color") {
+        status_t status = ParseColor(value, &rule->color);
+        rule->hasColor = (status == B_OK);
+        return status;
+    } else {
+        return B_BAD_VALUE;
+    }
+    return B_OK;
+}
+
+status_t Theme::ParseFaces(const BString& value, uint16* face) {
+    *face = 0;
+    int32 start = 0;
+    while (start < value.Length()) {
+        int32 comma = value.FindFirst(',', start);
+        if (comma < 0) {
+            comma = value.Length();
+        }
+        BString faceName;
+        value.CopyInto(faceName, start, comma - start);
+        start = comma + 1;
+
+        bool found = false;
+        for (auto faceEntry : kFaceNames) {
+            if (faceName == faceEntry.name) {
+                *face |= faceEntry.face;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return B_BAD_VALUE;
+        }
+    }
+    return B_OK;
+}
+
+status_t Theme::ParseColor(const BString& value, rgb_color* color) {
+    if (value.FindFirst("ui:") == 0) {
+        for (auto uiColor : kUIColorNames) {
+            if (strcmp(value.String() + 3, uiColor.name) == 0) {
+                *color = ui_color(uiColor.which);
+                return B_OK;
+            }
+        }
+        return B_BAD_VALUE;
+    }
+
+    int32 length = value.Length() - 1;
+    if (value.ByteAt(0) != '#' || (length != 6 && length != 8)) {
+        return B_BAD_VALUE;
+    }
+    char* end;
+    uint32 rgba = strtoul(value.String() + 1, &end, 16);
+    if (*end != '\0') {
+        return B_BAD_VALUE;
+    }
+    if (length == 6) {
+        rgba = (rgba << 8) | 0xff;  // add default alpha
+    }
+    *color = make_color(rgba >> 24, (rgba >> 16) & 0xff, (rgba >> 8) & 0xff, rgba & 0xff);
+
+    return B_OK;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * data driven editor theme, compiled from a simple text description into lookup tables
+ * indexed by markdown block, span and text type. One rule per line:
+ *
+ *   # comment
+ *   text            font=plain color=ui:document-text
+ *   block.h1        font=plain face=heavy size=1.9 color=#e6b450
+ *   span.strong     addface=bold
+ *
+ * selectors: text, block.<type>, block.h1 - block.h6, span.<type>, texttype.<type>
+ * properties: font (plain|fixed|bold), face and addface (comma separated faces),
+ *             size (factor of the base font size), spacing (fixed), color (#rrggbb[aa] or ui:<name>)
+ */
+#pragma once
+
+#include <GraphicsDefs.h>
+#include <String.h>
+#include <SupportDefs.h>
+
+#include "include/md4c.h"
+
+#define NUM_HEADING_LEVELS 6
+
+enum STYLE_FONT {
+    STYLE_FONT_PLAIN = 0,
+    STYLE_FONT_FIXED,
+    STYLE_FONT_BOLD
+};
+
+typedef struct style_rule {
+    bool            hasFont = false;
+    uint8           font = STYLE_FONT_PLAIN;
+    bool            hasFace = false;
+    uint16          face = 0;
+    uint16          addFace = 0;        // added to the inherited face
+    float           size = 0.0;         // factor of the base font size, 0 if unset
+    bool            hasSpacing = false;
+    uint8           spacing = 0;
+    bool            hasColor = false;
+    rgb_color       color;
+} style_rule;
+
+class Theme {
+
+public:
+                        Theme(const char* name);
+    virtual             ~Theme();
+
+    status_t            Load(const char* path);
+    status_t            Parse(const char* description);
+
+    /**
+     * the built-in theme, itself compiled from a description.
+     */
+    static Theme*       DefaultTheme();
+
+    const char*         Name()                          { return fName.String(); }
+
+    const style_rule*   BaseRule()                      { return &fBaseRule; }
+    const style_rule*   BlockRule(MD_BLOCKTYPE type)    { return &fBlockRules[type]; }
+    const style_rule*   HeadingRule(uint8 level);
+    const style_rule*   SpanRule(MD_SPANTYPE type)      { return &fSpanRules[type]; }
+    const style_rule*   TextRule(MD_TEXTTYPE type)      { return &fTextRules[type]; }
+
+private:
+    style_rule*         RuleForSelector(const BString& selector);
+    status_t            ParseProperty(const BString& property, style_rule* rule);
+    static status_t     ParseFaces(const BString& value, uint16* face);
+    static status_t     ParseColor(const BString& value, rgb_color* color);
+
+    BString             fName;
+    style_rule          fBaseRule;
+    style_rule          fBlockRules[MD_BLOCK_TD + 1];
+    style_rule          fHeadingRules[NUM_HEADING_LEVELS];
+    style_rule          fSpanRules[MD_SPAN_U + 1];
+    style_rule          fTextRules[MD_TEXT_LATEXMATH + 1];
+};
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * in-memory B+ tree of two levels for fixed size entries ordered by their operator<.
+ * entries are kept in sorted pages of up to kPageSize, found by binary search over the first entry
+ * of each page, so inserting or erasing moves at most a page and millions of entries stay compact.
+ */
+#pragma once
+
+#include <algorithm>
+#include <SupportDefs.h>
+#include <vector>
+
+using namespace std;
+
+template<typename Entry>
+class TreeIndex {
+
+public:
+    void                Clear() {
+        fPages.clear();
+        fFirstEntries.clear();
+        fCount = 0;
+    }
+
+    /**
+     * replaces all entries with sorted ones, pages are filled to three quarters to leave room for inserts.
+     */
+    void                Build(const vector<Entry>& sorted) {
+        Clear();
+        for (size_t start = 0; start < sorted.size(); start += kFillSize) {
+            size_t end = min(start + kFillSize, sorted.size());
+            fPages.emplace_back(sorted.begin() + start, sorted.begin() + end);
+            fFirstEntries.push_back(sorted[start]);
+        }
+        fCount = sorted.size();
+    }
+
+    void                Insert(const Entry& entry) {
+        if (fPages.empty()) {
+            fPages.emplace_back(1, entry);
+            fFirstEntries.push_back(entry);
+            fCount++;
+            return;
+        }
+        size_t page = PageOf(entry);
+        vector<Entry>& entries = fPages[page];
+        entries.insert(upper_bound(entries.begin(), entries.end(), entry), entry);
+        fFirstEntries[page] = entries.front();
+        fCount++;
+
+        if (entries.size() > kPageSize) {
+            // split in halves, the upper half goes to a new page after it
+            vector<Entry> upper(entries.begin() + entries.size() / 2, entries.end());
+            entries.resize(entries.size() / 2);
+            fFirstEntries.insert(fFirstEntries.begin() + page + 1, upper.front());
+            fPages.insert(fPages.begin() + page + 1, std::move(upper));
+        }
+    }
+
+    bool                Erase(const Entry& entry) {
+        if (fPages.empty())
+            return false;
+
+        size_t page = PageOf(entry);
+        vector<Entry>& entries = fPages[page];
+        auto position = lower_bound(entries.begin(), entries.end(), entry);
+        if (position == entries.end() || entry < *position)
+            return false;
+
+        entries.erase(position);
+        fCount--;
+        if (entries.empty()) {
+            fPages.erase(fPages.begin() + page);
+            fFirstEntries.erase(fFirstEntries.begin() + page);
+        } else {
+            fFirstEntries[page] = entries.front();
+        }
+        return true;
+    }
+
+    /**
+     * calls visit(entry) for the entries from the first one not less than from on, in order,
+     * until it returns false.
+     */
+    template<typename Visitor>
+    void                Scan(const Entry& from, Visitor visit) const {
+        // equal entries may end the page before the one starting with from
+        auto first = lower_bound(fFirstEntries.begin(), fFirstEntries.end(), from);
+        size_t startPage = first == fFirstEntries.begin() ? 0 : first - fFirstEntries.begin() - 1;
+        for (size_t page = startPage; page < fPages.size(); page++) {
+            auto position = page == startPage ? lower_bound(fPages[page].begin(), fPages[page].end(), from)
+                                              : fPages[page].begin();
+            for (; position != fPages[page].end(); position++) {
+                if (!visit(*position))
+                    return;
+            }
+        }
+    }
+
+    void                Export(vector<Entry>* entries) const {
+        entries->clear();
+        entries->reserve(fCount);
+        for (auto& page : fPages)
+            entries->insert(entries->end(), page.begin(), page.end());
+    }
+
+    size_t              Count() const   { return fCount; }
+
+    static const size_t kPageSize = 512;
+    static const size_t kFillSize = kPageSize * 3 / 4;
+
+private:
+    size_t              PageOf(const Entry& entry) const {
+        // the last page starting at or before entry, or the first one
+        auto page = upper_bound(fFirstEntries.begin(), fFirstEntries.end(), entry);
+        return page == fFirstEntries.begin() ? 0 : page - fFirstEntries.begin() - 1;
+    }
+
+    vector<vector<Entry>> fPages;
+    vector<Entry>       fFirstEntries;
+    size_t              fCount = 0;
+};
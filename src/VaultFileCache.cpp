@@ -0,0 +1,335 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "VaultFileCache.h"
+
+#include <Autolock.h>
+#include <Directory.h>
+#include <Entry.h>
+#include <File.h>
+#include <FindDirectory.h>
+#include <Message.h>
+#include <NodeMonitor.h>
+#include <Path.h>
+#include <PathMonitor.h>
+#include <stdio.h>
+
+#include "Messages.h"
+#include "MetadataIndex.h"
+#include "TaskMessenger.h"
+
+static const char* kVaultCacheFile = "senity_vault_cache";
+
+VaultFileCache::VaultFileCache(BMessenger target)
+    : BHandler("vault_file_cache"),
+      fLock("vault_file_cache_lock"),
+      fDirty(false),
+      fScanning(false),
+      fTarget(target) {
+}
+
+VaultFileCache::~VaultFileCache() {
+    StopScan();
+    StopWatching();
+}
+
+status_t VaultFileCache::Load() {
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kVaultCacheFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_READ_ONLY);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    status = archive.Unflatten(&file);
+    if (status != B_OK)
+        return status;
+
+    BAutolock lock(&fLock);
+    fRoot = archive.GetString("root", "");
+    fEntries.clear();
+
+    BString notePath, title;
+    for (int32 index = 0; archive.FindString("path", index, &notePath) == B_OK
+                          && archive.FindString("title", index, &title) == B_OK; index++) {
+        fEntries.insert(fEntries.end(), {notePath, title});
+    }
+    fDirty = false;
+    printf("VaultFileCache: loaded %zu notes for vault %s.\n", fEntries.size(), fRoot.String());
+
+    return B_OK;
+}
+
+status_t VaultFileCache::Save() {
+    BAutolock lock(&fLock);
+    if (!fDirty)
+        return B_OK;
+
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kVaultCacheFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    archive.AddString("root", fRoot);
+    for (auto entry : fEntries) {
+        archive.AddString("path", entry.first);
+        archive.AddString("title", entry.second);
+    }
+
+    status = archive.Flatten(&file);
+    if (status == B_OK)
+        fDirty = false;
+
+    return status;
+}
+
+status_t VaultFileCache::SetRoot(const char* path) {
+    BEntry entry(path, true);
+    if (!entry.IsDirectory())
+        return B_BAD_VALUE;
+
+    StopScan();
+    StopWatching();
+    {
+        BAutolock lock(&fLock);
+        if (fRoot != path) {
+            fRoot = path;
+            fEntries.clear();
+            fDirty = true;
+        }
+    }
+    StartWatching();
+    StartScan();
+
+    return B_OK;
+}
+
+void VaultFileCache::GetLabels(vector<BString>* labels) {
+    BAutolock lock(&fLock);
+    int32 rootLength = fRoot.Length() + 1;
+
+    fSnapshot.clear();
+    fSnapshot.reserve(fEntries.size());
+    labels->clear();
+    labels->reserve(fEntries.size());
+
+    for (auto entry : fEntries) {
+        // show title and vault relative folder
+        BString folder;
+        int32 leafStart = entry.first.FindLast('/');
+        if (leafStart > rootLength) {
+            entry.first.CopyInto(folder, rootLength, leafStart - rootLength);
+        }
+        BString label(entry.second);
+        if (!folder.IsEmpty()) {
+            label << "  \xE2\x80\x94 " << folder;
+        }
+        labels->push_back(label);
+        fSnapshot.push_back(entry.first);
+    }
+}
+
+status_t VaultFileCache::GetPathAt(int32 index, BString* path) {
+    BAutolock lock(&fLock);
+    if (index < 0 || index >= (int32)fSnapshot.size())
+        return B_BAD_VALUE;
+
+    *path = fSnapshot[index];
+    return B_OK;
+}
+
+void VaultFileCache::GetPaths(vector<BString>* paths) {
+    BAutolock lock(&fLock);
+    paths->clear();
+    paths->reserve(fEntries.size());
+    for (auto& entry : fEntries)
+        paths->push_back(entry.first);
+}
+
+status_t VaultFileCache::GetTitle(const char* path, BString* title) {
+    BAutolock lock(&fLock);
+    auto entry = fEntries.find(BString(path));
+    if (entry == fEntries.end())
+        return B_ENTRY_NOT_FOUND;
+
+    *title = entry->second;
+    return B_OK;
+}
+
+void VaultFileCache::MessageReceived(BMessage* message) {
+    switch (message->what) {
+        case B_PATH_MONITOR:
+        {
+            int32 opcode;
+            const char* path;
+            if (message->FindInt32("opcode", &opcode) != B_OK
+                || message->FindString("path", &path) != B_OK) {
+                break;
+            }
+            BAutolock lock(&fLock);
+            switch (opcode) {
+                case B_ENTRY_CREATED:
+                    if (MetadataIndex::IsNote(path))
+                        AddEntry(path);
+                    break;
+                case B_ENTRY_REMOVED:
+                    RemoveEntry(path);
+                    break;
+                case B_ENTRY_MOVED:
+                {
+                    const char* fromPath;
+                    if (message->FindString("from path", &fromPath) == B_OK)
+                        RemoveEntry(fromPath);
+                    if (MetadataIndex::IsNote(path))
+                        AddEntry(path);
+                    break;
+                }
+                default:
+                    break;
+            }
+            break;
+        }
+        default:
+        {
+            BHandler::MessageReceived(message);
+            break;
+        }
+    }
+}
+
+void VaultFileCache::NotifyNoteChanged(const char* path, bool removed) {
+    BMessage changed(MSG_VAULT_NOTE_CHANGED);
+    changed.AddString("path", path);
+    changed.AddBool("removed", removed);
+    fTarget.SendMessage(&changed);
+}
+
+void VaultFileCache::AddEntry(const char* path) {
+    fEntries[BString(path)] = TitleFor(path);
+    fDirty = true;
+    if (fScanning)
+        fScanChanges.push_back({BString(path), true});
+    NotifyNoteChanged(path, false);
+}
+
+void VaultFileCache::RemoveEntry(const char* path) {
+    if (fScanning)
+        fScanChanges.push_back({BString(path), false});
+    if (fEntries.erase(BString(path)) == 0)
+        return;
+
+    fDirty = true;
+    NotifyNoteChanged(path, true);
+}
+
+void VaultFileCache::StartScan() {
+    if (fRoot.IsEmpty())
+        return;
+
+    BString root(fRoot);
+    {
+        BAutolock lock(&fLock);
+        fScanning = true;
+        fScanChanges.clear();
+    }
+
+    // reconcile the cached list with the file system without blocking the window
+    fScanTask = TaskMessenger(fTarget).Submit(TASK_PRIORITY_MAINTENANCE,
+        [this, root](const CancelToken& token) -> BMessage* {
+            map<BString, BString> entries;
+            ScanDirectory(root.String(), token, &entries);
+            if (token.IsCanceled())
+                return NULL;
+
+            BAutolock lock(&fLock);
+            fEntries.swap(entries);
+            // the scan may have missed what the path monitor saw meanwhile, in the order it saw it
+            for (auto& change : fScanChanges) {
+                if (change.second)
+                    fEntries[change.first] = TitleFor(change.first.String());
+                else
+                    fEntries.erase(change.first);
+            }
+            fScanChanges.clear();
+            fScanning = false;
+            fDirty = true;
+            size_t count = fEntries.size();
+            printf("VaultFileCache: scanned %zu notes below %s.\n", count, root.String());
+
+            return new BMessage(MSG_VAULT_UPDATED);
+        });
+}
+
+void VaultFileCache::StopScan() {
+    fScanTask.Cancel();
+    fScanTask.Wait();
+
+    BAutolock lock(&fLock);
+    fScanning = false;
+    fScanChanges.clear();
+}
+
+void VaultFileCache::ScanDirectory(const char* path, const CancelToken& token,
+                                   map<BString, BString>* entries) {
+    BDirectory directory(path);
+    if (directory.InitCheck() != B_OK)
+        return;
+
+    BEntry entry;
+    while (!token.IsCanceled() && directory.GetNextEntry(&entry) == B_OK) {
+        BPath entryPath(&entry);
+        if (entry.IsDirectory()) {
+            ScanDirectory(entryPath.Path(), token, entries);
+        } else if (MetadataIndex::IsNote(entryPath.Path())) {
+            entries->insert({BString(entryPath.Path()), TitleFor(entryPath.Path())});
+        }
+    }
+}
+
+BString VaultFileCache::TitleFor(const char* path) {
+    BString title(path);
+    int32 leafStart = title.FindLast('/');
+    if (leafStart >= 0)
+        title.Remove(0, leafStart + 1);
+
+    int32 extension = title.FindLast('.');
+    if (extension > 0)
+        title.Truncate(extension);
+
+    return title;
+}
+
+void VaultFileCache::StartWatching() {
+    if (fRoot.IsEmpty())
+        return;
+
+    status_t status = BPathMonitor::StartWatching(fRoot.String(),
+        B_WATCH_RECURSIVELY | B_WATCH_FILES_ONLY | B_WATCH_NAME, BMessenger(this));
+    if (status != B_OK)
+        printf("VaultFileCache: could not watch %s: %s\n", fRoot.String(), strerror(status));
+}
+
+void VaultFileCache::StopWatching() {
+    if (!fRoot.IsEmpty())
+        BPathMonitor::StopWatching(fRoot.String(), BMessenger(this));
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * cached list of all notes below the vault root directory, kept up to date by a path monitor
+ * and persisted between sessions, so quick open is fast right after launch.
+ */
+#pragma once
+
+#include <Handler.h>
+#include <Locker.h>
+#include <map>
+#include <Messenger.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <vector>
+
+#include "TaskScheduler.h"
+
+using namespace std;
+
+class VaultFileCache : public BHandler {
+
+public:
+                        VaultFileCache(BMessenger target);
+    virtual             ~VaultFileCache();
+
+    status_t            Load();
+    status_t            Save();
+
+    /**
+     * sets the vault root, starts watching it and rescans it in the background.
+     * must be called after the handler was added to a looper.
+     */
+    status_t            SetRoot(const char* path);
+    const char*         Root()      { return fRoot.String(); }
+
+    /**
+     * takes a snapshot of all note labels, indices are valid for GetPathAt() until the next snapshot.
+     */
+    void                GetLabels(vector<BString>* labels);
+    status_t            GetPathAt(int32 index, BString* path);
+    void                GetPaths(vector<BString>* paths);
+    status_t            GetTitle(const char* path, BString* title);
+
+    virtual void        MessageReceived(BMessage* message);
+
+private:
+    void                StartScan();
+    void                StopScan();
+    static void         ScanDirectory(const char* path, const CancelToken& token,
+                                      map<BString, BString>* entries);
+    static BString      TitleFor(const char* path);
+    /**
+     * tells the target a note was added or removed, so indexes follow w/o a scan of the vault.
+     */
+    void                NotifyNoteChanged(const char* path, bool removed);
+    void                AddEntry(const char* path);
+    void                RemoveEntry(const char* path);
+    void                StartWatching();
+    void                StopWatching();
+
+    BLocker                 fLock;
+    BString                 fRoot;
+    map<BString, BString>   fEntries;       // path -> title
+    vector<BString>         fSnapshot;      // paths in label order of the last snapshot
+    bool                    fDirty;
+    bool                    fScanning;
+    vector<pair<BString, bool>> fScanChanges;  // notes added or removed while scanning, replayed on the result
+
+    TaskHandle              fScanTask;
+    BMessenger              fTarget;
+};
@@ -0,0 +1,320 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "VaultSync.h"
+
+#include <Autolock.h>
+#include <Entry.h>
+#include <File.h>
+#include <FindDirectory.h>
+#include <Message.h>
+#include <OS.h>
+#include <Path.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BlockDiff.h"
+#include "FrameSocket.h"
+#include "Messages.h"
+#include "SyncProtocol.h"
+#include "TaskMessenger.h"
+
+static const char* kSyncStateFile = "senity_sync_state";
+
+// cut probabilities by the high bits of the rolling hash, which depend on the last 64 bytes:
+// 1 in 16 block starts, 1 in 8192 other positions
+static const uint64 kBlockCutMask = 0xf000000000000000ULL;
+static const uint64 kInnerCutMask = 0xfff8000000000000ULL;
+
+static const uint64* GearTable() {
+    // fixed random values per byte, the same for all clients so chunks of the same text match
+    static const vector<uint64> table = [] {
+        vector<uint64> values(256);
+        uint64 state = 0x5e11175eedULL;
+        for (auto& value : values) {
+            // splitmix64
+            uint64 z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+VaultSync::VaultSync(BMessenger target)
+    : fLock("vault_sync_lock"),
+      fDirty(false),
+      fTarget(target) {
+}
+
+VaultSync::~VaultSync() {
+    Cancel();
+}
+
+status_t VaultSync::Load() {
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kSyncStateFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_READ_ONLY);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    status = archive.Unflatten(&file);
+    if (status != B_OK)
+        return status;
+
+    BAutolock lock(&fLock);
+    fSynced.clear();
+    BString notePath;
+    int64 modified, size;
+    for (int32 index = 0; archive.FindString("path", index, &notePath) == B_OK
+                          && archive.FindInt64("modified", index, &modified) == B_OK
+                          && archive.FindInt64("size", index, &size) == B_OK; index++) {
+        fSynced.insert(fSynced.end(), {notePath, {(time_t) modified, (off_t) size}});
+    }
+    fDirty = false;
+
+    return B_OK;
+}
+
+status_t VaultSync::Save() {
+    BAutolock lock(&fLock);
+    if (!fDirty)
+        return B_OK;
+
+    BPath path;
+    status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (status != B_OK)
+        return status;
+
+    status = path.Append(kSyncStateFile);
+    if (status != B_OK)
+        return status;
+
+    BFile file;
+    status = file.SetTo(path.Path(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    if (status != B_OK)
+        return status;
+
+    BMessage archive;
+    for (auto& entry : fSynced) {
+        archive.AddString("path", entry.first);
+        archive.AddInt64("modified", entry.second.modified);
+        archive.AddInt64("size", entry.second.size);
+    }
+
+    status = archive.Flatten(&file);
+    if (status == B_OK)
+        fDirty = false;
+
+    return status;
+}
+
+void VaultSync::Sync(const char* root, const vector<BString>& paths, const char* host, uint16 port) {
+    Cancel();
+
+    BString rootPath(root);
+    BString hostName(host);
+
+    fSyncTask = TaskMessenger(fTarget).Submit(TASK_PRIORITY_MAINTENANCE,
+        [this, rootPath, paths, hostName, port](const CancelToken& token) -> BMessage* {
+            sync_stats stats = {};
+            bigtime_t startTime = system_time();
+            bigtime_t startCpuTime = ThreadTime();
+
+            int socket = -1;
+            status_t status = FrameSocket::Connect(hostName.String(), port, &socket);
+            if (status != B_OK) {
+                printf("VaultSync: could not connect to %s:%u: %s\n", hostName.String(), port, strerror(status));
+            }
+            vector<char> text;
+            for (size_t index = 0; status == B_OK && index < paths.size() && !token.IsCanceled(); index++) {
+                const BString& path = paths[index];
+                stats.notes++;
+
+                // notes not modified since they were last synced are not even read
+                struct stat stat;
+                if (BEntry(path.String()).GetStat(&stat) != B_OK)
+                    continue;
+                {
+                    BAutolock lock(&fLock);
+                    auto synced = fSynced.find(path);
+                    if (synced != fSynced.end() && synced->second.modified == stat.st_mtime
+                        && synced->second.size == stat.st_size) {
+                        continue;
+                    }
+                }
+
+                BFile file(path.String(), B_READ_ONLY);
+                text.resize(stat.st_size);
+                ssize_t bytesRead = file.InitCheck() == B_OK ? file.ReadAt(0, text.data(), text.size()) : B_ERROR;
+                if (bytesRead != (ssize_t) text.size()) {
+                    printf("VaultSync: could not read %s, skipping it.\n", path.String());
+                    continue;
+                }
+
+                BString relativePath(path);
+                if (relativePath.StartsWith(rootPath) && relativePath[rootPath.Length()] == '/')
+                    relativePath.Remove(0, rootPath.Length() + 1);
+
+                status = SyncNote(socket, relativePath.String(), text.data(), text.size(), &stats);
+                if (status != B_OK) {
+                    printf("VaultSync: could not sync %s: %s\n", path.String(), strerror(status));
+                    break;
+                }
+                BAutolock lock(&fLock);
+                fSynced[path] = {stat.st_mtime, stat.st_size};
+                fDirty = true;
+            }
+            if (socket >= 0)
+                close(socket);
+
+            stats.cpuTime = ThreadTime() - startCpuTime;
+            stats.duration = system_time() - startTime;
+            printf("VaultSync: synced %d of %d notes with %lld bytes in %d chunks, sent %d chunks in %lld bytes, "
+                "received %lld bytes, chunking took %lld of %lld ms CPU, %lld ms in all.\n",
+                stats.changedNotes, stats.notes, (long long) stats.changedBytes, stats.chunks, stats.sentChunks,
+                (long long) stats.sentBytes, (long long) stats.receivedBytes, (long long) stats.chunkTime / 1000,
+                (long long) stats.cpuTime / 1000, (long long) stats.duration / 1000);
+
+            BMessage* result = new BMessage(MSG_VAULT_SYNCED);
+            result->AddInt32("status", status);
+            result->AddData("stats", B_RAW_TYPE, &stats, sizeof(stats));
+            return result;
+        });
+}
+
+void VaultSync::Cancel() {
+    fSyncTask.Cancel();
+    fSyncTask.Wait();
+}
+
+void VaultSync::GetChunks(const char* text, int64 size, vector<block_ref>* chunks) {
+    vector<diff_block> blocks;
+    BlockDiff::GetBlocks(text, size, &blocks);
+    const uint64* gear = GearTable();
+
+    chunks->clear();
+    auto block = blocks.begin();
+    for (int64 start = 0; start < size; ) {
+        int64 end = min(size, start + kMaxChunkSize);
+        int64 cut = end;
+        int64 lastBlockStart = -1;
+        // the hash only depends on the last 64 bytes, so it starts rolling just before the minimum size
+        int64 position = max(start, start + kMinChunkSize - 64);
+        uint64 hash = 0;
+        for (; position < end; position++) {
+            hash = (hash << 1) + gear[(uint8) text[position]];
+            int64 length = position + 1 - start;
+            if (length < kMinChunkSize)
+                continue;
+
+            while (block != blocks.end() && block->offset < position + 1)
+                block++;
+            if (block != blocks.end() && block->offset == position + 1) {
+                lastBlockStart = position + 1;
+                if ((hash & kBlockCutMask) == 0) {
+                    cut = position + 1;
+                    break;
+                }
+            } else if (length >= kMinInnerChunkSize && (hash & kInnerCutMask) == 0) {
+                cut = position + 1;
+                break;
+            }
+        }
+        // a chunk of maximum size still ends at a block start if there was one
+        if (cut == start + kMaxChunkSize && lastBlockStart > 0)
+            cut = lastBlockStart;
+
+        chunks->push_back({RevisionStore::HashBlock(text + start, cut - start), (uint32) (cut - start)});
+        start = cut;
+    }
+}
+
+status_t VaultSync::SyncNote(int socket, const char* path, const char* text, int64 size, sync_stats* stats) {
+    bigtime_t chunkStartTime = ThreadTime();
+    vector<block_ref> chunks;
+    GetChunks(text, size, &chunks);
+    stats->chunkTime += ThreadTime() - chunkStartTime;
+
+    vector<uint8> note;
+    uint32 pathLength = strlen(path);
+    AppendUInt32(&note, pathLength);
+    note.insert(note.end(), path, path + pathLength);
+    AppendUInt32(&note, chunks.size());
+    for (auto& chunk : chunks) {
+        AppendUInt64(&note, chunk.hash);
+        AppendUInt32(&note, chunk.length);
+    }
+    status_t status = FrameSocket::WriteFrame(socket, SYNC_FRAME_NOTE, note.data(), note.size());
+    if (status != B_OK)
+        return status;
+    stats->sentBytes += FrameSocket::kHeaderSize + note.size();
+
+    uint8 type;
+    vector<uint8> missing;
+    status = FrameSocket::ReadFrame(socket, kMaxSyncFrameSize, &type, &missing);
+    if (status != B_OK)
+        return status;
+    if (type != SYNC_FRAME_MISSING)
+        return B_BAD_DATA;
+    stats->receivedBytes += FrameSocket::kHeaderSize + missing.size();
+
+    vector<int64> offsets(chunks.size());
+    for (size_t index = 1; index < chunks.size(); index++)
+        offsets[index] = offsets[index - 1] + chunks[index - 1].length;
+
+    // only the chunks the server does not have yet are sent
+    const uint8* data = missing.data();
+    const uint8* end = data + missing.size();
+    uint32 count;
+    if (!ReadUInt32(&data, end, &count))
+        return B_BAD_DATA;
+    vector<uint8> content;
+    for (uint32 index = 0; index < count; index++) {
+        uint32 chunk;
+        if (!ReadUInt32(&data, end, &chunk) || chunk >= chunks.size())
+            return B_BAD_DATA;
+        content.insert(content.end(), text + offsets[chunk], text + offsets[chunk] + chunks[chunk].length);
+    }
+    status = FrameSocket::WriteFrame(socket, SYNC_FRAME_CHUNKS, content.data(), content.size());
+    if (status != B_OK)
+        return status;
+    stats->sentBytes += FrameSocket::kHeaderSize + content.size();
+
+    vector<uint8> stored;
+    status = FrameSocket::ReadFrame(socket, kMaxSyncFrameSize, &type, &stored);
+    if (status != B_OK)
+        return status;
+    if (type != SYNC_FRAME_STORED)
+        return B_BAD_DATA;
+    stats->receivedBytes += FrameSocket::kHeaderSize + stored.size();
+
+    stats->changedNotes++;
+    stats->changedBytes += size;
+    stats->chunks += chunks.size();
+    stats->sentChunks += count;
+    return B_OK;
+}
+
+bigtime_t VaultSync::ThreadTime() {
+    thread_info info;
+    if (get_thread_info(find_thread(NULL), &info) != B_OK)
+        return 0;
+
+    return info.user_time + info.kernel_time;
+}
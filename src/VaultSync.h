@@ -0,0 +1,82 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * syncs the notes of the vault to a sync server, sending only the chunks the server does not have.
+ * notes are cut into chunks by a gear rolling hash, see Xia et al., "FastCDC: a Fast and Efficient
+ * Content-Defined Chunking Approach for Data Deduplication", 2016. cuts prefer the starts of top level
+ * markdown blocks, so an edit changes the chunks around it only and the cuts after it stay in place.
+ */
+#pragma once
+
+#include <Locker.h>
+#include <map>
+#include <Messenger.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <time.h>
+#include <vector>
+
+#include "RevisionStore.h"
+#include "TaskScheduler.h"
+
+using namespace std;
+
+typedef struct sync_stats {
+    int32           notes;
+    int32           changedNotes;
+    int64           changedBytes;   // size of the changed notes
+    int32           chunks;         // of the changed notes
+    int32           sentChunks;
+    int64           sentBytes;      // on the wire, with frame headers
+    int64           receivedBytes;
+    bigtime_t       chunkTime;      // CPU time spent on chunking and hashing
+    bigtime_t       cpuTime;        // of the whole sync
+    bigtime_t       duration;
+} sync_stats;
+
+class VaultSync {
+
+public:
+                        VaultSync(BMessenger target);
+    virtual             ~VaultSync();
+
+    /**
+     * loads and saves which notes were synced in which state, so unchanged notes are not read again.
+     */
+    status_t            Load();
+    status_t            Save();
+
+    /**
+     * syncs the notes at paths below root to the server at host and port in the background, the target
+     * gets MSG_VAULT_SYNCED with the status once done. a sync still running is canceled.
+     */
+    void                Sync(const char* root, const vector<BString>& paths, const char* host, uint16 port);
+    void                Cancel();
+
+    /**
+     * cuts text into content defined chunks.
+     */
+    static void         GetChunks(const char* text, int64 size, vector<block_ref>* chunks);
+
+    static const int32  kMinChunkSize = 2 * 1024;
+    static const int32  kMaxChunkSize = 64 * 1024;
+    // inside a long block, cuts away from block starts are allowed from this size on
+    static const int32  kMinInnerChunkSize = 16 * 1024;
+
+private:
+    typedef struct note_state {
+        time_t          modified;
+        off_t           size;
+    } note_state;
+
+    status_t            SyncNote(int socket, const char* path, const char* text, int64 size, sync_stats* stats);
+    static bigtime_t    ThreadTime();
+
+    BLocker                 fLock;
+    map<BString, note_state> fSynced;       // path -> state when last synced
+    bool                    fDirty;
+
+    TaskHandle              fSyncTask;
+    BMessenger              fTarget;
+};
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * measures loading many labels with a note, see HighlightStore. a note of random words gets a
+ * labeled highlight every few words, which are written, read back in one go, anchored to the
+ * unchanged text and then to the text after random edits between them, and put into a map sorted
+ * by offset like EditorTextView::SetHighlights() does.
+ * usage: senity-highlight-load [highlights] [edits] [note path]
+ */
+
+#include <Entry.h>
+#include <File.h>
+#include <map>
+#include <OS.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "../../src/HighlightStore.h"
+
+using namespace std;
+
+// distinct labels among the highlights
+static const int32 kLabelCount = 1000;
+// words of text a highlight covers at most, and words of text between two at most
+static const int32 kMaxHighlightWords = 3;
+static const int32 kMaxGapWords = 4;
+// words an edit puts between two highlights at most, some edits move them further than the nearby search
+static const int32 kMaxEditWords = 60;
+
+static const char* kLabelTypes[] = { "Person", "Location", "Topic", "Organization", "Date" };
+
+static mt19937 sRandom(1);
+
+static int32 Random(int32 count) {
+    return sRandom() % count;
+}
+
+static string Words(int32 count) {
+    string words;
+    for (int32 index = 0; index < count; index++) {
+        if (index > 0)
+            words += Random(12) == 0 ? '\n' : ' ';
+        for (int32 length = 4 + Random(7); length > 0; length--)
+            words += (char) ('a' + Random(26));
+    }
+    return words;
+}
+
+/**
+ * the text between two highlights, starts and ends with a separator so words don't run together.
+ */
+static string Gap(int32 maxWords) {
+    int32 count = Random(maxWords + 1);
+    return count == 0 ? string(" ") : " " + Words(count) + " ";
+}
+
+static void Generate(int32 count, string* text, highlight_set* highlights) {
+    for (int32 index = 0; index < kLabelCount; index++) {
+        highlight_label label;
+        label.type = kLabelTypes[index % B_COUNT_OF(kLabelTypes)];
+        if (index % 3 != 0)
+            label.value << "label " << index;
+        highlights->labels.push_back(label);
+    }
+
+    *text = Words(1 + Random(kMaxGapWords));
+    for (int32 index = 0; index < count; index++) {
+        *text += Gap(kMaxGapWords);
+        string words = Words(1 + Random(kMaxHighlightWords));
+
+        highlight_record record;
+        record.offset = text->size();
+        record.length = words.size();
+        record.label = Random(kLabelCount);
+        record.color = HighlightStore::PackColor(make_color(Random(256), Random(256), Random(256), 255));
+        record.flags = Random(4) == 0 ? HIGHLIGHT_GENERATED : 0;
+        record.fingerprint = HighlightStore::Fingerprint(words.c_str(), words.size());
+        highlights->records.push_back(record);
+        *text += words;
+    }
+    *text += Gap(kMaxGapWords);
+}
+
+/**
+ * replaces the text between randomly chosen highlights, like another program editing the note,
+ * and keeps where each highlight is expected afterwards.
+ */
+static string Edit(const string& text, const highlight_set& highlights, int32 edits, vector<uint32>* expected) {
+    const vector<highlight_record>& records = highlights.records;
+    vector<bool> edited(records.size() + 1, false);
+    for (int32 edit = 0; edit < edits; edit++)
+        edited[Random(records.size() + 1)] = true;
+
+    string editedText;
+    uint32 end = 0;
+    expected->clear();
+    for (size_t index = 0; index <= records.size(); index++) {
+        uint32 start = index < records.size() ? records[index].offset : text.size();
+        // the words before the first highlight are kept, so the gap there is only the separator
+        if (edited[index] && index > 0)
+            editedText += Gap(kMaxEditWords);
+        else
+            editedText.append(text, end, start - end);
+        if (index == records.size())
+            break;
+
+        expected->push_back(editedText.size());
+        editedText.append(text, start, records[index].length);
+        end = start + records[index].length;
+    }
+    return editedText;
+}
+
+static bool Equals(const highlight_set& a, const highlight_set& b) {
+    if (a.labels.size() != b.labels.size() || a.records.size() != b.records.size())
+        return false;
+    for (size_t index = 0; index < a.labels.size(); index++) {
+        if (a.labels[index].type != b.labels[index].type || a.labels[index].value != b.labels[index].value)
+            return false;
+    }
+    return a.records.empty()
+        || memcmp(a.records.data(), b.records.data(), a.records.size() * sizeof(highlight_record)) == 0;
+}
+
+static status_t WriteNote(const char* path, const string& text) {
+    BFile file(path, B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    status_t status = file.InitCheck();
+    if (status != B_OK)
+        return status;
+
+    ssize_t written = file.WriteAt(0, text.c_str(), text.size());
+    if (written < 0)
+        return written;
+    return written == (ssize_t) text.size() ? B_OK : B_IO_ERROR;
+}
+
+/**
+ * anchors a copy of highlights to text, counts those found where expected and those found elsewhere.
+ */
+static bigtime_t Anchor(const string& text, const highlight_set& highlights, const vector<uint32>& expected,
+                        highlight_set* anchored, int32* dropped, int32* misplaced) {
+    *anchored = highlights;
+    bigtime_t startTime = system_time();
+    *dropped = HighlightStore::Anchor(text.c_str(), text.size(), anchored);
+    bigtime_t elapsed = system_time() - startTime;
+
+    // records keep their order, so the anchored ones are matched to the expected offsets in one pass
+    *misplaced = 0;
+    size_t index = 0;
+    for (auto& record : anchored->records) {
+        while (index < expected.size() && expected[index] < record.offset)
+            index++;
+        if (index == expected.size() || expected[index] != record.offset)
+            (*misplaced)++;
+    }
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    int32 count = argc > 1 ? atoi(argv[1]) : 100000;
+    int32 edits = argc > 2 ? atoi(argv[2]) : 100;
+    const char* path = argc > 3 ? argv[3] : "/tmp/senity-highlight-load.md";
+    if (count < 1 || edits < 0) {
+        fprintf(stderr, "usage: senity-highlight-load [highlights] [edits] [note path]\n");
+        return 1;
+    }
+
+    string text;
+    highlight_set highlights;
+    Generate(count, &text, &highlights);
+    printf("note of %zu bytes with %d highlights among %d labels.\n", text.size(), count, kLabelCount);
+
+    status_t status = WriteNote(path, text);
+    if (status != B_OK) {
+        fprintf(stderr, "could not write %s: %s\n", path, strerror(status));
+        return 1;
+    }
+
+    bigtime_t startTime = system_time();
+    status = HighlightStore::Write(path, highlights);
+    bigtime_t writeTime = system_time() - startTime;
+    highlight_set loaded;
+    startTime = system_time();
+    if (status == B_OK)
+        status = HighlightStore::Read(path, &loaded);
+    bigtime_t readTime = system_time() - startTime;
+    if (status != B_OK) {
+        fprintf(stderr, "could not store the highlights of %s: %s\n", path, strerror(status));
+        BEntry(path).Remove();
+        return 1;
+    }
+    printf("written in %.1f ms, read in %.1f ms.\n", writeTime / 1000.0, readTime / 1000.0);
+
+    int32 failures = 0;
+    if (!Equals(highlights, loaded)) {
+        fprintf(stderr, "the highlights read differ from those written.\n");
+        failures++;
+    }
+
+    vector<uint32> expected;
+    for (auto& record : highlights.records)
+        expected.push_back(record.offset);
+    highlight_set anchored;
+    int32 dropped, misplaced;
+    bigtime_t anchorTime = Anchor(text, loaded, expected, &anchored, &dropped, &misplaced);
+    printf("anchored to the same text in %.1f ms.\n", anchorTime / 1000.0);
+    if (dropped > 0 || misplaced > 0) {
+        fprintf(stderr, "anchoring to the same text dropped %d and moved %d highlights.\n", dropped, misplaced);
+        failures++;
+    }
+
+    string editedText = Edit(text, loaded, edits, &expected);
+    anchorTime = Anchor(editedText, loaded, expected, &anchored, &dropped, &misplaced);
+    printf("anchored after %d edits in %.1f ms, %d dropped and %d found elsewhere.\n", edits,
+        anchorTime / 1000.0, dropped, misplaced);
+
+    // the records come sorted, so each one is put at the end of the map
+    startTime = system_time();
+    map<int64, const highlight_record*> highlightMap;
+    for (auto& record : anchored.records)
+        highlightMap.insert(highlightMap.end(), {record.offset, &record});
+    printf("built the map of %zu highlights in %.1f ms.\n", highlightMap.size(),
+        (system_time() - startTime) / 1000.0);
+    if (highlightMap.size() != anchored.records.size()) {
+        fprintf(stderr, "anchored highlights share an offset.\n");
+        failures++;
+    }
+
+    HighlightStore::Write(path, highlight_set());
+    BEntry(path).Remove();
+    return failures == 0 ? 0 : 1;
+}
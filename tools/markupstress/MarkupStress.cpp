@@ -0,0 +1,218 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * stress test for the markup index, one writer publishing random edits while many readers scan
+ * their snapshots. every record is a text run of kSpacing characters at a multiple of kSpacing,
+ * so readers can check each snapshot for consistency without knowing which version they got.
+ * usage: senity-markup-stress [readers] [seconds] [records]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <OS.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "../../src/MarkupIndex.h"
+
+using namespace std;
+
+static const int64 kSpacing = 10;
+// records removed or inserted by one edit at most
+static const int32 kMaxEditRecords = 8;
+// characters read by a range scan
+static const int64 kRangeSize = 4096;
+
+// one cache line per reader so the counters don't contend
+typedef struct alignas(64) reader_stats {
+    uint64          snapshots = 0;
+    uint64          records = 0;
+    uint64          failures = 0;
+} reader_stats;
+
+static text_data* CreateItem(int64 offset) {
+    text_data* item = new text_data();
+    item->markup_class = MD_TEXT;
+    item->markup_type.text_type = MD_TEXT_NORMAL;
+    item->detail = NULL;
+    item->offset = offset;
+    item->length = kSpacing;
+    return item;
+}
+
+static markup_stack* CreateStack(int64 offset) {
+    markup_stack* stack = new markup_stack();
+    stack->push_back(CreateItem(offset));
+    return stack;
+}
+
+static void DeleteStack(markup_stack* stack) {
+    for (auto item : *stack)
+        delete item;
+    delete stack;
+}
+
+/**
+ * replaces removed records from the record index first on with inserted new ones and moves all
+ * records after them, like the parser does on an edit.
+ */
+static void Edit(markup_map* markupMap, int64 first, int64 removed, int64 inserted) {
+    int64 start = first * kSpacing;
+    int64 delta = (inserted - removed) * kSpacing;
+
+    auto item = markupMap->lower_bound(start);
+    for (int64 index = 0; index < removed; index++) {
+        DeleteStack(item->second);
+        item = markupMap->erase(item);
+    }
+
+    // move the map nodes instead of copying them, the writer should spend its time publishing
+    markup_map tail;
+    while (item != markupMap->end()) {
+        auto node = markupMap->extract(item++);
+        node.key() += delta;
+        for (auto text : *node.mapped())
+            text->offset += delta;
+        tail.insert(tail.end(), move(node));
+    }
+    for (int64 index = 0; index < inserted; index++) {
+        int64 offset = start + index * kSpacing;
+        markupMap->insert(markupMap->end(), make_pair(offset, CreateStack(offset)));
+    }
+    markupMap->merge(tail);
+}
+
+static bool CheckRecord(int64 offset, const markup_record& record, int64 expected) {
+    if (offset == expected && record.length == kSpacing && record.markupClass == MD_TEXT)
+        return true;
+
+    fprintf(stderr, "found a record of class %d and length %d at %lld, expected one at %lld.\n",
+        record.markupClass, record.length, (long long) offset, (long long) expected);
+    return false;
+}
+
+static void Read(MarkupIndex* index, const atomic<bool>* stop, unsigned int seed, reader_stats* stats) {
+    mt19937 random(seed);
+    while (!stop->load(memory_order_relaxed)) {
+        MarkupIndex::Reader reader(index);
+        const MarkupSnapshot* snapshot = reader.Snapshot();
+        int64 size = snapshot->CountRecords() * kSpacing;
+        bool consistent = true;
+
+        // mostly short range scans like search and outline do, a full scan every now and then
+        if (random() % 16 == 0 || size <= kRangeSize) {
+            int64 expected = 0;
+            snapshot->ForEach(0, INT64_MAX, [&](int64 offset, const markup_record& record) {
+                consistent = CheckRecord(offset, record, expected);
+                expected += kSpacing;
+                return consistent;
+            });
+            if (consistent && expected != size) {
+                fprintf(stderr, "found %lld of %d records in version %llu.\n", (long long) (expected / kSpacing),
+                    snapshot->CountRecords(), (unsigned long long) snapshot->Version());
+                consistent = false;
+            }
+            stats->records += expected / kSpacing;
+        } else {
+            int64 start = random() % (size - kRangeSize);
+            int64 expected = (start + kSpacing - 1) / kSpacing * kSpacing;
+            snapshot->ForEach(start, start + kRangeSize, [&](int64 offset, const markup_record& record) {
+                consistent = CheckRecord(offset, record, expected);
+                expected += kSpacing;
+                stats->records++;
+                return consistent;
+            });
+            if (consistent && expected <= start + kRangeSize) {
+                fprintf(stderr, "range %lld-%lld ends early at %lld in version %llu.\n", (long long) start,
+                    (long long) (start + kRangeSize), (long long) expected,
+                    (unsigned long long) snapshot->Version());
+                consistent = false;
+            }
+        }
+        stats->snapshots++;
+        if (!consistent)
+            stats->failures++;
+    }
+}
+
+int main(int argc, char** argv) {
+    int32 readerCount = argc > 1 ? atoi(argv[1]) : 4;
+    int32 seconds = argc > 2 ? atoi(argv[2]) : 5;
+    int64 recordCount = argc > 3 ? atoll(argv[3]) : 100000;
+    if (readerCount < 1 || readerCount >= EPOCH_MAX_READERS || seconds < 1 || recordCount < 1) {
+        fprintf(stderr, "usage: senity-markup-stress [readers] [seconds] [records]\n");
+        return 1;
+    }
+
+    markup_map markupMap;
+    for (int64 index = 0; index < recordCount; index++)
+        markupMap.insert(markupMap.end(), make_pair(index * kSpacing, CreateStack(index * kSpacing)));
+
+    MarkupIndex index;
+    bigtime_t startTime = system_time();
+    index.Publish(&markupMap, 0, recordCount * kSpacing);
+    printf("published %lld records in %lld ms.\n", (long long) recordCount,
+        (long long) (system_time() - startTime) / 1000);
+
+    atomic<bool> stop(false);
+    vector<reader_stats> stats(readerCount);
+    vector<thread> readers;
+    for (int32 reader = 0; reader < readerCount; reader++)
+        readers.push_back(thread(Read, &index, &stop, reader + 1, &stats[reader]));
+
+    // the record count takes a random walk, kept within half and twice the initial count
+    mt19937 random(0);
+    uint64 publishes = 0;
+    bigtime_t publishTime = 0;
+    bigtime_t maxPublishTime = 0;
+    startTime = system_time();
+    while (system_time() - startTime < seconds * 1000000LL) {
+        int64 size = markupMap.size();
+        int64 first = random() % (size + 1);
+        int64 removed = size > recordCount / 2 ? random() % (min<int64>(kMaxEditRecords, size - first) + 1) : 0;
+        int64 inserted = size < recordCount * 2 ? random() % (kMaxEditRecords + 1) : 0;
+        if (removed == 0 && inserted == 0)
+            continue;
+
+        Edit(&markupMap, first, removed, inserted);
+
+        int64 start = first * kSpacing;
+        bigtime_t publishStart = system_time();
+        index.Publish(&markupMap, start, start + inserted * kSpacing - 1, (inserted - removed) * kSpacing);
+        bigtime_t elapsed = system_time() - publishStart;
+        publishTime += elapsed;
+        maxPublishTime = max(maxPublishTime, elapsed);
+        publishes++;
+    }
+    stop = true;
+    bigtime_t totalTime = system_time() - startTime;
+    for (auto& reader : readers)
+        reader.join();
+
+    reader_stats total;
+    for (auto& reader : stats) {
+        total.snapshots += reader.snapshots;
+        total.records += reader.records;
+        total.failures += reader.failures;
+    }
+    double totalSeconds = totalTime / 1000000.0;
+    printf("writer: %llu publishes, %.0f per second, %.1f us on average, %lld us at most.\n",
+        (unsigned long long) publishes, publishes / totalSeconds, publishes ? (double) publishTime / publishes : 0.0,
+        (long long) maxPublishTime);
+    printf("%d readers: %llu snapshots, %.0f per second, %.1f million records read per second.\n", readerCount,
+        (unsigned long long) total.snapshots, total.snapshots / totalSeconds, total.records / totalSeconds / 1e6);
+    {
+        MarkupIndex::Reader reader(&index);
+        printf("%llu inconsistent snapshots, final version %llu with %d records in %d segments.\n",
+            (unsigned long long) total.failures, (unsigned long long) reader.Snapshot()->Version(),
+            reader.Snapshot()->CountRecords(), reader.Snapshot()->CountSegments());
+    }
+
+    for (auto& item : markupMap)
+        DeleteStack(item.second);
+    return total.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * checks the offset mapping of TextNormalizer on random texts with mixed line endings and BOMs.
+ * every text offset has to map to the file byte it came from, a line break to its CR if it had one,
+ * and back to itself again. the denormalized text has to give the original file.
+ * usage: senity-normalizer-check [texts] [seed]
+ */
+
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "../../src/TextNormalizer.h"
+
+using namespace std;
+
+static const char* kPieces[] = { "\r\n", "\r\n", "\r", "\n", "a", "bc", "def ", "# x", "\xC3\xA4" };
+
+static mt19937 sRandom(1);
+
+static string File() {
+    string file = sRandom() % 4 == 0 ? "\xEF\xBB\xBF" : "";
+    for (int32 count = sRandom() % 40, index = 0; index < count; index++)
+        file += kPieces[sRandom() % B_COUNT_OF(kPieces)];
+    return file;
+}
+
+static string Escape(const string& text) {
+    string escaped;
+    for (char c : text) {
+        if (c == '\r')
+            escaped += "\\r";
+        else if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+static bool Check(const string& file) {
+    vector<char> text(file.begin(), file.end());
+    TextNormalizer normalizer;
+    int32 size = normalizer.Normalize(text.data(), text.size());
+
+    for (int32 offset = 0; offset <= size; offset++) {
+        int32 fileOffset = normalizer.ToFileOffset(offset);
+        int32 textOffset = normalizer.ToTextOffset(fileOffset);
+        bool mapped = fileOffset >= 0 && fileOffset <= (int32) file.size();
+        if (mapped && offset < size) {
+            char c = file[fileOffset];
+            mapped = c == text[offset] || (text[offset] == '\n' && c == '\r');
+        }
+        // never between the CR and LF of a line break, a range ending there would keep the CR
+        if (mapped && fileOffset > 0 && fileOffset < (int32) file.size())
+            mapped = !(file[fileOffset - 1] == '\r' && file[fileOffset] == '\n');
+        if (!mapped || textOffset != offset) {
+            fprintf(stderr, "text offset %d of \"%s\" maps to file offset %d and back to %d.\n", offset,
+                Escape(file).c_str(), fileOffset, textOffset);
+            return false;
+        }
+    }
+
+    BString denormalized;
+    if (normalizer.Denormalize(text.data(), size, &denormalized) != B_OK
+        || string(denormalized.String(), denormalized.Length()) != file) {
+        fprintf(stderr, "\"%s\" is saved as \"%s\".\n", Escape(file).c_str(),
+            Escape(string(denormalized.String(), denormalized.Length())).c_str());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int32 count = argc > 1 ? atoi(argv[1]) : 10000;
+    sRandom.seed(argc > 2 ? atoi(argv[2]) : 1);
+
+    int32 failures = 0;
+    for (int32 index = 0; index < count; index++) {
+        if (!Check(File()))
+            failures++;
+    }
+    fprintf(stderr, "%d texts, %d with offsets not mapped back.\n", count, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * relay for shared editing sessions. editors connect and say hello, the relay welcomes them with all
+ * operations of the session so far and passes each batch of operations on to all other editors.
+ * the relay knows nothing about the text, editors integrate the operations in any order.
+ * usage: senity-relay [port]
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../../src/RelayProtocol.h"
+
+using namespace std;
+
+typedef struct relay_peer {
+    int             socket;
+    uint32          client;         // 0 until the editor said hello
+    vector<uint8>   input;          // received, not yet complete frames
+    vector<uint8>   output;         // frames not yet sent
+    size_t          sent;
+} relay_peer;
+
+static void AddFrame(vector<uint8>* output, uint8 type, const uint8* first, size_t firstSize,
+                     const uint8* data, size_t size) {
+    uint32 frameSize = htonl(1 + firstSize + size);
+    const uint8* sizeBytes = reinterpret_cast<const uint8*>(&frameSize);
+    output->insert(output->end(), sizeBytes, sizeBytes + sizeof(frameSize));
+    output->push_back(type);
+    output->insert(output->end(), first, first + firstSize);
+    output->insert(output->end(), data, data + size);
+}
+
+/**
+ * handles the complete frames of a peer. returns false if the peer has to go.
+ */
+static bool HandleInput(vector<relay_peer>& peers, size_t index, vector<uint8>* log, bool* joined) {
+    relay_peer& peer = peers[index];
+    size_t consumed = 0;
+    bool result = true;
+    while (peer.input.size() - consumed >= sizeof(uint32)) {
+        uint32 size;
+        memcpy(&size, peer.input.data() + consumed, sizeof(size));
+        size = ntohl(size);
+        if (size == 0 || size > kMaxRelayFrameSize) {
+            result = false;
+            break;
+        }
+        if (peer.input.size() - consumed - sizeof(size) < size) {
+            break;
+        }
+        uint8 type = peer.input[consumed + sizeof(size)];
+        const uint8* payload = peer.input.data() + consumed + sizeof(size) + 1;
+        size_t payloadSize = size - 1;
+        consumed += sizeof(size) + size;
+
+        if (type == RELAY_FRAME_HELLO && peer.client == 0 && payloadSize == sizeof(uint32)) {
+            uint32 client;
+            memcpy(&client, payload, sizeof(client));
+            peer.client = max(ntohl(client), (uint32) 1);
+            // the first editor ever brings in its text, later ones take over the session
+            uint8 first = *joined ? 0 : 1;
+            *joined = true;
+            AddFrame(&peer.output, RELAY_FRAME_WELCOME, &first, 1, log->data(), log->size());
+            printf("client %08x joined, %zu bytes of operations so far.\n", peer.client, log->size());
+        } else if (type == RELAY_FRAME_OPS && peer.client != 0) {
+            log->insert(log->end(), payload, payload + payloadSize);
+            for (size_t other = 0; other < peers.size(); other++) {
+                if (other != index && peers[other].client != 0) {
+                    AddFrame(&peers[other].output, RELAY_FRAME_OPS, NULL, 0, payload, payloadSize);
+                }
+            }
+        } else {
+            printf("client %08x sent an unexpected frame of type %u.\n", peer.client, type);
+            result = false;
+            break;
+        }
+    }
+    peer.input.erase(peer.input.begin(), peer.input.begin() + consumed);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    uint16 port = argc > 1 ? atoi(argv[1]) : kRelayPort;
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (listener < 0 || bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0
+            || listen(listener, 16) != 0) {
+        fprintf(stderr, "could not listen on port %u: %s\n", port, strerror(errno));
+        return 1;
+    }
+    printf("relaying editing sessions on port %u.\n", port);
+
+    vector<relay_peer> peers;
+    vector<uint8> log;      // all operations of the session, for editors joining later
+    bool joined = false;
+    uint8 buffer[64 * 1024];
+
+    while (true) {
+        vector<struct pollfd> polls(1 + peers.size());
+        polls[0].fd = listener;
+        polls[0].events = POLLIN;
+        for (size_t i = 0; i < peers.size(); i++) {
+            polls[i + 1].fd = peers[i].socket;
+            polls[i + 1].events = POLLIN | (peers[i].output.size() > peers[i].sent ? POLLOUT : 0);
+        }
+        if (poll(polls.data(), polls.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "could not poll: %s\n", strerror(errno));
+            return 1;
+        }
+
+        vector<bool> closing(peers.size(), false);
+        for (size_t i = 0; i < peers.size(); i++) {
+            relay_peer& peer = peers[i];
+            short events = polls[i + 1].revents;
+            if (events & POLLIN) {
+                ssize_t bytesRead = recv(peer.socket, buffer, sizeof(buffer), 0);
+                if (bytesRead <= 0) {
+                    closing[i] = true;
+                    continue;
+                }
+                peer.input.insert(peer.input.end(), buffer, buffer + bytesRead);
+                if (!HandleInput(peers, i, &log, &joined)) {
+                    closing[i] = true;
+                    continue;
+                }
+            } else if (events & (POLLERR | POLLHUP)) {
+                closing[i] = true;
+                continue;
+            }
+            if (events & POLLOUT) {
+                ssize_t written = send(peer.socket, peer.output.data() + peer.sent,
+                    peer.output.size() - peer.sent, MSG_DONTWAIT);
+                if (written < 0 && errno != EINTR && errno != EAGAIN) {
+                    closing[i] = true;
+                    continue;
+                }
+                if (written > 0) {
+                    peer.sent += written;
+                }
+                if (peer.sent == peer.output.size()) {
+                    peer.output.clear();
+                    peer.sent = 0;
+                }
+            }
+        }
+        for (size_t i = peers.size(); i-- > 0;) {
+            if (closing[i]) {
+                printf("client %08x left.\n", peers[i].client);
+                close(peers[i].socket);
+                peers.erase(peers.begin() + i);
+            }
+        }
+
+        if (polls[0].revents & POLLIN) {
+            int socket = accept(listener, NULL, NULL);
+            if (socket >= 0) {
+                int noDelay = 1;
+                setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                peers.push_back({socket, 0, {}, {}, 0});
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * checks the task scheduler: waiting on a task while all workers are busy, priorities, cancellation
+ * and tasks submitted from tasks. like the scheduler it only needs the C++ standard library, so it
+ * also builds elsewhere, e.g. g++ -std=c++17 -pthread SchedulerCheck.cpp ../../src/TaskScheduler.cpp
+ * usage: senity-scheduler-check [tasks]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "../../src/TaskScheduler.h"
+
+using namespace std;
+
+// checks taking longer than this are taken as hanging
+static const int32_t kTimeoutSeconds = 60;
+
+static int32_t sFailures = 0;
+
+static void Expect(bool condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "failed: %s\n", what);
+        sFailures++;
+    }
+}
+
+/**
+ * keeps a worker busy like a pass over the whole vault, until released.
+ */
+class Blocker {
+
+public:
+    void Block() {
+        unique_lock<mutex> lock(fLock);
+        fStarted = true;
+        fChanged.notify_all();
+        fChanged.wait(lock, [this]() { return fReleased; });
+    }
+
+    void WaitStarted() {
+        unique_lock<mutex> lock(fLock);
+        fChanged.wait(lock, [this]() { return fStarted; });
+    }
+
+    void Release() {
+        lock_guard<mutex> lock(fLock);
+        fReleased = true;
+        fChanged.notify_all();
+    }
+
+private:
+    mutex               fLock;
+    condition_variable  fChanged;
+    bool                fStarted = false;
+    bool                fReleased = false;
+};
+
+static void CheckWaitWhileBusy() {
+    TaskScheduler scheduler(2);
+    Blocker blocker;
+    vector<TaskHandle> blocking;
+    for (int32_t worker = 0; worker < scheduler.CountThreads(); worker++) {
+        blocking.push_back(scheduler.Submit(TASK_PRIORITY_MAINTENANCE,
+            [&blocker](const CancelToken&) { blocker.Block(); }));
+    }
+    blocker.WaitStarted();
+
+    thread::id runner;
+    TaskHandle task = scheduler.Submit(TASK_PRIORITY_VIEWPORT,
+        [&runner](const CancelToken&) { runner = this_thread::get_id(); });
+    task.Wait();
+    Expect(task.IsDone(), "a task waited on while all workers are busy is done");
+    Expect(runner == this_thread::get_id(),
+        "a task waited on while all workers are busy runs on the waiting thread");
+
+    blocker.Release();
+    for (auto& handle : blocking)
+        handle.Wait();
+    scheduler.WaitIdle();
+}
+
+static void CheckPriorities() {
+    TaskScheduler scheduler(1);
+    Blocker blocker;
+    scheduler.Submit(TASK_PRIORITY_VIEWPORT, [&blocker](const CancelToken&) { blocker.Block(); });
+    blocker.WaitStarted();
+
+    // queued while the only worker is busy, so they run by priority once it is free
+    mutex lock;
+    vector<TASK_PRIORITY> order;
+    for (int32_t priority = TASK_PRIORITY_COUNT - 1; priority >= 0; priority--) {
+        scheduler.Submit((TASK_PRIORITY) priority, [&, priority](const CancelToken&) {
+            lock_guard<mutex> guard(lock);
+            order.push_back((TASK_PRIORITY) priority);
+        });
+    }
+    blocker.Release();
+    scheduler.WaitIdle();
+
+    bool ordered = order.size() == TASK_PRIORITY_COUNT;
+    for (int32_t index = 0; ordered && index < TASK_PRIORITY_COUNT; index++)
+        ordered = order[index] == index;
+    Expect(ordered, "queued tasks run by priority");
+}
+
+static void CheckCancel() {
+    TaskScheduler scheduler(1);
+    Blocker blocker;
+    scheduler.Submit(TASK_PRIORITY_VIEWPORT, [&blocker](const CancelToken&) { blocker.Block(); });
+    blocker.WaitStarted();
+
+    CancelToken token;
+    atomic<bool> ran(false);
+    TaskHandle task = scheduler.Submit(TASK_PRIORITY_DOCUMENT, [&ran](const CancelToken&) { ran = true; }, token);
+    token.Cancel();
+    task.Wait();
+    Expect(task.IsDone() && !ran, "a canceled task is skipped, also when waited on");
+
+    blocker.Release();
+    scheduler.WaitIdle();
+    task_class_stats stats;
+    scheduler.GetStats(TASK_PRIORITY_DOCUMENT, &stats);
+    Expect(stats.canceled == 1 && stats.executed == 0, "a skipped task is counted as canceled");
+}
+
+static void CheckLoad(int32_t count) {
+    TaskScheduler scheduler(4);
+    atomic<int32_t> executed(0);
+    vector<TaskHandle> tasks;
+
+    // every task submits another one, half of them are waited on from outside the pool
+    for (int32_t index = 0; index < count; index++) {
+        tasks.push_back(scheduler.Submit((TASK_PRIORITY) (index % TASK_PRIORITY_COUNT),
+            [&scheduler, &executed](const CancelToken&) {
+                executed++;
+                scheduler.Submit(TASK_PRIORITY_MAINTENANCE, [&executed](const CancelToken&) { executed++; });
+            }));
+    }
+    for (int32_t index = 0; index < count; index += 2)
+        tasks[index].Wait();
+    scheduler.WaitIdle();
+    Expect(executed == count * 2, "all tasks run once");
+
+    uint64_t total = 0;
+    for (int32_t priority = 0; priority < TASK_PRIORITY_COUNT; priority++) {
+        task_class_stats stats;
+        scheduler.GetStats((TASK_PRIORITY) priority, &stats);
+        total += stats.executed;
+    }
+    Expect(total == (uint64_t) count * 2, "all tasks are counted once");
+}
+
+int main(int argc, char** argv) {
+    int32_t count = argc > 1 ? atoi(argv[1]) : 100000;
+    if (count < 1) {
+        fprintf(stderr, "usage: senity-scheduler-check [tasks]\n");
+        return 1;
+    }
+
+    atomic<bool> finished(false);
+    thread watchdog([&finished]() {
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(kTimeoutSeconds);
+        while (!finished && chrono::steady_clock::now() < deadline)
+            this_thread::sleep_for(chrono::milliseconds(10));
+        if (!finished) {
+            fprintf(stderr, "failed: the checks hang.\n");
+            _Exit(1);
+        }
+    });
+
+    CheckWaitWhileBusy();
+    CheckPriorities();
+    CheckCancel();
+    CheckLoad(count);
+
+    finished = true;
+    watchdog.join();
+    fprintf(stderr, "%d checks failed.\n", sFailures);
+    return sFailures == 0 ? 0 : 1;
+}
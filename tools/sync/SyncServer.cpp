@@ -0,0 +1,206 @@
+/*
+ * Copyright 2024, Gregor B. Rosenauer <gregor.rosenauer@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ *
+ * reference server for vault sync, serving one client at a time. chunks are kept by their hash in
+ * <directory>/chunks, notes are put together from their chunks below <directory>/vault.
+ * usage: senity-sync-server [directory] [port]
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <set>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../../src/FrameSocket.h"
+#include "../../src/SyncProtocol.h"
+
+using namespace std;
+
+typedef struct chunk_ref {
+    uint64          hash;
+    uint32          length;
+} chunk_ref;
+
+static uint64 HashChunk(const uint8* data, size_t length) {
+    // FNV-1a as used by the client
+    uint64 hash = 0xcbf29ce484222325ULL;
+    for (size_t index = 0; index < length; index++) {
+        hash ^= data[index];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static string ChunkPath(const string& directory, const chunk_ref& chunk) {
+    char name[40];
+    snprintf(name, sizeof(name), "/chunks/%016llx-%u", (unsigned long long) chunk.hash, chunk.length);
+    return directory + name;
+}
+
+static bool IsSafePath(const string& path) {
+    if (path.empty() || path[0] == '/')
+        return false;
+
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == string::npos)
+            end = path.size();
+        string component = path.substr(start, end - start);
+        if (component.empty() || component == "." || component == "..")
+            return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+static void CreateParents(const string& path) {
+    for (size_t slash = path.find('/', 1); slash != string::npos; slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+}
+
+static bool WriteFile(const string& path, const uint8* data, size_t size) {
+    // written to the side first, so readers never see a partly written file
+    string temporaryPath = path + ".part";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    bool written = fwrite(data, 1, size, file) == size;
+    written &= fclose(file) == 0;
+    return written && rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+static bool ReadFile(const string& path, vector<uint8>* data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+
+    uint8 buffer[64 * 1024];
+    size_t bytesRead;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data->insert(data->end(), buffer, buffer + bytesRead);
+    fclose(file);
+    return true;
+}
+
+/**
+ * receives one note, returns false if the connection has to go.
+ */
+static bool ReceiveNote(int socket, const string& directory, const vector<uint8>& note) {
+    const uint8* data = note.data();
+    const uint8* end = data + note.size();
+    uint32 pathLength, count;
+    if (!ReadUInt32(&data, end, &pathLength) || (size_t) (end - data) < pathLength)
+        return false;
+    string path(reinterpret_cast<const char*>(data), pathLength);
+    data += pathLength;
+    if (!IsSafePath(path) || !ReadUInt32(&data, end, &count))
+        return false;
+
+    if ((size_t) (end - data) / (sizeof(uint64) + sizeof(uint32)) < count)
+        return false;
+
+    vector<chunk_ref> chunks(count);
+    vector<uint32> missingChunks;
+    set<pair<uint64, uint32>> asked;
+    for (uint32 index = 0; index < count; index++) {
+        ReadUInt64(&data, end, &chunks[index].hash);
+        ReadUInt32(&data, end, &chunks[index].length);
+        // a chunk occurring twice is asked for once
+        if (access(ChunkPath(directory, chunks[index]).c_str(), F_OK) != 0
+            && asked.insert({chunks[index].hash, chunks[index].length}).second) {
+            missingChunks.push_back(index);
+        }
+    }
+    vector<uint8> missing;
+    AppendUInt32(&missing, missingChunks.size());
+    for (auto index : missingChunks)
+        AppendUInt32(&missing, index);
+    if (FrameSocket::WriteFrame(socket, SYNC_FRAME_MISSING, missing.data(), missing.size()) != B_OK)
+        return false;
+
+    uint8 type;
+    vector<uint8> content;
+    if (FrameSocket::ReadFrame(socket, kMaxSyncFrameSize, &type, &content) != B_OK || type != SYNC_FRAME_CHUNKS)
+        return false;
+
+    size_t offset = 0;
+    for (auto index : missingChunks) {
+        const chunk_ref& chunk = chunks[index];
+        if (content.size() - offset < chunk.length || HashChunk(content.data() + offset, chunk.length) != chunk.hash) {
+            printf("chunk %u of %s does not match its hash.\n", index, path.c_str());
+            return false;
+        }
+        if (!WriteFile(ChunkPath(directory, chunk), content.data() + offset, chunk.length)) {
+            fprintf(stderr, "could not store chunk of %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        offset += chunk.length;
+    }
+
+    vector<uint8> text;
+    for (auto& chunk : chunks) {
+        if (!ReadFile(ChunkPath(directory, chunk), &text)) {
+            fprintf(stderr, "could not read chunk of %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    string notePath = directory + "/vault/" + path;
+    CreateParents(notePath);
+    if (!WriteFile(notePath, text.data(), text.size())) {
+        fprintf(stderr, "could not write %s: %s\n", notePath.c_str(), strerror(errno));
+        return false;
+    }
+    printf("stored %s, %zu bytes in %u chunks, %zu of them new in %zu bytes.\n", path.c_str(), text.size(), count,
+        missingChunks.size(), content.size());
+
+    return FrameSocket::WriteFrame(socket, SYNC_FRAME_STORED, NULL, 0) == B_OK;
+}
+
+int main(int argc, char** argv) {
+    string directory = argc > 1 ? argv[1] : "sync-data";
+    uint16 port = argc > 2 ? atoi(argv[2]) : kSyncPort;
+    signal(SIGPIPE, SIG_IGN);
+
+    mkdir(directory.c_str(), 0755);
+    mkdir((directory + "/chunks").c_str(), 0755);
+    mkdir((directory + "/vault").c_str(), 0755);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (listener < 0 || bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0
+            || listen(listener, 4) != 0) {
+        fprintf(stderr, "could not listen on port %u: %s\n", port, strerror(errno));
+        return 1;
+    }
+    printf("syncing notes to %s on port %u.\n", directory.c_str(), port);
+
+    while (true) {
+        int socket = accept(listener, NULL, NULL);
+        if (socket < 0)
+            continue;
+
+        uint8 type;
+        vector<uint8> note;
+        while (FrameSocket::ReadFrame(socket, kMaxSyncFrameSize, &type, &note) == B_OK
+               && type == SYNC_FRAME_NOTE && ReceiveNote(socket, directory, note)) {
+        }
+        close(socket);
+    }
+    return 0;
+}